@@ -1,11 +1,26 @@
 #version 330 core
 layout (location = 0) out vec4 FColor;
 
+// Features a variant is specialized for, left undefined the shader works for any material:
+// LIGHT_COUNT		lights as a constant, otherwise Scene.lightCount
+// MATERIAL_ARRAYS	1 samples the texture arrays only, 0 the plain textures only
+// HAS_ORM			0 for materials without occlusion, roughness and metallic
+// HAS_NORMAL_MAP	1 to apply the normal map, every material drawn must have one
+
+#ifndef HAS_ORM
+#define HAS_ORM 1
+#endif
+
+#ifndef HAS_NORMAL_MAP
+#define HAS_NORMAL_MAP 0
+#endif
+
 in VSOutput
 {
     vec3 normal;
     vec3 position;
     vec2 texcoord;
+    flat vec4 layers;
 } fsInput;
 
 layout (std140) uniform UCamera
@@ -21,15 +36,48 @@ struct SAmbient
 	float intensity;
 };
 
+// orm holds occlusion, roughness and metallic in red, green and blue.
 struct SMaterial
 {
 	sampler2D albedo;
 	sampler2D normal;
-	sampler2D metallic;
-	sampler2D roughness;
+	sampler2D orm;
 	sampler2D emission;
 };
 
+// The same samplers packed in texture arrays, for meshes loaded with textureArrays.
+struct SMaterialArrays
+{
+	sampler2DArray albedo;
+	sampler2DArray normal;
+	sampler2DArray orm;
+	sampler2DArray emission;
+};
+
+// Everything the lighting needs from the material, fetched once per fragment.
+struct SSurface
+{
+	vec3 normal;
+	vec3 albedo;
+	float occlusion;
+	float roughness;
+	float metallic;
+};
+
+// Ambient lighting precomputed from the skybox, see EnvironmentData.
+struct SEnvironment
+{
+	// Irradiance over pi as spherical harmonics, the basis constants already folded in.
+	vec3 irradiance[9];
+
+	// Prefiltered for roughness along the mips, sRGB encoded.
+	samplerCube specular;
+	float specularLevels;
+
+	// Scale and bias of F0 by NdotV and roughness.
+	sampler2D brdf;
+};
+
 struct SLight
 {
 	vec3 position;
@@ -37,50 +85,141 @@ struct SLight
 	float intensity;
 };
 
-uniform int LightCount;
-uniform SLight Lights[4];
-uniform SAmbient Ambient;
+// Lighting shared by every program through one ParameterBlock. Declared the same way
+// in every variant, so std140 lays it out the same for all of them.
+layout (std140) uniform UScene
+{
+	SAmbient ambient;
+	SLight lights[4];
+	int lightCount;
+} Scene;
+
+#ifdef LIGHT_COUNT
+const int LightCount = LIGHT_COUNT;
+#else
+#define LightCount Scene.lightCount
+#endif
+
 uniform SMaterial Material;
+uniform SMaterialArrays MaterialArrays;
+uniform SEnvironment Environment;
 
-uniform samplerCube Skybox;
+// The layer is the same for the whole draw, so both branches keep their derivatives.
+vec4 SampleMaterial(sampler2D single, sampler2DArray array, float layer)
+{
+#if !defined(MATERIAL_ARRAYS)
+	return layer < 0.0 ? texture(single, fsInput.texcoord) : texture(array, vec3(fsInput.texcoord, layer));
+#elif MATERIAL_ARRAYS
+	return texture(array, vec3(fsInput.texcoord, layer));
+#else
+	return texture(single, fsInput.texcoord);
+#endif
+}
 
-vec3 ComputeSkyboxReflection()
+// BC5 normal maps only keep x and y, z is rebuilt from them.
+vec3 RgToNormal(vec2 rg)
 {
-	vec3 I = normalize(fsInput.position - Camera.position);
-	vec3 R = reflect(I, fsInput.normal);
-	return texture(Skybox, R).rgb;
+	vec2 xy = rg * 2.0 - 1.0;
+	return vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
 }
 
-vec3 ComputeSpecular(SLight light)
+// The vertices carry no tangents, the frame comes from the screen space derivatives of
+// the position and the texture coordinates instead.
+vec3 PerturbNormal(vec3 n, vec3 mapped)
+{
+	vec3 dp1 = dFdx(fsInput.position);
+	vec3 dp2 = dFdy(fsInput.position);
+	vec2 duv1 = dFdx(fsInput.texcoord);
+	vec2 duv2 = dFdy(fsInput.texcoord);
+
+	vec3 dp2perp = cross(dp2, n);
+	vec3 dp1perp = cross(n, dp1);
+	vec3 T = dp2perp * duv1.x + dp1perp * duv2.x;
+	vec3 B = dp2perp * duv1.y + dp1perp * duv2.y;
+
+	float scale = inversesqrt(max(max(dot(T, T), dot(B, B)), 1e-20));
+	return normalize(mat3(T * scale, B * scale, n) * mapped);
+}
+
+SSurface SampleSurface()
+{
+	SSurface surface;
+	surface.normal = normalize(fsInput.normal);
+	surface.albedo = SampleMaterial(Material.albedo, MaterialArrays.albedo, fsInput.layers.x).rgb;
+
+#if HAS_NORMAL_MAP
+	vec2 mapped = SampleMaterial(Material.normal, MaterialArrays.normal, fsInput.layers.y).rg;
+	surface.normal = PerturbNormal(surface.normal, RgToNormal(mapped));
+#endif
+
+#if HAS_ORM
+	vec3 orm = SampleMaterial(Material.orm, MaterialArrays.orm, fsInput.layers.z).rgb;
+	surface.occlusion = orm.r;
+	surface.roughness = orm.g;
+	surface.metallic = orm.b;
+#else
+	surface.occlusion = 1.0;
+	surface.roughness = 1.0;
+	surface.metallic = 0.0;
+#endif
+
+	return surface;
+}
+
+vec3 ComputeIrradiance(vec3 n)
+{
+	vec3 irradiance = Environment.irradiance[0];
+	irradiance += Environment.irradiance[1] * n.y + Environment.irradiance[2] * n.z + Environment.irradiance[3] * n.x;
+	irradiance += Environment.irradiance[4] * (n.x * n.y) + Environment.irradiance[5] * (n.y * n.z);
+	irradiance += Environment.irradiance[6] * (3.0 * n.z * n.z - 1.0) + Environment.irradiance[7] * (n.x * n.z);
+	irradiance += Environment.irradiance[8] * (n.x * n.x - n.y * n.y);
+	return max(irradiance, 0.0);
+}
+
+// Split sum image based lighting, two fetches and the spherical harmonics.
+vec3 ComputeEnvironment(SSurface surface)
+{
+	vec3 N = surface.normal;
+	vec3 V = normalize(Camera.position - fsInput.position);
+	vec3 R = reflect(-V, N);
+	float NdotV = max(dot(N, V), 0.0);
+
+	float lod = surface.roughness * (Environment.specularLevels - 1.0);
+	vec3 prefiltered = pow(textureLod(Environment.specular, R, lod).rgb, vec3(2.2));
+	vec2 brdf = texture(Environment.brdf, vec2(NdotV, surface.roughness)).rg;
+
+	vec3 F0 = mix(vec3(0.04), surface.albedo, surface.metallic);
+	vec3 specular = prefiltered * (F0 * brdf.x + brdf.y);
+	vec3 diffuse = ComputeIrradiance(N) * surface.albedo * (1.0 - surface.metallic);
+	return (diffuse + specular) * surface.occlusion;
+}
+
+vec3 ComputeSpecular(SLight light, SSurface surface)
 {
 	vec3 fragToLight = light.position - fsInput.position;
 	float distance2 = fragToLight.length() * fragToLight.length();
 
-	int roughness = int(texture(Material.roughness, fsInput.texcoord).r * 32);
+	int roughness = int(surface.roughness * 32);
 
 	vec3 L = normalize(fragToLight);
 	vec3 V = normalize(Camera.position - fsInput.position);
-	vec3 R = reflect(-L, fsInput.normal);
+	vec3 R = reflect(-L, surface.normal);
 	float cosA = pow(max(dot(V, R), 0.0), roughness);
 
-	vec3 albedo = vec3(texture(Material.albedo, fsInput.texcoord));
-	vec3 metallic = vec3(texture(Material.metallic, fsInput.texcoord));
-	
-	vec3 specular = (light.color * light.intensity) * (albedo * metallic) * cosA;
+	vec3 specular = (light.color * light.intensity) * (surface.albedo * surface.metallic) * cosA;
 	float attenuation = pow(cosA, 5) / distance2;
 	return specular * attenuation;
 }
 
-vec3 ComputeDiffuse(SLight light)
+vec3 ComputeDiffuse(SLight light, SSurface surface)
 {
 	vec3 fragToLight = light.position - fsInput.position;
 	float distance2 = fragToLight.length() * fragToLight.length();
 
 	vec3 L = normalize(fragToLight);
-	float cosA = max(dot(fsInput.normal, L), 0);
+	float cosA = max(dot(surface.normal, L), 0);
 	
-	vec3 albedo = vec3(texture(Material.albedo, fsInput.texcoord));
-	vec3 diffuse = (light.color * light.intensity) * albedo * cosA;
+	vec3 diffuse = (light.color * light.intensity) * surface.albedo * cosA;
 	float attenuation = cosA / distance2;
 	return diffuse * attenuation;
 }
@@ -97,13 +236,12 @@ vec3 RgbToNormal(vec3 rgb)
 
 void main()
 {
-	vec3 albedo = vec3(texture(Material.albedo, fsInput.texcoord));
-	vec3 metallic = vec3(texture(Material.metallic, fsInput.texcoord));
+	SSurface surface = SampleSurface();
 
-	vec3 final = (Ambient.color * Ambient.intensity) * (ComputeSkyboxReflection() * metallic) * albedo;
+	vec3 final = (Scene.ambient.color * Scene.ambient.intensity) * ComputeEnvironment(surface);
 	for (int i = 0; i < LightCount; i++)
 	{
-		final += ComputeDiffuse(Lights[i]) + ComputeSpecular(Lights[i]);
+		final += ComputeDiffuse(Scene.lights[i], surface) + ComputeSpecular(Scene.lights[i], surface);
 	}
 
 	FColor = vec4(final, 1.0);
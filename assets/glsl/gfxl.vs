@@ -3,11 +3,21 @@ layout (location = 0) in vec3 VPosition;
 layout (location = 1) in vec3 VNormal;
 layout (location = 2) in vec2 VTexCoord;
 
+// Set per mesh: packed positions are fractions of the mesh bounds, and w is 1 when
+// the normal comes in as an octahedral encoded vec2.
+layout (location = 3) in vec4 VQuantScale;
+layout (location = 4) in vec3 VQuantOffset;
+
+// Layers of the material textures in the bound arrays, albedo, normal, ORM and emission.
+// -1 samples the plain texture of the sampler instead.
+layout (location = 5) in vec4 VLayers;
+
 out VSOutput
 {
     vec3 normal;
     vec3 position;
     vec2 texcoord;
+    flat vec4 layers;
 } vsOutput;
 
 layout (std140) uniform UCamera
@@ -19,11 +29,24 @@ layout (std140) uniform UCamera
 
 uniform mat4 Model = mat4(1.0);
 
+vec3 DecodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+
+    return normalize(n);
+}
+
 void main()
 {
-    gl_Position = Camera.projection * Camera.view * Model * vec4(VPosition, 1.0);
+    vec3 position = VQuantOffset + VPosition * VQuantScale.xyz;
+    vec3 normal = VQuantScale.w > 0.5 ? DecodeOctahedral(VNormal.xy) : VNormal;
+
+    gl_Position = Camera.projection * Camera.view * Model * vec4(position, 1.0);
 
-    vsOutput.normal = normalize(mat3(transpose(inverse(Model))) * VNormal);
-    vsOutput.position = (Model * vec4(VPosition, 1.0)).xyz;
+    vsOutput.normal = normalize(mat3(transpose(inverse(Model))) * normal);
+    vsOutput.position = (Model * vec4(position, 1.0)).xyz;
     vsOutput.texcoord = VTexCoord;
+    vsOutput.layers = VLayers;
 }  
\ No newline at end of file
@@ -1,5 +1,7 @@
 #version 440 core
 layout (location = 0) in vec3 VPosition;
+layout (location = 3) in vec4 VQuantScale;
+layout (location = 4) in vec3 VQuantOffset;
 
 out VSOutput
 {
@@ -15,6 +17,7 @@ layout (std140) uniform UCamera
 
 void main()
 {
-    gl_Position = Camera.projection * mat4(mat3(Camera.view)) * vec4(VPosition, 1.0);
-    vsOutput.texcoord = VPosition;
+    vec3 position = VQuantOffset + VPosition * VQuantScale.xyz;
+    gl_Position = Camera.projection * mat4(mat3(Camera.view)) * vec4(position, 1.0);
+    vsOutput.texcoord = position;
 }  
\ No newline at end of file
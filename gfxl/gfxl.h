@@ -7,5 +7,8 @@
 #include "gfxl_core.h"
 #include "gfxl_math.h"
 #include "gfxl_graphics.h"
+#include "gfxl_mesh.h"
+#include "gfxl_texture.h"
+#include "gfxl_resource.h"
 
 #endif
\ No newline at end of file
@@ -2,6 +2,64 @@
 #ifndef GFXL_CORE_H
 #define GFXL_CORE_H
 
+#include <stddef.h>
+#include "gfxl_common.h"
 
+namespace gfxl
+{
+	struct MappedFile
+	{
+		const char* data;
+		size_t size;
+
+#ifdef _WIN32
+		void* fileHandle;
+		void* mappingHandle;
+#endif
+	};
+
+	// Maps a whole file read-only into memory, returns false if it can't be opened.
+	bool MappedFileOpen(MappedFile* file, const char* filename);
+	void MappedFileClose(MappedFile* file);
+
+	// Size and last write time of a file, the time is only good for comparisons.
+	bool FileGetInfo(const char* filename, ulong64* size, ulong64* writeTime);
+
+	// Seconds since an arbitrary point, only meaningful as a difference.
+	double GetTime();
+
+	// 32 bit FNV-1a. Pass the previous result as hash to go on hashing as if the strings were one.
+	// Constant strings can be hashed at compile time, assign the result to a constexpr.
+	constexpr uint32 HashString(const char* string, uint32 hash = 0x811C9DC5)
+	{
+		for (; *string != '\0'; string++)
+		{
+			hash ^= (unsigned char)*string;
+			hash *= 0x01000193;
+		}
+
+		return hash;
+	}
+
+	// 64 bit FNV-1a over size bytes, chained the same way.
+	ulong64 HashData(const void* data, size_t size, ulong64 hash = 0xCBF29CE484222325);
+
+	uint32 GetWorkerCount();
+
+	// Tracks a set of jobs running on the shared worker threads. Waiting runs queued jobs on
+	// the calling thread instead of blocking, so it is safe from inside a job too.
+	struct WorkerGroup;
+
+	WorkerGroup* CreateWorkerGroup();
+	void WorkerGroupSubmit(WorkerGroup* group, void(*func)(void* userData), void* userData);
+	void WorkerGroupWait(WorkerGroup* group);
+
+	// Waits for the remaining jobs first.
+	void Dispose(WorkerGroup* group);
+
+	// Calls func once for every index in [0, count), spread over all workers.
+	// The calling thread takes part and the call returns when every index is done.
+	void ParallelFor(uint32 count, void(*func)(uint32 index, void* userData), void* userData);
+}
 
 #endif
\ No newline at end of file
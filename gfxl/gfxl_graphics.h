@@ -22,12 +22,174 @@ namespace gfxl
 		Vector2 texcoord;
 	};
 
+	// Layout of the vertices once they are on the GPU. Packed positions are 16 bit fractions
+	// of the mesh bounds, the vertex shader scales them back with VQuantScale/VQuantOffset.
+	enum class VertexFormat : int
+	{
+		// 32 bytes, the Vertex struct as is.
+		Float,
+
+		// 16 bytes, 16 bit positions, octahedral normals in 2x16 bits, half float texcoords.
+		PackedOctahedral,
+
+		// 16 bytes, 16 bit positions, 10:10:10:2 normals, half float texcoords.
+		Packed1010102
+	};
+
+	// What a texture holds, which decides the format it is stored in.
+	enum class TextureRole : int
+	{
+		// RGB(A) color, BC1/BC3 or BC7 when compressed.
+		Color,
+
+		// Tangent space normals, BC5 when compressed. Only x and y are kept and the shader
+		// rebuilds z (RgToNormal in gfxl.fs).
+		Normal,
+
+		// A single channel (metallic, roughness, ...) read from red. R8, or BC4 when compressed.
+		// Samples come back as (r, r, r, 1) either way.
+		Mask
+	};
+
+	enum class TextureCompression : int
+	{
+		None,
+
+		// BC1/BC3 for color, BC4 for masks and BC5 for normals.
+		Default,
+
+		// Like Default but BC7 for color, slower to cook.
+		High
+	};
+
+	struct TextureLoadSettings
+	{
+		// Read a cooked .gfxltex with the whole mip chain next to the image when it is up
+		// to date, and write one after decoding when it isn't.
+		bool cache;
+
+		// The image holds sRGB encoded color (albedo, emission) and is filtered in linear space.
+		bool srgb;
+
+		TextureRole role;
+
+		// Formats the driver lacks fall back to the next best one, down to uncompressed.
+		TextureCompression compression;
+	};
+
+	// A stage is specialized with defines, "NAME" or "NAME VALUE" each, added right after its
+	// #version line or at the top of a stage without one. #include "file" pulls in a file
+	// relative to the one including it, every file at most once per stage.
+	struct ShaderLoadSettings
+	{
+		const char* const* defines;
+		uint32 defineCount;
+	};
+
+	enum class BlendMode : int
+	{
+		Opaque,
+
+		// Source alpha over what is there.
+		Alpha,
+
+		// Color added to what is there.
+		Additive
+	};
+
+	enum class CullMode : int
+	{
+		None,
+		Back,
+		Front
+	};
+
+	struct TextureStreamer;
+	struct ResourceCache;
+
+	struct MeshLoadSettings
+	{
+		// Read a cooked .gfxlmesh next to the model when it is up to date, and write
+		// one after parsing when it isn't.
+		bool cache;
+
+		// Reorder triangles and vertices for the post transform cache, overdraw and vertex fetch.
+		bool optimize;
+
+		VertexFormat vertexFormat;
+
+		// Split the mesh in clusters that RenderClusters can cull individually.
+		bool clusters;
+
+		// Number of detail levels RenderLod picks from, the full mesh included. 0 builds none.
+		uint32 lodCount;
+
+		// Import out of core straight into the cooked file, for models that don't fit in memory.
+		// The mesh comes out in spatial chunks RenderClusters culls, without optimization,
+		// LODs or materials. Always writes the cooked file.
+		bool stream;
+
+		// Memory the streaming import may use, in megabytes. 0 picks a default.
+		uint32 streamBudget;
+
+		// How the material textures are compressed, their role comes from the material slot.
+		TextureCompression textureCompression;
+
+		// Streams the material textures through this streamer instead of loading them whole.
+		TextureStreamer* textureStreamer;
+
+		// Pack material textures of the same size and format in texture arrays, so RenderSubmeshes
+		// binds a few sets of arrays instead of textures per material. Ignored when streaming.
+		bool textureArrays;
+
+		// Loads the material textures through this cache, shared with every other mesh and
+		// texture that comes from the same files. Ignored when streaming or packing arrays.
+		ResourceCache* resourceCache;
+	};
+
+	struct MeshData;
+
 	struct Shader;
 	struct Mesh;
 	struct Texture2D;
 	struct Cubemap;
+	struct Environment;
 	struct SpriteAtlas;
 	struct SpriteBatch;
+	struct TextureBatch;
+	struct ShaderBatch;
+	struct ParameterBlock;
+	struct RenderQueue;
+	struct Pipeline;
+
+	// Everything a draw sets besides its resources. The pipeline keeps a copy, changing
+	// settings afterwards does nothing.
+	struct PipelineSettings
+	{
+		const Shader* shader;
+		BlendMode blend;
+		CullMode cull;
+		bool depthTest;
+		bool depthWrite;
+	};
+
+	// GL calls made and skipped because they would have set what was already set.
+	struct StateStats
+	{
+		uint32 calls;
+		uint32 redundantCalls;
+	};
+
+	// Features of gfxl.fs a material draws with, the bits of the key that picks its variant.
+	static const uint32 MaterialVariantNormalMap = 1;
+	static const uint32 MaterialVariantOrm = 2;
+	static const uint32 MaterialVariantCount = 4;
+
+	// A program per variant key, each compiled for the features of its key.
+	struct ShaderVariants
+	{
+		Shader* shaders[MaterialVariantCount];
+	};
 
 	enum class ShaderType : int
 	{
@@ -60,12 +222,43 @@ namespace gfxl
 	Shader* CreateShader();
 	Texture2D* CreateTexture2D();
 	Cubemap* CreateCubemap();
+	Environment* CreateEnvironment();
 
 	SpriteAtlas* CreateSpriteAtlas();
 	SpriteBatch* CreateSpriteBatch();
 
-	bool ShaderLoadAndCompile(Shader* shader, const char* filename, ShaderType type);
+	// Stages are only read here and compiled by ShaderLink, which loads the program binary
+	// cached by an earlier run instead when the sources and the driver are the same.
+	bool ShaderLoadAndCompile(Shader* shader, const char* filename, ShaderType type, const ShaderLoadSettings& settings = {});
 	bool ShaderLink(Shader* shader);
+
+	// Hash of the stages loaded so far, after includes and defines. Equal keys compile to the
+	// same program.
+	ulong64 ShaderGetSourceKey(const Shader* shader);
+
+	// True once the shader is linked and can be drawn with, never for one that failed.
+	bool ShaderIsReady(const Shader* shader);
+
+	// Shaders added to a batch are handed to the driver to compile and link without waiting
+	// for them. Keep drawing with something else until they are ready, a shader must outlive
+	// the batch it is in.
+	ShaderBatch* CreateShaderBatch();
+	void ShaderBatchAdd(ShaderBatch* batch, Shader* shader);
+
+	// Finishes the shaders the driver is done with, returns true when the whole batch is.
+	// With KHR_parallel_shader_compile that never waits, without it one shader is waited
+	// for per call. Call it once a frame.
+	bool ShaderBatchUpdate(ShaderBatch* batch);
+	void ShaderBatchFinish(ShaderBatch* batch);
+
+	// Uniforms are looked up by the HashString of their name in a table filled at link time.
+	// Hash constant names once, into a constexpr, to skip hashing on every call.
+	void ShaderSetVar(const Shader* shader, uint32 nameHash, const Vector2& value);
+	void ShaderSetVar(const Shader* shader, uint32 nameHash, const Vector3& value);
+	void ShaderSetVar(const Shader* shader, uint32 nameHash, const Vector4& value);
+	void ShaderSetVar(const Shader* shader, uint32 nameHash, const Matrix4& value);
+	void ShaderSetVar(const Shader* shader, uint32 nameHash, float value);
+	void ShaderSetVar(const Shader* shader, uint32 nameHash, int value);
 	void ShaderSetVar(const Shader* shader, const char* name, const Vector2& value);
 	void ShaderSetVar(const Shader* shader, const char* name, const Vector3& value);
 	void ShaderSetVar(const Shader* shader, const char* name, const Vector4& value);
@@ -73,24 +266,124 @@ namespace gfxl
 	void ShaderSetVar(const Shader* shader, const char* name, float value);
 	void ShaderSetVar(const Shader* shader, const char* name, int value);
 
-	void MeshLoadFromModelFile(Mesh* mesh, const char* filename);
+	// A std140 uniform block shared by every program that declares it, written to its buffer
+	// once per flush instead of a uniform at a time. The layout is reflected from shader,
+	// any program declaring the block the same way shares it. Programs linked while the block
+	// exists are bound to it, so create it before linking the rest. One block per name.
+	ParameterBlock* CreateParameterBlock(const Shader* shader, const char* name);
+
+	// Binds the blocks shader declares to the parameter blocks of the same name, for
+	// programs that were linked before the blocks were created.
+	void ShaderBindParameterBlocks(const Shader* shader);
+
+	// Members are named like inside the block, "lights[0].color". Writing what a member
+	// already holds doesn't make the block dirty.
+	void ParameterBlockSet(ParameterBlock* block, uint32 nameHash, const Vector2& value);
+	void ParameterBlockSet(ParameterBlock* block, uint32 nameHash, const Vector3& value);
+	void ParameterBlockSet(ParameterBlock* block, uint32 nameHash, const Vector4& value);
+	void ParameterBlockSet(ParameterBlock* block, uint32 nameHash, const Matrix4& value);
+	void ParameterBlockSet(ParameterBlock* block, uint32 nameHash, float value);
+	void ParameterBlockSet(ParameterBlock* block, uint32 nameHash, int value);
+	void ParameterBlockSet(ParameterBlock* block, const char* name, const Vector2& value);
+	void ParameterBlockSet(ParameterBlock* block, const char* name, const Vector3& value);
+	void ParameterBlockSet(ParameterBlock* block, const char* name, const Vector4& value);
+	void ParameterBlockSet(ParameterBlock* block, const char* name, const Matrix4& value);
+	void ParameterBlockSet(ParameterBlock* block, const char* name, float value);
+	void ParameterBlockSet(ParameterBlock* block, const char* name, int value);
+
+	// Uploads the range written since the last flush in one go, nothing when it is clean.
+	// Call it once a frame before drawing.
+	void ParameterBlockFlush(ParameterBlock* block);
+
+	void MeshLoadFromModelFile(Mesh* mesh, const char* filename, const MeshLoadSettings& settings = {});
 	void MeshUploadData(Mesh* mesh,
 		const Vertex* vertices, uint32 vertexCount,
 		const uint32* indices, uint32 indexCount);
+	void MeshUploadData(Mesh* mesh, const MeshData* data, VertexFormat format = VertexFormat::Float);
+
+	// Bytes of video memory of the buffers, texture arrays and material textures the mesh owns.
+	// Textures shared through a resource cache are counted by the cache instead.
+	ulong64 MeshGetMemorySize(const Mesh* mesh);
 
 	void CameraUpdate(Camera* camera);
 	void CameraSetToPerspective(Camera* camera, float fov, float aspectRatio, float nearPlane, float farPlane);
 
-	void Texture2DFromImageFile(Texture2D* texture, const char* filename);
+	void Texture2DFromImageFile(Texture2D* texture, const char* filename, const TextureLoadSettings& settings = {});
+
+	// Packs the gray levels of three images in one texture, occlusion in red, roughness in
+	// green and metallic in blue, so a material reads all three with one fetch. Any of them
+	// can be null, occlusion and roughness then default to 1 and metallic to 0. The images
+	// are linear data whatever the srgb and role of settings say.
+	void Texture2DFromOrmFiles(Texture2D* texture, const char* occlusion, const char* roughness, const char* metallic,
+		const TextureLoadSettings& settings = {});
 	void Texture2DGetSize(const Texture2D* texture, int* width, int* height);
 
+	// Bytes of video memory the resident levels take, 0 until the texture is uploaded.
+	ulong64 Texture2DGetMemorySize(const Texture2D* texture);
+
 	void CubemapFromImageFiles(Cubemap* cubemap,
 		const char* front,
 		const char* back,
 		const char* left,
 		const char* right,
 		const char* top,
-		const char* bottom);
+		const char* bottom,
+		const TextureLoadSettings& settings = {});
+
+	// Image based lighting precomputed on the CPU from the six faces of a cubemap: spherical
+	// harmonics irradiance, a specular cubemap prefiltered for roughness along its mips and
+	// the BRDF table. With settings.cache it is all cooked in a .gfxlenv next to front, so
+	// only the first launch pays for the convolution.
+	void EnvironmentFromImageFiles(Environment* environment,
+		const char* front,
+		const char* back,
+		const char* left,
+		const char* right,
+		const char* top,
+		const char* bottom,
+		const TextureLoadSettings& settings = {});
+
+	// Images added to a batch start decoding on the worker threads right away. Finish waits
+	// for them and uploads everything on the calling thread, which must own the GL context.
+	// The textures aren't usable until then.
+	TextureBatch* CreateTextureBatch();
+	void TextureBatchAdd(TextureBatch* batch, Texture2D* texture, const char* filename, const TextureLoadSettings& settings = {});
+	void TextureBatchAddOrm(TextureBatch* batch, Texture2D* texture, const char* occlusion, const char* roughness,
+		const char* metallic, const TextureLoadSettings& settings = {});
+	void TextureBatchAdd(TextureBatch* batch, Cubemap* cubemap,
+		const char* front,
+		const char* back,
+		const char* left,
+		const char* right,
+		const char* top,
+		const char* bottom,
+		const TextureLoadSettings& settings = {});
+
+	// Uploads the entries done decoding without waiting for the rest, stopping once about
+	// maxUploadSize bytes went up, 0 for no limit. Call it once a frame to spread the uploads
+	// out, returns true when the whole batch is uploaded.
+	bool TextureBatchUpdate(TextureBatch* batch, uint32 maxUploadSize);
+	void TextureBatchFinish(TextureBatch* batch);
+
+	// Keeps only the mip levels draws need resident, within budget bytes of texture memory.
+	// Added textures come up with their levels of at most 128 texels once decoded, finer
+	// ones stream in as requests ask for them. Over budget the least recently used textures
+	// drop back to what they were last asked for. Cooked textures read their levels from
+	// the mapped file on demand, anything else keeps its decoded chain in memory.
+	TextureStreamer* CreateTextureStreamer(ulong64 budget);
+	void TextureStreamerAdd(TextureStreamer* streamer, Texture2D* texture, const char* filename, const TextureLoadSettings& settings = {});
+	void TextureStreamerAddOrm(TextureStreamer* streamer, Texture2D* texture, const char* occlusion, const char* roughness,
+		const char* metallic, const TextureLoadSettings& settings = {});
+	void TextureStreamerRemove(TextureStreamer* streamer, const Texture2D* texture);
+
+	// Marks texture as drawn this frame covering about screenSize pixels across. The mesh
+	// version requests every material texture of mesh from the size of its bounds on screen.
+	void TextureStreamerRequest(TextureStreamer* streamer, const Texture2D* texture, float screenSize);
+	void TextureStreamerRequest(TextureStreamer* streamer, const Mesh* mesh, const Camera* camera,
+		const Matrix4& model, float viewportHeight);
+
+	// Once a frame after the requests, streams in up to about maxUploadSize bytes, 0 for no limit.
+	void TextureStreamerUpdate(TextureStreamer* streamer, uint32 maxUploadSize);
 
 	void SpriteAtlasLoadFromImageFile(SpriteAtlas* atlas, const char* filename, int tileWidth, int tileHeight);
 
@@ -98,17 +391,78 @@ namespace gfxl
 	void SpriteBatchRender(SpriteAtlas* atlas, int x, int y);
 	void SpriteBatchEnd();
 
+	Pipeline* CreatePipeline(const PipelineSettings& settings);
+
+	// Only the state that differs from what the GL has set is changed.
+	void Bind(const Pipeline* pipeline);
 	void Bind(const Shader* shader);
 	void Bind(const Texture2D* texture, int index);
 	void Bind(const Cubemap* cubemap, int index);
 
+	// The specular cubemap goes to unit index and the BRDF table to index + 1.
+	void Bind(const Environment* environment, int index);
+
+	// Sets the Environment uniforms of gfxl.fs on the bound shader, with the units Bind uses.
+	void ShaderSetEnvironment(const Shader* shader, const Environment* environment, int index);
+
 	void Render(const Mesh* mesh, Primitive primitive = Primitive::Triangles);
+
+	// Draws only the clusters that are inside the camera frustum and not facing away from it.
+	// model must match the Model matrix the shader uses. Meshes without clusters are drawn whole.
+	void RenderClusters(const Mesh* mesh, const Camera* camera, const Matrix4& model = Matrix4(1.0f));
+
+	// Draws the submeshes one by one, binding the textures of their material to unit
+	// MaterialTextureUnit + MaterialSampler (albedo, normal, orm, emission) like gfxl.fs
+	// samples them. Meshes with texture arrays bind those from MaterialArrayUnit on.
+	void RenderSubmeshes(const Mesh* mesh);
+
+	// Draws the coarsest LOD whose error, scaled by the projected size of the mesh bounding
+	// sphere, stays under maxScreenError (a fraction of the viewport height). Meshes with
+	// materials draw the submeshes of the level with their textures, like RenderSubmeshes.
+	void RenderLod(const Mesh* mesh, const Camera* camera, const Matrix4& model = Matrix4(1.0f), float maxScreenError = 0.001f);
 	
+	// Draws recorded over the frame and issued sorted by program, then textures, then mesh,
+	// so each changes as rarely as it can. Nearest first among draws that share all three, a
+	// submesh by the middle of its own bounds when the mesh has clusters.
+	RenderQueue* CreateRenderQueue();
+
+	// Draws the whole mesh with model set as the Model uniform. textures, when given, are
+	// bound to the material units like RenderSubmeshes does, a null entry unbinds its unit.
+	// Without them the units keep whatever is bound.
+	void RenderQueueAdd(RenderQueue* queue, const Shader* shader, const Mesh* mesh, const Matrix4& model = Matrix4(1.0f),
+		const Texture2D* const* textures = nullptr);
+
+	// A draw per submesh with the textures of its material.
+	void RenderQueueAddSubmeshes(RenderQueue* queue, const Shader* shader, const Mesh* mesh, const Matrix4& model = Matrix4(1.0f));
+
+	// The same with each draw's program picked from variants by the key of its material. Bind
+	// groups draw all their materials at once, with the variant of the features every one has.
+	void RenderQueueAddSubmeshes(RenderQueue* queue, const ShaderVariants& variants, const Mesh* mesh,
+		const Matrix4& model = Matrix4(1.0f));
+
+	// The variant key of a material, from the textures it has. A normal map that is still
+	// streaming in is left out until it is resident.
+	uint32 MeshGetMaterialVariant(const Mesh* mesh, uint32 material);
+
+	// Sorts and issues everything added since the last submit, which leaves the queue empty.
+	// Without a camera the distance doesn't take part.
+	void RenderQueueSubmit(RenderQueue* queue, const Camera* camera = nullptr);
+
+	// Binds and state changes since the last call, call it once a frame.
+	StateStats GetStateStats();
+
 	void Dispose(Shader* shader);
 	void Dispose(Mesh* mesh);
 	void Dispose(Camera* camera);
 	void Dispose(Texture2D* texture);
 	void Dispose(Cubemap* cubemap);
+	void Dispose(Environment* environment);
+	void Dispose(ShaderBatch* batch);
+	void Dispose(ParameterBlock* block);
+	void Dispose(RenderQueue* queue);
+	void Dispose(Pipeline* pipeline);
+	void Dispose(TextureBatch* batch);
+	void Dispose(TextureStreamer* streamer);
 }
 
 #endif
\ No newline at end of file
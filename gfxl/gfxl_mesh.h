@@ -0,0 +1,239 @@
+#pragma once
+#ifndef GFXL_MESH_H
+#define GFXL_MESH_H
+
+#include "gfxl_common.h"
+#include "gfxl_core.h"
+#include "gfxl_graphics.h"
+
+namespace gfxl
+{
+	// Marks geometry without a material, and materials without a texture in some slot.
+	static const uint32 MeshNoMaterial = 0xFFFFFFFF;
+	static const uint32 MeshNoTexture = 0xFFFFFFFF;
+
+	static const uint32 MeshMaxNameLength = 64;
+	static const uint32 MeshMaxPathLength = 256;
+
+	// Texture slots of a material as imported.
+	enum class MaterialTexture : int
+	{
+		Albedo,
+		Normal,
+		Metallic,
+		Roughness,
+		Emission,
+
+		Count
+	};
+
+	// What a material binds when drawn, in the order of the Material samplers of gfxl.fs.
+	// Metallic and roughness are packed in the blue and green of one ORM texture at load.
+	enum class MaterialSampler : int
+	{
+		Albedo,
+		Normal,
+		Orm,
+		Emission,
+
+		Count
+	};
+
+	// Units RenderSubmeshes binds the samplers to, the MaterialArrays of gfxl.fs follow the plain textures.
+	static const int MaterialTextureUnit = 1;
+	static const int MaterialArrayUnit = MaterialTextureUnit + (int)MaterialSampler::Count;
+
+	// A run of triangles that share a material.
+	struct MeshSubmesh
+	{
+		uint32 indexOffset;
+		uint32 indexCount;
+		uint32 material;
+	};
+
+	// Material from an MTL library. Textures are indices into the texture table of the mesh,
+	// so every image is referenced once no matter how many materials use it.
+	struct MeshMaterial
+	{
+		char name[MeshMaxNameLength];
+
+		Vector3 diffuseColor;
+		Vector3 specularColor;
+		float32 specularPower;
+		float32 opacity;
+
+		uint32 textures[(int)MaterialTexture::Count];
+	};
+
+	// Path of a file the model references, an image or a material library, relative to the
+	// working directory like the model itself.
+	struct MeshTexture
+	{
+		char path[MeshMaxPathLength];
+	};
+
+	// A small contiguous run of triangles with a bounding sphere and a normal cone, used to
+	// reject whole groups of triangles that are off screen or facing away from the camera.
+	struct MeshCluster
+	{
+		uint32 indexOffset;
+		uint32 indexCount;
+
+		Vector3 center;
+		float32 radius;
+
+		Vector3 coneAxis;
+		float32 coneCutoff;
+	};
+
+	// One level of detail, a range of the shared index buffer. error is the largest distance
+	// the simplified surface strays from the original, in mesh units.
+	struct MeshLod
+	{
+		uint32 indexOffset;
+		uint32 indexCount;
+		float32 error;
+	};
+
+	// CPU side geometry, produced by the model loaders and consumed by MeshUploadData.
+	// Index data is optional, a null index array means the vertices are drawn in order.
+	// Loaders weld identical vertices and always emit indices.
+	struct MeshData
+	{
+		Vertex* vertices;
+		uint32 vertexCount;
+
+		uint32* indices;
+		uint32 indexCount;
+
+		Vector3 boundsMin;
+		Vector3 boundsMax;
+
+		// Triangles are sorted by material, one submesh per material in use. With LODs the
+		// table holds submeshCount entries per level, level after level.
+		MeshSubmesh* submeshes;
+		uint32 submeshCount;
+
+		MeshMaterial* materials;
+		uint32 materialCount;
+
+		MeshTexture* textures;
+		uint32 textureCount;
+
+		// MTL files the materials were read from, a cooked mesh is stamped with them too.
+		MeshTexture* libraries;
+		uint32 libraryCount;
+
+		MeshCluster* clusters;
+		uint32 clusterCount;
+
+		// When present the first LOD is the full mesh and the rest follow it in the index buffer.
+		MeshLod* lods;
+		uint32 lodCount;
+	};
+
+	// A cooked .gfxlmesh file mapped in memory. Vertex and index data point straight into
+	// the mapping and are laid out exactly as they are uploaded to the GPU.
+	struct CookedMesh
+	{
+		MappedFile file;
+
+		const void* vertices;
+		uint32 vertexCount;
+		uint32 vertexStride;
+		VertexFormat vertexFormat;
+
+		const void* indices;
+		uint32 indexCount;
+		uint32 indexSize;
+
+		// submeshCount entries per LOD, or a single level without LODs.
+		const MeshSubmesh* submeshes;
+		uint32 submeshCount;
+
+		const MeshMaterial* materials;
+		uint32 materialCount;
+
+		const MeshTexture* textures;
+		uint32 textureCount;
+
+		const MeshCluster* clusters;
+		uint32 clusterCount;
+
+		const MeshLod* lods;
+		uint32 lodCount;
+
+		Vector3 boundsMin;
+		Vector3 boundsMax;
+	};
+
+	uint32 VertexFormatGetStride(VertexFormat format);
+
+	MeshData* CreateMeshData();
+
+	// Also reads the materials of the first mtllib the file references, if any.
+	bool MeshDataLoadFromObjFile(MeshData* data, const char* filename);
+
+	// Appends the materials of an MTL file, texture paths are resolved against its directory
+	// and only added to the texture table if they aren't in it yet. filename is added to the
+	// libraries of data.
+	bool MeshDataLoadMaterials(MeshData* data, const char* filename);
+	void MeshDataComputeBounds(MeshData* data);
+
+	// Converts the vertices to format, positions are quantized against the bounds of data.
+	// destination must hold vertexCount * VertexFormatGetStride(format) bytes.
+	void MeshDataPackVertices(const MeshData* data, VertexFormat format, void* destination);
+
+	// Reorders triangles for the post transform cache and overdraw, then vertices for fetch
+	// locality. Triangles never leave their submesh. Reports ACMR/ATVR before and after through Message.
+	// Existing clusters and LODs no longer match the new order and are dropped.
+	void MeshDataOptimize(MeshData* data);
+
+	// Splits the triangles in clusters of up to maxTriangles, reordering the indices so
+	// every cluster is a contiguous range inside a single submesh. Run it after the
+	// optimization pass. Existing LODs are dropped.
+	void MeshDataBuildClusters(MeshData* data, uint32 maxTriangles = 124);
+
+	// Builds up to lodCount levels (the full mesh included) with a quadric error metric
+	// simplifier, each keeping about reduction of the triangles of the previous one.
+	// Attribute seams and material boundaries are kept in place. Every level is sorted by
+	// material like the full mesh. Run it last, it appends to the index buffer.
+	void MeshDataBuildLods(MeshData* data, uint32 lodCount = 4, float reduction = 0.5f);
+
+	// Converts an OBJ file of any size straight to a cooked mesh, reading it in windows and
+	// spilling to scratch files next to the output so memory use stays within
+	// settings.streamBudget. Triangles are split in spatial chunks, one cluster each.
+	bool MeshStreamObjToCooked(const char* filename, const char* cookedFilename, const MeshLoadSettings& settings);
+
+	// Drops every LOD but the full mesh, truncating the index buffer and the submesh table
+	// to the first level.
+	void MeshDataClearLods(MeshData* data);
+
+	// Writes data as a cooked mesh, stamped with the size and write time of the source file
+	// and its material libraries, and the settings that affect the processed geometry.
+	bool MeshDataWriteCooked(const MeshData* data, const char* filename,
+		const char* sourceFilename, const MeshLoadSettings& settings);
+
+	// Writes a cooked mesh piece by piece, for geometry that never fits in memory at once.
+	// Vertices are packed against the bounds given up front, every appended piece becomes a
+	// cluster and its indices are relative to its own vertices.
+	struct CookedMeshWriter;
+
+	CookedMeshWriter* CookedMeshWriterBegin(const char* filename, const char* sourceFilename,
+		const MeshLoadSettings& settings, const Vector3& boundsMin, const Vector3& boundsMax);
+	void CookedMeshWriterAppend(CookedMeshWriter* writer,
+		const Vertex* vertices, uint32 vertexCount, const uint32* indices, uint32 indexCount);
+
+	// Completes the file and frees the writer, returns false if any write failed.
+	bool CookedMeshWriterEnd(CookedMeshWriter* writer);
+
+	// Fails when the file is missing, corrupt, older than the source or any material library
+	// it was cooked from, or cooked with different settings.
+	bool CookedMeshOpen(CookedMesh* cooked, const char* filename,
+		const char* sourceFilename, const MeshLoadSettings& settings);
+	void CookedMeshClose(CookedMesh* cooked);
+
+	void Dispose(MeshData* data);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef GFXL_RESOURCE_H
+#define GFXL_RESOURCE_H
+
+#include "gfxl_common.h"
+#include "gfxl_graphics.h"
+
+namespace gfxl
+{
+	// Hands out shared textures, meshes and shaders. A load first looks for a resource loaded
+	// from the same paths with the same settings, then for one whose files have the same
+	// contents, and only loads when neither is there. Texture files are only read for that when
+	// another texture's have the same size and write time. Every load takes a reference that
+	// has to be released, the resource is disposed with the last one.
+	struct ResourceCache;
+
+	ResourceCache* CreateResourceCache();
+
+	// With a batch, a texture that isn't in the cache yet is added to it and isn't usable
+	// before TextureBatchFinish, like any other texture of the batch.
+	Texture2D* ResourceCacheLoadTexture2D(ResourceCache* cache, const char* filename,
+		const TextureLoadSettings& settings = {}, TextureBatch* batch = nullptr);
+	Texture2D* ResourceCacheLoadOrmTexture2D(ResourceCache* cache, const char* occlusion, const char* roughness,
+		const char* metallic, const TextureLoadSettings& settings = {}, TextureBatch* batch = nullptr);
+
+	// Meshes are only shared by path, their materials name files relative to the model so the
+	// same file elsewhere can be another model. The material textures go through the cache too
+	// unless settings name another one.
+	Mesh* ResourceCacheLoadMesh(ResourceCache* cache, const char* filename, const MeshLoadSettings& settings = {});
+
+	// Compiles and links a vertex and a fragment shader, every set of defines is a variant of
+	// its own. Shaders are shared by their sources after includes and defines, those are read
+	// either way but only compiled when no shader has them. A shader that fails still comes
+	// back, drawing with it draws nothing. With a batch, a shader that isn't in the cache yet
+	// is added to it, ShaderIsReady tells when it can be used.
+	Shader* ResourceCacheLoadShader(ResourceCache* cache, const char* vertexFilename, const char* fragmentFilename,
+		const ShaderLoadSettings& settings = {}, ShaderBatch* batch = nullptr);
+
+	// A variant of the stages for every material key, each loaded as above with the defines of
+	// settings followed by the HAS_NORMAL_MAP and HAS_ORM of gfxl.fs for its key. Released together.
+	ShaderVariants ResourceCacheLoadShaderVariants(ResourceCache* cache, const char* vertexFilename,
+		const char* fragmentFilename, const ShaderLoadSettings& settings = {}, ShaderBatch* batch = nullptr);
+
+	void ResourceCacheRelease(ResourceCache* cache, Texture2D* texture);
+	void ResourceCacheRelease(ResourceCache* cache, Mesh* mesh);
+	void ResourceCacheRelease(ResourceCache* cache, Shader* shader);
+	void ResourceCacheRelease(ResourceCache* cache, const ShaderVariants& variants);
+
+	// Logs how many resources of each type are loaded, how much video memory they take and
+	// how many loads were saved. Shaders only report their count.
+	void ResourceCacheReport(const ResourceCache* cache);
+
+	// Disposes whatever is still referenced.
+	void Dispose(ResourceCache* cache);
+}
+
+#endif
\ No newline at end of file
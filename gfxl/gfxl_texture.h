@@ -0,0 +1,145 @@
+#pragma once
+#ifndef GFXL_TEXTURE_H
+#define GFXL_TEXTURE_H
+
+#include "gfxl_common.h"
+#include "gfxl_core.h"
+#include "gfxl_graphics.h"
+
+namespace gfxl
+{
+	// Enough levels for a 32768 texel wide texture.
+	static const uint32 TextureMaxLevels = 16;
+
+	enum class TextureFormat : uint32
+	{
+		RGBA8,
+		R8,
+
+		// 4x4 texel blocks, 8 bytes each for BC1 and BC4, 16 for the rest.
+		BC1,
+		BC3,
+		BC4,
+		BC5,
+		BC7
+	};
+
+	static inline uint32 TextureFormatBit(TextureFormat format)
+	{
+		return 1u << (uint32)format;
+	}
+
+	// offset is relative to the start of the pixels of the whole chain.
+	struct TextureLevel
+	{
+		uint32 width;
+		uint32 height;
+		ulong64 offset;
+		ulong64 size;
+	};
+
+	// An image and optionally its mip chain, all levels back to back in one allocation.
+	struct TextureData
+	{
+		TextureFormat format;
+		uint32 width;
+		uint32 height;
+
+		TextureLevel levels[TextureMaxLevels];
+		uint32 levelCount;
+
+		unsigned char* pixels;
+		ulong64 size;
+	};
+
+	// A cooked .gfxltex file mapped in memory. Every level is stored exactly as it is
+	// uploaded, pixels points straight into the mapping.
+	struct CookedTexture
+	{
+		MappedFile file;
+
+		TextureFormat format;
+		uint32 width;
+		uint32 height;
+
+		const TextureLevel* levels;
+		uint32 levelCount;
+
+		const unsigned char* pixels;
+	};
+
+	// Lighting precomputed from an environment cubemap for the split sum approximation, so
+	// shading only takes a few fetches.
+	struct EnvironmentData
+	{
+		// Irradiance over pi as 9 spherical harmonics coefficients with the basis constants
+		// folded in: c0 + c1 y + c2 z + c3 x + c4 xy + c5 yz + c6 (3z^2 - 1) + c7 xz + c8 (x^2 - y^2)
+		// at the normal. Linear RGB.
+		Vector3 irradiance[9];
+
+		// RGBA8 faces in GL order (+X, -X, +Y, -Y, +Z, -Z), always sRGB encoded. Level i is
+		// prefiltered for roughness i / (levelCount - 1).
+		TextureData* specular[6];
+
+		// RGBA8, scale and bias of F0 in red and green, NdotV along x and roughness along y.
+		TextureData* brdf;
+	};
+
+	uint32 TextureFormatGetLevelSize(TextureFormat format, uint32 width, uint32 height);
+	bool TextureFormatIsCompressed(TextureFormat format);
+
+	// Picks the format for the role and compression in settings among supportedFormats,
+	// a mask of TextureFormatBit. RGBA8 and R8 are always assumed to be supported.
+	TextureFormat TextureChooseFormat(const TextureData* data, const TextureLoadSettings& settings, uint32 supportedFormats);
+
+	TextureData* CreateTextureData();
+
+	// Lays out levelCount levels halving down from width x height and allocates their pixels,
+	// dropping whatever data held before.
+	void TextureDataAllocate(TextureData* data, TextureFormat format, uint32 width, uint32 height, uint32 levelCount);
+
+	// Decodes the base level as RGBA8, dropping any mips data already had.
+	bool TextureDataLoadFromImageFile(TextureData* data, const char* filename);
+
+	// Like TextureDataLoadFromImageFile, but every channel is the gray level of its own image.
+	// Channels without one (nullptr) are filled with their default. The images must all be
+	// the same size.
+	bool TextureDataLoadFromChannelFiles(TextureData* data, const char* const filenames[4], const unsigned char defaults[4]);
+
+	// Fills in the whole mip chain down to 1x1 with a 2x2 box filter. With srgb the color
+	// channels are averaged in linear space and encoded again, alpha is always linear.
+	void TextureDataBuildMips(TextureData* data, bool srgb);
+
+	// Converts every level of an RGBA8 texture to format, block compressed formats are
+	// encoded on all workers. Build the mips first.
+	void TextureDataCompress(TextureData* data, TextureFormat format);
+
+	// Writes data as a cooked texture, stamped with the size and write time of the source
+	// files and the settings that affect the processed pixels.
+	bool TextureDataWriteCooked(const TextureData* data, const char* filename,
+		const char* const* sourceFilenames, uint32 sourceCount, const TextureLoadSettings& settings);
+
+	// Fails when the file is missing, corrupt, older than the sources it was cooked from
+	// or cooked with different settings.
+	bool CookedTextureOpen(CookedTexture* cooked, const char* filename,
+		const char* const* sourceFilenames, uint32 sourceCount, const TextureLoadSettings& settings);
+	void CookedTextureClose(CookedTexture* cooked);
+
+	EnvironmentData* CreateEnvironmentData();
+
+	// Convolves the base level of six square RGBA8 faces, in GL order, on all workers. With
+	// srgb the faces are decoded to linear first. The specular chain starts at specularSize,
+	// or the face size when that is smaller. Fails when the faces don't match.
+	bool EnvironmentDataCompute(EnvironmentData* data, const TextureData* const faces[6], bool srgb, uint32 specularSize);
+
+	// Cooked like a texture, stamped with the sources, the settings and specularSize.
+	bool EnvironmentDataWriteCooked(const EnvironmentData* data, const char* filename,
+		const char* const* sourceFilenames, uint32 sourceCount, const TextureLoadSettings& settings, uint32 specularSize);
+	bool EnvironmentDataReadCooked(EnvironmentData* data, const char* filename,
+		const char* const* sourceFilenames, uint32 sourceCount, const TextureLoadSettings& settings, uint32 specularSize);
+
+	void Dispose(TextureData* data);
+	void Dispose(EnvironmentData* data);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,337 @@
+#include <gfxl_core.h>
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace gfxl
+{
+	bool MappedFileOpen(MappedFile* file, const char* filename)
+	{
+		*file = {};
+
+#ifdef _WIN32
+		HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+		if (handle == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(handle, &size))
+		{
+			CloseHandle(handle);
+			return false;
+		}
+
+		file->fileHandle = handle;
+		file->size = (size_t)size.QuadPart;
+
+		// Empty files can't be mapped, but they are still valid files.
+		if (file->size == 0)
+			return true;
+
+		file->mappingHandle = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (file->mappingHandle == nullptr)
+		{
+			MappedFileClose(file);
+			return false;
+		}
+
+		file->data = (const char*)MapViewOfFile(file->mappingHandle, FILE_MAP_READ, 0, 0, 0);
+		if (file->data == nullptr)
+		{
+			MappedFileClose(file);
+			return false;
+		}
+#else
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(fd, &info) != 0)
+		{
+			close(fd);
+			return false;
+		}
+
+		file->size = (size_t)info.st_size;
+
+		if (file->size > 0)
+		{
+			void* data = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data == MAP_FAILED)
+			{
+				close(fd);
+				*file = {};
+				return false;
+			}
+
+			madvise(data, file->size, MADV_SEQUENTIAL);
+			file->data = (const char*)data;
+		}
+
+		// The mapping keeps its own reference to the file.
+		close(fd);
+#endif
+
+		return true;
+	}
+
+	void MappedFileClose(MappedFile* file)
+	{
+#ifdef _WIN32
+		if (file->data)
+			UnmapViewOfFile(file->data);
+
+		if (file->mappingHandle)
+			CloseHandle(file->mappingHandle);
+
+		if (file->fileHandle)
+			CloseHandle(file->fileHandle);
+#else
+		if (file->data)
+			munmap((void*)file->data, file->size);
+#endif
+
+		*file = {};
+	}
+
+	bool FileGetInfo(const char* filename, ulong64* size, ulong64* writeTime)
+	{
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA info;
+		if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &info))
+			return false;
+
+		*size = ((ulong64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+		*writeTime = ((ulong64)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+#else
+		struct stat info;
+		if (stat(filename, &info) != 0)
+			return false;
+
+		*size = (ulong64)info.st_size;
+		*writeTime = (ulong64)info.st_mtim.tv_sec * 1000000000ull + (ulong64)info.st_mtim.tv_nsec;
+#endif
+
+		return true;
+	}
+
+	double GetTime()
+	{
+		using namespace std::chrono;
+		return duration<double>(steady_clock::now().time_since_epoch()).count();
+	}
+
+	ulong64 HashData(const void* data, size_t size, ulong64 hash)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 0x00000100000001B3;
+		}
+
+		return hash;
+	}
+
+	uint32 GetWorkerCount()
+	{
+		uint32 count = std::thread::hardware_concurrency();
+		return count > 0 ? count : 1;
+	}
+
+	struct WorkerJob
+	{
+		void(*func)(void* userData);
+		void* userData;
+		WorkerGroup* group;
+	};
+
+	struct WorkerGroup
+	{
+		std::atomic<uint32> pending;
+	};
+
+	// Threads are started on first use and live until the program exits. The thread that
+	// waits on a group is the last worker, so there is one thread less than there are cores.
+	struct WorkerPool
+	{
+		std::vector<std::thread> threads;
+		std::deque<WorkerJob> jobs;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+		bool quit;
+
+		WorkerPool() : quit(false)
+		{
+			for (uint32 i = 1; i < GetWorkerCount(); i++)
+				threads.emplace_back([this]() { Run(); });
+		}
+
+		~WorkerPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				quit = true;
+			}
+
+			wake.notify_all();
+
+			for (std::thread& thread : threads)
+				thread.join();
+		}
+
+		// Runs job with the lock released, and returns with it held again.
+		void Execute(std::unique_lock<std::mutex>& lock, const WorkerJob& job)
+		{
+			lock.unlock();
+			job.func(job.userData);
+			job.group->pending--;
+			lock.lock();
+
+			done.notify_all();
+		}
+
+		void Run()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			while (true)
+			{
+				wake.wait(lock, [this]() { return quit || !jobs.empty(); });
+				if (quit)
+					return;
+
+				WorkerJob job = jobs.front();
+				jobs.pop_front();
+				Execute(lock, job);
+			}
+		}
+	};
+
+	static WorkerPool& GetWorkerPool()
+	{
+		static WorkerPool pool;
+		return pool;
+	}
+
+	WorkerGroup* CreateWorkerGroup()
+	{
+		WorkerGroup* group = new WorkerGroup();
+		group->pending = 0;
+		return group;
+	}
+
+	void WorkerGroupSubmit(WorkerGroup* group, void(*func)(void* userData), void* userData)
+	{
+		WorkerPool& pool = GetWorkerPool();
+		group->pending++;
+
+		{
+			std::lock_guard<std::mutex> lock(pool.mutex);
+			pool.jobs.push_back({ func, userData, group });
+		}
+
+		pool.wake.notify_one();
+	}
+
+	void WorkerGroupWait(WorkerGroup* group)
+	{
+		WorkerPool& pool = GetWorkerPool();
+		std::unique_lock<std::mutex> lock(pool.mutex);
+
+		// Only jobs of this group are helped with. Every queued job then has a thread that
+		// will run it, so waits from worker threads never deadlock the pool, and a wait on
+		// the render thread never picks up some unrelated long job.
+		while (group->pending > 0)
+		{
+			auto job = std::find_if(pool.jobs.begin(), pool.jobs.end(),
+				[group](const WorkerJob& queued) { return queued.group == group; });
+
+			if (job != pool.jobs.end())
+			{
+				WorkerJob run = *job;
+				pool.jobs.erase(job);
+				pool.Execute(lock, run);
+			}
+			else
+			{
+				pool.done.wait(lock);
+			}
+		}
+	}
+
+	void Dispose(WorkerGroup* group)
+	{
+		WorkerGroupWait(group);
+		delete group;
+	}
+
+	struct ParallelForJob
+	{
+		void(*func)(uint32 index, void* userData);
+		void* userData;
+		uint32 count;
+		std::atomic<uint32> next;
+	};
+
+	static void ParallelForRun(void* userData)
+	{
+		ParallelForJob* job = (ParallelForJob*)userData;
+
+		uint32 index;
+		while ((index = job->next.fetch_add(1)) < job->count)
+			job->func(index, job->userData);
+	}
+
+	void ParallelFor(uint32 count, void(*func)(uint32 index, void* userData), void* userData)
+	{
+		uint32 workerCount = GetWorkerCount();
+		if (workerCount > count)
+			workerCount = count;
+
+		if (workerCount <= 1)
+		{
+			for (uint32 i = 0; i < count; i++)
+				func(i, userData);
+
+			return;
+		}
+
+		ParallelForJob job;
+		job.func = func;
+		job.userData = userData;
+		job.count = count;
+		job.next = 0;
+
+		WorkerGroup* group = CreateWorkerGroup();
+
+		for (uint32 i = 0; i < workerCount - 1; i++)
+			WorkerGroupSubmit(group, ParallelForRun, &job);
+
+		ParallelForRun(&job);
+
+		// Helpers that only start now find nothing left, but the job must outlive them.
+		Dispose(group);
+	}
+}
\ No newline at end of file
@@ -1,12 +1,20 @@
 #ifdef GFXL_OPENGL
 
+#include <deque>
+#include <list>
+#include <atomic>
 #include <vector>
+#include <algorithm>
+#include <unordered_map>
 #include <string>
 #include <fstream>
+#include <math.h>
+#include <float.h>
 #include <stdio.h>
 
 #pragma comment (lib, "opengl32.lib")
 #include <glad\glad.h>
+#include <SDL2\SDL_video.h>
 
 #include <gfxl.h>
 #include <glm\gtc\type_ptr.hpp>
@@ -15,498 +23,4256 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb\stb_image.h>
 
+// Compressed formats from extensions glad doesn't know about.
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT		0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT	0x83F3
+#define GL_COMPRESSED_RGBA_BPTC_UNORM		0x8E8C
+
+// ARB_buffer_storage.
+#define GL_MAP_PERSISTENT_BIT				0x0040
+#define GL_MAP_COHERENT_BIT					0x0080
+
+// ARB_draw_indirect.
+#define GL_DRAW_INDIRECT_BUFFER				0x8F3F
+
+// ARB_get_program_binary.
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT	0x8257
+#define GL_PROGRAM_BINARY_LENGTH			0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS		0x87FE
+
+// KHR_parallel_shader_compile.
+#define GL_COMPLETION_STATUS_KHR			0x91B1
+
 #define GFXL_SHADER_VERTEX		GL_VERTEX_SHADER
 #define GFXL_SHADER_FRAGMENT	GL_FRAGMENT_SHADER
 #define GFXL_SHADER_GEOMETRY	GL_GEOMETRY_SHADER
 
 namespace gfxl
 {
-	struct CameraImpl
+	typedef void (APIENTRYP GLTexStorage2DProc)(GLenum target, GLsizei levels, GLenum internalFormat,
+		GLsizei width, GLsizei height);
+	typedef void (APIENTRYP GLTexStorage3DProc)(GLenum target, GLsizei levels, GLenum internalFormat,
+		GLsizei width, GLsizei height, GLsizei depth);
+	typedef void (APIENTRYP GLBufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+	typedef void (APIENTRYP GLMultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect,
+		GLsizei drawCount, GLsizei stride);
+	typedef void (APIENTRYP GLGetProgramBinaryProc)(GLuint program, GLsizei bufferSize, GLsizei* length,
+		GLenum* binaryFormat, void* binary);
+	typedef void (APIENTRYP GLProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+	typedef void (APIENTRYP GLProgramParameteriProc)(GLuint program, GLenum name, GLint value);
+	typedef void (APIENTRYP GLMaxShaderCompilerThreadsProc)(GLuint count);
+
+	// Entry points newer than the GL 3.3 core glad loads, null when the driver lacks them.
+	// Resolved the first time they are needed, by then a context is current.
+	struct GLExtensions
 	{
-		uint32 uniformBuffer;
-		Matrix4 projection;
+		bool loaded;
+
+		// GL 4.2 or ARB_texture_storage.
+		GLTexStorage2DProc TexStorage2D;
+		GLTexStorage3DProc TexStorage3D;
+
+		// GL 4.4 or ARB_buffer_storage.
+		GLBufferStorageProc BufferStorage;
+
+		// GL 4.3 or ARB_multi_draw_indirect, only loaded along with ARB_base_instance since
+		// without it the base instance of every command must be 0.
+		GLMultiDrawElementsIndirectProc MultiDrawElementsIndirect;
+
+		// GL 4.1 or ARB_get_program_binary, only loaded when the driver has a binary format.
+		GLGetProgramBinaryProc GetProgramBinary;
+		GLProgramBinaryProc ProgramBinary;
+		GLProgramParameteriProc ProgramParameteri;
+
+		// KHR or ARB_parallel_shader_compile, compiles and links run on driver threads and
+		// can be polled for completion without waiting on them.
+		bool parallelShaderCompile;
+
+		// TextureFormatBit mask of the formats textures can be uploaded in.
+		uint32 textureFormats;
 	};
 
-	struct Shader
+	static GLExtensions extensions;
+
+	static const GLExtensions& GetExtensions()
 	{
-		GLuint id;
-		GLuint sources[6];
-		GLuint count;
-	};
+		if (extensions.loaded)
+			return extensions;
 
-	struct Mesh
+		extensions.loaded = true;
+
+		if (SDL_GL_ExtensionSupported("GL_ARB_texture_storage"))
+		{
+			extensions.TexStorage2D = (GLTexStorage2DProc)SDL_GL_GetProcAddress("glTexStorage2D");
+			extensions.TexStorage3D = (GLTexStorage3DProc)SDL_GL_GetProcAddress("glTexStorage3D");
+		}
+
+		if (SDL_GL_ExtensionSupported("GL_ARB_buffer_storage"))
+			extensions.BufferStorage = (GLBufferStorageProc)SDL_GL_GetProcAddress("glBufferStorage");
+
+		if (SDL_GL_ExtensionSupported("GL_ARB_multi_draw_indirect") && SDL_GL_ExtensionSupported("GL_ARB_base_instance"))
+		{
+			extensions.MultiDrawElementsIndirect =
+				(GLMultiDrawElementsIndirectProc)SDL_GL_GetProcAddress("glMultiDrawElementsIndirect");
+		}
+
+		GLint binaryFormats = 0;
+		if (SDL_GL_ExtensionSupported("GL_ARB_get_program_binary"))
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+
+		if (binaryFormats > 0)
+		{
+			extensions.GetProgramBinary = (GLGetProgramBinaryProc)SDL_GL_GetProcAddress("glGetProgramBinary");
+			extensions.ProgramBinary = (GLProgramBinaryProc)SDL_GL_GetProcAddress("glProgramBinary");
+			extensions.ProgramParameteri = (GLProgramParameteriProc)SDL_GL_GetProcAddress("glProgramParameteri");
+		}
+
+		const char* const parallelExtensions[] = { "GL_KHR_parallel_shader_compile", "GL_ARB_parallel_shader_compile" };
+		const char* const threadFunctions[] = { "glMaxShaderCompilerThreadsKHR", "glMaxShaderCompilerThreadsARB" };
+
+		for (uint32 i = 0; i < 2 && !extensions.parallelShaderCompile; i++)
+		{
+			if (!SDL_GL_ExtensionSupported(parallelExtensions[i]))
+				continue;
+
+			// As many threads as the driver wants to use.
+			GLMaxShaderCompilerThreadsProc MaxShaderCompilerThreads =
+				(GLMaxShaderCompilerThreadsProc)SDL_GL_GetProcAddress(threadFunctions[i]);
+
+			if (MaxShaderCompilerThreads != nullptr)
+				MaxShaderCompilerThreads(0xFFFFFFFF);
+
+			extensions.parallelShaderCompile = true;
+		}
+
+		// RGTC (BC4, BC5) is core since GL 3.0.
+		extensions.textureFormats =
+			TextureFormatBit(TextureFormat::RGBA8) | TextureFormatBit(TextureFormat::R8) |
+			TextureFormatBit(TextureFormat::BC4) | TextureFormatBit(TextureFormat::BC5);
+
+		if (SDL_GL_ExtensionSupported("GL_EXT_texture_compression_s3tc"))
+			extensions.textureFormats |= TextureFormatBit(TextureFormat::BC1) | TextureFormatBit(TextureFormat::BC3);
+
+		if (SDL_GL_ExtensionSupported("GL_ARB_texture_compression_bptc"))
+			extensions.textureFormats |= TextureFormatBit(TextureFormat::BC7);
+
+		return extensions;
+	}
+
+	// A shadow of the GL state every bind and state change goes through, so setting what is
+	// already set never reaches the driver. Whatever isn't known, at startup or after its
+	// object is deleted, is StateUnknown and always set. Element array buffers are VAO state
+	// and texture units past StateTextureUnits aren't tracked, those always go through.
+	static const GLuint StateUnknown = 0xFFFFFFFF;
+	static const uint32 StateTextureUnits = 32;
+
+	// GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY and GL_TEXTURE_CUBE_MAP.
+	static const uint32 StateTextureTargets = 3;
+
+	// GL_ARRAY_BUFFER, GL_COPY_READ_BUFFER, GL_PIXEL_UNPACK_BUFFER, GL_UNIFORM_BUFFER and GL_DRAW_INDIRECT_BUFFER.
+	static const uint32 StateBufferTargets = 5;
+
+	struct GLStateCache
 	{
+		GLuint program;
 		GLuint vertexArray;
-		GLuint vertexBuffer;
-		GLuint indexBuffer;
+		GLuint activeUnit;
+		GLuint textures[StateTextureUnits][StateTextureTargets];
+		GLuint buffers[StateBufferTargets];
 
-		GLuint vertexCount;
-		GLuint indexCount;
+		// BlendMode, CullMode and booleans, as GLuint so they can be unknown too.
+		GLuint blend;
+		GLuint cull;
+		GLuint depthTest;
+		GLuint depthWrite;
+
+		uint32 calls;
+		uint32 redundantCalls;
 	};
-	
-	struct Texture2D
+
+	static GLStateCache CreateStateCache()
 	{
-		GLuint id;
-		int width;
-		int height;
+		GLStateCache cache;
+		cache.program = StateUnknown;
+		cache.vertexArray = StateUnknown;
+		cache.activeUnit = StateUnknown;
+		std::fill(&cache.textures[0][0], &cache.textures[0][0] + StateTextureUnits * StateTextureTargets, StateUnknown);
+		std::fill(cache.buffers, cache.buffers + StateBufferTargets, StateUnknown);
+
+		cache.blend = StateUnknown;
+		cache.cull = StateUnknown;
+		cache.depthTest = StateUnknown;
+		cache.depthWrite = StateUnknown;
+
+		cache.calls = 0;
+		cache.redundantCalls = 0;
+		return cache;
+	}
+
+	static GLStateCache stateCache = CreateStateCache();
+
+	static int StateGetTextureTarget(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_TEXTURE_2D: return 0;
+		case GL_TEXTURE_2D_ARRAY: return 1;
+		case GL_TEXTURE_CUBE_MAP: return 2;
+		default: return -1;
+		}
+	}
+
+	static int StateGetBufferTarget(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_ARRAY_BUFFER: return 0;
+		case GL_COPY_READ_BUFFER: return 1;
+		case GL_PIXEL_UNPACK_BUFFER: return 2;
+		case GL_UNIFORM_BUFFER: return 3;
+		case GL_DRAW_INDIRECT_BUFFER: return 4;
+		default: return -1;
+		}
+	}
+
+	// Records value, returns whether it differs from what the GL has and has to be set.
+	static bool StateChange(GLuint& cached, GLuint value)
+	{
+		if (cached == value)
+		{
+			stateCache.redundantCalls++;
+			return false;
+		}
+
+		cached = value;
+		stateCache.calls++;
+		return true;
+	}
+
+	static void StateUseProgram(GLuint program)
+	{
+		if (StateChange(stateCache.program, program))
+			glUseProgram(program);
+	}
+
+	static void StateBindVertexArray(GLuint vertexArray)
+	{
+		if (StateChange(stateCache.vertexArray, vertexArray))
+			glBindVertexArray(vertexArray);
+	}
+
+	// Binds texture to unit for drawing, the active unit only changes when the texture does.
+	static void StateBindTexture(GLuint unit, GLenum target, GLuint texture)
+	{
+		const int index = StateGetTextureTarget(target);
+		const bool tracked = unit < StateTextureUnits && index >= 0;
+
+		if (tracked && stateCache.textures[unit][index] == texture)
+		{
+			stateCache.redundantCalls++;
+			return;
+		}
+
+		if (StateChange(stateCache.activeUnit, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+
+		glBindTexture(target, texture);
+		stateCache.calls++;
+
+		if (tracked)
+			stateCache.textures[unit][index] = texture;
+	}
+
+	// Binds texture to unit 0 and makes that unit active, for the glTex* calls that follow to
+	// edit texture whatever was bound and active before.
+	static void StateBindTextureForEdit(GLenum target, GLuint texture)
+	{
+		if (StateChange(stateCache.activeUnit, 0))
+			glActiveTexture(GL_TEXTURE0);
+
+		StateBindTexture(0, target, texture);
+	}
+
+	static void StateBindBuffer(GLenum target, GLuint buffer)
+	{
+		const int index = StateGetBufferTarget(target);
+		if (index < 0)
+		{
+			glBindBuffer(target, buffer);
+			stateCache.calls++;
+			return;
+		}
+
+		if (StateChange(stateCache.buffers[index], buffer))
+			glBindBuffer(target, buffer);
+	}
+
+	// Indexed binds aren't filtered, but they bind the generic target as well.
+	static void StateBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+	{
+		glBindBufferRange(target, index, buffer, offset, size);
+		stateCache.calls++;
+
+		const int slot = StateGetBufferTarget(target);
+		if (slot >= 0)
+			stateCache.buffers[slot] = buffer;
+	}
+
+	static void StateBindBufferBase(GLenum target, GLuint index, GLuint buffer)
+	{
+		glBindBufferBase(target, index, buffer);
+		stateCache.calls++;
+
+		const int slot = StateGetBufferTarget(target);
+		if (slot >= 0)
+			stateCache.buffers[slot] = buffer;
+	}
+
+	// A deleted name may come back from the next glGen*, whatever held it is set again.
+	static void StateForget(GLuint* cached, uint32 count, GLuint id)
+	{
+		for (uint32 i = 0; i < count; i++)
+		{
+			if (cached[i] == id)
+				cached[i] = StateUnknown;
+		}
+	}
+
+	static void StateDeleteTextures(GLsizei count, const GLuint* textures)
+	{
+		for (GLsizei i = 0; i < count; i++)
+			StateForget(&stateCache.textures[0][0], StateTextureUnits * StateTextureTargets, textures[i]);
+
+		glDeleteTextures(count, textures);
+	}
+
+	static void StateDeleteBuffers(GLsizei count, const GLuint* buffers)
+	{
+		for (GLsizei i = 0; i < count; i++)
+			StateForget(stateCache.buffers, StateBufferTargets, buffers[i]);
+
+		glDeleteBuffers(count, buffers);
+	}
+
+	static void StateDeleteVertexArrays(GLsizei count, const GLuint* vertexArrays)
+	{
+		for (GLsizei i = 0; i < count; i++)
+			StateForget(&stateCache.vertexArray, 1, vertexArrays[i]);
+
+		glDeleteVertexArrays(count, vertexArrays);
+	}
+
+	static void StateDeleteProgram(GLuint program)
+	{
+		StateForget(&stateCache.program, 1, program);
+		glDeleteProgram(program);
+	}
+
+	// Records value without counting, for states that take more than one call to set. They
+	// count each call they make.
+	static bool StateRecord(GLuint& cached, GLuint value)
+	{
+		if (cached == value)
+		{
+			stateCache.redundantCalls++;
+			return false;
+		}
+
+		cached = value;
+		return true;
+	}
+
+	static void StateSetBlend(BlendMode blend)
+	{
+		const GLuint previous = stateCache.blend;
+		if (!StateRecord(stateCache.blend, (GLuint)blend))
+			return;
+
+		if (blend == BlendMode::Opaque)
+		{
+			glDisable(GL_BLEND);
+			stateCache.calls++;
+			return;
+		}
+
+		if (previous == StateUnknown || previous == (GLuint)BlendMode::Opaque)
+		{
+			glEnable(GL_BLEND);
+			stateCache.calls++;
+		}
+
+		if (blend == BlendMode::Alpha)
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		else
+			glBlendFunc(GL_ONE, GL_ONE);
+
+		stateCache.calls++;
+	}
+
+	static void StateSetCull(CullMode cull)
+	{
+		const GLuint previous = stateCache.cull;
+		if (!StateRecord(stateCache.cull, (GLuint)cull))
+			return;
+
+		if (cull == CullMode::None)
+		{
+			glDisable(GL_CULL_FACE);
+			stateCache.calls++;
+			return;
+		}
+
+		if (previous == StateUnknown || previous == (GLuint)CullMode::None)
+		{
+			glEnable(GL_CULL_FACE);
+			stateCache.calls++;
+		}
+
+		glCullFace(cull == CullMode::Back ? GL_BACK : GL_FRONT);
+		stateCache.calls++;
+	}
+
+	static void StateSetDepth(bool test, bool write)
+	{
+		if (StateChange(stateCache.depthTest, test))
+		{
+			if (test)
+				glEnable(GL_DEPTH_TEST);
+			else
+				glDisable(GL_DEPTH_TEST);
+		}
+
+		if (StateChange(stateCache.depthWrite, write))
+			glDepthMask(write ? GL_TRUE : GL_FALSE);
+	}
+
+	// Every upload is copied through this ring, so the GL reads from its own memory whenever
+	// it gets to it instead of copying client memory inline. Allocations go around the ring
+	// and a fence issued after their copies tells when a region can be written again.
+	static const ulong64 StagingRingSize = 32 * 1024 * 1024;
+	static const ulong64 StagingAlignment = 256;
+
+	// Writes to the persistently mapped ring are split among the workers in blocks this big.
+	static const ulong64 StagingCopyBlock = 1024 * 1024;
+
+	// A range the GL may still be reading from, free once fence is signaled.
+	struct StagingRegion
+	{
+		ulong64 begin;
+		ulong64 end;
+		GLsync fence;
 	};
 
-	struct Cubemap
+	struct StagingAllocation
 	{
-		GLuint id;
+		ulong64 offset;
+		ulong64 size;
+		unsigned char* memory;
 	};
 
-	struct SpriteBatch
+	struct StagingRing
 	{
-		// TODO: Maybe keep a list things we should be rendering.
+		GLuint buffer;
+
+		// The whole ring when it is persistently mapped, null when every allocation is mapped on its own.
+		unsigned char* memory;
+
+		ulong64 head;
+
+		// Allocations since the last fence, [pendingBegin, head).
+		ulong64 pendingBegin;
+
+		// Oldest first.
+		std::deque<StagingRegion> regions;
 	};
 
-	struct SpriteAtlas
+	struct StagingCopy
 	{
-		Texture2D texture;
-		Vector2i size;
+		unsigned char* destination;
+		const unsigned char* source;
+		ulong64 size;
 	};
 
-	Camera* CreateCamera()
+	static StagingRing staging;
+
+	static void StagingCreate()
 	{
-		Camera* camera = (Camera*)malloc(sizeof(Camera));
-		*camera = {};
-		camera->impl = (CameraImpl*)malloc(sizeof(CameraImpl));
-		*camera->impl = {};
-		return camera;
+		const GLExtensions& extensions = GetExtensions();
+
+		glGenBuffers(1, &staging.buffer);
+		StateBindBuffer(GL_COPY_READ_BUFFER, staging.buffer);
+
+		if (extensions.BufferStorage != nullptr)
+		{
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			extensions.BufferStorage(GL_COPY_READ_BUFFER, StagingRingSize, nullptr, flags);
+			staging.memory = (unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, StagingRingSize, flags);
+		}
+		else
+		{
+			glBufferData(GL_COPY_READ_BUFFER, StagingRingSize, nullptr, GL_STREAM_DRAW);
+		}
+
+		StateBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	// Closes the allocations made since the last call, call it after the copies reading from them.
+	static void StagingFence()
+	{
+		if (staging.head == staging.pendingBegin)
+			return;
+
+		StagingRegion region;
+		region.begin = staging.pendingBegin;
+		region.end = staging.head;
+		region.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		staging.regions.push_back(region);
+		staging.pendingBegin = staging.head;
+	}
+
+	// Fences complete in order, waiting on the newest region in the way frees all older ones too.
+	static void StagingWait(ulong64 begin, ulong64 end)
+	{
+		long64 last = -1;
+		for (uint32 i = 0; i < staging.regions.size(); i++)
+		{
+			if (staging.regions[i].begin < end && begin < staging.regions[i].end)
+				last = i;
+		}
+
+		if (last < 0)
+			return;
+
+		GLenum result;
+		do
+		{
+			result = glClientWaitSync(staging.regions[(size_t)last].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+		} while (result == GL_TIMEOUT_EXPIRED);
+
+		for (long64 i = 0; i <= last; i++)
+			glDeleteSync(staging.regions[(size_t)i].fence);
+
+		staging.regions.erase(staging.regions.begin(), staging.regions.begin() + (size_t)last + 1);
+	}
+
+	// Returns false when size doesn't fit in the ring at all, the caller uploads from its own memory then.
+	static bool StagingAllocate(ulong64 size, StagingAllocation* allocation)
+	{
+		if (size == 0 || size > StagingRingSize)
+			return false;
+
+		if (staging.buffer == 0)
+			StagingCreate();
+
+		ulong64 begin = staging.head;
+
+		// Allocations never wrap, the pending ones are fenced so the ring can start over.
+		if (begin + size > StagingRingSize)
+		{
+			StagingFence();
+			begin = staging.head = staging.pendingBegin = 0;
+		}
+
+		StagingWait(begin, begin + size);
+		staging.head = Min((begin + size + StagingAlignment - 1) & ~(StagingAlignment - 1), StagingRingSize);
+
+		allocation->offset = begin;
+		allocation->size = size;
+
+		if (staging.memory != nullptr)
+		{
+			allocation->memory = staging.memory + begin;
+			return true;
+		}
+
+		// The fences already keep the GL off this range, the driver doesn't need to.
+		StateBindBuffer(GL_COPY_READ_BUFFER, staging.buffer);
+		allocation->memory = (unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, begin, size,
+			GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		StateBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		return allocation->memory != nullptr;
+	}
+
+	static void StagingCopyRun(uint32 index, void* userData)
+	{
+		const StagingCopy* copy = (const StagingCopy*)userData;
+		ulong64 offset = index * StagingCopyBlock;
+		ulong64 size = Min(StagingCopyBlock, copy->size - offset);
+
+		memcpy(copy->destination + offset, copy->source + offset, (size_t)size);
+	}
+
+	// Fills the allocation and hands it over to the GL, copies can be issued from it right after.
+	static void StagingWrite(const StagingAllocation& allocation, const void* source)
+	{
+		StagingCopy copy;
+		copy.destination = allocation.memory;
+		copy.source = (const unsigned char*)source;
+		copy.size = allocation.size;
+
+		if (staging.memory != nullptr)
+		{
+			ParallelFor((uint32)((copy.size + StagingCopyBlock - 1) / StagingCopyBlock), StagingCopyRun, &copy);
+			return;
+		}
+
+		memcpy(copy.destination, copy.source, (size_t)copy.size);
+
+		StateBindBuffer(GL_COPY_READ_BUFFER, staging.buffer);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		StateBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	// Allocates the storage of the buffer bound to target and fills it through the ring.
+	static void StagingUploadBuffer(GLenum target, const void* data, ulong64 size)
+	{
+		glBufferData(target, (GLsizeiptr)size, nullptr, GL_STATIC_DRAW);
+
+		// Chunks of a quarter of the ring keep the copies going while earlier ones are in flight.
+		const unsigned char* source = (const unsigned char*)data;
+		for (ulong64 offset = 0; offset < size; )
+		{
+			ulong64 chunk = Min(size - offset, StagingRingSize / 4);
+
+			StagingAllocation allocation;
+			if (!StagingAllocate(chunk, &allocation))
+			{
+				glBufferSubData(target, (GLintptr)offset, (GLsizeiptr)chunk, source + offset);
+				offset += chunk;
+				continue;
+			}
+
+			StagingWrite(allocation, source + offset);
+
+			StateBindBuffer(GL_COPY_READ_BUFFER, staging.buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, target, (GLintptr)allocation.offset, (GLintptr)offset, (GLsizeiptr)chunk);
+			StateBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+			offset += chunk;
+		}
+
+		StagingFence();
+	}
+
+	struct CameraImpl
+	{
+		uint32 uniformBuffer;
+		Matrix4 projection;
+	};
+
+	// A slot of the uniform table, empty when location is -1.
+	struct ShaderUniform
+	{
+		uint32 hash;
+		GLint location;
+	};
+
+	struct Shader
+	{
+		GLuint id;
+		GLuint sources[6];
+		GLuint count;
+
+		// The stages loaded so far, compiled at link unless a cached binary of them is found.
+		// sourceKey hashes the stages and their code, nameKey the files they came from.
+		GLenum types[6];
+		char* texts[6];
+		ulong64 sourceKey;
+		uint32 nameKey;
+		char* firstFilename;
+
+		// linking while the driver works on the program, linked once it can be used.
+		ulong64 binaryKey;
+		bool linking;
+		bool linked;
+
+		// Active uniforms by name hash, open addressing over a power of two capacity.
+		ShaderUniform* uniforms;
+		uint32 uniformCapacity;
+	};
+
+	struct ShaderBatch
+	{
+		// The shaders the driver is still linking.
+		std::vector<Shader*> shaders;
+		double start;
+	};
+
+	// A CPU copy of a std140 uniform block and the buffer it goes to. members maps the name
+	// hashes of the members to their offsets, bytes dirtyBegin to dirtyEnd changed since the
+	// last flush.
+	struct ParameterBlock
+	{
+		uint32 nameHash;
+		GLuint buffer;
+		GLuint binding;
+
+		unsigned char* data;
+		uint32 size;
+
+		ShaderUniform* members;
+		uint32 memberCapacity;
+
+		uint32 dirtyBegin;
+		uint32 dirtyEnd;
+	};
+
+	// textureSet indexes the sets of the queue, RenderNoTextureSet when the draw keeps what
+	// is bound. indexCount 0 draws the whole mesh. center is that of what is drawn, in mesh space.
+	struct RenderPacket
+	{
+		const Shader* shader;
+		const Mesh* mesh;
+		uint32 textureSet;
+		uint32 model;
+		Vector3 center;
+
+		uint32 firstIndex;
+		uint32 indexCount;
+		bool bindGroups;
+	};
+
+	static const uint32 RenderNoTextureSet = 0xFFFFFFFF;
+
+	// The textures a draw binds to the material units.
+	struct RenderTextureSet
+	{
+		GLuint ids[(int)MaterialSampler::Count];
+	};
+
+	struct RenderSortItem
+	{
+		ulong64 key;
+		uint32 packet;
+	};
+
+	struct RenderQueue
+	{
+		std::vector<RenderPacket> packets;
+		std::vector<Matrix4> models;
+
+		// Every distinct set once, found again through the hash of its ids.
+		std::vector<RenderTextureSet> textureSets;
+		std::unordered_map<ulong64, uint32> textureSetsByHash;
+
+		// Kept between frames so submitting doesn't allocate.
+		std::unordered_map<const Shader*, uint32> shaderRanks;
+		std::unordered_map<const Mesh*, uint32> meshRanks;
+		std::vector<float> distances;
+		std::vector<RenderSortItem> items;
+		std::vector<RenderSortItem> scratch;
+	};
+
+	// Arrays, one per material slot, that every material sharing them draws with in one go.
+	// The group draws the commands from firstDraw on.
+	struct MeshBindGroup
+	{
+		GLuint arrays[(int)MaterialSampler::Count];
+		uint32 firstDraw;
+		uint32 drawCount;
+	};
+
+	// Layer of every sampler of a material in the arrays of its group, -1 for samplers
+	// without one. Read by the shader through the instanced attribute 5.
+	struct MeshMaterialLayers
+	{
+		float32 layers[(int)MaterialSampler::Count];
+	};
+
+	// Textures of the mesh each sampler of a material binds, MeshNoTexture for none.
+	struct MeshMaterialSamplers
+	{
+		uint32 textures[(int)MaterialSampler::Count];
+	};
+
+	// A texture the materials sample, either an image of the mesh data or its metallic and
+	// roughness images packed as an ORM texture. Indices are into the texture table of the data.
+	struct MeshTextureSource
+	{
+		uint32 image;
+		uint32 roughness;
+		uint32 metallic;
+		TextureLoadSettings settings;
+	};
+
+	// Laid out the way glMultiDrawElementsIndirect reads it. baseInstance is the material,
+	// which picks its layers from the instanced attributes.
+	struct MeshDrawCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	struct Mesh
+	{
+		GLuint vertexArray;
+		GLuint vertexBuffer;
+		GLuint indexBuffer;
+
+		GLuint vertexCount;
+		GLuint indexCount;
+		GLenum indexType;
+		ulong64 bufferSize;
+
+		// Packed positions are rebuilt as offset + position * scale in the vertex shader.
+		VertexFormat vertexFormat;
+		Vector3 quantScale;
+		Vector3 quantOffset;
+
+		// submeshCount entries per LOD, the first level matches what Render draws.
+		MeshSubmesh* submeshes;
+		uint32 submeshCount;
+
+		// Middle of the bounds of each first level submesh, found from the clusters. Without
+		// clusters every submesh has the center of the mesh.
+		Vector3* submeshCenters;
+
+		// Every texture of the model is loaded once, the samplers of each material index into textures.
+		MeshMaterial* materials;
+		MeshMaterialSamplers* materialSamplers;
+		uint32 materialCount;
+		Texture2D** textures;
+		uint32 textureCount;
+		TextureStreamer* textureStreamer;
+		ResourceCache* resourceCache;
+
+		// Packed in arrays the material textures replace the table above. There is one more
+		// entry of layers than materials, for submeshes without one.
+		GLuint* textureArrays;
+		uint32 textureArrayCount;
+		ulong64 textureArraySize;
+		MeshMaterialLayers* materialLayers;
+		MeshBindGroup* bindGroups;
+		uint32 bindGroupCount;
+		MeshDrawCommand* draws;
+		uint32 drawCount;
+		GLuint layerBuffer;
+		GLuint drawBuffer;
+
+		MeshCluster* clusters;
+		uint32 clusterCount;
+
+		// The first LOD covers the same range Render draws.
+		MeshLod* lods;
+		uint32 lodCount;
+
+		Vector3 center;
+		float radius;
+	};
+	
+	struct Texture2D
+	{
+		GLuint id;
+		int width;
+		int height;
+		ulong64 memorySize;
+	};
+
+	struct Cubemap
+	{
+		GLuint id;
+	};
+
+	// Every image comes with its whole mip chain in its final format, either mapped from a
+	// cooked file or decoded and processed on a worker.
+	struct TextureBatchImage
+	{
+		std::string filename;
+		TextureLoadSettings settings;
+
+		// Packed from one image per channel, filename then only names the cooked file.
+		// Channels without an image take their default.
+		bool packed;
+		std::string channelFilenames[4];
+		unsigned char channelDefaults[4];
+
+		uint32 supportedFormats;
+
+		TextureData* data;
+		CookedTexture cooked;
+		bool isCooked;
+
+		// Set by the decode job once it no longer touches the image.
+		std::atomic<bool> ready;
+	};
+
+	// Either a texture with one image or a cubemap with six, starting at firstImage.
+	struct TextureBatchEntry
+	{
+		Texture2D* texture;
+		Cubemap* cubemap;
+		uint32 firstImage;
+		bool uploaded;
+	};
+
+	struct TextureBatch
+	{
+		WorkerGroup* group;
+
+		// A deque never moves its elements, the decode jobs hold pointers into it.
+		std::deque<TextureBatchImage> images;
+		std::vector<TextureBatchEntry> entries;
+		uint32 uploadedCount;
+
+		double start;
+		ulong64 uploadSize;
+	};
+
+	// Levels at most this big are always resident, the rest stream in on demand.
+	static const uint32 TextureStreamMinSize = 128;
+
+	// A streamed texture holds levels residentLevel and below, the source image keeps the
+	// whole chain so the rest can come back without decoding again.
+	struct TextureStream
+	{
+		Texture2D* texture;
+		TextureBatchImage* image;
+		bool created;
+
+		uint32 levelCount;
+		uint32 minLevel;
+		uint32 residentLevel;
+
+		// The finest level a draw asked for this frame, levelCount when none did.
+		uint32 requestedLevel;
+		uint32 lastUsedFrame;
+
+		// Pages of the levels from prefetchLevel up to prefetchEnd are read in by a worker,
+		// so the upload doesn't stall on the disk. levelCount when none was asked for.
+		uint32 prefetchLevel;
+		uint32 prefetchEnd;
+		std::atomic<bool> prefetched;
+	};
+
+	struct TextureStreamer
+	{
+		WorkerGroup* group;
+
+		// Lists, removed streams and their images are erased from the middle.
+		std::list<TextureBatchImage> images;
+		std::list<TextureStream> streams;
+		std::unordered_map<const Texture2D*, TextureStream*> lookup;
+
+		ulong64 budget;
+		ulong64 residentSize;
+		uint32 frame;
+	};
+
+	// Everything gfxl.fs needs for the ambient lighting, see EnvironmentData.
+	struct Environment
+	{
+		Vector3 irradiance[9];
+		Cubemap specular;
+		uint32 specularLevels;
+		Texture2D brdf;
+	};
+
+	struct SpriteBatch
+	{
+		// TODO: Maybe keep a list things we should be rendering.
+	};
+
+	struct SpriteAtlas
+	{
+		Texture2D texture;
+		Vector2i size;
+	};
+
+	Camera* CreateCamera()
+	{
+		Camera* camera = (Camera*)malloc(sizeof(Camera));
+		*camera = {};
+		camera->impl = (CameraImpl*)malloc(sizeof(CameraImpl));
+		*camera->impl = {};
+		return camera;
+	}
+
+	Mesh* CreateMesh()
+	{
+		Mesh* mesh = (Mesh*)malloc(sizeof(Mesh));
+		*mesh = {};
+		return mesh;
+	}
+
+	Shader* CreateShader()
+	{
+		Shader* shader = (Shader*)malloc(sizeof(Shader));
+		*shader = {};
+		return shader;
+	}
+
+	Texture2D* CreateTexture2D()
+	{
+		Texture2D* texture = (Texture2D*)malloc(sizeof(Texture2D));
+		*texture = {};
+		return texture;
+	}
+
+	Cubemap* CreateCubemap()
+	{
+		return (Cubemap*)malloc(sizeof(Cubemap));
+	}
+
+	Environment* CreateEnvironment()
+	{
+		Environment* environment = (Environment*)malloc(sizeof(Environment));
+		*environment = {};
+		return environment;
+	}
+
+	SpriteBatch* CreateSpriteBatch()
+	{
+		return (SpriteBatch*)malloc(sizeof(SpriteBatch));
+	}
+
+	SpriteAtlas* CreateSpriteAtlas()
+	{
+		return (SpriteAtlas*)malloc(sizeof(SpriteAtlas));
+	}
+
+	static const uint32 ShaderMaxIncludeDepth = 16;
+
+	// Each define as a directive, then a #line that numbers what follows from nextLine on.
+	static std::string ShaderMakeDefines(const ShaderLoadSettings& settings, uint32 nextLine)
+	{
+		std::string defines;
+		for (uint32 i = 0; i < settings.defineCount; i++)
+		{
+			defines += "#define ";
+			defines += settings.defines[i];
+			defines += '\n';
+		}
+
+		defines += "#line " + std::to_string(nextLine) + " 0\n";
+		return defines;
+	}
+
+	// Appends filename to output with its includes expanded. #line directives keep the lines
+	// the compiler reports right, the source string number is the index in included.
+	static bool ShaderPreprocess(std::string& output, const char* filename, const ShaderLoadSettings& settings,
+		std::vector<std::string>& included, uint32 depth)
+	{
+		std::ifstream file(filename);
+		if (!file)
+		{
+			Message("[ERROR] Failed to load shader file %s\n", filename);
+			return false;
+		}
+
+		if (depth > ShaderMaxIncludeDepth)
+		{
+			Message("[ERROR] Includes nested too deep in %s\n", filename);
+			return false;
+		}
+
+		const std::string path = filename;
+		const size_t separator = path.find_last_of("/\\");
+		const std::string directory = separator != std::string::npos ? path.substr(0, separator + 1) : "";
+
+		const uint32 sourceIndex = (uint32)included.size();
+		included.push_back(path);
+
+		std::string line;
+		uint32 lineNumber = 0;
+		bool definesAdded = depth > 0;
+
+		while (std::getline(file, line))
+		{
+			lineNumber++;
+
+			const size_t start = line.find_first_not_of(" \t");
+			const bool directive = start != std::string::npos && line[start] == '#';
+
+			if (directive && line.compare(start, 8, "#include") == 0)
+			{
+				const size_t open = line.find('"', start + 8);
+				const size_t close = open != std::string::npos ? line.find('"', open + 1) : std::string::npos;
+
+				if (close == std::string::npos)
+				{
+					Message("[ERROR] Malformed #include in %s(%u)\n", filename, lineNumber);
+					return false;
+				}
+
+				const std::string includeFilename = directory + line.substr(open + 1, close - open - 1);
+				if (std::find(included.begin(), included.end(), includeFilename) == included.end())
+				{
+					output += "#line 1 " + std::to_string(included.size()) + "\n";
+					if (!ShaderPreprocess(output, includeFilename.c_str(), settings, included, depth + 1))
+						return false;
+				}
+
+				output += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(sourceIndex) + "\n";
+				continue;
+			}
+
+			output += line;
+			output += '\n';
+
+			if (!definesAdded && directive && line.compare(start, 8, "#version") == 0)
+			{
+				output += ShaderMakeDefines(settings, lineNumber + 1);
+				definesAdded = true;
+			}
+		}
+
+		// Without a #version line the defines go first, nothing may come before one.
+		if (!definesAdded && settings.defineCount > 0)
+			output.insert(0, ShaderMakeDefines(settings, 1));
+
+		return true;
+	}
+
+	bool ShaderLoadAndCompile(Shader* shader, const char* filename, ShaderType type, const ShaderLoadSettings& settings)
+	{
+		if (shader->count == 6)
+		{
+			Message("[ERROR] Shader has no room for another stage, %s\n", filename);
+			return false;
+		}
+
+		std::string contents;
+		std::vector<std::string> included;
+		if (!ShaderPreprocess(contents, filename, settings, included, 0))
+			return false;
+
+		const GLenum stage = (GLenum)type;
+
+		if (shader->count == 0)
+		{
+			shader->sourceKey = HashData(&stage, sizeof(stage));
+			shader->nameKey = HashString(filename);
+			shader->firstFilename = (char*)malloc(strlen(filename) + 1);
+			strcpy(shader->firstFilename, filename);
+		}
+		else
+		{
+			shader->sourceKey = HashData(&stage, sizeof(stage), shader->sourceKey);
+			shader->nameKey = HashString(filename, shader->nameKey);
+		}
+
+		// Every variant gets a cache file of its own, they don't take turns overwriting one.
+		for (uint32 i = 0; i < settings.defineCount; i++)
+			shader->nameKey = HashString(settings.defines[i], HashString("|", shader->nameKey));
+
+		shader->sourceKey = HashData(contents.data(), contents.size(), shader->sourceKey);
+
+		shader->types[shader->count] = stage;
+		shader->texts[shader->count] = (char*)malloc(contents.size() + 1);
+		memcpy(shader->texts[shader->count], contents.c_str(), contents.size() + 1);
+		shader->count++;
+		return true;
+	}
+
+	// At most half full, so probes stay short.
+	static ShaderUniform* UniformTableAllocate(uint32 entryCount, uint32* capacity)
+	{
+		*capacity = 16;
+		while (*capacity < entryCount * 2)
+			*capacity *= 2;
+
+		ShaderUniform* table = (ShaderUniform*)malloc(sizeof(ShaderUniform) * *capacity);
+		for (uint32 i = 0; i < *capacity; i++)
+			table[i] = { 0, -1 };
+
+		return table;
+	}
+
+	static void UniformTableInsert(ShaderUniform* table, uint32 capacity, const char* name, GLint location)
+	{
+		const uint32 hash = HashString(name);
+		const uint32 mask = capacity - 1;
+
+		for (uint32 i = hash & mask;; i = (i + 1) & mask)
+		{
+			ShaderUniform& uniform = table[i];
+
+			if (uniform.location == -1)
+			{
+				uniform.hash = hash;
+				uniform.location = location;
+				return;
+			}
+
+			if (uniform.hash == hash)
+			{
+				if (uniform.location != location)
+					Message("[ERROR] Uniform %s has the same hash as another one, rename one of them\n", name);
+				return;
+			}
+		}
+	}
+
+	static GLint UniformTableFind(const ShaderUniform* table, uint32 capacity, uint32 nameHash)
+	{
+		if (capacity == 0)
+			return -1;
+
+		const uint32 mask = capacity - 1;
+
+		for (uint32 i = nameHash & mask;; i = (i + 1) & mask)
+		{
+			const ShaderUniform& uniform = table[i];
+
+			if (uniform.location == -1 || uniform.hash == nameHash)
+				return uniform.location;
+		}
+	}
+
+	// Enumerates the active uniforms into the table. Arrays are entered once per element,
+	// and once more without the [0] so the bare name sets the first one like the GL does.
+	static void ShaderReflectUniforms(Shader* shader)
+	{
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(shader->id, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(shader->id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+		struct ActiveUniform
+		{
+			std::string name;
+			GLint size;
+		};
+
+		std::vector<ActiveUniform> active;
+		uint32 entryCount = 0;
+		std::vector<char> name((size_t)maxLength + 1);
+
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type;
+			glGetActiveUniform(shader->id, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, name.data());
+
+			// Members of uniform blocks have no location of their own.
+			if (glGetUniformLocation(shader->id, name.data()) == -1)
+				continue;
+
+			active.push_back({ std::string(name.data(), (size_t)length), size });
+			entryCount += (uint32)size + 1;
+		}
+
+		free(shader->uniforms);
+		shader->uniforms = UniformTableAllocate(entryCount, &shader->uniformCapacity);
+
+		for (const ActiveUniform& uniform : active)
+		{
+			const GLint location = glGetUniformLocation(shader->id, uniform.name.c_str());
+			UniformTableInsert(shader->uniforms, shader->uniformCapacity, uniform.name.c_str(), location);
+
+			const size_t bracket = uniform.name.size() > 3 ? uniform.name.size() - 3 : std::string::npos;
+			if (bracket == std::string::npos || uniform.name.compare(bracket, 3, "[0]") != 0)
+				continue;
+
+			const std::string base = uniform.name.substr(0, bracket);
+			UniformTableInsert(shader->uniforms, shader->uniformCapacity, base.c_str(), location);
+
+			for (GLint element = 1; element < uniform.size; element++)
+			{
+				const std::string elementName = base + "[" + std::to_string(element) + "]";
+				const GLint elementLocation = glGetUniformLocation(shader->id, elementName.c_str());
+				UniformTableInsert(shader->uniforms, shader->uniformCapacity, elementName.c_str(), elementLocation);
+			}
+		}
+	}
+
+	static GLint ShaderFindUniform(const Shader* shader, uint32 nameHash)
+	{
+		return UniformTableFind(shader->uniforms, shader->uniformCapacity, nameHash);
+	}
+
+	// Binding points of the parameter blocks by block name hash, every program linked while
+	// a block exists has its block of that name bound to it. 0 stays the camera's.
+	static std::unordered_map<uint32, GLuint> parameterBlockBindings;
+
+	void ShaderBindParameterBlocks(const Shader* shader)
+	{
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(shader->id, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+		glGetProgramiv(shader->id, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+
+		std::vector<char> name((size_t)maxLength + 1);
+
+		for (GLint i = 0; i < count; i++)
+		{
+			glGetActiveUniformBlockName(shader->id, (GLuint)i, (GLsizei)name.size(), nullptr, name.data());
+
+			auto found = parameterBlockBindings.find(HashString(name.data()));
+			if (found != parameterBlockBindings.end())
+				glUniformBlockBinding(shader->id, (GLuint)i, found->second);
+		}
+	}
+
+	static const uint32 ProgramBinaryMagic = 0x42504647; // "GFPB"
+	static const uint32 ProgramBinaryVersion = 1;
+
+	// The binary as the driver returned it follows the header.
+	struct ProgramBinaryHeader
+	{
+		uint32 magic;
+		uint32 version;
+
+		// The sources and the driver that compiled them, a binary is only good for both.
+		ulong64 key;
+
+		uint32 format;
+		uint32 size;
+	};
+
+	// A binary can't be loaded by another driver, or even another version of the same one.
+	static ulong64 ShaderGetBinaryKey(const Shader* shader)
+	{
+		const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		ulong64 key = shader->sourceKey;
+
+		for (GLenum name : names)
+		{
+			const char* value = (const char*)glGetString(name);
+			if (value != nullptr)
+				key = HashData(value, strlen(value), key);
+		}
+
+		return key;
+	}
+
+	static std::string ShaderGetBinaryFilename(const Shader* shader)
+	{
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".%08x.gfxlprog", shader->nameKey);
+		return std::string(shader->firstFilename) + suffix;
+	}
+
+	// Links the program straight from the cached binary, false when there is none or the
+	// driver turns it down.
+	static bool ShaderLoadBinary(Shader* shader, const std::string& filename, ulong64 key)
+	{
+		const GLExtensions& extensions = GetExtensions();
+		if (extensions.ProgramBinary == nullptr)
+			return false;
+
+		MappedFile file;
+		if (!MappedFileOpen(&file, filename.c_str()))
+			return false;
+
+		const ProgramBinaryHeader* header = (const ProgramBinaryHeader*)file.data;
+
+		GLint success = file.size >= sizeof(ProgramBinaryHeader) &&
+			header->magic == ProgramBinaryMagic &&
+			header->version == ProgramBinaryVersion &&
+			header->key == key &&
+			sizeof(ProgramBinaryHeader) + (ulong64)header->size <= file.size;
+
+		if (success)
+		{
+			extensions.ProgramBinary(shader->id, header->format, file.data + sizeof(ProgramBinaryHeader), header->size);
+			glGetProgramiv(shader->id, GL_LINK_STATUS, &success);
+		}
+
+		MappedFileClose(&file);
+		return success != 0;
+	}
+
+	static void ShaderWriteBinary(const Shader* shader, const std::string& filename, ulong64 key)
+	{
+		const GLExtensions& extensions = GetExtensions();
+		if (extensions.GetProgramBinary == nullptr)
+			return;
+
+		GLint size = 0;
+		glGetProgramiv(shader->id, GL_PROGRAM_BINARY_LENGTH, &size);
+		if (size <= 0)
+			return;
+
+		std::vector<char> binary((size_t)size);
+		ProgramBinaryHeader header = {};
+		header.magic = ProgramBinaryMagic;
+		header.version = ProgramBinaryVersion;
+		header.key = key;
+
+		GLsizei length = 0;
+		GLenum format = 0;
+		extensions.GetProgramBinary(shader->id, size, &length, &format, binary.data());
+		header.format = format;
+		header.size = (uint32)length;
+
+		// Swapped in at the end like cooked textures, never a truncated binary under the real name.
+		std::string temporary = filename + ".tmp";
+
+		FILE* file = fopen(temporary.c_str(), "wb");
+		if (file == nullptr)
+			return;
+
+		bool success =
+			fwrite(&header, sizeof(header), 1, file) == 1 &&
+			fwrite(binary.data(), 1, (size_t)length, file) == (size_t)length;
+
+		success = fclose(file) == 0 && success;
+
+		if (success)
+		{
+			remove(filename.c_str());
+			success = rename(temporary.c_str(), filename.c_str()) == 0;
+		}
+
+		if (!success)
+			remove(temporary.c_str());
+	}
+
+	// The sources aren't needed once the program is linked, or failed to.
+	static void ShaderFreeSources(Shader* shader)
+	{
+		for (GLuint i = 0; i < shader->count; i++)
+		{
+			free(shader->texts[i]);
+			shader->texts[i] = nullptr;
+		}
+
+		free(shader->firstFilename);
+		shader->firstFilename = nullptr;
+	}
+
+	// Hands the stages and the link to the driver without asking how they went, that would
+	// wait for them. A cached binary links right away.
+	static void ShaderLinkBegin(Shader* shader)
+	{
+		if (shader->count == 0 || shader->linking || shader->linked)
+			return;
+
+		const GLExtensions& extensions = GetExtensions();
+		const std::string binaryFilename = ShaderGetBinaryFilename(shader);
+		shader->binaryKey = ShaderGetBinaryKey(shader);
+
+		shader->id = glCreateProgram();
+
+		if (ShaderLoadBinary(shader, binaryFilename, shader->binaryKey))
+		{
+			ShaderFreeSources(shader);
+			ShaderReflectUniforms(shader);
+			ShaderBindParameterBlocks(shader);
+			shader->linked = true;
+			return;
+		}
+
+		// Started over, a program the driver turned a binary down for is best not reused.
+		StateDeleteProgram(shader->id);
+		shader->id = glCreateProgram();
+
+		for (GLuint i = 0; i < shader->count; i++)
+		{
+			shader->sources[i] = glCreateShader(shader->types[i]);
+
+			const GLchar* source = shader->texts[i];
+			glShaderSource(shader->sources[i], 1, &source, nullptr);
+			glCompileShader(shader->sources[i]);
+			glAttachShader(shader->id, shader->sources[i]);
+		}
+
+		if (extensions.ProgramParameteri != nullptr)
+			extensions.ProgramParameteri(shader->id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+		glLinkProgram(shader->id);
+		shader->linking = true;
+	}
+
+	// Whether ShaderLinkEnd would return without waiting. Without parallel compiles there's
+	// no telling, so it is never known to be done.
+	static bool ShaderLinkIsDone(const Shader* shader)
+	{
+		if (!shader->linking)
+			return true;
+
+		if (!GetExtensions().parallelShaderCompile)
+			return false;
+
+		GLint done = GL_FALSE;
+		glGetProgramiv(shader->id, GL_COMPLETION_STATUS_KHR, &done);
+		return done != GL_FALSE;
+	}
+
+	// Waits for the link when it isn't done and reports how it went.
+	static bool ShaderLinkEnd(Shader* shader)
+	{
+		if (!shader->linking)
+			return shader->linked;
+
+		shader->linking = false;
+
+		GLint success;
+		glGetProgramiv(shader->id, GL_LINK_STATUS, &success);
+
+		if (!success)
+		{
+			// The stage that failed says why, the link only says that one did.
+			bool compiled = true;
+			for (GLuint i = 0; i < shader->count; i++)
+			{
+				GLint stageSuccess = 0;
+				glGetShaderiv(shader->sources[i], GL_COMPILE_STATUS, &stageSuccess);
+
+				if (!stageSuccess)
+				{
+					char info[1024];
+					glGetShaderInfoLog(shader->sources[i], 1024, nullptr, info);
+					Message(info);
+					compiled = false;
+				}
+			}
+
+			if (compiled)
+			{
+				char info[1024];
+				glGetProgramInfoLog(shader->id, 1024, nullptr, info);
+				Message(info);
+			}
+
+			StateDeleteProgram(shader->id);
+			shader->id = 0;
+
+			for (int i = 0; i < shader->count; i++)
+				glDeleteShader(shader->sources[i]);
+
+			// Without stages another link has nothing to compile, the shader starts over.
+			ShaderFreeSources(shader);
+			shader->count = 0;
+			return false;
+		}
+
+		for (int i = 0; i < shader->count; i++)
+			glDeleteShader(shader->sources[i]);
+
+		ShaderWriteBinary(shader, ShaderGetBinaryFilename(shader), shader->binaryKey);
+		ShaderFreeSources(shader);
+		ShaderReflectUniforms(shader);
+		ShaderBindParameterBlocks(shader);
+		shader->linked = true;
+		return true;
+	}
+
+	bool ShaderLink(Shader* shader)
+	{
+		ShaderLinkBegin(shader);
+		return ShaderLinkEnd(shader);
+	}
+
+	ulong64 ShaderGetSourceKey(const Shader* shader)
+	{
+		return shader->sourceKey;
+	}
+
+	bool ShaderIsReady(const Shader* shader)
+	{
+		return shader->linked;
+	}
+
+	ShaderBatch* CreateShaderBatch()
+	{
+		ShaderBatch* batch = new ShaderBatch();
+		batch->start = GetTime();
+		return batch;
+	}
+
+	void ShaderBatchAdd(ShaderBatch* batch, Shader* shader)
+	{
+		ShaderLinkBegin(shader);
+
+		if (shader->linking)
+			batch->shaders.push_back(shader);
+	}
+
+	bool ShaderBatchUpdate(ShaderBatch* batch)
+	{
+		if (batch->shaders.empty())
+			return true;
+
+		auto done = std::remove_if(batch->shaders.begin(), batch->shaders.end(), [](Shader* shader)
+		{
+			if (!ShaderLinkIsDone(shader))
+				return false;
+
+			ShaderLinkEnd(shader);
+			return true;
+		});
+
+		batch->shaders.erase(done, batch->shaders.end());
+
+		// Without parallel compiles the driver may still be compiling on its own threads,
+		// but checking waits for it. One shader a call keeps that wait to one at a time.
+		if (!GetExtensions().parallelShaderCompile && !batch->shaders.empty())
+		{
+			ShaderLinkEnd(batch->shaders.front());
+			batch->shaders.erase(batch->shaders.begin());
+		}
+
+		if (!batch->shaders.empty())
+			return false;
+
+		Message("Shaders ready in %.2f s\n", GetTime() - batch->start);
+		batch->start = GetTime();
+		return true;
+	}
+
+	void ShaderBatchFinish(ShaderBatch* batch)
+	{
+		for (Shader* shader : batch->shaders)
+			ShaderLinkEnd(shader);
+
+		batch->shaders.clear();
+	}
+
+	void ShaderSetVar(const Shader* shader, uint32 nameHash, const Vector2& value)
+	{
+		GLint location = ShaderFindUniform(shader, nameHash);
+		glUniform2fv(location, 1, glm::value_ptr(value));
+	}
+
+	void ShaderSetVar(const Shader* shader, uint32 nameHash, const Vector3& value)
+	{
+		GLint location = ShaderFindUniform(shader, nameHash);
+		glUniform3fv(location, 1, glm::value_ptr(value));
+	}
+
+	void ShaderSetVar(const Shader* shader, uint32 nameHash, const Vector4& value)
+	{
+		GLint location = ShaderFindUniform(shader, nameHash);
+		glUniform4fv(location, 1, glm::value_ptr(value));
+	}
+
+	void ShaderSetVar(const Shader* shader, uint32 nameHash, const Matrix4& value)
+	{
+		GLint location = ShaderFindUniform(shader, nameHash);
+		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+
+	void ShaderSetVar(const Shader* shader, uint32 nameHash, float value)
+	{
+		GLint location = ShaderFindUniform(shader, nameHash);
+		glUniform1f(location, value);
+	}
+
+	void ShaderSetVar(const Shader* shader, uint32 nameHash, int value)
+	{
+		GLint location = ShaderFindUniform(shader, nameHash);
+		glUniform1i(location, value);
+	}
+
+	void ShaderSetVar(const Shader* shader, const char* name, const Vector2& value)
+	{
+		ShaderSetVar(shader, HashString(name), value);
+	}
+
+	void ShaderSetVar(const Shader* shader, const char* name, const Vector3& value)
+	{
+		ShaderSetVar(shader, HashString(name), value);
+	}
+
+	void ShaderSetVar(const Shader* shader, const char* name, const Vector4& value)
+	{
+		ShaderSetVar(shader, HashString(name), value);
+	}
+
+	void ShaderSetVar(const Shader* shader, const char* name, const Matrix4& value)
+	{
+		ShaderSetVar(shader, HashString(name), value);
+	}
+
+	void ShaderSetVar(const Shader* shader, const char* name, float value)
+	{
+		ShaderSetVar(shader, HashString(name), value);
+	}
+
+	void ShaderSetVar(const Shader* shader, const char* name, int value)
+	{
+		ShaderSetVar(shader, HashString(name), value);
+	}
+
+	static bool ParameterBlockBindingIsTaken(GLuint binding)
+	{
+		for (const auto& pair : parameterBlockBindings)
+		{
+			if (pair.second == binding)
+				return true;
+		}
+
+		return false;
+	}
+
+	ParameterBlock* CreateParameterBlock(const Shader* shader, const char* name)
+	{
+		const GLuint index = glGetUniformBlockIndex(shader->id, name);
+		if (index == GL_INVALID_INDEX)
+		{
+			Message("[ERROR] Shader has no uniform block %s\n", name);
+			return nullptr;
+		}
+
+		GLint size = 0, count = 0;
+		glGetActiveUniformBlockiv(shader->id, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+		glGetActiveUniformBlockiv(shader->id, index, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &count);
+
+		std::vector<GLint> indices((size_t)count);
+		std::vector<GLint> offsets((size_t)count), sizes((size_t)count), strides((size_t)count);
+		glGetActiveUniformBlockiv(shader->id, index, GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES, indices.data());
+		glGetActiveUniformsiv(shader->id, count, (const GLuint*)indices.data(), GL_UNIFORM_OFFSET, offsets.data());
+		glGetActiveUniformsiv(shader->id, count, (const GLuint*)indices.data(), GL_UNIFORM_SIZE, sizes.data());
+		glGetActiveUniformsiv(shader->id, count, (const GLuint*)indices.data(), GL_UNIFORM_ARRAY_STRIDE, strides.data());
+
+		uint32 entryCount = 0;
+		for (GLint i = 0; i < count; i++)
+			entryCount += (uint32)sizes[i] + 1;
+
+		ParameterBlock* block = (ParameterBlock*)malloc(sizeof(ParameterBlock));
+		*block = {};
+		block->nameHash = HashString(name);
+		block->size = (uint32)size;
+		block->data = (unsigned char*)calloc(1, (size_t)size);
+		block->members = UniformTableAllocate(entryCount, &block->memberCapacity);
+
+		// Members go by their name inside the block, "lights[1].color" rather than "UScene.lights[1].color".
+		const std::string prefix = std::string(name) + ".";
+		GLint maxLength = 0;
+		glGetProgramiv(shader->id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<char> memberName((size_t)maxLength + 1);
+
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			glGetActiveUniformName(shader->id, (GLuint)indices[i], (GLsizei)memberName.size(), &length, memberName.data());
+
+			std::string member(memberName.data(), (size_t)length);
+			if (member.compare(0, prefix.size(), prefix) == 0)
+				member.erase(0, prefix.size());
+
+			UniformTableInsert(block->members, block->memberCapacity, member.c_str(), offsets[i]);
+
+			const size_t bracket = member.size() > 3 ? member.size() - 3 : std::string::npos;
+			if (bracket == std::string::npos || member.compare(bracket, 3, "[0]") != 0)
+				continue;
+
+			const std::string base = member.substr(0, bracket);
+			UniformTableInsert(block->members, block->memberCapacity, base.c_str(), offsets[i]);
+
+			for (GLint element = 1; element < sizes[i]; element++)
+			{
+				const std::string elementName = base + "[" + std::to_string(element) + "]";
+				UniformTableInsert(block->members, block->memberCapacity, elementName.c_str(), offsets[i] + element * strides[i]);
+			}
+		}
+
+		// The lowest binding point no other block holds.
+		GLuint binding = 1;
+		while (ParameterBlockBindingIsTaken(binding))
+			binding++;
+
+		block->binding = binding;
+		parameterBlockBindings[block->nameHash] = binding;
+		glUniformBlockBinding(shader->id, index, binding);
+
+		glGenBuffers(1, &block->buffer);
+		StateBindBuffer(GL_UNIFORM_BUFFER, block->buffer);
+		glBufferData(GL_UNIFORM_BUFFER, size, block->data, GL_DYNAMIC_DRAW);
+		StateBindBuffer(GL_UNIFORM_BUFFER, 0);
+		StateBindBufferBase(GL_UNIFORM_BUFFER, binding, block->buffer);
+
+		return block;
+	}
+
+	// Copies value in and widens the dirty range, unless it is what the block already holds.
+	static void ParameterBlockWrite(ParameterBlock* block, uint32 nameHash, const void* value, uint32 size)
+	{
+		const GLint offset = UniformTableFind(block->members, block->memberCapacity, nameHash);
+		if (offset < 0 || (uint32)offset + size > block->size)
+			return;
+
+		unsigned char* destination = block->data + offset;
+		if (memcmp(destination, value, size) == 0)
+			return;
+
+		memcpy(destination, value, size);
+
+		if (block->dirtyEnd == 0)
+		{
+			block->dirtyBegin = (uint32)offset;
+			block->dirtyEnd = (uint32)offset + size;
+		}
+		else
+		{
+			block->dirtyBegin = Min(block->dirtyBegin, (uint32)offset);
+			block->dirtyEnd = Max(block->dirtyEnd, (uint32)offset + size);
+		}
+	}
+
+	void ParameterBlockSet(ParameterBlock* block, uint32 nameHash, const Vector2& value)
+	{
+		ParameterBlockWrite(block, nameHash, glm::value_ptr(value), sizeof(Vector2));
+	}
+
+	void ParameterBlockSet(ParameterBlock* block, uint32 nameHash, const Vector3& value)
+	{
+		ParameterBlockWrite(block, nameHash, glm::value_ptr(value), sizeof(Vector3));
+	}
+
+	void ParameterBlockSet(ParameterBlock* block, uint32 nameHash, const Vector4& value)
+	{
+		ParameterBlockWrite(block, nameHash, glm::value_ptr(value), sizeof(Vector4));
+	}
+
+	// std140 lays a mat4 out as four vec4 columns, exactly like glm keeps it.
+	void ParameterBlockSet(ParameterBlock* block, uint32 nameHash, const Matrix4& value)
+	{
+		ParameterBlockWrite(block, nameHash, glm::value_ptr(value), sizeof(Matrix4));
+	}
+
+	void ParameterBlockSet(ParameterBlock* block, uint32 nameHash, float value)
+	{
+		ParameterBlockWrite(block, nameHash, &value, sizeof(value));
+	}
+
+	void ParameterBlockSet(ParameterBlock* block, uint32 nameHash, int value)
+	{
+		ParameterBlockWrite(block, nameHash, &value, sizeof(value));
+	}
+
+	void ParameterBlockSet(ParameterBlock* block, const char* name, const Vector2& value)
+	{
+		ParameterBlockSet(block, HashString(name), value);
+	}
+
+	void ParameterBlockSet(ParameterBlock* block, const char* name, const Vector3& value)
+	{
+		ParameterBlockSet(block, HashString(name), value);
+	}
+
+	void ParameterBlockSet(ParameterBlock* block, const char* name, const Vector4& value)
+	{
+		ParameterBlockSet(block, HashString(name), value);
+	}
+
+	void ParameterBlockSet(ParameterBlock* block, const char* name, const Matrix4& value)
+	{
+		ParameterBlockSet(block, HashString(name), value);
+	}
+
+	void ParameterBlockSet(ParameterBlock* block, const char* name, float value)
+	{
+		ParameterBlockSet(block, HashString(name), value);
+	}
+
+	void ParameterBlockSet(ParameterBlock* block, const char* name, int value)
+	{
+		ParameterBlockSet(block, HashString(name), value);
+	}
+
+	void ParameterBlockFlush(ParameterBlock* block)
+	{
+		if (block->dirtyEnd == 0)
+			return;
+
+		StateBindBuffer(GL_UNIFORM_BUFFER, block->buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, block->dirtyBegin, block->dirtyEnd - block->dirtyBegin, block->data + block->dirtyBegin);
+		StateBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		block->dirtyBegin = 0;
+		block->dirtyEnd = 0;
+	}
+
+	static void MeshUploadBuffers(Mesh* mesh,
+		const void* vertices, uint32 vertexCount, VertexFormat format,
+		const Vector3& boundsMin, const Vector3& boundsMax,
+		const void* indices, uint32 indexCount, GLenum indexType)
+	{
+		GLsizei stride = VertexFormatGetStride(format);
+
+		glGenVertexArrays(1, &mesh->vertexArray);
+		StateBindVertexArray(mesh->vertexArray);
+		
+		glGenBuffers(1, &mesh->vertexBuffer);
+		StateBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
+		StagingUploadBuffer(GL_ARRAY_BUFFER, vertices, (ulong64)stride * vertexCount);
+		mesh->bufferSize = (ulong64)stride * vertexCount;
+
+		if (indices != nullptr && indexCount > 0)
+		{
+			GLsizeiptr indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+
+			glGenBuffers(1, &mesh->indexBuffer);
+			StateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indexBuffer);
+			StagingUploadBuffer(GL_ELEMENT_ARRAY_BUFFER, indices, (ulong64)indexSize * indexCount);
+			mesh->bufferSize += (ulong64)indexSize * indexCount;
+		}
+
+		switch (format)
+		{
+		case VertexFormat::Float:
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, nullptr);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void *)offsetof(Vertex, normal));
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void *)offsetof(Vertex, texcoord));
+			break;
+
+		case VertexFormat::PackedOctahedral:
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, nullptr);
+			glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void *)8);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void *)12);
+			break;
+
+		case VertexFormat::Packed1010102:
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, nullptr);
+			glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void *)8);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void *)12);
+			break;
+		}
+
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+		glEnableVertexAttribArray(2);
+
+		StateBindVertexArray(0);
+
+		mesh->vertexCount = vertexCount;
+		mesh->indexCount = indexCount;
+		mesh->indexType = indexType;
+		mesh->vertexFormat = format;
+
+		mesh->center = (boundsMin + boundsMax) * 0.5f;
+		mesh->radius = Magnitude(boundsMax - boundsMin) * 0.5f;
+
+		if (format == VertexFormat::Float)
+		{
+			mesh->quantScale = Vector3(1.0f);
+			mesh->quantOffset = Vector3(0.0f);
+		}
+		else
+		{
+			mesh->quantScale = boundsMax - boundsMin;
+			mesh->quantOffset = boundsMin;
+		}
+	}
+
+	static void MeshSetClusters(Mesh* mesh, const MeshCluster* clusters, uint32 clusterCount)
+	{
+		free(mesh->clusters);
+		mesh->clusters = nullptr;
+		mesh->clusterCount = 0;
+
+		if (clusters == nullptr || clusterCount == 0)
+			return;
+
+		mesh->clusters = (MeshCluster*)malloc(sizeof(MeshCluster) * clusterCount);
+		mesh->clusterCount = clusterCount;
+		memcpy(mesh->clusters, clusters, sizeof(MeshCluster) * clusterCount);
+	}
+
+	static void MeshSetLods(Mesh* mesh, const MeshLod* lods, uint32 lodCount)
+	{
+		free(mesh->lods);
+		mesh->lods = nullptr;
+		mesh->lodCount = 0;
+
+		if (lods == nullptr || lodCount == 0)
+			return;
+
+		mesh->lods = (MeshLod*)malloc(sizeof(MeshLod) * lodCount);
+		mesh->lodCount = lodCount;
+		memcpy(mesh->lods, lods, sizeof(MeshLod) * lodCount);
+
+		mesh->indexCount = lods[0].indexCount;
+	}
+
+	static void MeshFreeMaterials(Mesh* mesh)
+	{
+		for (uint32 i = 0; i < mesh->textureCount; i++)
+		{
+			if (mesh->resourceCache != nullptr)
+			{
+				ResourceCacheRelease(mesh->resourceCache, mesh->textures[i]);
+				continue;
+			}
+
+			if (mesh->textureStreamer != nullptr)
+				TextureStreamerRemove(mesh->textureStreamer, mesh->textures[i]);
+
+			Dispose(mesh->textures[i]);
+		}
+
+		if (mesh->textureArrayCount > 0)
+			StateDeleteTextures(mesh->textureArrayCount, mesh->textureArrays);
+
+		// The attribute reading it is only enabled while bind groups draw.
+		if (mesh->layerBuffer != 0)
+			StateDeleteBuffers(1, &mesh->layerBuffer);
+
+		if (mesh->drawBuffer != 0)
+			StateDeleteBuffers(1, &mesh->drawBuffer);
+
+		free(mesh->submeshes);
+		free(mesh->submeshCenters);
+		free(mesh->materials);
+		free(mesh->materialSamplers);
+		free(mesh->textures);
+		free(mesh->textureArrays);
+		free(mesh->materialLayers);
+		free(mesh->bindGroups);
+		free(mesh->draws);
+
+		mesh->submeshes = nullptr;
+		mesh->submeshCount = 0;
+		mesh->submeshCenters = nullptr;
+		mesh->materials = nullptr;
+		mesh->materialSamplers = nullptr;
+		mesh->materialCount = 0;
+		mesh->textures = nullptr;
+		mesh->textureCount = 0;
+		mesh->textureStreamer = nullptr;
+		mesh->resourceCache = nullptr;
+		mesh->textureArrays = nullptr;
+		mesh->textureArrayCount = 0;
+		mesh->textureArraySize = 0;
+		mesh->materialLayers = nullptr;
+		mesh->bindGroups = nullptr;
+		mesh->bindGroupCount = 0;
+		mesh->draws = nullptr;
+		mesh->drawCount = 0;
+		mesh->layerBuffer = 0;
+		mesh->drawBuffer = 0;
+	}
+
+	static void MeshSetTextureArrays(Mesh* mesh, const MeshTexture* textures, const std::vector<MeshTextureSource>& sources);
+
+	// Material textures are only cooked when the mesh is, MeshUploadData on its own never writes files.
+	static TextureLoadSettings MeshTextureSettings(const MeshLoadSettings& settings)
+	{
+		TextureLoadSettings textureSettings = {};
+		textureSettings.cache = settings.cache;
+		textureSettings.compression = settings.textureCompression;
+		return textureSettings;
+	}
+
+	// Clusters never cross from one submesh into the next, the bounds of a submesh are the
+	// bounds of the cluster spheres that start in its range. Needs the clusters set first.
+	static void MeshSetSubmeshCenters(Mesh* mesh)
+	{
+		const uint32 submeshCount = mesh->submeshCount;
+		mesh->submeshCenters = (Vector3*)malloc(sizeof(Vector3) * submeshCount);
+
+		std::vector<Vector3> boundsMin(submeshCount, Vector3(FLT_MAX));
+		std::vector<Vector3> boundsMax(submeshCount, Vector3(-FLT_MAX));
+
+		// Submeshes by where they start, a cluster is in the last one starting at or before it.
+		std::vector<uint32> order(submeshCount);
+		for (uint32 i = 0; i < submeshCount; i++)
+			order[i] = i;
+
+		std::sort(order.begin(), order.end(), [mesh](uint32 a, uint32 b)
+		{
+			return mesh->submeshes[a].indexOffset < mesh->submeshes[b].indexOffset;
+		});
+
+		for (uint32 i = 0; i < mesh->clusterCount; i++)
+		{
+			const MeshCluster& cluster = mesh->clusters[i];
+
+			auto after = std::upper_bound(order.begin(), order.end(), cluster.indexOffset, [mesh](uint32 offset, uint32 submesh)
+			{
+				return offset < mesh->submeshes[submesh].indexOffset;
+			});
+
+			if (after == order.begin())
+				continue;
+
+			const uint32 submesh = *(after - 1);
+			if (cluster.indexOffset >= mesh->submeshes[submesh].indexOffset + mesh->submeshes[submesh].indexCount)
+				continue;
+
+			boundsMin[submesh] = Min(boundsMin[submesh], cluster.center - Vector3(cluster.radius));
+			boundsMax[submesh] = Max(boundsMax[submesh], cluster.center + Vector3(cluster.radius));
+		}
+
+		for (uint32 i = 0; i < submeshCount; i++)
+		{
+			const bool found = boundsMin[i].x <= boundsMax[i].x;
+			mesh->submeshCenters[i] = found ? (boundsMin[i] + boundsMax[i]) * 0.5f : mesh->center;
+		}
+	}
+
+	static void MeshSetMaterials(Mesh* mesh,
+		const MeshSubmesh* submeshes, uint32 submeshCount, uint32 lodCount,
+		const MeshMaterial* materials, uint32 materialCount,
+		const MeshTexture* textures, uint32 textureCount, const MeshLoadSettings& meshSettings)
+	{
+		MeshFreeMaterials(mesh);
+
+		if (submeshes == nullptr || submeshCount == 0)
+			return;
+
+		size_t tableCount = (size_t)submeshCount * (lodCount > 0 ? lodCount : 1);
+		mesh->submeshes = (MeshSubmesh*)malloc(sizeof(MeshSubmesh) * tableCount);
+		mesh->submeshCount = submeshCount;
+		memcpy(mesh->submeshes, submeshes, sizeof(MeshSubmesh) * tableCount);
+		MeshSetSubmeshCenters(mesh);
+
+		if (materialCount > 0)
+		{
+			mesh->materials = (MeshMaterial*)malloc(sizeof(MeshMaterial) * materialCount);
+			mesh->materialCount = materialCount;
+			memcpy(mesh->materials, materials, sizeof(MeshMaterial) * materialCount);
+		}
+
+		if (materialCount == 0 || textureCount == 0)
+			return;
+
+		// Every distinct texture the samplers need, a source takes the settings of the first
+		// sampler it is used by. Color is filtered in linear space and gets the color formats.
+		std::vector<MeshTextureSource> sources;
+		mesh->materialSamplers = (MeshMaterialSamplers*)malloc(sizeof(MeshMaterialSamplers) * materialCount);
+
+		for (uint32 i = 0; i < materialCount; i++)
+		{
+			const uint32* slots = materials[i].textures;
+
+			for (uint32 sampler = 0; sampler < (uint32)MaterialSampler::Count; sampler++)
+			{
+				MeshTextureSource source = { MeshNoTexture, MeshNoTexture, MeshNoTexture, MeshTextureSettings(meshSettings) };
+
+				switch ((MaterialSampler)sampler)
+				{
+				case MaterialSampler::Albedo:
+					source.image = slots[(int)MaterialTexture::Albedo];
+					source.settings.srgb = true;
+					break;
+
+				case MaterialSampler::Emission:
+					source.image = slots[(int)MaterialTexture::Emission];
+					source.settings.srgb = true;
+					break;
+
+				case MaterialSampler::Normal:
+					source.image = slots[(int)MaterialTexture::Normal];
+					source.settings.role = TextureRole::Normal;
+					break;
+
+				default:
+					source.roughness = slots[(int)MaterialTexture::Roughness];
+					source.metallic = slots[(int)MaterialTexture::Metallic];
+					break;
+				}
+
+				source.image = source.image < textureCount ? source.image : MeshNoTexture;
+				source.roughness = source.roughness < textureCount ? source.roughness : MeshNoTexture;
+				source.metallic = source.metallic < textureCount ? source.metallic : MeshNoTexture;
+
+				uint32 index = MeshNoTexture;
+				if (source.image != MeshNoTexture || source.roughness != MeshNoTexture || source.metallic != MeshNoTexture)
+				{
+					index = 0;
+					while (index < sources.size() && (sources[index].image != source.image ||
+						sources[index].roughness != source.roughness || sources[index].metallic != source.metallic))
+						index++;
+
+					if (index == sources.size())
+						sources.push_back(source);
+				}
+
+				mesh->materialSamplers[i].textures[sampler] = index;
+			}
+		}
+
+		if (sources.empty())
+			return;
+
+		TextureStreamer* textureStreamer = meshSettings.textureStreamer;
+		if (textureStreamer == nullptr && meshSettings.textureArrays)
+		{
+			MeshSetTextureArrays(mesh, textures, sources);
+			return;
+		}
+
+		mesh->textures = (Texture2D**)malloc(sizeof(Texture2D*) * sources.size());
+		mesh->textureCount = (uint32)sources.size();
+		mesh->textureStreamer = textureStreamer;
+		mesh->resourceCache = textureStreamer == nullptr ? meshSettings.resourceCache : nullptr;
+
+		TextureBatch* batch = textureStreamer == nullptr ? CreateTextureBatch() : nullptr;
+
+		for (uint32 i = 0; i < mesh->textureCount; i++)
+		{
+			const MeshTextureSource& source = sources[i];
+
+			const char* roughness = source.roughness != MeshNoTexture ? textures[source.roughness].path : nullptr;
+			const char* metallic = source.metallic != MeshNoTexture ? textures[source.metallic].path : nullptr;
+
+			// Textures the cache already has, from this mesh or any other, aren't added to the batch again.
+			if (mesh->resourceCache != nullptr)
+			{
+				mesh->textures[i] = source.image != MeshNoTexture ?
+					ResourceCacheLoadTexture2D(mesh->resourceCache, textures[source.image].path, source.settings, batch) :
+					ResourceCacheLoadOrmTexture2D(mesh->resourceCache, nullptr, roughness, metallic, source.settings, batch);
+				continue;
+			}
+
+			Texture2D* texture = mesh->textures[i] = CreateTexture2D();
+
+			if (source.image != MeshNoTexture && batch != nullptr)
+				TextureBatchAdd(batch, texture, textures[source.image].path, source.settings);
+			else if (source.image != MeshNoTexture)
+				TextureStreamerAdd(textureStreamer, texture, textures[source.image].path, source.settings);
+			else if (batch != nullptr)
+				TextureBatchAddOrm(batch, texture, nullptr, roughness, metallic, source.settings);
+			else
+				TextureStreamerAddOrm(textureStreamer, texture, nullptr, roughness, metallic, source.settings);
+		}
+
+		if (batch != nullptr)
+		{
+			TextureBatchFinish(batch);
+			Dispose(batch);
+		}
+	}
+
+	static void MeshUploadMeshData(Mesh* mesh, const MeshData* data, VertexFormat format, const MeshLoadSettings& settings)
+	{
+		MeshSetClusters(mesh, data->clusters, data->clusterCount);
+
+		std::vector<char> packed((size_t)VertexFormatGetStride(format) * data->vertexCount);
+		MeshDataPackVertices(data, format, packed.data());
+
+		if (data->indices != nullptr && data->indexCount > 0 && data->vertexCount <= 0x10000)
+		{
+			std::vector<ushort16> shortIndices(data->indices, data->indices + data->indexCount);
+			MeshUploadBuffers(mesh, packed.data(), data->vertexCount, format, data->boundsMin, data->boundsMax,
+				shortIndices.data(), data->indexCount, GL_UNSIGNED_SHORT);
+		}
+		else
+		{
+			MeshUploadBuffers(mesh, packed.data(), data->vertexCount, format, data->boundsMin, data->boundsMax,
+				data->indices, data->indexCount, GL_UNSIGNED_INT);
+		}
+
+		MeshSetLods(mesh, data->lods, data->lodCount);
+		MeshSetMaterials(mesh,
+			data->submeshes, data->submeshCount, data->lodCount,
+			data->materials, data->materialCount,
+			data->textures, data->textureCount, settings);
+	}
+
+	static std::string MeshCookedFilename(const char* filename)
+	{
+		std::string cooked(filename);
+
+		size_t extension = cooked.find_last_of('.');
+		size_t separator = cooked.find_last_of("/\\");
+
+		if (extension != std::string::npos && (separator == std::string::npos || extension > separator))
+			cooked.erase(extension);
+
+		return cooked + ".gfxlmesh";
+	}
+
+	void MeshLoadFromModelFile(Mesh* mesh, const char * filename, const MeshLoadSettings& settings)
+	{
+		std::string cookedFilename = MeshCookedFilename(filename);
+
+		if (settings.cache || settings.stream)
+		{
+			double start = GetTime();
+
+			CookedMesh cooked;
+			bool opened = CookedMeshOpen(&cooked, cookedFilename.c_str(), filename, settings);
+
+			// Streamed models only ever exist in their cooked form, a stale one is streamed again.
+			if (!opened && settings.stream)
+			{
+				opened = MeshStreamObjToCooked(filename, cookedFilename.c_str(), settings) &&
+					CookedMeshOpen(&cooked, cookedFilename.c_str(), filename, settings);
+			}
+
+			if (opened)
+			{
+				MeshUploadBuffers(mesh,
+					cooked.vertices, cooked.vertexCount, cooked.vertexFormat,
+					cooked.boundsMin, cooked.boundsMax,
+					cooked.indices, cooked.indexCount,
+					cooked.indexSize == sizeof(GLushort) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+
+				MeshSetClusters(mesh, cooked.clusters, cooked.clusterCount);
+				MeshSetLods(mesh, cooked.lods, cooked.lodCount);
+				MeshSetMaterials(mesh,
+					cooked.submeshes, cooked.submeshCount, cooked.lodCount,
+					cooked.materials, cooked.materialCount,
+					cooked.textures, cooked.textureCount, settings);
+
+				Message("Loaded %s from %s in %.2f ms\n",
+					filename, cookedFilename.c_str(), (GetTime() - start) * 1000.0);
+
+				CookedMeshClose(&cooked);
+				return;
+			}
+
+			if (settings.stream)
+				return;
+		}
+
+		MeshData* data = CreateMeshData();
+
+		if (MeshDataLoadFromObjFile(data, filename))
+		{
+			if (settings.optimize)
+				MeshDataOptimize(data);
+
+			if (settings.clusters)
+				MeshDataBuildClusters(data);
+
+			if (settings.lodCount > 1)
+				MeshDataBuildLods(data, settings.lodCount);
+
+			MeshUploadMeshData(mesh, data, settings.vertexFormat, settings);
+
+			if (settings.cache && !MeshDataWriteCooked(data, cookedFilename.c_str(), filename, settings))
+				Message("[ERROR] Failed to write cooked mesh %s\n", cookedFilename.c_str());
+		}
+
+		Dispose(data);
+	}
+
+	void MeshUploadData(Mesh* mesh,
+		const Vertex* vertices, uint32 vertexCount,
+		const uint32* indices, uint32 indexCount)
+	{
+		Vector3 boundsMin(0.0f);
+		Vector3 boundsMax(0.0f);
+
+		if (vertexCount > 0)
+		{
+			boundsMin = boundsMax = vertices[0].position;
+
+			for (uint32 i = 1; i < vertexCount; i++)
+			{
+				boundsMin = Min(boundsMin, vertices[i].position);
+				boundsMax = Max(boundsMax, vertices[i].position);
+			}
+		}
+
+		// Halve the index bandwidth whenever every vertex can be addressed with 16 bits.
+		if (indices != nullptr && indexCount > 0 && vertexCount <= 0x10000)
+		{
+			std::vector<ushort16> shortIndices(indices, indices + indexCount);
+			MeshUploadBuffers(mesh, vertices, vertexCount, VertexFormat::Float, boundsMin, boundsMax,
+				shortIndices.data(), indexCount, GL_UNSIGNED_SHORT);
+			return;
+		}
+
+		MeshUploadBuffers(mesh, vertices, vertexCount, VertexFormat::Float, boundsMin, boundsMax,
+			indices, indexCount, GL_UNSIGNED_INT);
+	}
+
+	void MeshUploadData(Mesh* mesh, const MeshData* data, VertexFormat format)
+	{
+		MeshUploadMeshData(mesh, data, format, {});
+	}
+
+	ulong64 MeshGetMemorySize(const Mesh* mesh)
+	{
+		ulong64 size = mesh->bufferSize + mesh->textureArraySize;
+
+		if (mesh->resourceCache == nullptr)
+		{
+			for (uint32 i = 0; i < mesh->textureCount; i++)
+				size += mesh->textures[i]->memorySize;
+		}
+
+		return size;
+	}
+
+	void CameraUpdate(Camera* camera)
+	{
+		if (!camera->impl->uniformBuffer)
+		{
+			uint32 size = sizeof(Matrix4) * 2 + sizeof(Vector3);
+
+			glGenBuffers(1, &camera->impl->uniformBuffer);
+			StateBindBuffer(GL_UNIFORM_BUFFER, camera->impl->uniformBuffer);
+			glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+			StateBindBuffer(GL_UNIFORM_BUFFER, 0);
+			StateBindBufferRange(GL_UNIFORM_BUFFER, 0, camera->impl->uniformBuffer, 0, size);
+		}
+
+		StateBindBuffer(GL_UNIFORM_BUFFER, camera->impl->uniformBuffer);
+
+		Matrix4 view = glm::lookAt(camera->position, camera->lookAt, Vector3(0, 1, 0));
+		
+		glBufferSubData(
+			GL_UNIFORM_BUFFER,
+			0,
+			sizeof(Matrix4),
+			glm::value_ptr(view));
+
+		glBufferSubData(
+			GL_UNIFORM_BUFFER,
+			sizeof(Matrix4),
+			sizeof(Matrix4),
+			glm::value_ptr(camera->impl->projection));
+
+		glBufferSubData(
+			GL_UNIFORM_BUFFER,
+			sizeof(Matrix4) * 2,
+			sizeof(Vector3),
+			glm::value_ptr(camera->position));
+
+		StateBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	void CameraSetToPerspective(Camera* camera, float fov, float aspectRatio, float nearPlane, float farPlane)
+	{
+		camera->impl->projection = glm::perspective(fov, aspectRatio, nearPlane, farPlane);
+	}
+
+	struct GLTextureFormat
+	{
+		GLenum internalFormat;
+
+		// Zero for compressed formats.
+		GLenum format;
+	};
+
+	static GLTextureFormat GetGLTextureFormat(TextureFormat format)
+	{
+		switch (format)
+		{
+		case TextureFormat::R8:
+			return { GL_R8, GL_RED };
+
+		case TextureFormat::BC1:
+			return { GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 0 };
+
+		case TextureFormat::BC3:
+			return { GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 0 };
+
+		case TextureFormat::BC4:
+			return { GL_COMPRESSED_RED_RGTC1, 0 };
+
+		case TextureFormat::BC5:
+			return { GL_COMPRESSED_RG_RGTC2, 0 };
+
+		case TextureFormat::BC7:
+			return { GL_COMPRESSED_RGBA_BPTC_UNORM, 0 };
+
+		default:
+			return { GL_RGBA8, GL_RGBA };
+		}
+	}
+
+	// The pixels of a batch image, wherever they ended up.
+	struct TextureImage
+	{
+		TextureFormat format;
+		uint32 width;
+		uint32 height;
+
+		const TextureLevel* levels;
+		uint32 levelCount;
+
+		const unsigned char* pixels;
+	};
+
+	static ulong64 TextureImageGetSize(const TextureImage& image)
+	{
+		ulong64 size = 0;
+		for (uint32 i = 0; i < image.levelCount; i++)
+			size += image.levels[i].size;
+
+		return size;
+	}
+
+	// Copies level into the ring and binds it as the unpack buffer, the pointer returned is an
+	// offset into it. Unless the level doesn't fit, then it is read straight from the image.
+	static const unsigned char* TextureStageLevel(const TextureImage& image, const TextureLevel& level)
+	{
+		const unsigned char* pixels = image.pixels + level.offset;
+
+		StagingAllocation allocation;
+		if (StagingAllocate(level.size, &allocation))
+		{
+			StagingWrite(allocation, pixels);
+			StateBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer);
+			pixels = (const unsigned char*)(size_t)allocation.offset;
+		}
+
+		return pixels;
+	}
+
+	// target is GL_TEXTURE_2D or a cubemap face. With immutable storage every level was
+	// allocated up front and is only filled in here.
+	static void TextureUploadLevels(GLenum target, const TextureImage& image, bool immutable)
+	{
+		const GLTextureFormat glFormat = GetGLTextureFormat(image.format);
+		const bool compressed = TextureFormatIsCompressed(image.format);
+
+		// R8 rows are tightly packed.
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		for (uint32 i = 0; i < image.levelCount; i++)
+		{
+			const TextureLevel& level = image.levels[i];
+			const unsigned char* pixels = TextureStageLevel(image, level);
+
+			if (compressed && immutable)
+				glCompressedTexSubImage2D(target, i, 0, 0, level.width, level.height, glFormat.internalFormat, (GLsizei)level.size, pixels);
+			else if (compressed)
+				glCompressedTexImage2D(target, i, glFormat.internalFormat, level.width, level.height, 0, (GLsizei)level.size, pixels);
+			else if (immutable)
+				glTexSubImage2D(target, i, 0, 0, level.width, level.height, glFormat.format, GL_UNSIGNED_BYTE, pixels);
+			else
+				glTexImage2D(target, i, glFormat.internalFormat, level.width, level.height, 0, glFormat.format, GL_UNSIGNED_BYTE, pixels);
+
+			StateBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+
+	static void TextureSetParameters(GLenum target, const TextureImage& image)
+	{
+		glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, image.levelCount - 1);
+		glTexParameteri(target, GL_TEXTURE_MIN_FILTER, image.levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+		// Single channel formats sample like the RGBA8 image they came from.
+		if (image.format == TextureFormat::R8 || image.format == TextureFormat::BC4)
+		{
+			const GLint swizzle[] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+			glTexParameteriv(target, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+		}
+	}
+
+	// Uploads every level as is. Immutable storage when the driver has it, so the texture is
+	// complete from the start and the driver never has to guess at the rest of the chain.
+	static void Texture2DUpload(Texture2D* texture, const TextureImage& image)
+	{
+		const GLExtensions& extensions = GetExtensions();
+		const bool immutable = extensions.TexStorage2D != nullptr;
+
+		glGenTextures(1, &texture->id);
+		StateBindTextureForEdit(GL_TEXTURE_2D, texture->id);
+
+		texture->width = (int)image.width;
+		texture->height = (int)image.height;
+		texture->memorySize = TextureImageGetSize(image);
+
+		if (immutable)
+		{
+			extensions.TexStorage2D(GL_TEXTURE_2D, image.levelCount, GetGLTextureFormat(image.format).internalFormat,
+				image.width, image.height);
+		}
+
+		TextureUploadLevels(GL_TEXTURE_2D, image, immutable);
+		TextureSetParameters(GL_TEXTURE_2D, image);
+
+		StateBindTexture(0, GL_TEXTURE_2D, 0);
+	}
+
+	// layers must all match in format, size and level count. Every layer goes up level by
+	// level into its slice, through the staging ring like any other texture.
+	static GLuint TextureArrayUpload(const TextureImage* layers, uint32 layerCount)
+	{
+		const GLExtensions& extensions = GetExtensions();
+		const TextureImage& first = layers[0];
+		const GLTextureFormat glFormat = GetGLTextureFormat(first.format);
+		const bool compressed = TextureFormatIsCompressed(first.format);
+
+		GLuint id;
+		glGenTextures(1, &id);
+		StateBindTextureForEdit(GL_TEXTURE_2D_ARRAY, id);
+
+		if (extensions.TexStorage3D != nullptr)
+		{
+			extensions.TexStorage3D(GL_TEXTURE_2D_ARRAY, first.levelCount, glFormat.internalFormat,
+				first.width, first.height, layerCount);
+		}
+		else
+		{
+			for (uint32 i = 0; i < first.levelCount; i++)
+			{
+				const TextureLevel& level = first.levels[i];
+
+				if (compressed)
+				{
+					glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, glFormat.internalFormat, level.width, level.height,
+						layerCount, 0, (GLsizei)(level.size * layerCount), nullptr);
+				}
+				else
+				{
+					glTexImage3D(GL_TEXTURE_2D_ARRAY, i, glFormat.internalFormat, level.width, level.height,
+						layerCount, 0, glFormat.format, GL_UNSIGNED_BYTE, nullptr);
+				}
+			}
+		}
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		for (uint32 layer = 0; layer < layerCount; layer++)
+		{
+			for (uint32 i = 0; i < first.levelCount; i++)
+			{
+				const TextureLevel& level = layers[layer].levels[i];
+				const unsigned char* pixels = TextureStageLevel(layers[layer], level);
+
+				if (compressed)
+				{
+					glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, level.width, level.height, 1,
+						glFormat.internalFormat, (GLsizei)level.size, pixels);
+				}
+				else
+				{
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, level.width, level.height, 1,
+						glFormat.format, GL_UNSIGNED_BYTE, pixels);
+				}
+
+				StateBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+		}
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		TextureSetParameters(GL_TEXTURE_2D_ARRAY, first);
+		StateBindTexture(0, GL_TEXTURE_2D_ARRAY, 0);
+		return id;
+	}
+
+	void Texture2DFromImageFile(Texture2D* texture, const char * filename, const TextureLoadSettings& settings)
+	{
+		TextureBatch* batch = CreateTextureBatch();
+		TextureBatchAdd(batch, texture, filename, settings);
+		TextureBatchFinish(batch);
+		Dispose(batch);
+	}
+
+	void Texture2DFromOrmFiles(Texture2D* texture, const char* occlusion, const char* roughness, const char* metallic,
+		const TextureLoadSettings& settings)
+	{
+		TextureBatch* batch = CreateTextureBatch();
+		TextureBatchAddOrm(batch, texture, occlusion, roughness, metallic, settings);
+		TextureBatchFinish(batch);
+		Dispose(batch);
+	}
+
+	void Texture2DGetSize(const Texture2D* texture, int* width, int* height)
+	{
+		*width = texture->width;
+		*height = texture->height;
+	}
+
+	ulong64 Texture2DGetMemorySize(const Texture2D* texture)
+	{
+		return texture->memorySize;
+	}
+
+	// faces are ordered +X, -X, +Y, -Y, +Z, -Z and must all match in size and format.
+	static void CubemapUpload(Cubemap* cubemap, const TextureImage* faces)
+	{
+		const GLExtensions& extensions = GetExtensions();
+		const bool immutable = extensions.TexStorage2D != nullptr;
+
+		for (uint32 i = 1; i < 6; i++)
+		{
+			if (faces[i].format != faces[0].format || faces[i].width != faces[0].width ||
+				faces[i].height != faces[0].height || faces[i].levelCount != faces[0].levelCount)
+			{
+				Message("[ERROR] Cubemap faces differ in size or format\n");
+				return;
+			}
+		}
+
+		glGenTextures(1, &cubemap->id);
+		StateBindTextureForEdit(GL_TEXTURE_CUBE_MAP, cubemap->id);
+
+		if (immutable)
+		{
+			extensions.TexStorage2D(GL_TEXTURE_CUBE_MAP, faces[0].levelCount, GetGLTextureFormat(faces[0].format).internalFormat,
+				faces[0].width, faces[0].height);
+		}
+
+		for (uint32 i = 0; i < 6; i++)
+			TextureUploadLevels(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, faces[i], immutable);
+
+		TextureSetParameters(GL_TEXTURE_CUBE_MAP, faces[0]);
+		StateBindTexture(0, GL_TEXTURE_CUBE_MAP, 0);
+	}
+
+	void CubemapFromImageFiles(Cubemap* cubemap, const char* front, const char* back, const char* left, 
+		const char* right, const char* top, const char* bottom, const TextureLoadSettings& settings)
+	{
+		// Even on its own, a cubemap decodes its six faces in parallel.
+		TextureBatch* batch = CreateTextureBatch();
+		TextureBatchAdd(batch, cubemap, front, back, left, right, top, bottom, settings);
+		TextureBatchFinish(batch);
+		Dispose(batch);
+	}
+
+	static std::string TextureCookedFilename(const char* filename, const char* cookedExtension = ".gfxltex")
+	{
+		std::string cooked(filename);
+
+		size_t extension = cooked.find_last_of('.');
+		size_t separator = cooked.find_last_of("/\\");
+
+		if (extension != std::string::npos && (separator == std::string::npos || extension > separator))
+			cooked.erase(extension);
+
+		return cooked + cookedExtension;
+	}
+
+	// The specular cubemap starts at most this big, rougher levels don't need more.
+	static const uint32 EnvironmentSpecularSize = 128;
+
+	struct EnvironmentDecodeJob
+	{
+		const char* const* filenames;
+		TextureData** faces;
+	};
+
+	static void EnvironmentDecodeFace(uint32 index, void* userData)
+	{
+		const EnvironmentDecodeJob* job = (const EnvironmentDecodeJob*)userData;
+		TextureDataLoadFromImageFile(job->faces[index], job->filenames[index]);
+	}
+
+	void EnvironmentFromImageFiles(Environment* environment, const char* front, const char* back, const char* left,
+		const char* right, const char* top, const char* bottom, const TextureLoadSettings& settings)
+	{
+		double start = GetTime();
+
+		// GL face order, +X, -X, +Y, -Y, +Z, -Z.
+		const char* filenames[] = { right, left, top, bottom, back, front };
+		std::string cookedFilename = TextureCookedFilename(front, ".gfxlenv");
+
+		EnvironmentData* data = CreateEnvironmentData();
+		bool cooked = settings.cache &&
+			EnvironmentDataReadCooked(data, cookedFilename.c_str(), filenames, 6, settings, EnvironmentSpecularSize);
+		bool loaded = cooked;
+
+		if (!cooked)
+		{
+			TextureData* faces[6];
+			for (uint32 i = 0; i < 6; i++)
+				faces[i] = CreateTextureData();
+
+			EnvironmentDecodeJob job = { filenames, faces };
+			ParallelFor(6, EnvironmentDecodeFace, &job);
+
+			loaded = EnvironmentDataCompute(data, faces, settings.srgb, EnvironmentSpecularSize);
+
+			if (loaded && settings.cache)
+				EnvironmentDataWriteCooked(data, cookedFilename.c_str(), filenames, 6, settings, EnvironmentSpecularSize);
+
+			for (uint32 i = 0; i < 6; i++)
+				Dispose(faces[i]);
+		}
+
+		if (loaded)
+		{
+			memcpy(environment->irradiance, data->irradiance, sizeof(environment->irradiance));
+
+			TextureImage faces[6];
+			for (uint32 i = 0; i < 6; i++)
+			{
+				const TextureData* face = data->specular[i];
+				faces[i] = { face->format, face->width, face->height, face->levels, face->levelCount, face->pixels };
+			}
+
+			const TextureData* brdf = data->brdf;
+			const TextureImage brdfImage = { brdf->format, brdf->width, brdf->height, brdf->levels, brdf->levelCount, brdf->pixels };
+
+			// The rough levels are tiny, without seamless filtering every face edge would show.
+			glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+			CubemapUpload(&environment->specular, faces);
+			Texture2DUpload(&environment->brdf, brdfImage);
+			StagingFence();
+
+			environment->specularLevels = faces[0].levelCount;
+
+			Message("%s environment lighting from %s in %.2f ms\n", cooked ? "Loaded" : "Precomputed", front,
+				(GetTime() - start) * 1000.0);
+		}
+
+		Dispose(data);
+	}
+
+	// Runs on a worker thread, the GL is only touched once the batch is finished.
+	static void TextureBatchDecodeImage(TextureBatchImage* image)
+	{
+		std::string cookedFilename = TextureCookedFilename(image->filename.c_str());
+
+		const char* sources[4] = { image->filename.c_str() };
+		uint32 sourceCount = 1;
+
+		if (image->packed)
+		{
+			sourceCount = 0;
+			for (const std::string& channel : image->channelFilenames)
+			{
+				if (!channel.empty())
+					sources[sourceCount++] = channel.c_str();
+			}
+		}
+
+		if (image->settings.cache)
+		{
+			image->isCooked = CookedTextureOpen(&image->cooked, cookedFilename.c_str(),
+				sources, sourceCount, image->settings);
+
+			// Cooked for a driver with formats this one lacks, it is cooked again.
+			if (image->isCooked && !(image->supportedFormats & TextureFormatBit(image->cooked.format)))
+			{
+				CookedTextureClose(&image->cooked);
+				image->isCooked = false;
+			}
+
+			if (image->isCooked)
+				return;
+		}
+
+		if (image->packed)
+		{
+			const char* channels[4];
+			for (uint32 i = 0; i < 4; i++)
+				channels[i] = image->channelFilenames[i].empty() ? nullptr : image->channelFilenames[i].c_str();
+
+			if (!TextureDataLoadFromChannelFiles(image->data, channels, image->channelDefaults))
+				return;
+		}
+		else if (!TextureDataLoadFromImageFile(image->data, image->filename.c_str()))
+			return;
+
+		TextureDataBuildMips(image->data, image->settings.srgb);
+		TextureDataCompress(image->data, TextureChooseFormat(image->data, image->settings, image->supportedFormats));
+
+		if (image->settings.cache &&
+			!TextureDataWriteCooked(image->data, cookedFilename.c_str(), sources, sourceCount, image->settings))
+			Message("[ERROR] Failed to write cooked texture %s\n", cookedFilename.c_str());
+	}
+
+	static void TextureBatchDecode(void* userData)
+	{
+		TextureBatchImage* image = (TextureBatchImage*)userData;
+		TextureBatchDecodeImage(image);
+		image->ready.store(true, std::memory_order_release);
+	}
+
+	// images is any container that keeps its elements in place as it grows, a deque or a list.
+	template <typename Images>
+	static TextureBatchImage* TextureQueueDecode(WorkerGroup* group, Images& images,
+		const char* filename, const TextureLoadSettings& settings)
+	{
+		// Value initialized in place, the ready flag can't be copied.
+		images.emplace_back();
+
+		TextureBatchImage& image = images.back();
+		image.filename = filename;
+		image.settings = settings;
+		image.supportedFormats = GetExtensions().textureFormats;
+		image.data = CreateTextureData();
+
+		WorkerGroupSubmit(group, TextureBatchDecode, &image);
+		return &image;
+	}
+
+	// Cooked next to the first image as <name>_orm_<hash of every slot and path>, materials can
+	// share some of their images without sharing the packed texture. Without any image there
+	// is nothing to cook, the entry fails like an image that doesn't load.
+	template <typename Images>
+	static TextureBatchImage* TextureQueueDecodeOrm(WorkerGroup* group, Images& images,
+		const char* occlusion, const char* roughness, const char* metallic, const TextureLoadSettings& settings)
+	{
+		images.emplace_back();
+
+		TextureBatchImage& image = images.back();
+		image.settings = settings;
+		image.settings.srgb = false;
+		image.settings.role = TextureRole::Color;
+		image.supportedFormats = GetExtensions().textureFormats;
+		image.data = CreateTextureData();
+		image.packed = true;
+
+		const char* channels[] = { occlusion, roughness, metallic };
+		const unsigned char defaults[] = { 255, 255, 0, 255 };
+
+		ulong64 hash = HashData("orm", 3);
+		std::string first;
+
+		for (uint32 i = 0; i < 3; i++)
+		{
+			// The same image in another channel is another texture.
+			hash = HashData(&i, sizeof(i), hash);
+
+			if (channels[i] == nullptr)
+				continue;
+
+			image.channelFilenames[i] = channels[i];
+			hash = HashData(channels[i], strlen(channels[i]), hash);
+
+			if (first.empty())
+				first = TextureCookedFilename(channels[i]);
+		}
+
+		memcpy(image.channelDefaults, defaults, sizeof(defaults));
+
+		if (first.empty())
+		{
+			Message("[ERROR] ORM texture without an occlusion, roughness or metallic image\n");
+			image.ready.store(true, std::memory_order_release);
+			return &image;
+		}
+
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), "_orm_%08x", (uint32)(hash ^ (hash >> 32)));
+		image.filename = first.substr(0, first.size() - strlen(".gfxltex")) + suffix;
+
+		WorkerGroupSubmit(group, TextureBatchDecode, &image);
+		return &image;
+	}
+
+	static void TextureBatchQueue(TextureBatch* batch, const char* filename, const TextureLoadSettings& settings)
+	{
+		TextureQueueDecode(batch->group, batch->images, filename, settings);
+	}
+
+	static bool TextureBatchGetImage(const TextureBatchImage& batchImage, TextureImage* image)
+	{
+		if (batchImage.isCooked)
+		{
+			const CookedTexture& cooked = batchImage.cooked;
+			*image = { cooked.format, cooked.width, cooked.height, cooked.levels, cooked.levelCount, cooked.pixels };
+			return true;
+		}
+
+		const TextureData* data = batchImage.data;
+		*image = { data->format, data->width, data->height, data->levels, data->levelCount, data->pixels };
+		return data->pixels != nullptr;
+	}
+
+	static void TextureBatchImageFree(TextureBatchImage* image)
+	{
+		if (image->isCooked)
+			CookedTextureClose(&image->cooked);
+
+		// Images are freed as their entry uploads, so this runs again on freed ones.
+		if (image->data != nullptr)
+			Dispose(image->data);
+
+		image->data = nullptr;
+		image->isCooked = false;
+	}
+
+	// Decodes the textures like a batch, then packs every group of matching images in an
+	// array, splitting groups bigger than the GL allows. Materials that end up with the
+	// same arrays in every slot share a bind group and are drawn together.
+	static void MeshSetTextureArrays(Mesh* mesh, const MeshTexture* textures, const std::vector<MeshTextureSource>& sources)
+	{
+		double start = GetTime();
+
+		WorkerGroup* group = CreateWorkerGroup();
+		std::deque<TextureBatchImage> images;
+		const uint32 textureCount = (uint32)sources.size();
+
+		for (const MeshTextureSource& source : sources)
+		{
+			if (source.image != MeshNoTexture)
+			{
+				TextureQueueDecode(group, images, textures[source.image].path, source.settings);
+				continue;
+			}
+
+			TextureQueueDecodeOrm(group, images, nullptr,
+				source.roughness != MeshNoTexture ? textures[source.roughness].path : nullptr,
+				source.metallic != MeshNoTexture ? textures[source.metallic].path : nullptr, source.settings);
+		}
+
+		Dispose(group);
+
+		GLint maxLayers;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+		std::vector<TextureImage> views(textureCount);
+		std::vector<std::vector<TextureImage>> arrays;
+		std::vector<uint32> textureArray(textureCount, MeshNoTexture);
+		std::vector<uint32> textureLayer(textureCount, 0);
+
+		for (uint32 i = 0; i < textureCount; i++)
+		{
+			if (!TextureBatchGetImage(images[i], &views[i]))
+				continue;
+
+			const TextureImage& image = views[i];
+
+			uint32 array = 0;
+			for (; array < arrays.size(); array++)
+			{
+				const TextureImage& first = arrays[array][0];
+				if (first.format == image.format && first.width == image.width && first.height == image.height &&
+					first.levelCount == image.levelCount && arrays[array].size() < (size_t)maxLayers)
+					break;
+			}
+
+			if (array == arrays.size())
+				arrays.emplace_back();
+
+			textureArray[i] = array;
+			textureLayer[i] = (uint32)arrays[array].size();
+			arrays[array].push_back(image);
+		}
+
+		if (!arrays.empty())
+		{
+			mesh->textureArrays = (GLuint*)malloc(sizeof(GLuint) * arrays.size());
+			mesh->textureArrayCount = (uint32)arrays.size();
+
+			for (uint32 i = 0; i < mesh->textureArrayCount; i++)
+			{
+				mesh->textureArrays[i] = TextureArrayUpload(arrays[i].data(), (uint32)arrays[i].size());
+				mesh->textureArraySize += TextureImageGetSize(arrays[i][0]) * arrays[i].size();
+			}
+
+			StagingFence();
+		}
+
+		for (TextureBatchImage& image : images)
+			TextureBatchImageFree(&image);
+
+		// The layers of every material and the arrays of their slots, the group they share.
+		const uint32 materialCount = mesh->materialCount;
+		mesh->materialLayers = (MeshMaterialLayers*)malloc(sizeof(MeshMaterialLayers) * (materialCount + 1));
+
+		std::vector<MeshBindGroup> groups;
+		std::vector<uint32> materialGroup(materialCount + 1);
+
+		for (uint32 i = 0; i <= materialCount; i++)
+		{
+			MeshBindGroup bindGroup = {};
+
+			for (uint32 sampler = 0; sampler < (uint32)MaterialSampler::Count; sampler++)
+			{
+				uint32 texture = i < materialCount ? mesh->materialSamplers[i].textures[sampler] : MeshNoTexture;
+				bool packed = texture < textureCount && textureArray[texture] != MeshNoTexture;
+
+				bindGroup.arrays[sampler] = packed ? mesh->textureArrays[textureArray[texture]] : 0;
+				mesh->materialLayers[i].layers[sampler] = packed ? (float32)textureLayer[texture] : -1.0f;
+			}
+
+			uint32 index = 0;
+			while (index < groups.size() && memcmp(groups[index].arrays, bindGroup.arrays, sizeof(bindGroup.arrays)) != 0)
+				index++;
+
+			if (index == groups.size())
+				groups.push_back(bindGroup);
+
+			materialGroup[i] = index;
+		}
+
+		// The first LOD in group order, so every group is a single run of commands.
+		std::vector<MeshDrawCommand> draws;
+
+		for (uint32 i = 0; i < groups.size(); i++)
+		{
+			groups[i].firstDraw = (uint32)draws.size();
+
+			for (uint32 j = 0; j < mesh->submeshCount; j++)
+			{
+				const MeshSubmesh& submesh = mesh->submeshes[j];
+				uint32 material = Min(submesh.material, materialCount);
+
+				if (submesh.indexCount == 0 || materialGroup[material] != i)
+					continue;
+
+				draws.push_back({ submesh.indexCount, 1, submesh.indexOffset, 0, material });
+			}
+
+			groups[i].drawCount = (uint32)draws.size() - groups[i].firstDraw;
+		}
+
+		mesh->bindGroups = (MeshBindGroup*)malloc(sizeof(MeshBindGroup) * groups.size());
+		mesh->bindGroupCount = (uint32)groups.size();
+		memcpy(mesh->bindGroups, groups.data(), sizeof(MeshBindGroup) * groups.size());
+
+		mesh->draws = (MeshDrawCommand*)malloc(sizeof(MeshDrawCommand) * Max((size_t)1, draws.size()));
+		mesh->drawCount = (uint32)draws.size();
+		memcpy(mesh->draws, draws.data(), sizeof(MeshDrawCommand) * draws.size());
+
+		// With indirect draws the layers are instanced attributes, each command picks its
+		// material's with the base instance. The attribute stays disabled in the VAO, every
+		// other draw of the mesh reads the -1 layers MeshBind sets.
+		if (GetExtensions().MultiDrawElementsIndirect != nullptr && mesh->vertexArray != 0)
+		{
+			glGenBuffers(1, &mesh->layerBuffer);
+			StateBindBuffer(GL_ARRAY_BUFFER, mesh->layerBuffer);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(MeshMaterialLayers) * (materialCount + 1), mesh->materialLayers, GL_STATIC_DRAW);
+
+			StateBindVertexArray(mesh->vertexArray);
+			glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(MeshMaterialLayers), nullptr);
+			glVertexAttribDivisor(5, 1);
+			StateBindVertexArray(0);
+			StateBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			glGenBuffers(1, &mesh->drawBuffer);
+			StateBindBuffer(GL_DRAW_INDIRECT_BUFFER, mesh->drawBuffer);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(MeshDrawCommand) * draws.size(), draws.data(), GL_STATIC_DRAW);
+			StateBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+
+		Message("Packed %u textures in %u arrays, %u bind groups for %u materials in %.2f ms\n",
+			textureCount, mesh->textureArrayCount, mesh->bindGroupCount, materialCount, (GetTime() - start) * 1000.0);
+	}
+
+	TextureBatch* CreateTextureBatch()
+	{
+		TextureBatch* batch = new TextureBatch();
+		batch->group = CreateWorkerGroup();
+		batch->start = GetTime();
+		return batch;
+	}
+
+	void TextureBatchAdd(TextureBatch* batch, Texture2D* texture, const char* filename, const TextureLoadSettings& settings)
+	{
+		TextureBatchEntry entry = {};
+		entry.texture = texture;
+		entry.firstImage = (uint32)batch->images.size();
+		batch->entries.push_back(entry);
+
+		TextureBatchQueue(batch, filename, settings);
+	}
+
+	void TextureBatchAddOrm(TextureBatch* batch, Texture2D* texture, const char* occlusion, const char* roughness,
+		const char* metallic, const TextureLoadSettings& settings)
+	{
+		TextureBatchEntry entry = {};
+		entry.texture = texture;
+		entry.firstImage = (uint32)batch->images.size();
+		batch->entries.push_back(entry);
+
+		TextureQueueDecodeOrm(batch->group, batch->images, occlusion, roughness, metallic, settings);
+	}
+
+	void TextureBatchAdd(TextureBatch* batch, Cubemap* cubemap, const char* front, const char* back,
+		const char* left, const char* right, const char* top, const char* bottom, const TextureLoadSettings& settings)
+	{
+		TextureBatchEntry entry = {};
+		entry.cubemap = cubemap;
+		entry.firstImage = (uint32)batch->images.size();
+		batch->entries.push_back(entry);
+
+		// Queued in GL face order, +X, -X, +Y, -Y, +Z, -Z.
+		const char* faces[] = { right, left, top, bottom, back, front };
+		for (const char* face : faces)
+			TextureBatchQueue(batch, face, settings);
+	}
+
+	static bool TextureBatchIsReady(const TextureBatch* batch, const TextureBatchEntry& entry, uint32 imageCount)
+	{
+		for (uint32 i = 0; i < imageCount; i++)
+		{
+			if (!batch->images[entry.firstImage + i].ready.load(std::memory_order_acquire))
+				return false;
+		}
+
+		return true;
+	}
+
+	bool TextureBatchUpdate(TextureBatch* batch, uint32 maxUploadSize)
+	{
+		ulong64 uploadSize = 0;
+
+		for (TextureBatchEntry& entry : batch->entries)
+		{
+			// At least one entry goes up per call, however big, so the batch always progresses.
+			if (maxUploadSize > 0 && uploadSize >= maxUploadSize)
+				break;
+
+			const uint32 imageCount = entry.cubemap != nullptr ? 6 : 1;
+			if (entry.uploaded || !TextureBatchIsReady(batch, entry, imageCount))
+				continue;
+
+			TextureImage images[6];
+			bool loaded = true;
+
+			for (uint32 i = 0; i < imageCount; i++)
+			{
+				loaded = TextureBatchGetImage(batch->images[entry.firstImage + i], &images[i]) && loaded;
+
+				for (uint32 j = 0; j < images[i].levelCount; j++)
+					uploadSize += images[i].levels[j].size;
+			}
+
+			if (!loaded)
+			{
+				if (entry.texture != nullptr)
+					entry.texture->id = 0;
+			}
+			else if (entry.cubemap != nullptr)
+				CubemapUpload(entry.cubemap, images);
+			else
+				Texture2DUpload(entry.texture, images[0]);
+
+			// The pixels are in the staging ring or the texture now.
+			for (uint32 i = 0; i < imageCount; i++)
+				TextureBatchImageFree(&batch->images[entry.firstImage + i]);
+
+			entry.uploaded = true;
+			batch->uploadedCount++;
+		}
+
+		StagingFence();
+		batch->uploadSize += uploadSize;
+
+		if (batch->uploadedCount < batch->entries.size())
+			return false;
+
+		if (!batch->entries.empty())
+		{
+			Message("Loaded %u images (%.2f MB) in %.2f ms\n",
+				(uint32)batch->images.size(), batch->uploadSize / (1024.0 * 1024.0),
+				(GetTime() - batch->start) * 1000.0);
+		}
+
+		batch->images.clear();
+		batch->entries.clear();
+		batch->uploadedCount = 0;
+		batch->uploadSize = 0;
+		batch->start = GetTime();
+		return true;
+	}
+
+	void TextureBatchFinish(TextureBatch* batch)
+	{
+		WorkerGroupWait(batch->group);
+		TextureBatchUpdate(batch, 0);
+	}
+
+	static ulong64 TextureStreamGetSize(const TextureImage& image, uint32 level)
+	{
+		ulong64 size = 0;
+		for (uint32 i = level; i < image.levelCount; i++)
+			size += image.levels[i].size;
+
+		return size;
+	}
+
+	// Replaces the texture with one holding level and everything below it. GL has no way to
+	// resize storage in place, the levels that stay are uploaded again from the source.
+	static void TextureStreamSetResident(TextureStreamer* streamer, TextureStream* stream, uint32 level)
+	{
+		TextureImage image;
+		TextureBatchGetImage(*stream->image, &image);
+
+		TextureImage resident = image;
+		resident.width = image.levels[level].width;
+		resident.height = image.levels[level].height;
+		resident.levels = image.levels + level;
+		resident.levelCount = image.levelCount - level;
+
+		GLuint previous = stream->texture->id;
+		Texture2DUpload(stream->texture, resident);
+
+		// Still the size of the whole image, whatever is resident.
+		stream->texture->width = (int)image.width;
+		stream->texture->height = (int)image.height;
+
+		if (stream->created)
+		{
+			StateDeleteTextures(1, &previous);
+			streamer->residentSize -= TextureStreamGetSize(image, stream->residentLevel);
+		}
+
+		streamer->residentSize += TextureStreamGetSize(image, level);
+		stream->residentLevel = level;
+		stream->created = true;
+	}
+
+	static void TextureStreamPrefetch(void* userData)
+	{
+		TextureStream* stream = (TextureStream*)userData;
+		const CookedTexture& cooked = stream->image->cooked;
+
+		// Levels are stored largest first, the missing ones are a single range of the file.
+		const unsigned char* begin = cooked.pixels + cooked.levels[stream->prefetchLevel].offset;
+		const unsigned char* end = cooked.pixels + cooked.levels[stream->prefetchEnd].offset;
+
+		volatile unsigned char sink = 0;
+		for (const unsigned char* page = begin; page < end; page += 4096)
+			sink += *page;
+
+		stream->prefetched.store(true, std::memory_order_release);
+	}
+
+	// True once the levels from level up are in memory, starts reading them in otherwise.
+	static bool TextureStreamIsPrefetched(TextureStreamer* streamer, TextureStream* stream, uint32 level)
+	{
+		// Decoded images are in memory already.
+		if (!stream->image->isCooked)
+			return true;
+
+		if (stream->prefetchLevel != stream->levelCount)
+		{
+			if (!stream->prefetched.load(std::memory_order_acquire))
+				return false;
+
+			if (stream->prefetchLevel <= level)
+				return true;
+		}
+
+		stream->prefetchLevel = level;
+		stream->prefetchEnd = stream->residentLevel;
+		stream->prefetched.store(false, std::memory_order_relaxed);
+		WorkerGroupSubmit(streamer->group, TextureStreamPrefetch, stream);
+		return false;
+	}
+
+	// Drops levels from the least recently used texture that has any to spare, either not
+	// drawn this frame or holding finer levels than it asked for. False when none does.
+	static bool TextureStreamerEvict(TextureStreamer* streamer, const TextureStream* keep)
+	{
+		TextureStream* victim = nullptr;
+		uint32 victimLevel = 0;
+
+		for (TextureStream& stream : streamer->streams)
+		{
+			if (&stream == keep || !stream.created || stream.texture == nullptr)
+				continue;
+
+			const bool used = stream.lastUsedFrame == streamer->frame;
+			const uint32 level = used ? stream.requestedLevel : stream.minLevel;
+
+			if (stream.residentLevel >= level)
+				continue;
+
+			if (victim == nullptr || stream.lastUsedFrame < victim->lastUsedFrame)
+			{
+				victim = &stream;
+				victimLevel = level;
+			}
+		}
+
+		if (victim == nullptr)
+			return false;
+
+		TextureStreamSetResident(streamer, victim, victimLevel);
+		return true;
+	}
+
+	TextureStreamer* CreateTextureStreamer(ulong64 budget)
+	{
+		TextureStreamer* streamer = new TextureStreamer();
+		streamer->group = CreateWorkerGroup();
+		streamer->budget = budget;
+		streamer->frame = 1;
+		return streamer;
+	}
+
+	static void TextureStreamerAddImage(TextureStreamer* streamer, Texture2D* texture, TextureBatchImage* image)
+	{
+		texture->id = 0;
+		texture->width = 0;
+		texture->height = 0;
+
+		streamer->streams.emplace_back();
+
+		TextureStream& stream = streamer->streams.back();
+		stream.texture = texture;
+		stream.image = image;
+		stream.levelCount = TextureMaxLevels;
+		stream.requestedLevel = TextureMaxLevels;
+
+		streamer->lookup[texture] = &stream;
+	}
+
+	void TextureStreamerAdd(TextureStreamer* streamer, Texture2D* texture, const char* filename, const TextureLoadSettings& settings)
+	{
+		TextureStreamerAddImage(streamer, texture, TextureQueueDecode(streamer->group, streamer->images, filename, settings));
+	}
+
+	void TextureStreamerAddOrm(TextureStreamer* streamer, Texture2D* texture, const char* occlusion, const char* roughness,
+		const char* metallic, const TextureLoadSettings& settings)
+	{
+		TextureStreamerAddImage(streamer, texture,
+			TextureQueueDecodeOrm(streamer->group, streamer->images, occlusion, roughness, metallic, settings));
+	}
+
+	void TextureStreamerRemove(TextureStreamer* streamer, const Texture2D* texture)
+	{
+		auto found = streamer->lookup.find(texture);
+		if (found == streamer->lookup.end())
+			return;
+
+		// The stream stays behind until TextureStreamerUpdate sees its image is no longer
+		// decoding or prefetching.
+		TextureStream* stream = found->second;
+		if (stream->created)
+		{
+			TextureImage image;
+			TextureBatchGetImage(*stream->image, &image);
+			streamer->residentSize -= TextureStreamGetSize(image, stream->residentLevel);
+		}
+
+		stream->texture = nullptr;
+		streamer->lookup.erase(found);
+	}
+
+	void TextureStreamerRequest(TextureStreamer* streamer, const Texture2D* texture, float screenSize)
+	{
+		auto found = streamer->lookup.find(texture);
+		if (found == streamer->lookup.end())
+			return;
+
+		TextureStream* stream = found->second;
+		stream->lastUsedFrame = streamer->frame;
+
+		if (!stream->created)
+			return;
+
+		// One texel per pixel, every level down halves the texels across.
+		const float32 size = (float32)Max(texture->width, texture->height);
+		uint32 level = 0;
+
+		if (screenSize < size)
+			level = screenSize >= 1.0f ? (uint32)log2f(size / screenSize) : stream->minLevel;
+
+		stream->requestedLevel = Min(stream->requestedLevel, Min(level, stream->minLevel));
+	}
+
+	void TextureStreamerRequest(TextureStreamer* streamer, const Mesh* mesh, const Camera* camera,
+		const Matrix4& model, float viewportHeight)
+	{
+		// Same bounding sphere estimate RenderLod picks levels with, as its height in pixels.
+		float scale = Max(Magnitude(Vector3(model[0])), Max(Magnitude(Vector3(model[1])), Magnitude(Vector3(model[2]))));
+		Vector3 center = Vector3(model * Vector4(mesh->center, 1.0f));
+		float radius = mesh->radius * scale;
+		float distance = Magnitude(center - camera->position) - radius;
+
+		// From inside the bounds any surface can fill the screen.
+		float screenSize = distance > 0.0f ? radius * camera->impl->projection[1][1] / distance * viewportHeight : FLT_MAX;
+
+		for (uint32 i = 0; i < mesh->textureCount; i++)
+			TextureStreamerRequest(streamer, mesh->textures[i], screenSize);
+	}
+
+	// Whether a worker may still be writing the image of stream or reading its pages.
+	static bool TextureStreamIsBusy(const TextureStream& stream)
+	{
+		if (!stream.image->ready.load(std::memory_order_acquire))
+			return true;
+
+		return stream.created && stream.prefetchLevel != stream.levelCount &&
+			!stream.prefetched.load(std::memory_order_acquire);
+	}
+
+	void TextureStreamerUpdate(TextureStreamer* streamer, uint32 maxUploadSize)
+	{
+		// Removed streams go once their jobs are done, along with their decoded chain.
+		for (auto it = streamer->streams.begin(); it != streamer->streams.end(); )
+		{
+			if (it->texture != nullptr || TextureStreamIsBusy(*it))
+			{
+				++it;
+				continue;
+			}
+
+			const TextureBatchImage* image = it->image;
+			TextureBatchImageFree(it->image);
+			streamer->images.remove_if([image](const TextureBatchImage& other) { return &other == image; });
+			it = streamer->streams.erase(it);
+		}
+
+		std::vector<TextureStream*> wanted;
+
+		for (TextureStream& stream : streamer->streams)
+		{
+			if (stream.texture == nullptr)
+				continue;
+
+			if (!stream.created)
+			{
+				if (!stream.image->ready.load(std::memory_order_acquire) || stream.levelCount == 0)
+					continue;
+
+				TextureImage image;
+				if (!TextureBatchGetImage(*stream.image, &image))
+				{
+					// Never loads, it stays at id 0 like a failed batch texture.
+					stream.levelCount = 0;
+					continue;
+				}
+
+				stream.levelCount = image.levelCount;
+				stream.minLevel = image.levelCount - 1;
+				while (stream.minLevel > 0 && Max(image.levels[stream.minLevel - 1].width,
+					image.levels[stream.minLevel - 1].height) <= TextureStreamMinSize)
+				{
+					stream.minLevel--;
+				}
+
+				stream.residentLevel = stream.levelCount;
+				stream.prefetchLevel = stream.levelCount;
+				stream.requestedLevel = stream.levelCount;
+
+				TextureStreamSetResident(streamer, &stream, stream.minLevel);
+				continue;
+			}
+
+			if (stream.lastUsedFrame == streamer->frame && stream.requestedLevel < stream.residentLevel)
+				wanted.push_back(&stream);
+		}
+
+		// The textures furthest from what they need go first.
+		std::sort(wanted.begin(), wanted.end(), [](const TextureStream* a, const TextureStream* b)
+		{
+			return a->residentLevel - a->requestedLevel > b->residentLevel - b->requestedLevel;
+		});
+
+		ulong64 uploadSize = 0;
+
+		for (TextureStream* stream : wanted)
+		{
+			if (maxUploadSize > 0 && uploadSize >= maxUploadSize)
+				break;
+
+			if (!TextureStreamIsPrefetched(streamer, stream, stream->requestedLevel))
+				continue;
+
+			TextureImage image;
+			TextureBatchGetImage(*stream->image, &image);
+
+			// Makes room, and settles for a coarser level when nothing else can give any up.
+			uint32 level = stream->image->isCooked ? Max(stream->requestedLevel, stream->prefetchLevel) : stream->requestedLevel;
+			while (level < stream->residentLevel &&
+				streamer->residentSize + TextureStreamGetSize(image, level) - TextureStreamGetSize(image, stream->residentLevel) > streamer->budget)
+			{
+				if (!TextureStreamerEvict(streamer, stream))
+					level++;
+			}
+
+			if (level < stream->residentLevel)
+			{
+				uploadSize += TextureStreamGetSize(image, level);
+				TextureStreamSetResident(streamer, stream, level);
+			}
+
+			if (level <= stream->prefetchLevel)
+				stream->prefetchLevel = stream->levelCount;
+		}
+
+		StagingFence();
+
+		for (TextureStream& stream : streamer->streams)
+			stream.requestedLevel = stream.levelCount;
+
+		streamer->frame++;
+	}
+
+	struct Pipeline
+	{
+		PipelineSettings settings;
+	};
+
+	Pipeline* CreatePipeline(const PipelineSettings& settings)
+	{
+		Pipeline* pipeline = (Pipeline*)malloc(sizeof(Pipeline));
+		*pipeline = {};
+		pipeline->settings = settings;
+		return pipeline;
+	}
+
+	void Bind(const Pipeline* pipeline)
+	{
+		const PipelineSettings& settings = pipeline->settings;
+
+		Bind(settings.shader);
+		StateSetBlend(settings.blend);
+		StateSetCull(settings.cull);
+		StateSetDepth(settings.depthTest, settings.depthWrite);
+	}
+
+	StateStats GetStateStats()
+	{
+		StateStats stats;
+		stats.calls = stateCache.calls;
+		stats.redundantCalls = stateCache.redundantCalls;
+
+		stateCache.calls = 0;
+		stateCache.redundantCalls = 0;
+		return stats;
+	}
+
+	void Bind(const Shader* shader)
+	{
+		if (shader == nullptr)
+		{
+			StateUseProgram(0);
+			return;
+		}
+
+		StateUseProgram(shader->id);
+	}
+
+	void Bind(const Texture2D* texture, int index)
+	{
+		StateBindTexture(index, GL_TEXTURE_2D, texture->id);
+	}
+
+	void Bind(const Cubemap* cubemap, int index)
+	{
+		StateBindTexture(index, GL_TEXTURE_CUBE_MAP, cubemap->id);
+	}
+
+	void Bind(const Environment* environment, int index)
+	{
+		Bind(&environment->specular, index);
+		Bind(&environment->brdf, index + 1);
+	}
+
+	void ShaderSetEnvironment(const Shader* shader, const Environment* environment, int index)
+	{
+		static constexpr uint32 irradiance[9] =
+		{
+			HashString("Environment.irradiance[0]"), HashString("Environment.irradiance[1]"),
+			HashString("Environment.irradiance[2]"), HashString("Environment.irradiance[3]"),
+			HashString("Environment.irradiance[4]"), HashString("Environment.irradiance[5]"),
+			HashString("Environment.irradiance[6]"), HashString("Environment.irradiance[7]"),
+			HashString("Environment.irradiance[8]")
+		};
+
+		for (uint32 i = 0; i < 9; i++)
+			ShaderSetVar(shader, irradiance[i], environment->irradiance[i]);
+
+		ShaderSetVar(shader, "Environment.specular", index);
+		ShaderSetVar(shader, "Environment.specularLevels", (float)environment->specularLevels);
+		ShaderSetVar(shader, "Environment.brdf", index + 1);
+	}
+
+	static void MeshBind(const Mesh* mesh)
+	{
+		StateBindVertexArray(mesh->vertexArray);
+
+		// Generic attribute values aren't part of the VAO, so the dequantization constants
+		// are set per draw. w tells the shader the normals are octahedral encoded.
+		const Vector3& scale = mesh->quantScale;
+		const Vector3& offset = mesh->quantOffset;
+		glVertexAttrib4f(3, scale.x, scale.y, scale.z, mesh->vertexFormat == VertexFormat::PackedOctahedral ? 1.0f : 0.0f);
+		glVertexAttrib3f(4, offset.x, offset.y, offset.z);
+
+		// Unless the VAO reads layers per material, the plain material textures are sampled.
+		glVertexAttrib4f(5, -1.0f, -1.0f, -1.0f, -1.0f);
+	}
+
+	// Bound for materials without metallic and roughness: no occlusion, fully rough and not metallic.
+	static GLuint GetDefaultOrmTexture()
+	{
+		static GLuint id = 0;
+		if (id != 0)
+			return id;
+
+		const unsigned char texel[] = { 255, 255, 0, 255 };
+
+		glGenTextures(1, &id);
+		StateBindTextureForEdit(GL_TEXTURE_2D, id);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		StateBindTexture(0, GL_TEXTURE_2D, 0);
+
+		return id;
+	}
+
+	void Render(const Mesh* mesh, Primitive primitive)
+	{
+		MeshBind(mesh);
+
+		if (mesh->indexBuffer == 0 || mesh->indexCount == 0)
+		{
+			glDrawArrays((GLenum)primitive, 0, mesh->vertexCount);
+			return;
+		}
+
+		glDrawElements((GLenum)primitive, mesh->indexCount, mesh->indexType, 0);
+	}
+
+	// Every bind group binds its arrays once. Indirect draws take the whole group in one call,
+	// otherwise the layers are set as generic attributes between plain draws.
+	static void MeshRenderBindGroups(const Mesh* mesh)
+	{
+		MeshBind(mesh);
+
+		// Nothing stays bound to the plain samplers, like a material without textures.
+		for (uint32 sampler = 0; sampler < (uint32)MaterialSampler::Count; sampler++)
+		{
+			StateBindTexture(MaterialTextureUnit + sampler, GL_TEXTURE_2D, sampler == (uint32)MaterialSampler::Orm ? GetDefaultOrmTexture() : 0);
+		}
+
+		const GLExtensions& extensions = GetExtensions();
+		size_t indexSize = mesh->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+
+		if (mesh->drawBuffer != 0)
+		{
+			StateBindBuffer(GL_DRAW_INDIRECT_BUFFER, mesh->drawBuffer);
+			glEnableVertexAttribArray(5);
+		}
+
+		for (uint32 i = 0; i < mesh->bindGroupCount; i++)
+		{
+			const MeshBindGroup& group = mesh->bindGroups[i];
+			if (group.drawCount == 0)
+				continue;
+
+			for (uint32 sampler = 0; sampler < (uint32)MaterialSampler::Count; sampler++)
+			{
+				StateBindTexture(MaterialArrayUnit + sampler, GL_TEXTURE_2D_ARRAY, group.arrays[sampler]);
+			}
+
+			if (mesh->drawBuffer != 0)
+			{
+				extensions.MultiDrawElementsIndirect(GL_TRIANGLES, mesh->indexType,
+					(const void*)(group.firstDraw * sizeof(MeshDrawCommand)), group.drawCount, 0);
+				continue;
+			}
+
+			for (uint32 j = group.firstDraw; j < group.firstDraw + group.drawCount; j++)
+			{
+				const MeshDrawCommand& draw = mesh->draws[j];
+				const float32* layers = mesh->materialLayers[draw.baseInstance].layers;
+
+				glVertexAttrib4f(5, layers[0], layers[1], layers[2], layers[3]);
+				glDrawElements(GL_TRIANGLES, draw.count, mesh->indexType, (const void*)(draw.firstIndex * indexSize));
+			}
+		}
+
+		if (mesh->drawBuffer != 0)
+		{
+			glDisableVertexAttribArray(5);
+			StateBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
 	}
 
-	Mesh* CreateMesh()
+	static GLuint MeshGetMaterialTexture(const Mesh* mesh, uint32 material, uint32 sampler)
 	{
-		return (Mesh*)malloc(sizeof(Mesh));
+		uint32 texture = mesh->materialSamplers[material].textures[sampler];
+		GLuint id = texture < mesh->textureCount ? mesh->textures[texture]->id : 0;
+
+		// Also while a streamed one is loading, unbound it would read as fully occluded.
+		if (id == 0 && sampler == (uint32)MaterialSampler::Orm)
+			id = GetDefaultOrmTexture();
+
+		return id;
 	}
 
-	Shader* CreateShader()
+	// Draws the submeshes of one level, binding the textures of their material as it changes.
+	static void MeshRenderLevelSubmeshes(const Mesh* mesh, uint32 level)
 	{
-		Shader* ptr = (Shader*)malloc(sizeof(Shader));
-		ptr->count = 0;
-		return ptr;
+		MeshBind(mesh);
+
+		size_t indexSize = mesh->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		const MeshSubmesh* submeshes = mesh->submeshes + (size_t)level * mesh->submeshCount;
+		uint32 boundMaterial = MeshNoMaterial;
+
+		for (uint32 i = 0; i < mesh->submeshCount; i++)
+		{
+			const MeshSubmesh& submesh = submeshes[i];
+			if (submesh.indexCount == 0)
+				continue;
+
+			if (submesh.material != boundMaterial && submesh.material < mesh->materialCount && mesh->materialSamplers != nullptr)
+			{
+				// Samplers without a texture are unbound, so nothing leaks over from the previous material.
+				for (uint32 sampler = 0; sampler < (uint32)MaterialSampler::Count; sampler++)
+				{
+					StateBindTexture(MaterialTextureUnit + sampler, GL_TEXTURE_2D, MeshGetMaterialTexture(mesh, submesh.material, sampler));
+				}
+
+				boundMaterial = submesh.material;
+			}
+
+			glDrawElements(GL_TRIANGLES, submesh.indexCount, mesh->indexType, (const void*)(submesh.indexOffset * indexSize));
+		}
 	}
 
-	Texture2D* CreateTexture2D()
+	void RenderSubmeshes(const Mesh* mesh)
 	{
-		return (Texture2D*)malloc(sizeof(Texture2D));
+		if (mesh->submeshCount == 0 || mesh->indexBuffer == 0)
+		{
+			Render(mesh);
+			return;
+		}
+
+		if (mesh->bindGroupCount > 0)
+		{
+			MeshRenderBindGroups(mesh);
+			return;
+		}
+
+		MeshRenderLevelSubmeshes(mesh, 0);
 	}
 
-	Cubemap* CreateCubemap()
+	RenderQueue* CreateRenderQueue()
 	{
-		return (Cubemap*)malloc(sizeof(Cubemap));
+		return new RenderQueue();
 	}
 
-	SpriteBatch* CreateSpriteBatch()
+	static uint32 RenderQueueAddTextureSet(RenderQueue* queue, const RenderTextureSet& set)
 	{
-		return (SpriteBatch*)malloc(sizeof(SpriteBatch));
+		const ulong64 hash = HashData(set.ids, sizeof(set.ids));
+
+		auto found = queue->textureSetsByHash.find(hash);
+		if (found != queue->textureSetsByHash.end() &&
+			memcmp(queue->textureSets[found->second].ids, set.ids, sizeof(set.ids)) == 0)
+			return found->second;
+
+		const uint32 index = (uint32)queue->textureSets.size();
+		queue->textureSets.push_back(set);
+		queue->textureSetsByHash[hash] = index;
+		return index;
 	}
 
-	SpriteAtlas* CreateSpriteAtlas()
+	void RenderQueueAdd(RenderQueue* queue, const Shader* shader, const Mesh* mesh, const Matrix4& model,
+		const Texture2D* const* textures)
 	{
-		return (SpriteAtlas*)malloc(sizeof(SpriteAtlas));
+		RenderPacket packet = {};
+		packet.shader = shader;
+		packet.mesh = mesh;
+		packet.center = mesh->center;
+		packet.textureSet = RenderNoTextureSet;
+		packet.model = (uint32)queue->models.size();
+		queue->models.push_back(model);
+
+		if (textures != nullptr)
+		{
+			RenderTextureSet set;
+			for (uint32 sampler = 0; sampler < (uint32)MaterialSampler::Count; sampler++)
+				set.ids[sampler] = textures[sampler] != nullptr ? textures[sampler]->id : 0;
+
+			packet.textureSet = RenderQueueAddTextureSet(queue, set);
+		}
+
+		queue->packets.push_back(packet);
 	}
 
-	bool ShaderLoadAndCompile(Shader* shader, const char* filename, ShaderType type)
+	uint32 MeshGetMaterialVariant(const Mesh* mesh, uint32 material)
 	{
-		GLuint id = glCreateShader((GLenum)type);
-
-		std::ifstream file(filename);
-		std::string contents((std::istreambuf_iterator<char>(file)),
-			std::istreambuf_iterator<char>());
-		
-		const GLchar* source = contents.c_str();
-		glShaderSource(id, 1, &source, nullptr);
-		glCompileShader(id);
+		if (material >= mesh->materialCount || mesh->materialSamplers == nullptr)
+			return 0;
 
-		GLint success = 0;
-		glGetShaderiv(id, GL_COMPILE_STATUS, &success);
+		uint32 key = 0;
 
-		if (!success)
+		// Packed materials sample the arrays only, a texture left out of them is as good as none.
+		if (mesh->materialLayers != nullptr)
 		{
-			char info[1024];
-			glGetShaderInfoLog(id, 1024, nullptr, info);
-			Message(info);
-			glDeleteShader(id);
-			return false;
+			const float32* layers = mesh->materialLayers[material].layers;
+			key |= layers[(int)MaterialSampler::Normal] >= 0.0f ? MaterialVariantNormalMap : 0;
+			key |= layers[(int)MaterialSampler::Orm] >= 0.0f ? MaterialVariantOrm : 0;
+			return key;
 		}
 
-		shader->sources[shader->count++] = id;
-		return true;
+		// Without its own ORM texture a material samples the default one, which changes nothing.
+		key |= MeshGetMaterialTexture(mesh, material, (uint32)MaterialSampler::Normal) != 0 ? MaterialVariantNormalMap : 0;
+		key |= mesh->materialSamplers[material].textures[(int)MaterialSampler::Orm] != MeshNoTexture ? MaterialVariantOrm : 0;
+		return key;
 	}
 
-	bool ShaderLink(Shader* shader)
+	// The features every material of the mesh has, for draws that cover them all.
+	static uint32 MeshGetCommonVariant(const Mesh* mesh)
 	{
-		shader->id = glCreateProgram();
-
-		for (int i = 0; i < shader->count; i++)
-			glAttachShader(shader->id, shader->sources[i]);
+		if (mesh->materialCount == 0)
+			return 0;
 
-		glLinkProgram(shader->id);
+		uint32 key = MaterialVariantCount - 1;
+		for (uint32 i = 0; i < mesh->materialCount; i++)
+			key &= MeshGetMaterialVariant(mesh, i);
 
-		GLint success;
-		glGetProgramiv(shader->id, GL_LINK_STATUS, &success);
+		return key;
+	}
 
-		if (!success)
+	// Without variants every draw takes shader.
+	static void RenderQueueAddSubmeshes(RenderQueue* queue, const Shader* shader, const ShaderVariants* variants,
+		const Mesh* mesh, const Matrix4& model)
+	{
+		if (mesh->submeshCount == 0 || mesh->indexBuffer == 0)
 		{
-			char info[1024];
-			glGetProgramInfoLog(shader->id, 1024, nullptr, info);
-			Message(info);
-			glDeleteProgram(shader->id);
+			RenderQueueAdd(queue, variants != nullptr ? variants->shaders[MeshGetCommonVariant(mesh)] : shader, mesh, model);
+			return;
+		}
 
-			for (int i = 0; i < shader->count; i++)
-				glDeleteShader(shader->sources[i]);
+		RenderPacket packet = {};
+		packet.shader = shader;
+		packet.mesh = mesh;
+		packet.center = mesh->center;
+		packet.textureSet = RenderNoTextureSet;
+		packet.model = (uint32)queue->models.size();
+		queue->models.push_back(model);
 
-			return false;
+		// Bind groups bind their own arrays and already draw in as few calls as they can.
+		if (mesh->bindGroupCount > 0)
+		{
+			if (variants != nullptr)
+				packet.shader = variants->shaders[MeshGetCommonVariant(mesh)];
+
+			packet.bindGroups = true;
+			queue->packets.push_back(packet);
+			return;
 		}
 
-		for (int i = 0; i < shader->count; i++)
-			glDeleteShader(shader->sources[i]);
+		for (uint32 i = 0; i < mesh->submeshCount; i++)
+		{
+			const MeshSubmesh& submesh = mesh->submeshes[i];
+			if (submesh.indexCount == 0)
+				continue;
 
-		return true;
-	}
+			packet.firstIndex = submesh.indexOffset;
+			packet.indexCount = submesh.indexCount;
+			packet.center = mesh->submeshCenters[i];
+			packet.textureSet = RenderNoTextureSet;
 
-	void ShaderSetVar(const Shader* shader, const char * name, const Vector2& value)
-	{
-		int location = glGetUniformLocation(shader->id, name);
-		glUniform2fv(location, 1, glm::value_ptr(value));
-	}
+			if (variants != nullptr)
+				packet.shader = variants->shaders[MeshGetMaterialVariant(mesh, submesh.material)];
 
-	void ShaderSetVar(const Shader* shader, const char * name, const Vector3& value)
-	{
-		int location = glGetUniformLocation(shader->id, name);
-		glUniform3fv(location, 1, glm::value_ptr(value));
+			if (submesh.material < mesh->materialCount && mesh->materialSamplers != nullptr)
+			{
+				RenderTextureSet set;
+				for (uint32 sampler = 0; sampler < (uint32)MaterialSampler::Count; sampler++)
+					set.ids[sampler] = MeshGetMaterialTexture(mesh, submesh.material, sampler);
+
+				packet.textureSet = RenderQueueAddTextureSet(queue, set);
+			}
+
+			queue->packets.push_back(packet);
+		}
 	}
 
-	void ShaderSetVar(const Shader* shader, const char * name, const Vector4& value)
+	void RenderQueueAddSubmeshes(RenderQueue* queue, const Shader* shader, const Mesh* mesh, const Matrix4& model)
 	{
-		int location = glGetUniformLocation(shader->id, name);
-		glUniform4fv(location, 1, glm::value_ptr(value));
+		RenderQueueAddSubmeshes(queue, shader, nullptr, mesh, model);
 	}
 
-	void ShaderSetVar(const Shader* shader, const char * name, const Matrix4& value)
+	void RenderQueueAddSubmeshes(RenderQueue* queue, const ShaderVariants& variants, const Mesh* mesh, const Matrix4& model)
 	{
-		int location = glGetUniformLocation(shader->id, name);
-		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+		RenderQueueAddSubmeshes(queue, nullptr, &variants, mesh, model);
 	}
 
-	void ShaderSetVar(const Shader* shader, const char * name, float value)
+	// Least significant byte first, passes where every key has the same byte are skipped.
+	static void RenderSortItems(std::vector<RenderSortItem>& items, std::vector<RenderSortItem>& scratch)
 	{
-		int location = glGetUniformLocation(shader->id, name);
-		glUniform1f(location, value);
+		scratch.resize(items.size());
+
+		for (uint32 shift = 0; shift < 64; shift += 8)
+		{
+			uint32 counts[256] = {};
+			for (const RenderSortItem& item : items)
+				counts[(item.key >> shift) & 0xFF]++;
+
+			if (counts[(items[0].key >> shift) & 0xFF] == items.size())
+				continue;
+
+			uint32 offset = 0;
+			for (uint32 i = 0; i < 256; i++)
+			{
+				const uint32 count = counts[i];
+				counts[i] = offset;
+				offset += count;
+			}
+
+			for (const RenderSortItem& item : items)
+				scratch[counts[(item.key >> shift) & 0xFF]++] = item;
+
+			items.swap(scratch);
+		}
 	}
 
-	void ShaderSetVar(const Shader* shader, const char * name, int value)
+	// Gives pointers dense indices in the order they first come up, so they fit in the key.
+	template <typename T>
+	static uint32 RenderGetRank(std::unordered_map<const T*, uint32>& ranks, const T* pointer)
 	{
-		int location = glGetUniformLocation(shader->id, name);
-		glUniform1i(location, value);
+		auto inserted = ranks.insert({ pointer, (uint32)ranks.size() });
+		return inserted.first->second;
 	}
 
-	void MeshLoadFromModelFile(Mesh* mesh, const char * filename)
+	void RenderQueueSubmit(RenderQueue* queue, const Camera* camera)
 	{
-		FILE *file = fopen(filename, "r");
-		if (file == nullptr)
-		{
-			Message("[ERROR] File not found");
+		if (queue->packets.empty())
 			return;
-		}
 
-		std::vector<Vector3> positions;
-		std::vector<Vector3> normals;
-		std::vector<Vector2> uvs;
+		// Program in the top 12 bits, then 20 of textures and 16 of mesh, the distance to the
+		// camera in the low 16 breaks the ties front to back.
+		std::vector<float>& distances = queue->distances;
+		float maxDistance = 0.0f;
 
-		std::vector<Vertex> vertices;
-
-		while (true)
+		if (camera != nullptr)
 		{
-			char header[16];
-			int cursor = fscanf(file, "%s", header);
-
-			if (cursor == EOF)
-				break;
+			distances.resize(queue->packets.size());
 
-			if (strcmp(header, "v") == 0)
-			{
-				Vector3 position;
-				fscanf(file, "%f %f %f\n", &position.x, &position.y, &position.z);
-				positions.push_back(position);
-			}
-			else if (strcmp(header, "vn") == 0)
+			for (size_t i = 0; i < queue->packets.size(); i++)
 			{
-				Vector3 normal;
-				fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z);
-				normals.push_back(normal);
+				const RenderPacket& packet = queue->packets[i];
+				const Vector3 center = Vector3(queue->models[packet.model] * Vector4(packet.center, 1.0f));
+
+				distances[i] = glm::length(center - camera->position);
+				maxDistance = Max(maxDistance, distances[i]);
 			}
-			else if (strcmp(header, "vt") == 0)
+		}
+
+		queue->items.resize(queue->packets.size());
+
+		for (size_t i = 0; i < queue->packets.size(); i++)
+		{
+			const RenderPacket& packet = queue->packets[i];
+
+			const ulong64 shader = Min(RenderGetRank(queue->shaderRanks, packet.shader), 0xFFFu);
+			const ulong64 textures = packet.textureSet == RenderNoTextureSet ? 0 : Min(packet.textureSet + 1, 0xFFFFFu);
+			const ulong64 mesh = Min(RenderGetRank(queue->meshRanks, packet.mesh), 0xFFFFu);
+			const ulong64 depth = maxDistance > 0.0f ? (ulong64)(distances[i] / maxDistance * 0xFFFF) : 0;
+
+			queue->items[i].key = (shader << 52) | (textures << 32) | (mesh << 16) | depth;
+			queue->items[i].packet = (uint32)i;
+		}
+
+		RenderSortItems(queue->items, queue->scratch);
+
+		static constexpr uint32 modelHash = HashString("Model");
+		const Shader* boundShader = nullptr;
+		const Mesh* boundMesh = nullptr;
+		const Matrix4* boundModel = nullptr;
+
+		// Unknown to start with, every unit is bound the first time.
+		GLuint boundTextures[(int)MaterialSampler::Count];
+		for (GLuint& id : boundTextures)
+			id = 0xFFFFFFFF;
+
+		for (const RenderSortItem& item : queue->items)
+		{
+			const RenderPacket& packet = queue->packets[item.packet];
+			const Mesh* mesh = packet.mesh;
+
+			if (packet.shader != boundShader)
 			{
-				Vector2 uv;
-				fscanf(file, "%f %f\n", &uv.x, &uv.y);
-				uvs.push_back(uv);
+				Bind(packet.shader);
+				boundShader = packet.shader;
+				boundModel = nullptr;
 			}
-			else if (strcmp(header, "s") == 0)
+
+			const Matrix4& model = queue->models[packet.model];
+			if (boundModel == nullptr || (&model != boundModel && model != *boundModel))
 			{
-				char ignore[8];
-				fgets(ignore, sizeof(ignore), file);
-				printf(ignore);
+				ShaderSetVar(packet.shader, modelHash, model);
+				boundModel = &model;
 			}
-			else if (strcmp(header, "f") == 0)
+
+			if (packet.bindGroups)
 			{
-				char line[128];
-				fgets(line, sizeof(line), file);
+				MeshRenderBindGroups(mesh);
 
-				int vp[3];
-				int vt[3];
-				int vn[3];
+				// It leaves layers in the generic attributes and its own textures behind.
+				boundMesh = nullptr;
+				for (GLuint& id : boundTextures)
+					id = 0xFFFFFFFF;
 
-				int count = sscanf(line, "%d/%d/%d %d/%d/%d %d/%d/%d\n",
-					&vp[0], &vt[0], &vn[0],
-					&vp[1], &vt[1], &vn[1],
-					&vp[2], &vt[2], &vn[2]);
-				
-				bool hasTexCoords = count == 9;
-				if (!hasTexCoords)
-				{
-					int count = sscanf(line, "%d//%d %d//%d %d//%d\n",
-						&vp[0], &vn[0],
-						&vp[1], &vn[1],
-						&vp[2], &vn[2]);
-				}
+				continue;
+			}
 
-				Vertex v[3];
-				v[0].position = positions[vp[0] - 1];
-				v[1].position = positions[vp[1] - 1];
-				v[2].position = positions[vp[2] - 1];
+			if (packet.textureSet != RenderNoTextureSet)
+			{
+				const RenderTextureSet& set = queue->textureSets[packet.textureSet];
 
-				if (hasTexCoords)
+				for (uint32 sampler = 0; sampler < (uint32)MaterialSampler::Count; sampler++)
 				{
-					v[0].texcoord = uvs[vt[0] - 1];
-					v[1].texcoord = uvs[vt[1] - 1];
-					v[2].texcoord = uvs[vt[2] - 1];
+					if (set.ids[sampler] == boundTextures[sampler])
+						continue;
+
+					StateBindTexture(MaterialTextureUnit + sampler, GL_TEXTURE_2D, set.ids[sampler]);
+					boundTextures[sampler] = set.ids[sampler];
 				}
+			}
 
-				v[0].normal = normals[vn[0] - 1];
-				v[1].normal = normals[vn[1] - 1];
-				v[2].normal = normals[vn[2] - 1];
+			if (mesh != boundMesh)
+			{
+				MeshBind(mesh);
+				boundMesh = mesh;
+			}
 
-				vertices.push_back(v[0]);
-				vertices.push_back(v[1]);
-				vertices.push_back(v[2]);
+			if (packet.indexCount > 0)
+			{
+				size_t indexSize = mesh->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+				glDrawElements(GL_TRIANGLES, packet.indexCount, mesh->indexType, (const void*)(packet.firstIndex * indexSize));
+			}
+			else if (mesh->indexBuffer == 0 || mesh->indexCount == 0)
+			{
+				glDrawArrays(GL_TRIANGLES, 0, mesh->vertexCount);
+			}
+			else
+			{
+				glDrawElements(GL_TRIANGLES, mesh->indexCount, mesh->indexType, 0);
 			}
 		}
 
-		MeshUploadData(mesh,
-			vertices.data(), vertices.size(),
-			nullptr, 0);
+		queue->packets.clear();
+		queue->models.clear();
+		queue->textureSets.clear();
+		queue->textureSetsByHash.clear();
+		queue->shaderRanks.clear();
+		queue->meshRanks.clear();
 	}
 
-	void MeshUploadData(Mesh* mesh,
-		const Vertex* vertices, uint32 vertexCount,
-		const uint32* indices, uint32 indexCount)
+	// Planes of the frustum of clip, pointing inwards and normalized, in the space clip transforms from.
+	static void ExtractFrustumPlanes(const Matrix4& clip, Vector4 planes[6])
 	{
-		glGenVertexArrays(1, &mesh->vertexArray);
-		glBindVertexArray(mesh->vertexArray);
-		
-		glGenBuffers(1, &mesh->vertexBuffer);
-		glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertexCount, vertices, GL_STATIC_DRAW);
-
-		if (indices != nullptr && indexCount > 0)
-		{
-			glGenBuffers(1, &mesh->indexBuffer);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indexBuffer);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indexCount, indices, GL_STATIC_DRAW);
-		}
-
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), nullptr);
-		glEnableVertexAttribArray(0);
-
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
-		glEnableVertexAttribArray(1);
-
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, texcoord));
-		glEnableVertexAttribArray(2);
+		Vector4 rows[4];
+		for (int i = 0; i < 4; i++)
+			rows[i] = Vector4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
 
-		glBindVertexArray(0);
+		planes[0] = rows[3] + rows[0];
+		planes[1] = rows[3] - rows[0];
+		planes[2] = rows[3] + rows[1];
+		planes[3] = rows[3] - rows[1];
+		planes[4] = rows[3] + rows[2];
+		planes[5] = rows[3] - rows[2];
 
-		mesh->vertexCount = vertexCount;
-		mesh->indexCount = indexCount;
+		for (int i = 0; i < 6; i++)
+			planes[i] /= Magnitude(Vector3(planes[i]));
 	}
 
-	void CameraUpdate(Camera* camera)
+	void RenderClusters(const Mesh* mesh, const Camera* camera, const Matrix4& model)
 	{
-		if (!camera->impl->uniformBuffer)
+		if (mesh->clusterCount == 0 || mesh->indexBuffer == 0)
 		{
-			uint32 size = sizeof(Matrix4) * 2 + sizeof(Vector3);
-
-			glGenBuffers(1, &camera->impl->uniformBuffer);
-			glBindBuffer(GL_UNIFORM_BUFFER, camera->impl->uniformBuffer);
-			glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
-			glBindBuffer(GL_UNIFORM_BUFFER, 0);
-			glBindBufferRange(GL_UNIFORM_BUFFER, 0, camera->impl->uniformBuffer, 0, size);
+			Render(mesh);
+			return;
 		}
 
-		glBindBuffer(GL_UNIFORM_BUFFER, camera->impl->uniformBuffer);
+		static std::vector<GLsizei> counts;
+		static std::vector<const void*> offsets;
 
+		counts.clear();
+		offsets.clear();
+
+		// Everything is tested in mesh space, so the clusters never need transforming.
 		Matrix4 view = glm::lookAt(camera->position, camera->lookAt, Vector3(0, 1, 0));
-		
-		glBufferSubData(
-			GL_UNIFORM_BUFFER,
-			0,
-			sizeof(Matrix4),
-			glm::value_ptr(view));
+		Vector4 planes[6];
+		ExtractFrustumPlanes(camera->impl->projection * view * model, planes);
 
-		glBufferSubData(
-			GL_UNIFORM_BUFFER,
-			sizeof(Matrix4),
-			sizeof(Matrix4),
-			glm::value_ptr(camera->impl->projection));
+		Vector3 eye = Vector3(glm::inverse(model) * Vector4(camera->position, 1.0f));
+		size_t indexSize = mesh->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		uint32 rangeEnd = 0xFFFFFFFF;
 
-		glBufferSubData(
-			GL_UNIFORM_BUFFER,
-			sizeof(Matrix4) * 2,
-			sizeof(Vector3),
-			glm::value_ptr(camera->position));
+		for (uint32 i = 0; i < mesh->clusterCount; i++)
+		{
+			const MeshCluster& cluster = mesh->clusters[i];
 
-		glBindBuffer(GL_UNIFORM_BUFFER, 0);
-	}
+			bool visible = true;
+			for (int j = 0; j < 6 && visible; j++)
+				visible = Dot(Vector3(planes[j]), cluster.center) + planes[j].w >= -cluster.radius;
 
-	void CameraSetToPerspective(Camera* camera, float fov, float aspectRatio, float nearPlane, float farPlane)
-	{
-		camera->impl->projection = glm::perspective(fov, aspectRatio, nearPlane, farPlane);
-	}
+			if (!visible)
+				continue;
 
-	void Texture2DFromImageFile(Texture2D* texture, const char * filename)
-	{
-		glGenTextures(1, &texture->id);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture->id);
+			// The whole cone of normals points away from the eye, every triangle is backfacing.
+			Vector3 toCluster = cluster.center - eye;
+			if (Dot(toCluster, cluster.coneAxis) >= cluster.coneCutoff * Magnitude(toCluster) + cluster.radius)
+				continue;
 
-		int channels;
-		unsigned char* data = stbi_load(filename, &texture->width, &texture->height, &channels, STBI_rgb_alpha);
+			// Neighbouring visible clusters are merged into a single range.
+			if (cluster.indexOffset == rangeEnd)
+			{
+				counts.back() += cluster.indexCount;
+			}
+			else
+			{
+				counts.push_back(cluster.indexCount);
+				offsets.push_back((const void*)(cluster.indexOffset * indexSize));
+			}
 
-		if (!data)
-		{
-			Message("Failed to load image file.");
-			glDeleteTextures(1, &texture->id);
-			return;
+			rangeEnd = cluster.indexOffset + cluster.indexCount;
 		}
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture->width, texture->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		stbi_image_free(data);
-		
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glBindTexture(GL_TEXTURE_2D, 0);
-	}
+		if (counts.empty())
+			return;
 
-	void Texture2DGetSize(const Texture2D* texture, int* width, int* height)
-	{
-		*width = texture->width;
-		*height = texture->height;
+		MeshBind(mesh);
+		glMultiDrawElements(GL_TRIANGLES, counts.data(), mesh->indexType, offsets.data(), (GLsizei)counts.size());
 	}
 
-	static void CubemapLoadFace(GLenum face, const char* filename)
+	void RenderLod(const Mesh* mesh, const Camera* camera, const Matrix4& model, float maxScreenError)
 	{
-		int width, height, channels;
-		unsigned char* data = nullptr;
-		data = stbi_load(filename, &width, &height, &channels, 0);
-
-		if (data == nullptr)
+		if (mesh->lodCount == 0 || mesh->radius <= 0.0f)
 		{
-			Message("Failed to load cubemap face.");
+			Render(mesh);
 			return;
 		}
 
-		glTexImage2D(face, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-		stbi_image_free(data);
-	}
-
-	void CubemapFromImageFiles(Cubemap* cubemap, const char* front, const char* back, const char* left, 
-		const char* right, const char* top, const char* bottom)
-	{
-		glGenTextures(1, &cubemap->id);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap->id);
-
-		CubemapLoadFace(GL_TEXTURE_CUBE_MAP_POSITIVE_X, right);
-		CubemapLoadFace(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, left);
-		CubemapLoadFace(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, top);
-		CubemapLoadFace(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, bottom);
-		CubemapLoadFace(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, back);
-		CubemapLoadFace(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, front);
+		// The largest axis scale keeps the sphere conservative under non uniform scaling.
+		float scale = Max(Magnitude(Vector3(model[0])), Max(Magnitude(Vector3(model[1])), Magnitude(Vector3(model[2]))));
+		Vector3 center = Vector3(model * Vector4(mesh->center, 1.0f));
+		float radius = mesh->radius * scale;
+		float distance = Magnitude(center - camera->position) - radius;
 
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		uint32 level = 0;
+		if (distance > 0.0f)
+		{
+			// Height of the bounding sphere on screen, as a fraction of the viewport height.
+			float screenSize = radius * camera->impl->projection[1][1] / distance;
 
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+			for (uint32 i = 1; i < mesh->lodCount; i++)
+			{
+				// The error's share of the sphere's diameter, times the diameter on screen.
+				if (mesh->lods[i].error / (2.0f * mesh->radius) * screenSize > maxScreenError)
+					break;
 
-		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-	}
+				level = i;
+			}
+		}
 
-	void Bind(const Shader* shader)
-	{
-		if (shader == nullptr)
+		// Every level is sorted by material, so with materials it draws like RenderSubmeshes.
+		if (mesh->submeshCount > 0 && mesh->materialSamplers != nullptr && mesh->bindGroupCount == 0)
 		{
-			glUseProgram(0);
+			MeshRenderLevelSubmeshes(mesh, level);
 			return;
 		}
 
-		glUseProgram(shader->id);
-	}
-
-	void Bind(const Texture2D* texture, int index)
-	{
-		glActiveTexture(GL_TEXTURE0 + index);
-		glBindTexture(GL_TEXTURE_2D, texture->id);
-	}
+		const MeshLod& lod = mesh->lods[level];
+		size_t indexSize = mesh->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
 
-	void Bind(const Cubemap* cubemap, int index)
-	{
-		glActiveTexture(GL_TEXTURE0 + index);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap->id);
+		MeshBind(mesh);
+		glDrawElements(GL_TRIANGLES, lod.indexCount, mesh->indexType, (const void*)(lod.indexOffset * indexSize));
 	}
 
-	void Render(const Mesh* mesh, Primitive primitive)
+	void Dispose(Shader* shader)
 	{
-		glBindVertexArray(mesh->vertexArray);
-
-		if (mesh->indexBuffer == 0 || mesh->indexCount == 0)
+		if (shader->linking)
 		{
-			glDrawArrays((GLenum)primitive, 0, mesh->vertexCount);
-			return;
+			for (int i = 0; i < shader->count; i++)
+				glDeleteShader(shader->sources[i]);
 		}
 
-		glDrawElements((GLenum)primitive, mesh->indexCount, GL_UNSIGNED_INT, 0);
-	}
-
-	void Dispose(Shader* shader)
-	{
-		glDeleteProgram(shader->id);
+		StateDeleteProgram(shader->id);
+		ShaderFreeSources(shader);
+		free(shader->uniforms);
 		free(shader);
 	}
 
 	void Dispose(Mesh* mesh)
 	{
+		MeshFreeMaterials(mesh);
+
 		if (mesh->vertexArray)
-			glDeleteVertexArrays(1, &mesh->vertexArray);
+			StateDeleteVertexArrays(1, &mesh->vertexArray);
 
 		if (mesh->vertexBuffer)
-			glDeleteBuffers(1, &mesh->vertexBuffer);
+			StateDeleteBuffers(1, &mesh->vertexBuffer);
 
 		if (mesh->indexBuffer)
-			glDeleteBuffers(1, &mesh->indexBuffer);
+			StateDeleteBuffers(1, &mesh->indexBuffer);
 
+		free(mesh->clusters);
+		free(mesh->lods);
 		free(mesh);
 	}
 
@@ -518,15 +4284,69 @@ namespace gfxl
 
 	void Dispose(Texture2D* texture)
 	{
-		glDeleteTextures(1, &texture->id);
+		StateDeleteTextures(1, &texture->id);
 		free(texture);
 	}
 
 	void Dispose(Cubemap* cubemap)
 	{
-		glDeleteTextures(1, &cubemap->id);
+		StateDeleteTextures(1, &cubemap->id);
 		free(cubemap);
 	}
+
+	void Dispose(Environment* environment)
+	{
+		StateDeleteTextures(1, &environment->specular.id);
+		StateDeleteTextures(1, &environment->brdf.id);
+		free(environment);
+	}
+
+	void Dispose(ParameterBlock* block)
+	{
+		auto found = parameterBlockBindings.find(block->nameHash);
+		if (found != parameterBlockBindings.end() && found->second == block->binding)
+			parameterBlockBindings.erase(found);
+
+		StateDeleteBuffers(1, &block->buffer);
+		free(block->data);
+		free(block->members);
+		free(block);
+	}
+
+	void Dispose(RenderQueue* queue)
+	{
+		delete queue;
+	}
+
+	void Dispose(Pipeline* pipeline)
+	{
+		free(pipeline);
+	}
+
+	void Dispose(ShaderBatch* batch)
+	{
+		delete batch;
+	}
+
+	void Dispose(TextureBatch* batch)
+	{
+		Dispose(batch->group);
+
+		for (TextureBatchImage& image : batch->images)
+			TextureBatchImageFree(&image);
+
+		delete batch;
+	}
+
+	void Dispose(TextureStreamer* streamer)
+	{
+		Dispose(streamer->group);
+
+		for (TextureBatchImage& image : streamer->images)
+			TextureBatchImageFree(&image);
+
+		delete streamer;
+	}
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include <gfxl_mesh.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <glm\gtc\packing.hpp>
+
+namespace gfxl
+{
+	struct PackedVertex
+	{
+		ushort16 position[4];
+		uint32 normal;
+		uint32 texcoord;
+	};
+
+	static inline ushort16 PackUnorm16(float value)
+	{
+		return (ushort16)(Clamp(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	}
+
+	// Octahedral mapping: project on the octahedron, fold the lower half over the upper one.
+	static inline uint32 PackOctahedral(Vector3 normal)
+	{
+		normal /= Abs(normal.x) + Abs(normal.y) + Abs(normal.z) + 1e-20f;
+
+		Vector2 encoded(normal.x, normal.y);
+		if (normal.z < 0.0f)
+		{
+			encoded.x = (1.0f - Abs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f);
+			encoded.y = (1.0f - Abs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f);
+		}
+
+		return glm::packSnorm2x16(encoded);
+	}
+
+	// GL_INT_2_10_10_10_REV, x in the lowest bits and w left at 1.
+	static inline uint32 Pack1010102(const Vector3& normal)
+	{
+		int32 x = (int32)glm::round(Clamp(normal.x, -1.0f, 1.0f) * 511.0f);
+		int32 y = (int32)glm::round(Clamp(normal.y, -1.0f, 1.0f) * 511.0f);
+		int32 z = (int32)glm::round(Clamp(normal.z, -1.0f, 1.0f) * 511.0f);
+
+		return ((uint32)x & 0x3FF) | (((uint32)y & 0x3FF) << 10) | (((uint32)z & 0x3FF) << 20) | (1u << 30);
+	}
+
+	uint32 VertexFormatGetStride(VertexFormat format)
+	{
+		return format == VertexFormat::Float ? sizeof(Vertex) : sizeof(PackedVertex);
+	}
+
+	MeshData* CreateMeshData()
+	{
+		MeshData* data = (MeshData*)malloc(sizeof(MeshData));
+		*data = {};
+		return data;
+	}
+
+	void MeshDataComputeBounds(MeshData* data)
+	{
+		if (data->vertexCount == 0)
+		{
+			data->boundsMin = Vector3(0.0f);
+			data->boundsMax = Vector3(0.0f);
+			return;
+		}
+
+		Vector3 boundsMin = data->vertices[0].position;
+		Vector3 boundsMax = data->vertices[0].position;
+
+		for (uint32 i = 1; i < data->vertexCount; i++)
+		{
+			boundsMin = Min(boundsMin, data->vertices[i].position);
+			boundsMax = Max(boundsMax, data->vertices[i].position);
+		}
+
+		data->boundsMin = boundsMin;
+		data->boundsMax = boundsMax;
+	}
+
+	void MeshDataPackVertices(const MeshData* data, VertexFormat format, void* destination)
+	{
+		if (format == VertexFormat::Float)
+		{
+			memcpy(destination, data->vertices, sizeof(Vertex) * data->vertexCount);
+			return;
+		}
+
+		Vector3 extent = data->boundsMax - data->boundsMin;
+		Vector3 scale(
+			extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+			extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+			extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+		PackedVertex* packed = (PackedVertex*)destination;
+
+		for (uint32 i = 0; i < data->vertexCount; i++)
+		{
+			const Vertex& vertex = data->vertices[i];
+			Vector3 position = (vertex.position - data->boundsMin) * scale;
+
+			packed[i].position[0] = PackUnorm16(position.x);
+			packed[i].position[1] = PackUnorm16(position.y);
+			packed[i].position[2] = PackUnorm16(position.z);
+			packed[i].position[3] = 0;
+
+			packed[i].normal = format == VertexFormat::PackedOctahedral ?
+				PackOctahedral(vertex.normal) : Pack1010102(vertex.normal);
+
+			packed[i].texcoord = glm::packHalf2x16(vertex.texcoord);
+		}
+	}
+
+	void MeshDataClearLods(MeshData* data)
+	{
+		if (data->lods != nullptr)
+			data->indexCount = data->lods[0].indexCount;
+
+		// The submeshes of the other levels follow the first level's in the table.
+		if (data->lods != nullptr && data->submeshCount > 0)
+			data->submeshes = (MeshSubmesh*)realloc(data->submeshes, sizeof(MeshSubmesh) * data->submeshCount);
+
+		free(data->lods);
+		data->lods = nullptr;
+		data->lodCount = 0;
+	}
+
+	void Dispose(MeshData* data)
+	{
+		free(data->vertices);
+		free(data->indices);
+		free(data->submeshes);
+		free(data->materials);
+		free(data->textures);
+		free(data->libraries);
+		free(data->clusters);
+		free(data->lods);
+		free(data);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,248 @@
+#include <gfxl_mesh.h>
+
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace gfxl
+{
+	// Vertex limit per cluster, keeps clusters compact even on meshes with many seams.
+	static const uint32 ClusterMaxVertices = 96;
+
+	// Normal cones wider than this (dot product against the axis) can't ever be culled.
+	static const float ClusterMinConeDot = 0.1f;
+
+	struct ClusterBuilder
+	{
+		std::vector<uint32> offsets;
+		std::vector<uint32> triangles;
+		std::vector<bool> emitted;
+
+		// Cluster index + 1 the vertex was last added to, saves clearing a set per cluster.
+		std::vector<uint32> vertexStamp;
+		std::vector<uint32> candidateStamp;
+		std::vector<uint32> candidates;
+	};
+
+	// Only triangles in [begin, end), the submesh of the cluster, can join it.
+	static void ClusterAddCandidates(ClusterBuilder& builder, const uint32* indices, uint32 triangle, uint32 stamp,
+		uint32 begin, uint32 end)
+	{
+		for (uint32 i = 0; i < 3; i++)
+		{
+			uint32 vertex = indices[triangle * 3 + i];
+
+			for (uint32 j = builder.offsets[vertex]; j < builder.offsets[vertex + 1]; j++)
+			{
+				uint32 neighbour = builder.triangles[j];
+				if (builder.emitted[neighbour] || builder.candidateStamp[neighbour] == stamp ||
+					neighbour < begin || neighbour >= end)
+					continue;
+
+				builder.candidateStamp[neighbour] = stamp;
+				builder.candidates.push_back(neighbour);
+			}
+		}
+	}
+
+	static void ClusterComputeBounds(MeshCluster* cluster, const MeshData* data, const uint32* indices)
+	{
+		const uint32 begin = cluster->indexOffset;
+		const uint32 end = cluster->indexOffset + cluster->indexCount;
+
+		Vector3 boundsMin = data->vertices[indices[begin]].position;
+		Vector3 boundsMax = boundsMin;
+
+		for (uint32 i = begin; i < end; i++)
+		{
+			boundsMin = Min(boundsMin, data->vertices[indices[i]].position);
+			boundsMax = Max(boundsMax, data->vertices[indices[i]].position);
+		}
+
+		cluster->center = (boundsMin + boundsMax) * 0.5f;
+		cluster->radius = 0.0f;
+
+		Vector3 axis(0.0f);
+		for (uint32 i = begin; i < end; i += 3)
+		{
+			const Vector3& a = data->vertices[indices[i + 0]].position;
+			const Vector3& b = data->vertices[indices[i + 1]].position;
+			const Vector3& c = data->vertices[indices[i + 2]].position;
+
+			cluster->radius = Max(cluster->radius, Magnitude(a - cluster->center));
+			cluster->radius = Max(cluster->radius, Magnitude(b - cluster->center));
+			cluster->radius = Max(cluster->radius, Magnitude(c - cluster->center));
+
+			Vector3 normal = Cross(b - a, c - a);
+			float length = Magnitude(normal);
+			if (length > 0.0f)
+				axis += normal / length;
+		}
+
+		float axisLength = Magnitude(axis);
+		cluster->coneAxis = axisLength > 0.0f ? axis / axisLength : Vector3(0.0f, 0.0f, 1.0f);
+
+		float minDot = axisLength > 0.0f ? 1.0f : -1.0f;
+		for (uint32 i = begin; i < end; i += 3)
+		{
+			const Vector3& a = data->vertices[indices[i + 0]].position;
+			const Vector3& b = data->vertices[indices[i + 1]].position;
+			const Vector3& c = data->vertices[indices[i + 2]].position;
+
+			Vector3 normal = Cross(b - a, c - a);
+			float length = Magnitude(normal);
+			if (length > 0.0f)
+				minDot = Min(minDot, Dot(normal / length, cluster->coneAxis));
+		}
+
+		// Stored as the sine of the cone spread, so the culling test needs no trigonometry.
+		// A cutoff of 1 makes the test always fail.
+		cluster->coneCutoff = minDot < ClusterMinConeDot ? 1.0f : sqrtf(1.0f - minDot * minDot);
+	}
+
+	void MeshDataBuildClusters(MeshData* data, uint32 maxTriangles)
+	{
+		free(data->clusters);
+		data->clusters = nullptr;
+		data->clusterCount = 0;
+
+		MeshDataClearLods(data);
+
+		if (data->indices == nullptr || data->indexCount < 3)
+			return;
+
+		const uint32 triangleCount = data->indexCount / 3;
+		const uint32 vertexCount = data->vertexCount;
+		const uint32* indices = data->indices;
+
+		ClusterBuilder builder;
+		builder.offsets.assign(vertexCount + 1, 0);
+		builder.triangles.resize(triangleCount * 3);
+		builder.emitted.assign(triangleCount, false);
+		builder.vertexStamp.assign(vertexCount, 0);
+		builder.candidateStamp.assign(triangleCount, 0);
+
+		for (uint32 i = 0; i < triangleCount * 3; i++)
+			builder.offsets[indices[i] + 1]++;
+
+		for (uint32 i = 0; i < vertexCount; i++)
+			builder.offsets[i + 1] += builder.offsets[i];
+
+		std::vector<uint32> cursor(builder.offsets.begin(), builder.offsets.end() - 1);
+		for (uint32 i = 0; i < triangleCount * 3; i++)
+			builder.triangles[cursor[indices[i]]++] = i / 3;
+
+		std::vector<uint32> reordered;
+		reordered.reserve(triangleCount * 3);
+
+		std::vector<MeshCluster> clusters;
+		uint32 seed = 0;
+
+		// Seeds move forward through the submeshes and clusters never cross into the next one,
+		// so the triangles stay sorted by material.
+		uint32 submesh = 0;
+		uint32 rangeBegin = 0;
+		uint32 rangeEnd = triangleCount;
+
+		// Grow every cluster from a seed triangle, always adding the neighbour that brings
+		// the fewest new vertices, so clusters stay compact and their normal cones tight.
+		while (true)
+		{
+			while (seed < triangleCount && builder.emitted[seed])
+				seed++;
+
+			if (seed == triangleCount)
+				break;
+
+			while (submesh < data->submeshCount &&
+				(data->submeshes[submesh].indexOffset + data->submeshes[submesh].indexCount) / 3 <= seed)
+				submesh++;
+
+			if (submesh < data->submeshCount)
+			{
+				rangeBegin = data->submeshes[submesh].indexOffset / 3;
+				rangeEnd = (data->submeshes[submesh].indexOffset + data->submeshes[submesh].indexCount) / 3;
+			}
+
+			uint32 stamp = (uint32)clusters.size() + 1;
+			uint32 clusterVertices = 0;
+			uint32 clusterTriangles = 0;
+
+			MeshCluster cluster = {};
+			cluster.indexOffset = (uint32)reordered.size();
+
+			builder.candidates.clear();
+			uint32 next = seed;
+
+			while (true)
+			{
+				for (uint32 i = 0; i < 3; i++)
+				{
+					uint32 vertex = indices[next * 3 + i];
+					reordered.push_back(vertex);
+
+					if (builder.vertexStamp[vertex] != stamp)
+					{
+						builder.vertexStamp[vertex] = stamp;
+						clusterVertices++;
+					}
+				}
+
+				builder.emitted[next] = true;
+				clusterTriangles++;
+
+				if (clusterTriangles == maxTriangles)
+					break;
+
+				ClusterAddCandidates(builder, indices, next, stamp, rangeBegin, rangeEnd);
+
+				long64 best = -1;
+				uint32 bestNew = 4;
+
+				for (uint32 i = 0; i < builder.candidates.size(); )
+				{
+					uint32 triangle = builder.candidates[i];
+					if (builder.emitted[triangle])
+					{
+						builder.candidates[i] = builder.candidates.back();
+						builder.candidates.pop_back();
+						continue;
+					}
+
+					uint32 newVertices = 0;
+					for (uint32 j = 0; j < 3; j++)
+						newVertices += builder.vertexStamp[indices[triangle * 3 + j]] != stamp;
+
+					if (newVertices < bestNew && clusterVertices + newVertices <= ClusterMaxVertices)
+					{
+						best = triangle;
+						bestNew = newVertices;
+					}
+
+					i++;
+				}
+
+				if (best < 0)
+					break;
+
+				next = (uint32)best;
+			}
+
+			cluster.indexCount = clusterTriangles * 3;
+			clusters.push_back(cluster);
+		}
+
+		memcpy(data->indices, reordered.data(), sizeof(uint32) * reordered.size());
+		data->indexCount = (uint32)reordered.size();
+
+		for (MeshCluster& cluster : clusters)
+			ClusterComputeBounds(&cluster, data, data->indices);
+
+		data->clusterCount = (uint32)clusters.size();
+		data->clusters = (MeshCluster*)malloc(sizeof(MeshCluster) * data->clusterCount);
+		memcpy(data->clusters, clusters.data(), sizeof(MeshCluster) * data->clusterCount);
+
+		Message("Built %u clusters from %u triangles\n", data->clusterCount, triangleCount);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,497 @@
+#include <gfxl_mesh.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+namespace gfxl
+{
+	static const uint32 CookedMeshMagic = 0x4D584647; // "GFXM"
+	static const uint32 CookedMeshVersion = 8;
+	static const uint32 CookedMeshAlignment = 16;
+
+	// Every section offset is relative to the start of the file and aligned to CookedMeshAlignment.
+	struct CookedMeshHeader
+	{
+		uint32 magic;
+		uint32 version;
+
+		// Of the model and its material libraries together.
+		ulong64 sourceSize;
+		ulong64 sourceTime;
+		uint32 settingsKey;
+
+		uint32 vertexFormat;
+		uint32 vertexStride;
+		uint32 vertexCount;
+
+		uint32 indexSize;
+		uint32 indexCount;
+
+		uint32 submeshCount;
+		uint32 materialCount;
+		uint32 textureCount;
+		uint32 libraryCount;
+		uint32 clusterCount;
+		uint32 lodCount;
+
+		float32 boundsMin[3];
+		float32 boundsMax[3];
+
+		ulong64 vertexOffset;
+		ulong64 indexOffset;
+		ulong64 submeshOffset;
+		ulong64 materialOffset;
+		ulong64 textureOffset;
+		ulong64 libraryOffset;
+		ulong64 clusterOffset;
+		ulong64 lodOffset;
+	};
+
+	static inline ulong64 CookedAlign(ulong64 offset)
+	{
+		return (offset + CookedMeshAlignment - 1) & ~(ulong64)(CookedMeshAlignment - 1);
+	}
+
+	// Only settings that change the cooked geometry take part, the cache flag itself doesn't.
+	static uint32 CookedSettingsKey(const MeshLoadSettings& settings)
+	{
+		uint32 key = 0;
+		key |= settings.optimize ? 1 : 0;
+		key |= (uint32)settings.vertexFormat << 1;
+		key |= settings.clusters ? 1 << 3 : 0;
+		key |= (settings.lodCount & 0xFF) << 4;
+		key |= settings.stream ? 1 << 12 : 0;
+		return key;
+	}
+
+	// Total size and latest write time of the model and its libraries, a change to any of
+	// them changes one or the other.
+	static bool CookedGetSourceInfo(const char* sourceFilename, const MeshTexture* libraries, uint32 libraryCount,
+		ulong64* size, ulong64* writeTime)
+	{
+		if (!FileGetInfo(sourceFilename, size, writeTime))
+			return false;
+
+		for (uint32 i = 0; i < libraryCount; i++)
+		{
+			ulong64 librarySize, libraryTime;
+			if (!FileGetInfo(libraries[i].path, &librarySize, &libraryTime))
+				return false;
+
+			*size += librarySize;
+			*writeTime = Max(*writeTime, libraryTime);
+		}
+
+		return true;
+	}
+
+	static bool CookedWriteSection(FILE* file, ulong64* cursor, ulong64 offset, const void* data, size_t size)
+	{
+		static const char padding[CookedMeshAlignment] = {};
+
+		if (offset > *cursor && fwrite(padding, 1, (size_t)(offset - *cursor), file) != offset - *cursor)
+			return false;
+
+		if (size > 0 && fwrite(data, 1, size, file) != size)
+			return false;
+
+		*cursor = offset + size;
+		return true;
+	}
+
+	bool MeshDataWriteCooked(const MeshData* data, const char* filename,
+		const char* sourceFilename, const MeshLoadSettings& settings)
+	{
+		CookedMeshHeader header = {};
+		header.magic = CookedMeshMagic;
+		header.version = CookedMeshVersion;
+
+		header.libraryCount = data->libraries ? data->libraryCount : 0;
+
+		if (!CookedGetSourceInfo(sourceFilename, data->libraries, header.libraryCount, &header.sourceSize, &header.sourceTime))
+			return false;
+
+		header.settingsKey = CookedSettingsKey(settings);
+		header.vertexFormat = (uint32)settings.vertexFormat;
+		header.vertexStride = VertexFormatGetStride(settings.vertexFormat);
+		header.vertexCount = data->vertexCount;
+
+		// Indices are stored with the width they are drawn with.
+		header.indexSize = data->vertexCount <= 0x10000 ? sizeof(ushort16) : sizeof(uint32);
+		header.indexCount = data->indices ? data->indexCount : 0;
+
+		header.clusterCount = data->clusters ? data->clusterCount : 0;
+		header.lodCount = data->lods ? data->lodCount : 0;
+		header.materialCount = data->materials ? data->materialCount : 0;
+		header.textureCount = data->textures ? data->textureCount : 0;
+
+		// Geometry loaded without submeshes still gets one per level covering all of it.
+		const uint32 levelCount = header.lodCount > 0 ? header.lodCount : 1;
+		std::vector<MeshSubmesh> submeshes;
+
+		if (data->submeshes != nullptr && data->submeshCount > 0)
+		{
+			header.submeshCount = data->submeshCount;
+			submeshes.assign(data->submeshes, data->submeshes + (size_t)data->submeshCount * levelCount);
+		}
+		else
+		{
+			header.submeshCount = 1;
+			for (uint32 i = 0; i < levelCount; i++)
+			{
+				MeshSubmesh submesh;
+				submesh.indexOffset = data->lods ? data->lods[i].indexOffset : 0;
+				submesh.indexCount = data->lods ? data->lods[i].indexCount : header.indexCount;
+				submesh.material = MeshNoMaterial;
+				submeshes.push_back(submesh);
+			}
+		}
+
+		header.boundsMin[0] = data->boundsMin.x;
+		header.boundsMin[1] = data->boundsMin.y;
+		header.boundsMin[2] = data->boundsMin.z;
+		header.boundsMax[0] = data->boundsMax.x;
+		header.boundsMax[1] = data->boundsMax.y;
+		header.boundsMax[2] = data->boundsMax.z;
+
+		size_t vertexSize = (size_t)header.vertexStride * header.vertexCount;
+		size_t indexSize = (size_t)header.indexSize * header.indexCount;
+		size_t submeshSize = sizeof(MeshSubmesh) * submeshes.size();
+		size_t materialSize = sizeof(MeshMaterial) * header.materialCount;
+		size_t textureSize = sizeof(MeshTexture) * header.textureCount;
+		size_t librarySize = sizeof(MeshTexture) * header.libraryCount;
+		size_t clusterSize = sizeof(MeshCluster) * header.clusterCount;
+		size_t lodSize = sizeof(MeshLod) * header.lodCount;
+
+		header.vertexOffset = CookedAlign(sizeof(CookedMeshHeader));
+		header.indexOffset = CookedAlign(header.vertexOffset + vertexSize);
+		header.submeshOffset = CookedAlign(header.indexOffset + indexSize);
+		header.materialOffset = CookedAlign(header.submeshOffset + submeshSize);
+		header.textureOffset = CookedAlign(header.materialOffset + materialSize);
+		header.libraryOffset = CookedAlign(header.textureOffset + textureSize);
+		header.clusterOffset = CookedAlign(header.libraryOffset + librarySize);
+		header.lodOffset = CookedAlign(header.clusterOffset + clusterSize);
+
+		std::vector<char> vertices(vertexSize);
+		MeshDataPackVertices(data, settings.vertexFormat, vertices.data());
+
+		std::vector<ushort16> shortIndices;
+		const void* indices = data->indices;
+
+		if (header.indexSize == sizeof(ushort16))
+		{
+			shortIndices.assign(data->indices, data->indices + header.indexCount);
+			indices = shortIndices.data();
+		}
+
+		// Write next to the destination and swap it in at the end, a crash mid write
+		// must never leave a truncated file that looks valid.
+		std::string temporary = std::string(filename) + ".tmp";
+
+		FILE* file = fopen(temporary.c_str(), "wb");
+		if (file == nullptr)
+			return false;
+
+		ulong64 cursor = 0;
+		bool success =
+			CookedWriteSection(file, &cursor, 0, &header, sizeof(header)) &&
+			CookedWriteSection(file, &cursor, header.vertexOffset, vertices.data(), vertexSize) &&
+			CookedWriteSection(file, &cursor, header.indexOffset, indices, indexSize) &&
+			CookedWriteSection(file, &cursor, header.submeshOffset, submeshes.data(), submeshSize) &&
+			CookedWriteSection(file, &cursor, header.materialOffset, data->materials, materialSize) &&
+			CookedWriteSection(file, &cursor, header.textureOffset, data->textures, textureSize) &&
+			CookedWriteSection(file, &cursor, header.libraryOffset, data->libraries, librarySize) &&
+			CookedWriteSection(file, &cursor, header.clusterOffset, data->clusters, clusterSize) &&
+			CookedWriteSection(file, &cursor, header.lodOffset, data->lods, lodSize);
+
+		success = fclose(file) == 0 && success;
+
+		if (success)
+		{
+			remove(filename);
+			success = rename(temporary.c_str(), filename) == 0;
+		}
+
+		if (!success)
+			remove(temporary.c_str());
+
+		return success;
+	}
+
+	struct CookedMeshWriter
+	{
+		FILE* file;
+		FILE* indexFile;
+		ulong64 cursor;
+
+		std::string filename;
+		std::string temporary;
+		std::string indexTemporary;
+
+		CookedMeshHeader header;
+		VertexFormat vertexFormat;
+		Vector3 boundsMin;
+		Vector3 boundsMax;
+
+		std::vector<MeshCluster> clusters;
+		std::vector<char> packed;
+		std::vector<uint32> rebased;
+
+		bool failed;
+	};
+
+	CookedMeshWriter* CookedMeshWriterBegin(const char* filename, const char* sourceFilename,
+		const MeshLoadSettings& settings, const Vector3& boundsMin, const Vector3& boundsMax)
+	{
+		CookedMeshWriter* writer = new CookedMeshWriter();
+		writer->filename = filename;
+		writer->temporary = writer->filename + ".tmp";
+		writer->indexTemporary = writer->filename + ".indices.tmp";
+		writer->vertexFormat = settings.vertexFormat;
+		writer->boundsMin = boundsMin;
+		writer->boundsMax = boundsMax;
+
+		CookedMeshHeader& header = writer->header;
+		header.magic = CookedMeshMagic;
+		header.version = CookedMeshVersion;
+		header.settingsKey = CookedSettingsKey(settings);
+		header.vertexFormat = (uint32)settings.vertexFormat;
+		header.vertexStride = VertexFormatGetStride(settings.vertexFormat);
+		header.vertexOffset = CookedAlign(sizeof(CookedMeshHeader));
+
+		header.boundsMin[0] = boundsMin.x;
+		header.boundsMin[1] = boundsMin.y;
+		header.boundsMin[2] = boundsMin.z;
+		header.boundsMax[0] = boundsMax.x;
+		header.boundsMax[1] = boundsMax.y;
+		header.boundsMax[2] = boundsMax.z;
+
+		if (!FileGetInfo(sourceFilename, &header.sourceSize, &header.sourceTime))
+		{
+			delete writer;
+			return nullptr;
+		}
+
+		writer->file = fopen(writer->temporary.c_str(), "wb");
+		writer->indexFile = fopen(writer->indexTemporary.c_str(), "wb");
+
+		// The header is rewritten once the counts and offsets are known.
+		writer->failed = writer->file == nullptr || writer->indexFile == nullptr ||
+			!CookedWriteSection(writer->file, &writer->cursor, 0, &header, sizeof(header)) ||
+			!CookedWriteSection(writer->file, &writer->cursor, header.vertexOffset, nullptr, 0);
+
+		return writer;
+	}
+
+	void CookedMeshWriterAppend(CookedMeshWriter* writer,
+		const Vertex* vertices, uint32 vertexCount, const uint32* indices, uint32 indexCount)
+	{
+		if (writer->failed || vertexCount == 0 || indexCount == 0)
+			return;
+
+		CookedMeshHeader& header = writer->header;
+
+		// Packed positions are quantized against the bounds of the whole mesh, not the chunk.
+		MeshData chunk = {};
+		chunk.vertices = (Vertex*)vertices;
+		chunk.vertexCount = vertexCount;
+		chunk.boundsMin = writer->boundsMin;
+		chunk.boundsMax = writer->boundsMax;
+
+		writer->packed.resize((size_t)header.vertexStride * vertexCount);
+		MeshDataPackVertices(&chunk, writer->vertexFormat, writer->packed.data());
+
+		writer->rebased.resize(indexCount);
+		for (uint32 i = 0; i < indexCount; i++)
+			writer->rebased[i] = header.vertexCount + indices[i];
+
+		writer->failed =
+			!CookedWriteSection(writer->file, &writer->cursor, writer->cursor, writer->packed.data(), writer->packed.size()) ||
+			fwrite(writer->rebased.data(), sizeof(uint32), indexCount, writer->indexFile) != indexCount;
+
+		// Chunks are too large for a useful normal cone, they are only frustum culled.
+		MeshCluster cluster = {};
+		cluster.indexOffset = header.indexCount;
+		cluster.indexCount = indexCount;
+		cluster.coneAxis = Vector3(0.0f, 0.0f, 1.0f);
+		cluster.coneCutoff = 1.0f;
+
+		Vector3 chunkMin = vertices[0].position;
+		Vector3 chunkMax = vertices[0].position;
+
+		for (uint32 i = 1; i < vertexCount; i++)
+		{
+			chunkMin = Min(chunkMin, vertices[i].position);
+			chunkMax = Max(chunkMax, vertices[i].position);
+		}
+
+		cluster.center = (chunkMin + chunkMax) * 0.5f;
+		cluster.radius = Magnitude(chunkMax - chunkMin) * 0.5f;
+		writer->clusters.push_back(cluster);
+
+		header.vertexCount += vertexCount;
+		header.indexCount += indexCount;
+	}
+
+	bool CookedMeshWriterEnd(CookedMeshWriter* writer)
+	{
+		CookedMeshHeader& header = writer->header;
+		bool success = !writer->failed && header.indexCount > 0;
+
+		if (writer->indexFile != nullptr)
+			success = fclose(writer->indexFile) == 0 && success;
+
+		MeshSubmesh submesh;
+		submesh.indexOffset = 0;
+		submesh.indexCount = header.indexCount;
+		submesh.material = MeshNoMaterial;
+
+		header.indexSize = header.vertexCount <= 0x10000 ? sizeof(ushort16) : sizeof(uint32);
+		header.submeshCount = 1;
+		header.clusterCount = (uint32)writer->clusters.size();
+
+		header.indexOffset = CookedAlign(header.vertexOffset + (ulong64)header.vertexStride * header.vertexCount);
+		header.submeshOffset = CookedAlign(header.indexOffset + (ulong64)header.indexSize * header.indexCount);
+		header.materialOffset = CookedAlign(header.submeshOffset + sizeof(MeshSubmesh));
+		header.textureOffset = header.materialOffset;
+		header.libraryOffset = header.materialOffset;
+		header.clusterOffset = header.materialOffset;
+		header.lodOffset = CookedAlign(header.clusterOffset + sizeof(MeshCluster) * writer->clusters.size());
+
+		// Indices come back from the scratch file in blocks, narrowed on the way if they fit.
+		FILE* indexFile = success ? fopen(writer->indexTemporary.c_str(), "rb") : nullptr;
+		success = success && indexFile != nullptr &&
+			CookedWriteSection(writer->file, &writer->cursor, header.indexOffset, nullptr, 0);
+
+		std::vector<uint32> block(64 * 1024);
+		std::vector<ushort16> shortBlock(block.size());
+
+		for (uint32 remaining = header.indexCount; success && remaining > 0; )
+		{
+			uint32 count = remaining < block.size() ? remaining : (uint32)block.size();
+			success = fread(block.data(), sizeof(uint32), count, indexFile) == count;
+
+			if (success && header.indexSize == sizeof(ushort16))
+			{
+				std::copy(block.begin(), block.begin() + count, shortBlock.begin());
+				success = CookedWriteSection(writer->file, &writer->cursor, writer->cursor, shortBlock.data(), count * sizeof(ushort16));
+			}
+			else if (success)
+			{
+				success = CookedWriteSection(writer->file, &writer->cursor, writer->cursor, block.data(), count * sizeof(uint32));
+			}
+
+			remaining -= count;
+		}
+
+		if (indexFile != nullptr)
+			fclose(indexFile);
+
+		success = success &&
+			CookedWriteSection(writer->file, &writer->cursor, header.submeshOffset, &submesh, sizeof(submesh)) &&
+			CookedWriteSection(writer->file, &writer->cursor, header.clusterOffset, writer->clusters.data(), sizeof(MeshCluster) * writer->clusters.size()) &&
+			CookedWriteSection(writer->file, &writer->cursor, header.lodOffset, nullptr, 0) &&
+			fseek(writer->file, 0, SEEK_SET) == 0 &&
+			fwrite(&header, sizeof(header), 1, writer->file) == 1;
+
+		if (writer->file != nullptr)
+			success = fclose(writer->file) == 0 && success;
+
+		remove(writer->indexTemporary.c_str());
+
+		if (success)
+		{
+			remove(writer->filename.c_str());
+			success = rename(writer->temporary.c_str(), writer->filename.c_str()) == 0;
+		}
+
+		if (!success)
+			remove(writer->temporary.c_str());
+
+		delete writer;
+		return success;
+	}
+
+	bool CookedMeshOpen(CookedMesh* cooked, const char* filename,
+		const char* sourceFilename, const MeshLoadSettings& settings)
+	{
+		*cooked = {};
+
+		if (!MappedFileOpen(&cooked->file, filename))
+			return false;
+
+		const MappedFile& file = cooked->file;
+		const CookedMeshHeader* header = (const CookedMeshHeader*)file.data;
+
+		bool valid = file.size >= sizeof(CookedMeshHeader) &&
+			header->magic == CookedMeshMagic &&
+			header->version == CookedMeshVersion &&
+			header->settingsKey == CookedSettingsKey(settings) &&
+			header->vertexFormat == (uint32)settings.vertexFormat &&
+			header->vertexStride == VertexFormatGetStride(settings.vertexFormat) &&
+			(header->indexSize == sizeof(ushort16) || header->indexSize == sizeof(uint32)) &&
+			header->vertexOffset + (ulong64)header->vertexStride * header->vertexCount <= file.size &&
+			header->indexOffset + (ulong64)header->indexSize * header->indexCount <= file.size &&
+			header->submeshOffset + sizeof(MeshSubmesh) * (ulong64)header->submeshCount *
+				(header->lodCount > 0 ? header->lodCount : 1) <= file.size &&
+			header->materialOffset + sizeof(MeshMaterial) * (ulong64)header->materialCount <= file.size &&
+			header->textureOffset + sizeof(MeshTexture) * (ulong64)header->textureCount <= file.size &&
+			header->libraryOffset + sizeof(MeshTexture) * (ulong64)header->libraryCount <= file.size &&
+			header->clusterOffset + sizeof(MeshCluster) * (ulong64)header->clusterCount <= file.size &&
+			header->lodOffset + sizeof(MeshLod) * (ulong64)header->lodCount <= file.size;
+
+		// The libraries to stamp against only come from the file itself.
+		const MeshTexture* libraries = valid ? (const MeshTexture*)(file.data + header->libraryOffset) : nullptr;
+		for (uint32 i = 0; valid && i < header->libraryCount; i++)
+			valid = memchr(libraries[i].path, '\0', MeshMaxPathLength) != nullptr;
+
+		ulong64 sourceSize, sourceTime;
+		valid = valid &&
+			CookedGetSourceInfo(sourceFilename, libraries, header->libraryCount, &sourceSize, &sourceTime) &&
+			header->sourceSize == sourceSize &&
+			header->sourceTime == sourceTime;
+
+		if (!valid)
+		{
+			MappedFileClose(&cooked->file);
+			return false;
+		}
+
+		cooked->vertices = file.data + header->vertexOffset;
+		cooked->vertexCount = header->vertexCount;
+		cooked->vertexStride = header->vertexStride;
+		cooked->vertexFormat = (VertexFormat)header->vertexFormat;
+
+		cooked->indices = file.data + header->indexOffset;
+		cooked->indexCount = header->indexCount;
+		cooked->indexSize = header->indexSize;
+
+		cooked->submeshes = (const MeshSubmesh*)(file.data + header->submeshOffset);
+		cooked->submeshCount = header->submeshCount;
+
+		cooked->materials = (const MeshMaterial*)(file.data + header->materialOffset);
+		cooked->materialCount = header->materialCount;
+
+		cooked->textures = (const MeshTexture*)(file.data + header->textureOffset);
+		cooked->textureCount = header->textureCount;
+
+		cooked->clusters = (const MeshCluster*)(file.data + header->clusterOffset);
+		cooked->clusterCount = header->clusterCount;
+
+		cooked->lods = (const MeshLod*)(file.data + header->lodOffset);
+		cooked->lodCount = header->lodCount;
+
+		cooked->boundsMin = Vector3(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]);
+		cooked->boundsMax = Vector3(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]);
+		return true;
+	}
+
+	void CookedMeshClose(CookedMesh* cooked)
+	{
+		MappedFileClose(&cooked->file);
+		*cooked = {};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,225 @@
+#include <gfxl_mesh.h>
+#include <gfxl_core.h>
+
+#include <vector>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+
+namespace gfxl
+{
+	struct MtlTextureKey
+	{
+		const char* key;
+		MaterialTexture slot;
+	};
+
+	// Keys whose image means what the slot does, the first match wins for a slot. The specular
+	// color of map_Ks and the exponent of map_Ns are neither metallic nor roughness, they are
+	// left out rather than packed into the ORM texture as such.
+	static const MtlTextureKey MtlTextureKeys[] =
+	{
+		{ "map_Kd", MaterialTexture::Albedo },
+		{ "map_Bump", MaterialTexture::Normal },
+		{ "map_bump", MaterialTexture::Normal },
+		{ "bump", MaterialTexture::Normal },
+		{ "norm", MaterialTexture::Normal },
+		{ "map_Pm", MaterialTexture::Metallic },
+		{ "map_Pr", MaterialTexture::Roughness },
+		{ "map_Ke", MaterialTexture::Emission }
+	};
+
+	static inline bool MtlIsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	static void MtlCopyString(char* destination, uint32 capacity, const char* begin, const char* end)
+	{
+		size_t length = (size_t)(end - begin);
+		length = length < capacity - 1 ? length : capacity - 1;
+
+		memcpy(destination, begin, length);
+		destination[length] = '\0';
+	}
+
+	static Vector3 MtlParseColor(const char* p, const char* end)
+	{
+		std::string text(p, end);
+		Vector3 color(0.0f);
+
+		char* cursor = (char*)text.c_str();
+		for (int i = 0; i < 3; i++)
+		{
+			char* next;
+			float value = strtof(cursor, &next);
+			if (next == cursor)
+				return i == 1 ? Vector3(color.x) : color;
+
+			color[i] = value;
+			cursor = next;
+		}
+
+		return color;
+	}
+
+	static bool MtlIsOptionArgument(const char* begin, const char* end)
+	{
+		std::string token(begin, end);
+
+		// Switches, -imfchan channels, or numbers.
+		if (token == "on" || token == "off" || (token.size() == 1 && strchr("rgbmlz", token[0]) != nullptr))
+			return true;
+
+		char* numberEnd;
+		strtod(token.c_str(), &numberEnd);
+		return numberEnd != token.c_str() && *numberEnd == '\0';
+	}
+
+	// Texture statements may carry options (-bm 1.0, -s 1 1 1, ...) before the file name,
+	// the file name is whatever is left once they are skipped.
+	static const char* MtlSkipOptions(const char* p, const char* end)
+	{
+		while (p < end && *p == '-')
+		{
+			do
+			{
+				while (p < end && !MtlIsSpace(*p))
+					p++;
+
+				while (p < end && MtlIsSpace(*p))
+					p++;
+
+				const char* token = p;
+				while (token < end && !MtlIsSpace(*token))
+					token++;
+
+				if (p == end || !MtlIsOptionArgument(p, token))
+					break;
+			} while (true);
+		}
+
+		return p;
+	}
+
+	static uint32 MtlAddTexture(std::vector<MeshTexture>& textures, const std::string& path)
+	{
+		for (uint32 i = 0; i < textures.size(); i++)
+		{
+			if (path == textures[i].path)
+				return i;
+		}
+
+		MeshTexture texture;
+		MtlCopyString(texture.path, MeshMaxPathLength, path.c_str(), path.c_str() + path.size());
+		textures.push_back(texture);
+		return (uint32)textures.size() - 1;
+	}
+
+	bool MeshDataLoadMaterials(MeshData* data, const char* filename)
+	{
+		MappedFile file;
+		if (!MappedFileOpen(&file, filename))
+		{
+			Message("[ERROR] File not found: %s\n", filename);
+			return false;
+		}
+
+		std::string directory(filename);
+		size_t separator = directory.find_last_of("/\\");
+		directory = separator == std::string::npos ? std::string() : directory.substr(0, separator + 1);
+
+		std::vector<MeshMaterial> materials(data->materials, data->materials + data->materialCount);
+		std::vector<MeshTexture> textures(data->textures, data->textures + data->textureCount);
+
+		MeshMaterial* material = nullptr;
+		const char* fileEnd = file.data + file.size;
+
+		for (const char* p = file.data; p < fileEnd; )
+		{
+			const char* end = (const char*)memchr(p, '\n', fileEnd - p);
+			end = end ? end : fileEnd;
+
+			const char* next = end + 1;
+
+			while (p < end && MtlIsSpace(*p))
+				p++;
+
+			while (end > p && MtlIsSpace(end[-1]))
+				end--;
+
+			const char* key = p;
+			while (p < end && !MtlIsSpace(*p))
+				p++;
+
+			size_t keyLength = (size_t)(p - key);
+
+			while (p < end && MtlIsSpace(*p))
+				p++;
+
+			if (keyLength == 6 && memcmp(key, "newmtl", 6) == 0)
+			{
+				MeshMaterial newMaterial = {};
+				MtlCopyString(newMaterial.name, MeshMaxNameLength, p, end);
+				newMaterial.diffuseColor = Vector3(1.0f);
+				newMaterial.opacity = 1.0f;
+
+				for (uint32 i = 0; i < (uint32)MaterialTexture::Count; i++)
+					newMaterial.textures[i] = MeshNoTexture;
+
+				materials.push_back(newMaterial);
+				material = &materials.back();
+			}
+			else if (material != nullptr && keyLength > 0)
+			{
+				std::string name(key, keyLength);
+
+				if (name == "Kd")
+					material->diffuseColor = MtlParseColor(p, end);
+				else if (name == "Ks")
+					material->specularColor = MtlParseColor(p, end);
+				else if (name == "Ns")
+					material->specularPower = (float32)atof(std::string(p, end).c_str());
+				else if (name == "d")
+					material->opacity = (float32)atof(std::string(p, end).c_str());
+				else if (name == "Tr")
+					material->opacity = 1.0f - (float32)atof(std::string(p, end).c_str());
+				else
+				{
+					for (const MtlTextureKey& textureKey : MtlTextureKeys)
+					{
+						uint32& slot = material->textures[(int)textureKey.slot];
+						if (name != textureKey.key || slot != MeshNoTexture)
+							continue;
+
+						const char* path = MtlSkipOptions(p, end);
+						if (path < end)
+							slot = MtlAddTexture(textures, directory + std::string(path, end));
+
+						break;
+					}
+				}
+			}
+
+			p = next;
+		}
+
+		MappedFileClose(&file);
+
+		free(data->materials);
+		free(data->textures);
+
+		data->materialCount = (uint32)materials.size();
+		data->materials = (MeshMaterial*)malloc(sizeof(MeshMaterial) * (materials.size() > 0 ? materials.size() : 1));
+		memcpy(data->materials, materials.data(), sizeof(MeshMaterial) * materials.size());
+
+		data->textureCount = (uint32)textures.size();
+		data->textures = (MeshTexture*)malloc(sizeof(MeshTexture) * (textures.size() > 0 ? textures.size() : 1));
+		memcpy(data->textures, textures.data(), sizeof(MeshTexture) * textures.size());
+
+		data->libraries = (MeshTexture*)realloc(data->libraries, sizeof(MeshTexture) * (data->libraryCount + 1));
+		MtlCopyString(data->libraries[data->libraryCount++].path, MeshMaxPathLength, filename, filename + strlen(filename));
+
+		return true;
+	}
+}
\ No newline at end of file
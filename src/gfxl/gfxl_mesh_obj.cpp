@@ -0,0 +1,1087 @@
+#include <gfxl_mesh.h>
+#include <gfxl_core.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace gfxl
+{
+	// Files are cut in chunks of at least this size, anything smaller isn't worth a thread.
+	static const size_t ObjMinChunkSize = 256 * 1024;
+
+	// Indices are zero based and already resolved, -1 marks a missing attribute.
+	struct ObjCorner
+	{
+		int32 position;
+		int32 texcoord;
+		int32 normal;
+	};
+
+	// A usemtl statement, it applies from triangle on until the next one.
+	struct ObjMaterialUse
+	{
+		uint32 triangle;
+		const char* name;
+		const char* nameEnd;
+	};
+
+	struct ObjChunk
+	{
+		const char* begin;
+		const char* end;
+
+		// Statements that can't be resolved until every chunk is parsed.
+		std::vector<ObjMaterialUse> materialUses;
+		const char* library;
+		const char* libraryEnd;
+
+		uint32 positionCount;
+		uint32 texcoordCount;
+		uint32 normalCount;
+		uint32 cornerCount;
+
+		uint32 positionOffset;
+		uint32 texcoordOffset;
+		uint32 normalOffset;
+		uint32 cornerOffset;
+	};
+
+	struct ObjContext
+	{
+		std::vector<ObjChunk> chunks;
+
+		std::vector<Vector3> positions;
+		std::vector<Vector2> texcoords;
+		std::vector<Vector3> normals;
+		std::vector<ObjCorner> corners;
+
+		Vertex* vertices;
+	};
+
+	static inline bool ObjIsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	static inline bool ObjIsDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	static inline const char* ObjSkipSpaces(const char* p, const char* end)
+	{
+		while (p < end && ObjIsSpace(*p))
+			p++;
+
+		return p;
+	}
+
+	static inline const char* ObjLineEnd(const char* p, const char* end)
+	{
+		const char* newline = (const char*)memchr(p, '\n', end - p);
+		return newline ? newline : end;
+	}
+
+	static const char* ObjParseInt(const char* p, const char* end, int32* value)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		int32 result = 0;
+		while (p < end && ObjIsDigit(*p))
+			result = result * 10 + (*p++ - '0');
+
+		*value = negative ? -result : result;
+		return p;
+	}
+
+	static const char* ObjParseFloat(const char* p, const char* end, float* value)
+	{
+		static const double powers[] =
+		{
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+			1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+
+		p = ObjSkipSpaces(p, end);
+
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		// Only the first 19 significant digits fit in the mantissa, the rest only shift the exponent.
+		ulong64 mantissa = 0;
+		int digits = 0;
+		int exponent = 0;
+
+		while (p < end && ObjIsDigit(*p))
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0;
+			}
+			else
+			{
+				exponent++;
+			}
+
+			p++;
+		}
+
+		if (p < end && *p == '.')
+		{
+			p++;
+
+			while (p < end && ObjIsDigit(*p))
+			{
+				if (digits < 19)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					digits += mantissa != 0;
+					exponent--;
+				}
+
+				p++;
+			}
+		}
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			int32 e;
+			p = ObjParseInt(p + 1, end, &e);
+			exponent += e;
+		}
+
+		double result = (double)mantissa;
+		if (exponent < 0)
+			result = exponent >= -22 ? result / powers[-exponent] : result * pow(10.0, exponent);
+		else if (exponent > 0)
+			result = exponent <= 22 ? result * powers[exponent] : result * pow(10.0, exponent);
+
+		*value = (float)(negative ? -result : result);
+		return p;
+	}
+
+	// OBJ indices are one based, negative values are relative to the current end of the list.
+	static inline int32 ObjResolveIndex(int32 index, uint32 count)
+	{
+		if (index > 0)
+			return index - 1;
+
+		if (index < 0)
+			return (int32)count + index;
+
+		return -1;
+	}
+
+	static const char* ObjParseCorner(const char* p, const char* end, const ObjChunk& chunk,
+		uint32 positionCount, uint32 texcoordCount, uint32 normalCount, ObjCorner* corner)
+	{
+		int32 index;
+		p = ObjParseInt(p, end, &index);
+		corner->position = ObjResolveIndex(index, chunk.positionOffset + positionCount);
+		corner->texcoord = -1;
+		corner->normal = -1;
+
+		if (p < end && *p == '/')
+		{
+			p++;
+
+			if (p < end && *p != '/')
+			{
+				p = ObjParseInt(p, end, &index);
+				corner->texcoord = ObjResolveIndex(index, chunk.texcoordOffset + texcoordCount);
+			}
+
+			if (p < end && *p == '/')
+			{
+				p = ObjParseInt(p + 1, end, &index);
+				corner->normal = ObjResolveIndex(index, chunk.normalOffset + normalCount);
+			}
+		}
+
+		// Skip whatever is left of a malformed token.
+		while (p < end && !ObjIsSpace(*p))
+			p++;
+
+		return p;
+	}
+
+	static uint32 ObjCountFaceCorners(const char* p, const char* end)
+	{
+		uint32 count = 0;
+		while (true)
+		{
+			p = ObjSkipSpaces(p, end);
+			if (p == end || *p == '#')
+				break;
+
+			count++;
+			while (p < end && !ObjIsSpace(*p))
+				p++;
+		}
+
+		// Polygons are fanned into triangles.
+		return count >= 3 ? (count - 2) * 3 : 0;
+	}
+
+	static void ObjCountChunk(uint32 index, void* userData)
+	{
+		ObjContext* context = (ObjContext*)userData;
+		ObjChunk& chunk = context->chunks[index];
+
+		for (const char* p = chunk.begin; p < chunk.end; )
+		{
+			const char* end = ObjLineEnd(p, chunk.end);
+			p = ObjSkipSpaces(p, end);
+
+			if (end - p >= 2)
+			{
+				if (p[0] == 'v' && ObjIsSpace(p[1]))
+					chunk.positionCount++;
+				else if (p[0] == 'v' && p[1] == 't')
+					chunk.texcoordCount++;
+				else if (p[0] == 'v' && p[1] == 'n')
+					chunk.normalCount++;
+				else if (p[0] == 'f' && ObjIsSpace(p[1]))
+					chunk.cornerCount += ObjCountFaceCorners(p + 1, end);
+			}
+
+			p = end + 1;
+		}
+	}
+
+	static const char* ObjTrimEnd(const char* p, const char* end)
+	{
+		while (end > p && ObjIsSpace(end[-1]))
+			end--;
+
+		return end;
+	}
+
+	static void ObjParseChunk(uint32 index, void* userData)
+	{
+		ObjContext* context = (ObjContext*)userData;
+		ObjChunk& chunk = context->chunks[index];
+
+		Vector3* positions = context->positions.data() + chunk.positionOffset;
+		Vector2* texcoords = context->texcoords.data() + chunk.texcoordOffset;
+		Vector3* normals = context->normals.data() + chunk.normalOffset;
+		ObjCorner* corners = context->corners.data() + chunk.cornerOffset;
+
+		uint32 positionCount = 0;
+		uint32 texcoordCount = 0;
+		uint32 normalCount = 0;
+		uint32 cornerCount = 0;
+
+		for (const char* p = chunk.begin; p < chunk.end; )
+		{
+			const char* end = ObjLineEnd(p, chunk.end);
+			p = ObjSkipSpaces(p, end);
+
+			if (end - p >= 2)
+			{
+				if (p[0] == 'v' && ObjIsSpace(p[1]))
+				{
+					Vector3& position = positions[positionCount++];
+					p = ObjParseFloat(p + 1, end, &position.x);
+					p = ObjParseFloat(p, end, &position.y);
+					p = ObjParseFloat(p, end, &position.z);
+				}
+				else if (p[0] == 'v' && p[1] == 't')
+				{
+					Vector2& texcoord = texcoords[texcoordCount++];
+					p = ObjParseFloat(p + 2, end, &texcoord.x);
+					p = ObjParseFloat(p, end, &texcoord.y);
+				}
+				else if (p[0] == 'v' && p[1] == 'n')
+				{
+					Vector3& normal = normals[normalCount++];
+					p = ObjParseFloat(p + 2, end, &normal.x);
+					p = ObjParseFloat(p, end, &normal.y);
+					p = ObjParseFloat(p, end, &normal.z);
+				}
+				else if (p[0] == 'f' && ObjIsSpace(p[1]))
+				{
+					ObjCorner first, previous;
+					uint32 count = 0;
+
+					for (p = p + 1; ; count++)
+					{
+						p = ObjSkipSpaces(p, end);
+						if (p == end || *p == '#')
+							break;
+
+						ObjCorner corner;
+						p = ObjParseCorner(p, end, chunk, positionCount, texcoordCount, normalCount, &corner);
+
+						if (count == 0)
+							first = corner;
+						else if (count >= 2)
+						{
+							corners[cornerCount++] = first;
+							corners[cornerCount++] = previous;
+							corners[cornerCount++] = corner;
+						}
+
+						previous = corner;
+					}
+				}
+				else if (end - p > 7 && memcmp(p, "usemtl", 6) == 0 && ObjIsSpace(p[6]))
+				{
+					ObjMaterialUse use;
+					use.triangle = (chunk.cornerOffset + cornerCount) / 3;
+					use.name = ObjSkipSpaces(p + 7, end);
+					use.nameEnd = ObjTrimEnd(use.name, end);
+					chunk.materialUses.push_back(use);
+				}
+				else if (end - p > 7 && memcmp(p, "mtllib", 6) == 0 && ObjIsSpace(p[6]) && chunk.library == nullptr)
+				{
+					chunk.library = ObjSkipSpaces(p + 7, end);
+					chunk.libraryEnd = ObjTrimEnd(chunk.library, end);
+				}
+			}
+
+			p = end + 1;
+		}
+	}
+
+	static inline uint32 ObjHashCorner(const ObjCorner& corner)
+	{
+		uint32 hash = (uint32)corner.position * 0x9E3779B1u;
+		hash ^= (uint32)corner.texcoord * 0x85EBCA77u;
+		hash ^= (uint32)corner.normal * 0xC2B2AE3Du;
+		hash ^= hash >> 15;
+		hash *= 0x2C1B3C6Du;
+		hash ^= hash >> 13;
+		return hash;
+	}
+
+	static inline bool ObjCornerEquals(const ObjCorner& a, const ObjCorner& b)
+	{
+		return a.position == b.position && a.texcoord == b.texcoord && a.normal == b.normal;
+	}
+
+	// Welds identical (position, texcoord, normal) triplets into one vertex. Every corner
+	// gets an index, and the first corner of every unique triplet is kept in the unique list.
+	static uint32 ObjWeldCorners(const ObjContext& context, uint32* indices, std::vector<uint32>& unique)
+	{
+		const uint32 cornerCount = (uint32)context.corners.size();
+		const uint32 empty = 0xFFFFFFFF;
+
+		// Open addressing with linear probing, kept at most half full.
+		uint32 capacity = 64;
+		while (capacity < cornerCount * 2)
+			capacity *= 2;
+
+		std::vector<uint32> table(capacity, empty);
+		const uint32 mask = capacity - 1;
+
+		unique.clear();
+		unique.reserve(cornerCount / 4);
+
+		for (uint32 i = 0; i < cornerCount; i++)
+		{
+			const ObjCorner& corner = context.corners[i];
+			uint32 slot = ObjHashCorner(corner) & mask;
+
+			while (true)
+			{
+				uint32 vertex = table[slot];
+				if (vertex == empty)
+				{
+					vertex = (uint32)unique.size();
+					table[slot] = vertex;
+					unique.push_back(i);
+					indices[i] = vertex;
+					break;
+				}
+
+				if (ObjCornerEquals(context.corners[unique[vertex]], corner))
+				{
+					indices[i] = vertex;
+					break;
+				}
+
+				slot = (slot + 1) & mask;
+			}
+		}
+
+		return (uint32)unique.size();
+	}
+
+	struct ObjVertexBuild
+	{
+		const ObjContext* context;
+		const uint32* unique;
+		uint32 count;
+		uint32 blockSize;
+	};
+
+	static void ObjBuildVertices(uint32 index, void* userData)
+	{
+		const ObjVertexBuild* build = (const ObjVertexBuild*)userData;
+		const ObjContext* context = build->context;
+
+		const uint32 positionCount = (uint32)context->positions.size();
+		const uint32 texcoordCount = (uint32)context->texcoords.size();
+		const uint32 normalCount = (uint32)context->normals.size();
+
+		uint32 begin = index * build->blockSize;
+		uint32 end = begin + build->blockSize < build->count ? begin + build->blockSize : build->count;
+
+		for (uint32 i = begin; i < end; i++)
+		{
+			const ObjCorner& corner = context->corners[build->unique[i]];
+			Vertex& vertex = context->vertices[i];
+
+			vertex.position = (uint32)corner.position < positionCount ? context->positions[corner.position] : Vector3(0.0f);
+			vertex.texcoord = (uint32)corner.texcoord < texcoordCount ? context->texcoords[corner.texcoord] : Vector2(0.0f);
+			vertex.normal = (uint32)corner.normal < normalCount ? context->normals[corner.normal] : Vector3(0.0f);
+		}
+	}
+
+	static uint32 ObjFindMaterial(const MeshData* data, const char* name, const char* nameEnd)
+	{
+		size_t length = (size_t)(nameEnd - name);
+
+		for (uint32 i = 0; i < data->materialCount; i++)
+		{
+			const char* materialName = data->materials[i].name;
+			if (strlen(materialName) == length && memcmp(materialName, name, length) == 0)
+				return i;
+		}
+
+		return MeshNoMaterial;
+	}
+
+	// Loads the first material library of the file and assigns a material to every triangle,
+	// a usemtl holds until the next one even across chunks.
+	static void ObjResolveMaterials(const ObjContext& context, MeshData* data, const char* filename,
+		std::vector<uint32>& triangleMaterials)
+	{
+		for (const ObjChunk& chunk : context.chunks)
+		{
+			if (chunk.library == nullptr)
+				continue;
+
+			std::string path(filename);
+			size_t separator = path.find_last_of("/\\");
+			path = separator == std::string::npos ? std::string() : path.substr(0, separator + 1);
+			path.append(chunk.library, chunk.libraryEnd);
+
+			MeshDataLoadMaterials(data, path.c_str());
+			break;
+		}
+
+		uint32 material = MeshNoMaterial;
+		uint32 triangle = 0;
+		std::vector<std::string> unknown;
+
+		for (const ObjChunk& chunk : context.chunks)
+		{
+			for (const ObjMaterialUse& use : chunk.materialUses)
+			{
+				for (; triangle < use.triangle; triangle++)
+					triangleMaterials[triangle] = material;
+
+				material = ObjFindMaterial(data, use.name, use.nameEnd);
+
+				std::string name(use.name, use.nameEnd);
+				if (material == MeshNoMaterial && std::find(unknown.begin(), unknown.end(), name) == unknown.end())
+				{
+					Message("[ERROR] Unknown material %s in %s\n", name.c_str(), filename);
+					unknown.push_back(name);
+				}
+			}
+		}
+
+		for (; triangle < triangleMaterials.size(); triangle++)
+			triangleMaterials[triangle] = material;
+	}
+
+	// Stable counting sort of the triangles by material, one submesh per material in use.
+	// Triangles without a material go last.
+	static void ObjBuildSubmeshes(MeshData* data, const std::vector<uint32>& triangleMaterials)
+	{
+		const uint32 triangleCount = data->indexCount / 3;
+		const uint32 bucketCount = data->materialCount + 1;
+
+		std::vector<uint32> offsets(bucketCount + 1, 0);
+		for (uint32 material : triangleMaterials)
+			offsets[(material == MeshNoMaterial ? data->materialCount : material) + 1]++;
+
+		std::vector<MeshSubmesh> submeshes;
+		for (uint32 i = 0; i < bucketCount; i++)
+		{
+			if (offsets[i + 1] > 0)
+			{
+				MeshSubmesh submesh;
+				submesh.indexOffset = offsets[i] * 3;
+				submesh.indexCount = offsets[i + 1] * 3;
+				submesh.material = i < data->materialCount ? i : MeshNoMaterial;
+				submeshes.push_back(submesh);
+			}
+
+			offsets[i + 1] += offsets[i];
+		}
+
+		if (submeshes.size() > 1)
+		{
+			std::vector<uint32> sorted(triangleCount * 3);
+			for (uint32 i = 0; i < triangleCount; i++)
+			{
+				uint32 bucket = triangleMaterials[i] == MeshNoMaterial ? data->materialCount : triangleMaterials[i];
+				uint32 target = offsets[bucket]++;
+
+				sorted[target * 3 + 0] = data->indices[i * 3 + 0];
+				sorted[target * 3 + 1] = data->indices[i * 3 + 1];
+				sorted[target * 3 + 2] = data->indices[i * 3 + 2];
+			}
+
+			memcpy(data->indices, sorted.data(), sizeof(uint32) * sorted.size());
+		}
+
+		data->submeshCount = (uint32)submeshes.size();
+		data->submeshes = (MeshSubmesh*)malloc(sizeof(MeshSubmesh) * (submeshes.size() > 0 ? submeshes.size() : 1));
+		memcpy(data->submeshes, submeshes.data(), sizeof(MeshSubmesh) * submeshes.size());
+	}
+
+	bool MeshDataLoadFromObjFile(MeshData* data, const char* filename)
+	{
+		double start = GetTime();
+
+		MappedFile file;
+		if (!MappedFileOpen(&file, filename))
+		{
+			Message("[ERROR] File not found: %s\n", filename);
+			return false;
+		}
+
+		ObjContext context;
+
+		// Cut the file in line aligned chunks, every chunk is parsed by a single worker.
+		uint32 chunkCount = (uint32)(file.size / ObjMinChunkSize);
+		uint32 maxChunkCount = GetWorkerCount() * 4;
+		chunkCount = chunkCount < 1 ? 1 : (chunkCount > maxChunkCount ? maxChunkCount : chunkCount);
+
+		const char* fileEnd = file.data + file.size;
+		const char* begin = file.data;
+
+		for (uint32 i = 0; i < chunkCount; i++)
+		{
+			const char* end = fileEnd;
+			if (i + 1 < chunkCount)
+			{
+				end = file.data + file.size / chunkCount * (i + 1);
+				end = end < begin ? begin : end;
+				end = ObjLineEnd(end, fileEnd);
+				end = end < fileEnd ? end + 1 : end;
+			}
+
+			ObjChunk chunk = {};
+			chunk.begin = begin;
+			chunk.end = end;
+			context.chunks.push_back(chunk);
+
+			begin = end;
+		}
+
+		ParallelFor(chunkCount, ObjCountChunk, &context);
+
+		// Every chunk writes its results at a fixed offset, so the merged arrays keep file order.
+		uint32 positionCount = 0;
+		uint32 texcoordCount = 0;
+		uint32 normalCount = 0;
+		uint32 cornerCount = 0;
+
+		for (ObjChunk& chunk : context.chunks)
+		{
+			chunk.positionOffset = positionCount;
+			chunk.texcoordOffset = texcoordCount;
+			chunk.normalOffset = normalCount;
+			chunk.cornerOffset = cornerCount;
+
+			positionCount += chunk.positionCount;
+			texcoordCount += chunk.texcoordCount;
+			normalCount += chunk.normalCount;
+			cornerCount += chunk.cornerCount;
+		}
+
+		context.positions.resize(positionCount);
+		context.texcoords.resize(texcoordCount);
+		context.normals.resize(normalCount);
+		context.corners.resize(cornerCount);
+
+		ParallelFor(chunkCount, ObjParseChunk, &context);
+
+		uint32* indices = (uint32*)malloc(sizeof(uint32) * (cornerCount > 0 ? cornerCount : 1));
+
+		std::vector<uint32> unique;
+		uint32 vertexCount = ObjWeldCorners(context, indices, unique);
+
+		ObjVertexBuild build;
+		build.context = &context;
+		build.unique = unique.data();
+		build.count = vertexCount;
+		build.blockSize = 16 * 1024;
+
+		context.vertices = (Vertex*)malloc(sizeof(Vertex) * (vertexCount > 0 ? vertexCount : 1));
+		ParallelFor((vertexCount + build.blockSize - 1) / build.blockSize, ObjBuildVertices, &build);
+
+		free(data->vertices);
+		free(data->indices);
+		free(data->submeshes);
+		free(data->materials);
+		free(data->textures);
+		free(data->libraries);
+		free(data->clusters);
+		free(data->lods);
+
+		*data = {};
+		data->vertices = context.vertices;
+		data->vertexCount = vertexCount;
+		data->indices = indices;
+		data->indexCount = cornerCount;
+
+		MeshDataComputeBounds(data);
+
+		std::vector<uint32> triangleMaterials(cornerCount / 3);
+		ObjResolveMaterials(context, data, filename, triangleMaterials);
+		ObjBuildSubmeshes(data, triangleMaterials);
+
+		double elapsed = GetTime() - start;
+		double megabytes = file.size / (1024.0 * 1024.0);
+
+		Message("Loaded %s: %.2f MB, %u triangles, %u vertices, %u submeshes in %.2f ms (%.1f MB/s)\n",
+			filename, megabytes, cornerCount / 3, vertexCount, data->submeshCount, elapsed * 1000.0,
+			elapsed > 0.0 ? megabytes / elapsed : 0.0);
+
+		MappedFileClose(&file);
+		return true;
+	}
+
+	// Streaming import defaults, and the depth at which a bucket that won't split is cut as is.
+	static const uint32 ObjStreamDefaultBudget = 256;
+	static const uint32 ObjStreamMaxDepth = 24;
+
+	struct ObjTriangle
+	{
+		ObjCorner corners[3];
+	};
+
+	// A scratch file of triangles whose centroids all fall in the bounds.
+	struct ObjStreamBucket
+	{
+		std::string filename;
+		ulong64 triangleCount;
+		Vector3 boundsMin;
+		Vector3 boundsMax;
+		uint32 depth;
+	};
+
+	struct ObjStream
+	{
+		std::string scratch;
+		uint32 scratchCount;
+
+		size_t windowSize;
+		size_t fileBufferSize;
+		uint32 chunkTriangles;
+
+		FILE* positionFile;
+		FILE* texcoordFile;
+		FILE* normalFile;
+		FILE* triangleFile;
+
+		uint32 positionCount;
+		uint32 texcoordCount;
+		uint32 normalCount;
+		ulong64 triangleCount;
+
+		Vector3 boundsMin;
+		Vector3 boundsMax;
+
+		// The attribute scratch files are mapped once the first pass is done, so random
+		// lookups go through the page cache instead of the heap.
+		MappedFile positions;
+		MappedFile texcoords;
+		MappedFile normals;
+	};
+
+	static std::string ObjStreamScratchFilename(ObjStream& stream)
+	{
+		return stream.scratch + "." + std::to_string(stream.scratchCount++) + ".tmp";
+	}
+
+	static FILE* ObjStreamOpenScratch(const ObjStream& stream, const std::string& filename, const char* mode)
+	{
+		FILE* file = fopen(filename.c_str(), mode);
+		if (file != nullptr)
+			setvbuf(file, nullptr, _IOFBF, stream.fileBufferSize);
+
+		return file;
+	}
+
+	static void ObjStreamParseLine(ObjStream& stream, const char* p, const char* end)
+	{
+		p = ObjSkipSpaces(p, end);
+		if (end - p < 2)
+			return;
+
+		if (p[0] == 'v' && ObjIsSpace(p[1]))
+		{
+			Vector3 position;
+			p = ObjParseFloat(p + 1, end, &position.x);
+			p = ObjParseFloat(p, end, &position.y);
+			p = ObjParseFloat(p, end, &position.z);
+
+			stream.boundsMin = stream.positionCount == 0 ? position : Min(stream.boundsMin, position);
+			stream.boundsMax = stream.positionCount == 0 ? position : Max(stream.boundsMax, position);
+
+			fwrite(&position, sizeof(position), 1, stream.positionFile);
+			stream.positionCount++;
+		}
+		else if (p[0] == 'v' && p[1] == 't')
+		{
+			Vector2 texcoord;
+			p = ObjParseFloat(p + 2, end, &texcoord.x);
+			p = ObjParseFloat(p, end, &texcoord.y);
+
+			fwrite(&texcoord, sizeof(texcoord), 1, stream.texcoordFile);
+			stream.texcoordCount++;
+		}
+		else if (p[0] == 'v' && p[1] == 'n')
+		{
+			Vector3 normal;
+			p = ObjParseFloat(p + 2, end, &normal.x);
+			p = ObjParseFloat(p, end, &normal.y);
+			p = ObjParseFloat(p, end, &normal.z);
+
+			fwrite(&normal, sizeof(normal), 1, stream.normalFile);
+			stream.normalCount++;
+		}
+		else if (p[0] == 'f' && ObjIsSpace(p[1]))
+		{
+			// Relative indices resolve against everything read so far.
+			ObjChunk chunk = {};
+			chunk.positionOffset = stream.positionCount;
+			chunk.texcoordOffset = stream.texcoordCount;
+			chunk.normalOffset = stream.normalCount;
+
+			ObjTriangle triangle;
+			uint32 count = 0;
+
+			for (p = p + 1; ; count++)
+			{
+				p = ObjSkipSpaces(p, end);
+				if (p == end || *p == '#')
+					break;
+
+				ObjCorner corner;
+				p = ObjParseCorner(p, end, chunk, 0, 0, 0, &corner);
+
+				if (count == 0)
+					triangle.corners[0] = corner;
+				else if (count >= 2)
+				{
+					triangle.corners[2] = corner;
+					fwrite(&triangle, sizeof(triangle), 1, stream.triangleFile);
+					stream.triangleCount++;
+				}
+
+				triangle.corners[1] = corner;
+			}
+		}
+	}
+
+	// First pass, splits the file in flat attribute arrays and a list of triangles, reading
+	// it a window at a time.
+	static bool ObjStreamSplitFile(ObjStream& stream, const char* filename, const std::string& triangleFilename)
+	{
+		FILE* file = fopen(filename, "rb");
+		if (file == nullptr)
+		{
+			Message("[ERROR] File not found: %s\n", filename);
+			return false;
+		}
+
+		stream.positionFile = ObjStreamOpenScratch(stream, stream.scratch + ".positions.tmp", "wb");
+		stream.texcoordFile = ObjStreamOpenScratch(stream, stream.scratch + ".texcoords.tmp", "wb");
+		stream.normalFile = ObjStreamOpenScratch(stream, stream.scratch + ".normals.tmp", "wb");
+		stream.triangleFile = ObjStreamOpenScratch(stream, triangleFilename, "wb");
+
+		bool success = stream.positionFile && stream.texcoordFile && stream.normalFile && stream.triangleFile;
+
+		std::vector<char> window(stream.windowSize);
+		size_t used = 0;
+
+		while (success)
+		{
+			size_t read = fread(window.data() + used, 1, window.size() - used, file);
+			used += read;
+
+			bool last = read == 0;
+			const char* begin = window.data();
+			const char* end = begin + used;
+
+			// Only whole lines are parsed, the tail waits for the next window.
+			const char* parsedEnd = end;
+			if (!last)
+			{
+				while (parsedEnd > begin && parsedEnd[-1] != '\n')
+					parsedEnd--;
+
+				if (parsedEnd == begin)
+				{
+					Message("[ERROR] Line longer than the streaming window in %s\n", filename);
+					success = false;
+					break;
+				}
+			}
+
+			for (const char* p = begin; p < parsedEnd; )
+			{
+				const char* lineEnd = ObjLineEnd(p, parsedEnd);
+				ObjStreamParseLine(stream, p, lineEnd);
+				p = lineEnd + 1;
+			}
+
+			used = end - parsedEnd;
+			memmove(window.data(), parsedEnd, used);
+
+			if (last)
+				break;
+		}
+
+		fclose(file);
+
+		for (FILE* scratch : { stream.positionFile, stream.texcoordFile, stream.normalFile, stream.triangleFile })
+		{
+			if (scratch != nullptr && (ferror(scratch) || fclose(scratch) != 0))
+				success = false;
+		}
+
+		return success;
+	}
+
+	static Vector3 ObjStreamCentroid(const ObjStream& stream, const ObjTriangle& triangle)
+	{
+		const Vector3* positions = (const Vector3*)stream.positions.data;
+		Vector3 centroid(0.0f);
+
+		for (uint32 i = 0; i < 3; i++)
+		{
+			uint32 position = (uint32)triangle.corners[i].position;
+			centroid += position < stream.positionCount ? positions[position] : Vector3(0.0f);
+		}
+
+		return centroid / 3.0f;
+	}
+
+	// Spreads the triangles of a bucket over its eight octants, by centroid.
+	static bool ObjStreamSplitBucket(ObjStream& stream, const ObjStreamBucket& bucket, std::vector<ObjStreamBucket>& pending)
+	{
+		ObjStreamBucket children[8];
+		FILE* files[8];
+
+		Vector3 center = (bucket.boundsMin + bucket.boundsMax) * 0.5f;
+		bool success = true;
+
+		for (uint32 i = 0; i < 8; i++)
+		{
+			children[i].filename = ObjStreamScratchFilename(stream);
+			children[i].triangleCount = 0;
+			children[i].boundsMin = Vector3(
+				i & 1 ? center.x : bucket.boundsMin.x,
+				i & 2 ? center.y : bucket.boundsMin.y,
+				i & 4 ? center.z : bucket.boundsMin.z);
+			children[i].boundsMax = Vector3(
+				i & 1 ? bucket.boundsMax.x : center.x,
+				i & 2 ? bucket.boundsMax.y : center.y,
+				i & 4 ? bucket.boundsMax.z : center.z);
+			children[i].depth = bucket.depth + 1;
+
+			files[i] = ObjStreamOpenScratch(stream, children[i].filename, "wb");
+			success = success && files[i] != nullptr;
+		}
+
+		FILE* input = fopen(bucket.filename.c_str(), "rb");
+		success = success && input != nullptr;
+
+		std::vector<ObjTriangle> triangles(stream.windowSize / sizeof(ObjTriangle));
+
+		while (success)
+		{
+			size_t count = fread(triangles.data(), sizeof(ObjTriangle), triangles.size(), input);
+			if (count == 0)
+				break;
+
+			for (size_t i = 0; i < count; i++)
+			{
+				Vector3 centroid = ObjStreamCentroid(stream, triangles[i]);
+				uint32 octant = (centroid.x >= center.x ? 1 : 0) | (centroid.y >= center.y ? 2 : 0) | (centroid.z >= center.z ? 4 : 0);
+
+				fwrite(&triangles[i], sizeof(ObjTriangle), 1, files[octant]);
+				children[octant].triangleCount++;
+			}
+		}
+
+		if (input != nullptr)
+			fclose(input);
+
+		remove(bucket.filename.c_str());
+
+		for (uint32 i = 0; i < 8; i++)
+		{
+			if (files[i] != nullptr && (ferror(files[i]) || fclose(files[i]) != 0))
+				success = false;
+
+			if (children[i].triangleCount > 0)
+				pending.push_back(children[i]);
+			else
+				remove(children[i].filename.c_str());
+		}
+
+		return success;
+	}
+
+	// Welds and writes the triangles of a bucket, a chunk at a time.
+	static bool ObjStreamEmitBucket(ObjStream& stream, const ObjStreamBucket& bucket, CookedMeshWriter* writer)
+	{
+		FILE* input = fopen(bucket.filename.c_str(), "rb");
+		if (input == nullptr)
+			return false;
+
+		const Vector3* positions = (const Vector3*)stream.positions.data;
+		const Vector2* texcoords = (const Vector2*)stream.texcoords.data;
+		const Vector3* normals = (const Vector3*)stream.normals.data;
+
+		ObjContext context;
+		std::vector<ObjTriangle> triangles(stream.chunkTriangles);
+		std::vector<uint32> indices;
+		std::vector<uint32> unique;
+		std::vector<Vertex> vertices;
+
+		while (true)
+		{
+			size_t count = fread(triangles.data(), sizeof(ObjTriangle), triangles.size(), input);
+			if (count == 0)
+				break;
+
+			context.corners.assign(&triangles[0].corners[0], &triangles[0].corners[0] + count * 3);
+			indices.resize(count * 3);
+
+			uint32 vertexCount = ObjWeldCorners(context, indices.data(), unique);
+			vertices.resize(vertexCount);
+
+			for (uint32 i = 0; i < vertexCount; i++)
+			{
+				const ObjCorner& corner = context.corners[unique[i]];
+				Vertex& vertex = vertices[i];
+
+				vertex.position = (uint32)corner.position < stream.positionCount ? positions[corner.position] : Vector3(0.0f);
+				vertex.texcoord = (uint32)corner.texcoord < stream.texcoordCount ? texcoords[corner.texcoord] : Vector2(0.0f);
+				vertex.normal = (uint32)corner.normal < stream.normalCount ? normals[corner.normal] : Vector3(0.0f);
+			}
+
+			CookedMeshWriterAppend(writer, vertices.data(), vertexCount, indices.data(), (uint32)indices.size());
+		}
+
+		fclose(input);
+		remove(bucket.filename.c_str());
+		return true;
+	}
+
+	bool MeshStreamObjToCooked(const char* filename, const char* cookedFilename, const MeshLoadSettings& settings)
+	{
+		double start = GetTime();
+
+		// The budget is shared between the read window, the scratch file buffers (up to eight
+		// open at once) and the chunk being welded, which costs about 160 bytes a triangle.
+		size_t budget = (size_t)(settings.streamBudget > 0 ? settings.streamBudget : ObjStreamDefaultBudget) * 1024 * 1024;
+
+		ObjStream stream = {};
+		stream.scratch = cookedFilename;
+		stream.windowSize = Max(budget / 8, (size_t)(1024 * 1024));
+		stream.fileBufferSize = Max(budget / 32, (size_t)(64 * 1024));
+		stream.chunkTriangles = (uint32)Clamp(budget / 2 / 160, (size_t)4096, (size_t)(1024 * 1024));
+
+		ObjStreamBucket root;
+		root.filename = ObjStreamScratchFilename(stream);
+		root.depth = 0;
+
+		bool success = ObjStreamSplitFile(stream, filename, root.filename);
+
+		success = success &&
+			(stream.positionCount == 0 || MappedFileOpen(&stream.positions, (stream.scratch + ".positions.tmp").c_str())) &&
+			(stream.texcoordCount == 0 || MappedFileOpen(&stream.texcoords, (stream.scratch + ".texcoords.tmp").c_str())) &&
+			(stream.normalCount == 0 || MappedFileOpen(&stream.normals, (stream.scratch + ".normals.tmp").c_str()));
+
+		root.triangleCount = stream.triangleCount;
+		root.boundsMin = stream.boundsMin;
+		root.boundsMax = stream.boundsMax;
+
+		CookedMeshWriter* writer = success ?
+			CookedMeshWriterBegin(cookedFilename, filename, settings, stream.boundsMin, stream.boundsMax) : nullptr;
+
+		success = success && writer != nullptr;
+
+		// Buckets are split until they fit in a chunk, emitting in depth first order keeps
+		// neighbouring chunks next to each other in the file.
+		std::vector<ObjStreamBucket> pending;
+		pending.push_back(root);
+
+		uint32 chunkCount = 0;
+		while (!pending.empty())
+		{
+			ObjStreamBucket bucket = pending.back();
+			pending.pop_back();
+
+			if (!success)
+			{
+				remove(bucket.filename.c_str());
+				continue;
+			}
+
+			if (bucket.triangleCount <= stream.chunkTriangles || bucket.depth >= ObjStreamMaxDepth)
+			{
+				success = ObjStreamEmitBucket(stream, bucket, writer);
+				chunkCount += (uint32)((bucket.triangleCount + stream.chunkTriangles - 1) / stream.chunkTriangles);
+			}
+			else
+			{
+				success = ObjStreamSplitBucket(stream, bucket, pending);
+			}
+		}
+
+		if (writer != nullptr)
+			success = CookedMeshWriterEnd(writer) && success;
+
+		MappedFileClose(&stream.positions);
+		MappedFileClose(&stream.texcoords);
+		MappedFileClose(&stream.normals);
+
+		remove((stream.scratch + ".positions.tmp").c_str());
+		remove((stream.scratch + ".texcoords.tmp").c_str());
+		remove((stream.scratch + ".normals.tmp").c_str());
+
+		if (!success)
+		{
+			Message("[ERROR] Failed to stream %s to %s\n", filename, cookedFilename);
+			return false;
+		}
+
+		Message("Streamed %s: %llu triangles in %u chunks, %u MB budget, %.2f s\n",
+			filename, stream.triangleCount, chunkCount, (uint32)(budget / (1024 * 1024)), GetTime() - start);
+
+		return true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,332 @@
+#include <gfxl_mesh.h>
+
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+
+namespace gfxl
+{
+	// Post transform cache size the triangle order is tuned for, and simulated with.
+	static const uint32 OptimizeCacheSize = 16;
+
+	// Overdraw ordering is dropped if it costs more than this much over the cache optimized ACMR.
+	static const float OptimizeOverdrawThreshold = 1.05f;
+
+	// Clusters smaller than this are merged with the next one before sorting for overdraw.
+	static const uint32 OptimizeMinClusterSize = 32;
+
+	// Simulates a FIFO post transform cache and returns the number of vertex shader invocations.
+	static uint32 OptimizeCountCacheMisses(const uint32* indices, uint32 indexCount, uint32 vertexCount)
+	{
+		std::vector<uint32> cachedAt(vertexCount, 0);
+		uint32 misses = 0;
+
+		for (uint32 i = 0; i < indexCount; i++)
+		{
+			uint32 vertex = indices[i];
+
+			// A vertex is still cached if less than OptimizeCacheSize misses happened since it was loaded.
+			if (cachedAt[vertex] == 0 || misses - (cachedAt[vertex] - 1) >= OptimizeCacheSize)
+			{
+				cachedAt[vertex] = misses + 1;
+				misses++;
+			}
+		}
+
+		return misses;
+	}
+
+	struct OptimizeAdjacency
+	{
+		std::vector<uint32> offsets;
+		std::vector<uint32> triangles;
+	};
+
+	static void OptimizeBuildAdjacency(OptimizeAdjacency* adjacency, const uint32* indices, uint32 indexCount, uint32 vertexCount)
+	{
+		adjacency->offsets.assign(vertexCount + 1, 0);
+		adjacency->triangles.resize(indexCount);
+
+		for (uint32 i = 0; i < indexCount; i++)
+			adjacency->offsets[indices[i] + 1]++;
+
+		for (uint32 i = 0; i < vertexCount; i++)
+			adjacency->offsets[i + 1] += adjacency->offsets[i];
+
+		std::vector<uint32> cursor(adjacency->offsets.begin(), adjacency->offsets.end() - 1);
+		for (uint32 i = 0; i < indexCount; i++)
+			adjacency->triangles[cursor[indices[i]]++] = i / 3;
+	}
+
+	// Tipsify, from "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander et al.).
+	// Fans around one vertex at a time and picks the next fanning vertex among the ones
+	// that will still be in the cache. Triangles where the walk had to jump to a vertex outside
+	// the current neighbourhood are recorded as cluster starts for the overdraw pass.
+	static void OptimizeTipsify(uint32* destination, const uint32* indices, uint32 indexCount, uint32 vertexCount,
+		std::vector<uint32>& clusters)
+	{
+		const uint32 triangleCount = indexCount / 3;
+
+		OptimizeAdjacency adjacency;
+		OptimizeBuildAdjacency(&adjacency, indices, indexCount, vertexCount);
+
+		std::vector<uint32> live(vertexCount);
+		for (uint32 i = 0; i < vertexCount; i++)
+			live[i] = adjacency.offsets[i + 1] - adjacency.offsets[i];
+
+		std::vector<uint32> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<uint32> deadEnd;
+		std::vector<uint32> candidates;
+
+		uint32 time = OptimizeCacheSize + 1;
+		uint32 cursor = 0;
+		uint32 output = 0;
+
+		clusters.clear();
+
+		long64 fan = 0;
+		bool jumped = true;
+
+		while (fan >= 0)
+		{
+			candidates.clear();
+
+			for (uint32 i = adjacency.offsets[fan]; i < adjacency.offsets[fan + 1]; i++)
+			{
+				uint32 triangle = adjacency.triangles[i];
+				if (emitted[triangle])
+					continue;
+
+				if (jumped)
+				{
+					clusters.push_back(output / 3);
+					jumped = false;
+				}
+
+				for (uint32 j = 0; j < 3; j++)
+				{
+					uint32 vertex = indices[triangle * 3 + j];
+					destination[output++] = vertex;
+
+					deadEnd.push_back(vertex);
+					candidates.push_back(vertex);
+					live[vertex]--;
+
+					if (time - cacheTime[vertex] > OptimizeCacheSize)
+						cacheTime[vertex] = time++;
+				}
+
+				emitted[triangle] = true;
+			}
+
+			// Prefer the candidate that stays cached the longest while it is fanned.
+			long64 next = -1;
+			long64 best = -1;
+
+			for (uint32 vertex : candidates)
+			{
+				if (live[vertex] == 0)
+					continue;
+
+				long64 priority = 0;
+				if (time - cacheTime[vertex] + 2 * live[vertex] <= OptimizeCacheSize)
+					priority = time - cacheTime[vertex];
+
+				if (priority > best)
+				{
+					best = priority;
+					next = vertex;
+				}
+			}
+
+			if (next == -1)
+			{
+				jumped = true;
+
+				while (!deadEnd.empty() && next == -1)
+				{
+					uint32 vertex = deadEnd.back();
+					deadEnd.pop_back();
+
+					if (live[vertex] > 0)
+						next = vertex;
+				}
+
+				while (cursor < vertexCount && next == -1)
+				{
+					if (live[cursor] > 0)
+						next = cursor;
+
+					cursor++;
+				}
+			}
+
+			fan = next;
+		}
+	}
+
+	struct OptimizeCluster
+	{
+		uint32 begin;
+		uint32 end;
+		float sortKey;
+	};
+
+	// Orders clusters so the ones facing away from the mesh center are drawn first. They are
+	// the most likely to occlude the rest from any viewpoint, which cuts overdraw without
+	// knowing the camera.
+	static void OptimizeOverdraw(uint32* destination, const uint32* indices, uint32 indexCount,
+		const Vertex* vertices, const std::vector<uint32>& starts)
+	{
+		const uint32 triangleCount = indexCount / 3;
+
+		std::vector<OptimizeCluster> clusters;
+		for (uint32 i = 0; i < starts.size(); i++)
+		{
+			uint32 begin = starts[i];
+			uint32 end = i + 1 < starts.size() ? starts[i + 1] : triangleCount;
+
+			if (!clusters.empty() && clusters.back().end - clusters.back().begin < OptimizeMinClusterSize)
+				clusters.back().end = end;
+			else
+				clusters.push_back({ begin, end, 0.0f });
+		}
+
+		Vector3 meshCenter(0.0f);
+		float meshArea = 0.0f;
+
+		std::vector<Vector3> centers(clusters.size());
+		std::vector<Vector3> normals(clusters.size());
+
+		for (uint32 i = 0; i < clusters.size(); i++)
+		{
+			Vector3 center(0.0f);
+			Vector3 normal(0.0f);
+			float area = 0.0f;
+
+			for (uint32 triangle = clusters[i].begin; triangle < clusters[i].end; triangle++)
+			{
+				const Vector3& a = vertices[indices[triangle * 3 + 0]].position;
+				const Vector3& b = vertices[indices[triangle * 3 + 1]].position;
+				const Vector3& c = vertices[indices[triangle * 3 + 2]].position;
+
+				Vector3 cross = Cross(b - a, c - a);
+				float triangleArea = Magnitude(cross);
+
+				center += (a + b + c) * (triangleArea / 3.0f);
+				normal += cross;
+				area += triangleArea;
+			}
+
+			meshCenter += center;
+			meshArea += area;
+
+			centers[i] = area > 0.0f ? center / area : center;
+			normals[i] = Magnitude(normal) > 0.0f ? Normalize(normal) : normal;
+		}
+
+		if (meshArea > 0.0f)
+			meshCenter /= meshArea;
+
+		for (uint32 i = 0; i < clusters.size(); i++)
+			clusters[i].sortKey = Dot(centers[i] - meshCenter, normals[i]);
+
+		std::stable_sort(clusters.begin(), clusters.end(),
+			[](const OptimizeCluster& a, const OptimizeCluster& b) { return a.sortKey > b.sortKey; });
+
+		uint32 output = 0;
+		for (const OptimizeCluster& cluster : clusters)
+		{
+			for (uint32 i = cluster.begin * 3; i < cluster.end * 3; i++)
+				destination[output++] = indices[i];
+		}
+	}
+
+	// Renumbers vertices in the order the index buffer first touches them, so vertex
+	// fetches walk memory linearly. Unreferenced vertices are dropped.
+	static uint32 OptimizeVertexFetch(Vertex* destination, uint32* indices, uint32 indexCount,
+		const Vertex* vertices, uint32 vertexCount)
+	{
+		const uint32 unused = 0xFFFFFFFF;
+		std::vector<uint32> remap(vertexCount, unused);
+
+		uint32 count = 0;
+		for (uint32 i = 0; i < indexCount; i++)
+		{
+			uint32& vertex = remap[indices[i]];
+			if (vertex == unused)
+			{
+				vertex = count++;
+				destination[vertex] = vertices[indices[i]];
+			}
+
+			indices[i] = vertex;
+		}
+
+		return count;
+	}
+
+	void MeshDataOptimize(MeshData* data)
+	{
+		if (data->indices == nullptr || data->indexCount < 3)
+			return;
+
+		free(data->clusters);
+		data->clusters = nullptr;
+		data->clusterCount = 0;
+
+		MeshDataClearLods(data);
+
+		const uint32 indexCount = data->indexCount - data->indexCount % 3;
+		const uint32 triangleCount = indexCount / 3;
+		const uint32 vertexCount = data->vertexCount;
+
+		uint32 missesBefore = OptimizeCountCacheMisses(data->indices, indexCount, vertexCount);
+
+		// Every submesh is drawn on its own, so triangles are only ever reordered within one.
+		std::vector<MeshSubmesh> ranges(data->submeshes, data->submeshes + data->submeshCount);
+		if (ranges.empty())
+			ranges.push_back({ 0, indexCount, MeshNoMaterial });
+
+		std::vector<uint32> clusters;
+		std::vector<uint32> tipsified(indexCount);
+		std::vector<uint32> overdraw(indexCount);
+		uint32 overdrawRanges = 0;
+
+		for (const MeshSubmesh& range : ranges)
+		{
+			uint32* destination = data->indices + range.indexOffset;
+			uint32 count = range.indexCount - range.indexCount % 3;
+
+			OptimizeTipsify(tipsified.data(), destination, count, vertexCount, clusters);
+			OptimizeOverdraw(overdraw.data(), tipsified.data(), count, data->vertices, clusters);
+
+			uint32 tipsifyMisses = OptimizeCountCacheMisses(tipsified.data(), count, vertexCount);
+			uint32 overdrawMisses = OptimizeCountCacheMisses(overdraw.data(), count, vertexCount);
+
+			bool useOverdraw = overdrawMisses <= tipsifyMisses * OptimizeOverdrawThreshold;
+			overdrawRanges += useOverdraw;
+
+			const std::vector<uint32>& best = useOverdraw ? overdraw : tipsified;
+			std::copy(best.begin(), best.begin() + count, destination);
+		}
+
+		data->indexCount = indexCount;
+		uint32 missesAfter = OptimizeCountCacheMisses(data->indices, indexCount, vertexCount);
+
+		Vertex* vertices = (Vertex*)malloc(sizeof(Vertex) * (vertexCount > 0 ? vertexCount : 1));
+		uint32 usedCount = OptimizeVertexFetch(vertices, data->indices, indexCount, data->vertices, vertexCount);
+
+		free(data->vertices);
+		data->vertices = vertices;
+		data->vertexCount = usedCount;
+
+		Message("Optimized %u triangles: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %u/%u submeshes overdraw ordered\n",
+			triangleCount,
+			(float)missesBefore / triangleCount, (float)missesAfter / triangleCount,
+			vertexCount > 0 ? (float)missesBefore / vertexCount : 0.0f,
+			usedCount > 0 ? (float)missesAfter / usedCount : 0.0f,
+			overdrawRanges, (uint32)ranges.size());
+	}
+}
\ No newline at end of file
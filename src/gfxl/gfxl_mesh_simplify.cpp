@@ -0,0 +1,533 @@
+#include <gfxl_mesh.h>
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace gfxl
+{
+	// A LOD that removes less than this fraction of the previous one isn't worth keeping.
+	static const float SimplifyMinReduction = 0.9f;
+
+	// Border edges get a plane quadric this much heavier than the surface, so open
+	// edges keep their silhouette.
+	static const double SimplifyBorderWeight = 10.0;
+
+	enum class SimplifyVertexKind : int
+	{
+		// Interior vertex with a single wedge, can collapse onto any neighbour.
+		Manifold,
+
+		// On an open edge, can only slide along the border.
+		Border,
+
+		// Attribute seam or material boundary, never moves.
+		Locked
+	};
+
+	// Symmetric plane quadric, error(p) = p'Ap + 2b'p + c, weighted by triangle area.
+	struct SimplifyQuadric
+	{
+		double a00, a01, a02, a11, a12, a22;
+		double b0, b1, b2;
+		double c;
+		double weight;
+	};
+
+	struct SimplifyCollapse
+	{
+		uint32 from;
+		uint32 to;
+		uint32 fromIndex;
+		uint32 toIndex;
+		double error;
+	};
+
+	struct SimplifyContext
+	{
+		const MeshData* data;
+
+		// Every vertex mapped to the first vertex with the same position.
+		std::vector<uint32> canonical;
+		std::vector<SimplifyVertexKind> kinds;
+		std::vector<SimplifyQuadric> quadrics;
+
+		std::vector<uint32> offsets;
+		std::vector<uint32> triangles;
+	};
+
+	static void QuadricAddPlane(SimplifyQuadric& q, const Vector3& normal, double distance, double weight)
+	{
+		double x = normal.x, y = normal.y, z = normal.z;
+
+		q.a00 += weight * x * x;
+		q.a01 += weight * x * y;
+		q.a02 += weight * x * z;
+		q.a11 += weight * y * y;
+		q.a12 += weight * y * z;
+		q.a22 += weight * z * z;
+		q.b0 += weight * x * distance;
+		q.b1 += weight * y * distance;
+		q.b2 += weight * z * distance;
+		q.c += weight * distance * distance;
+		q.weight += weight;
+	}
+
+	static void QuadricAdd(SimplifyQuadric& q, const SimplifyQuadric& other)
+	{
+		q.a00 += other.a00;
+		q.a01 += other.a01;
+		q.a02 += other.a02;
+		q.a11 += other.a11;
+		q.a12 += other.a12;
+		q.a22 += other.a22;
+		q.b0 += other.b0;
+		q.b1 += other.b1;
+		q.b2 += other.b2;
+		q.c += other.c;
+		q.weight += other.weight;
+	}
+
+	// Returns the weighted squared distance of p to all the planes of q.
+	static double QuadricError(const SimplifyQuadric& q, const Vector3& p)
+	{
+		double x = p.x, y = p.y, z = p.z;
+
+		double error =
+			q.a00 * x * x + 2.0 * q.a01 * x * y + 2.0 * q.a02 * x * z +
+			q.a11 * y * y + 2.0 * q.a12 * y * z + q.a22 * z * z +
+			2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+
+		return error > 0.0 && q.weight > 0.0 ? error / q.weight : 0.0;
+	}
+
+	static void SimplifyBuildAdjacency(SimplifyContext& context, const std::vector<uint32>& indices)
+	{
+		const uint32 vertexCount = context.data->vertexCount;
+
+		context.offsets.assign(vertexCount + 1, 0);
+		context.triangles.resize(indices.size());
+
+		for (uint32 index : indices)
+			context.offsets[context.canonical[index] + 1]++;
+
+		for (uint32 i = 0; i < vertexCount; i++)
+			context.offsets[i + 1] += context.offsets[i];
+
+		std::vector<uint32> cursor(context.offsets.begin(), context.offsets.end() - 1);
+		for (uint32 i = 0; i < indices.size(); i++)
+			context.triangles[cursor[context.canonical[indices[i]]]++] = i / 3;
+	}
+
+	// True when no triangle around b walks the edge back from b to a.
+	static bool SimplifyIsBorderEdge(const SimplifyContext& context, const std::vector<uint32>& indices, uint32 a, uint32 b)
+	{
+		for (uint32 i = context.offsets[b]; i < context.offsets[b + 1]; i++)
+		{
+			uint32 triangle = context.triangles[i];
+
+			for (uint32 j = 0; j < 3; j++)
+			{
+				uint32 v0 = context.canonical[indices[triangle * 3 + j]];
+				uint32 v1 = context.canonical[indices[triangle * 3 + (j + 1) % 3]];
+
+				if (v0 == b && v1 == a)
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	static void SimplifySetup(SimplifyContext& context, const std::vector<uint32>& indices,
+		const std::vector<uint32>& triangleSubmeshes)
+	{
+		const MeshData* data = context.data;
+		const uint32 vertexCount = data->vertexCount;
+
+		// Weld by position through a sorted order, the vertex with the lowest index is canonical.
+		std::vector<uint32> order(vertexCount);
+		for (uint32 i = 0; i < vertexCount; i++)
+			order[i] = i;
+
+		auto less = [data](uint32 a, uint32 b)
+		{
+			const Vector3& pa = data->vertices[a].position;
+			const Vector3& pb = data->vertices[b].position;
+
+			if (pa.x != pb.x) return pa.x < pb.x;
+			if (pa.y != pb.y) return pa.y < pb.y;
+			if (pa.z != pb.z) return pa.z < pb.z;
+			return a < b;
+		};
+
+		std::sort(order.begin(), order.end(), less);
+
+		context.canonical.resize(vertexCount);
+		context.kinds.assign(vertexCount, SimplifyVertexKind::Manifold);
+
+		for (uint32 i = 0; i < vertexCount; )
+		{
+			uint32 j = i + 1;
+			while (j < vertexCount && data->vertices[order[j]].position == data->vertices[order[i]].position)
+				j++;
+
+			for (uint32 k = i; k < j; k++)
+				context.canonical[order[k]] = order[i];
+
+			if (j - i > 1)
+				context.kinds[order[i]] = SimplifyVertexKind::Locked;
+
+			i = j;
+		}
+
+		// A vertex used by more than one submesh sits on a material boundary.
+		const uint32 unassigned = 0xFFFFFFFF;
+		std::vector<uint32> vertexSubmesh(vertexCount, unassigned);
+
+		for (uint32 i = 0; i < indices.size(); i++)
+		{
+			uint32 vertex = context.canonical[indices[i]];
+			uint32 submesh = triangleSubmeshes[i / 3];
+
+			if (vertexSubmesh[vertex] == unassigned)
+				vertexSubmesh[vertex] = submesh;
+			else if (vertexSubmesh[vertex] != submesh)
+				context.kinds[vertex] = SimplifyVertexKind::Locked;
+		}
+
+		SimplifyBuildAdjacency(context, indices);
+
+		context.quadrics.assign(vertexCount, SimplifyQuadric());
+
+		for (uint32 i = 0; i < indices.size(); i += 3)
+		{
+			uint32 v[3];
+			for (uint32 j = 0; j < 3; j++)
+				v[j] = context.canonical[indices[i + j]];
+
+			const Vector3& p0 = data->vertices[v[0]].position;
+			const Vector3& p1 = data->vertices[v[1]].position;
+			const Vector3& p2 = data->vertices[v[2]].position;
+
+			Vector3 cross = Cross(p1 - p0, p2 - p0);
+			float area = Magnitude(cross);
+			if (area <= 0.0f)
+				continue;
+
+			Vector3 normal = cross / area;
+			double distance = -Dot(normal, p0);
+
+			for (uint32 j = 0; j < 3; j++)
+				QuadricAddPlane(context.quadrics[v[j]], normal, distance, area);
+
+			for (uint32 j = 0; j < 3; j++)
+			{
+				uint32 a = v[j];
+				uint32 b = v[(j + 1) % 3];
+
+				if (!SimplifyIsBorderEdge(context, indices, a, b))
+					continue;
+
+				if (context.kinds[a] == SimplifyVertexKind::Manifold)
+					context.kinds[a] = SimplifyVertexKind::Border;
+
+				if (context.kinds[b] == SimplifyVertexKind::Manifold)
+					context.kinds[b] = SimplifyVertexKind::Border;
+
+				// Plane through the edge, perpendicular to the triangle.
+				const Vector3& pa = data->vertices[a].position;
+				const Vector3& pb = data->vertices[b].position;
+				Vector3 edge = pb - pa;
+				float length = Magnitude(edge);
+				if (length <= 0.0f)
+					continue;
+
+				Vector3 borderNormal = Normalize(Cross(edge, normal));
+				double borderDistance = -Dot(borderNormal, pa);
+				double weight = SimplifyBorderWeight * length * length;
+
+				QuadricAddPlane(context.quadrics[a], borderNormal, borderDistance, weight);
+				QuadricAddPlane(context.quadrics[b], borderNormal, borderDistance, weight);
+			}
+		}
+	}
+
+	// Collapsing must not turn any remaining triangle around from over to upside down.
+	static bool SimplifyFlips(const SimplifyContext& context, const std::vector<uint32>& indices, uint32 from, uint32 to)
+	{
+		const Vertex* vertices = context.data->vertices;
+		const Vector3& target = vertices[to].position;
+
+		for (uint32 i = context.offsets[from]; i < context.offsets[from + 1]; i++)
+		{
+			uint32 triangle = context.triangles[i];
+
+			uint32 v[3];
+			for (uint32 j = 0; j < 3; j++)
+				v[j] = context.canonical[indices[triangle * 3 + j]];
+
+			if (v[0] == to || v[1] == to || v[2] == to)
+				continue;
+
+			Vector3 p[3];
+			Vector3 moved[3];
+			for (uint32 j = 0; j < 3; j++)
+			{
+				p[j] = vertices[v[j]].position;
+				moved[j] = v[j] == from ? target : p[j];
+			}
+
+			Vector3 before = Cross(p[1] - p[0], p[2] - p[0]);
+			Vector3 after = Cross(moved[1] - moved[0], moved[2] - moved[0]);
+
+			if (Dot(before, after) <= 0.0f)
+				return true;
+		}
+
+		return false;
+	}
+
+	// Collapses edges in passes until indices has no more than targetCount triangles, or
+	// nothing can collapse anymore. Returns the largest collapse error, as a distance.
+	static double SimplifyToTarget(SimplifyContext& context, std::vector<uint32>& indices,
+		std::vector<uint32>& triangleSubmeshes, uint32 targetCount)
+	{
+		const uint32 vertexCount = context.data->vertexCount;
+		double maxError = 0.0;
+
+		std::vector<SimplifyCollapse> collapses;
+		std::vector<uint32> remap(vertexCount);
+		std::vector<bool> touched(vertexCount);
+
+		while (indices.size() / 3 > targetCount)
+		{
+			SimplifyBuildAdjacency(context, indices);
+			collapses.clear();
+
+			for (uint32 i = 0; i < indices.size(); i += 3)
+			{
+				for (uint32 j = 0; j < 3; j++)
+				{
+					uint32 fromIndex = indices[i + j];
+					uint32 toIndex = indices[i + (j + 1) % 3];
+					uint32 from = context.canonical[fromIndex];
+					uint32 to = context.canonical[toIndex];
+
+					for (uint32 direction = 0; direction < 2; direction++)
+					{
+						SimplifyVertexKind kind = context.kinds[from];
+
+						bool allowed = kind == SimplifyVertexKind::Manifold ||
+							(kind == SimplifyVertexKind::Border && context.kinds[to] != SimplifyVertexKind::Manifold &&
+							(SimplifyIsBorderEdge(context, indices, from, to) || SimplifyIsBorderEdge(context, indices, to, from)));
+
+						if (allowed && from != to)
+						{
+							SimplifyQuadric quadric = context.quadrics[from];
+							QuadricAdd(quadric, context.quadrics[to]);
+
+							SimplifyCollapse collapse;
+							collapse.from = from;
+							collapse.to = to;
+							collapse.fromIndex = fromIndex;
+							collapse.toIndex = toIndex;
+							collapse.error = QuadricError(quadric, context.data->vertices[to].position);
+							collapses.push_back(collapse);
+						}
+
+						std::swap(from, to);
+						std::swap(fromIndex, toIndex);
+					}
+				}
+			}
+
+			std::sort(collapses.begin(), collapses.end(),
+				[](const SimplifyCollapse& a, const SimplifyCollapse& b) { return a.error < b.error; });
+
+			for (uint32 i = 0; i < vertexCount; i++)
+				remap[i] = i;
+
+			std::fill(touched.begin(), touched.end(), false);
+
+			uint32 triangleCount = (uint32)indices.size() / 3;
+			uint32 collapsed = 0;
+
+			for (const SimplifyCollapse& collapse : collapses)
+			{
+				if (triangleCount <= targetCount)
+					break;
+
+				if (touched[collapse.from] || touched[collapse.to])
+					continue;
+
+				if (SimplifyFlips(context, indices, collapse.from, collapse.to))
+					continue;
+
+				// Every triangle around the collapsed vertex changes shape, so its whole
+				// neighbourhood waits for the next pass.
+				for (uint32 i = context.offsets[collapse.from]; i < context.offsets[collapse.from + 1]; i++)
+				{
+					uint32 triangle = context.triangles[i];
+					bool removed = false;
+
+					for (uint32 j = 0; j < 3; j++)
+					{
+						uint32 vertex = context.canonical[indices[triangle * 3 + j]];
+						touched[vertex] = true;
+						removed |= vertex == collapse.to;
+					}
+
+					triangleCount -= removed;
+				}
+
+				// Only single wedge vertices ever collapse, so the vertex and its index match.
+				remap[collapse.fromIndex] = collapse.toIndex;
+				QuadricAdd(context.quadrics[collapse.to], context.quadrics[collapse.from]);
+
+				maxError = Max(maxError, collapse.error);
+				collapsed++;
+			}
+
+			if (collapsed == 0)
+				break;
+
+			uint32 write = 0;
+			for (uint32 i = 0; i < indices.size(); i += 3)
+			{
+				uint32 a = remap[indices[i + 0]];
+				uint32 b = remap[indices[i + 1]];
+				uint32 c = remap[indices[i + 2]];
+
+				uint32 ca = context.canonical[a];
+				uint32 cb = context.canonical[b];
+				uint32 cc = context.canonical[c];
+
+				if (ca == cb || cb == cc || ca == cc)
+					continue;
+
+				triangleSubmeshes[write / 3] = triangleSubmeshes[i / 3];
+
+				indices[write++] = a;
+				indices[write++] = b;
+				indices[write++] = c;
+			}
+
+			indices.resize(write);
+			triangleSubmeshes.resize(write / 3);
+		}
+
+		return sqrt(maxError);
+	}
+
+	// Appends the triangles of a level to all, grouped by submesh in the order of the full
+	// mesh, and records where every submesh landed.
+	static void SimplifyAppendLevel(std::vector<uint32>& all, std::vector<MeshSubmesh>& submeshes,
+		const std::vector<uint32>& indices, const std::vector<uint32>& triangleSubmeshes, const MeshData* data)
+	{
+		const uint32 submeshCount = data->submeshCount > 0 ? data->submeshCount : 1;
+		const uint32 base = (uint32)all.size();
+
+		std::vector<uint32> offsets(submeshCount + 1, 0);
+		for (uint32 submesh : triangleSubmeshes)
+			offsets[submesh + 1]++;
+
+		for (uint32 i = 0; i < submeshCount; i++)
+		{
+			MeshSubmesh submesh;
+			submesh.indexOffset = base + offsets[i] * 3;
+			submesh.indexCount = offsets[i + 1] * 3;
+			submesh.material = data->submeshCount > 0 ? data->submeshes[i].material : MeshNoMaterial;
+			submeshes.push_back(submesh);
+
+			offsets[i + 1] += offsets[i];
+		}
+
+		all.resize(base + indices.size());
+		for (uint32 i = 0; i < triangleSubmeshes.size(); i++)
+		{
+			uint32 target = base + offsets[triangleSubmeshes[i]]++ * 3;
+
+			all[target + 0] = indices[i * 3 + 0];
+			all[target + 1] = indices[i * 3 + 1];
+			all[target + 2] = indices[i * 3 + 2];
+		}
+	}
+
+	void MeshDataBuildLods(MeshData* data, uint32 lodCount, float reduction)
+	{
+		MeshDataClearLods(data);
+
+		if (data->indices == nullptr || data->indexCount < 3 || lodCount < 2)
+			return;
+
+		const uint32 baseCount = data->indexCount - data->indexCount % 3;
+
+		std::vector<uint32> indices(data->indices, data->indices + baseCount);
+		std::vector<uint32> all(indices);
+
+		std::vector<uint32> triangleSubmeshes(baseCount / 3, 0);
+		for (uint32 i = 0; i < data->submeshCount; i++)
+		{
+			const MeshSubmesh& submesh = data->submeshes[i];
+			for (uint32 j = submesh.indexOffset / 3; j < (submesh.indexOffset + submesh.indexCount) / 3 && j < baseCount / 3; j++)
+				triangleSubmeshes[j] = i;
+		}
+
+		std::vector<MeshSubmesh> submeshes(data->submeshes, data->submeshes + data->submeshCount);
+
+		std::vector<MeshLod> lods;
+		lods.push_back({ 0, baseCount, 0.0f });
+
+		SimplifyContext context;
+		context.data = data;
+		SimplifySetup(context, indices, triangleSubmeshes);
+
+		// Every LOD continues from the previous one, so the quadrics keep the error of all
+		// the collapses so far and the errors grow monotonically along the chain.
+		while (lods.size() < lodCount)
+		{
+			uint32 previousCount = (uint32)indices.size() / 3;
+			uint32 targetCount = (uint32)(previousCount * reduction);
+
+			double error = SimplifyToTarget(context, indices, triangleSubmeshes, targetCount);
+
+			if (indices.empty() || indices.size() / 3 > previousCount * SimplifyMinReduction)
+				break;
+
+			MeshLod lod;
+			lod.indexOffset = (uint32)all.size();
+			lod.indexCount = (uint32)indices.size();
+			lod.error = (float32)Max(error, (double)lods.back().error);
+			lods.push_back(lod);
+
+			SimplifyAppendLevel(all, submeshes, indices, triangleSubmeshes, data);
+		}
+
+		if (lods.size() < 2)
+			return;
+
+		free(data->indices);
+		data->indices = (uint32*)malloc(sizeof(uint32) * all.size());
+		data->indexCount = (uint32)all.size();
+		memcpy(data->indices, all.data(), sizeof(uint32) * all.size());
+
+		data->lodCount = (uint32)lods.size();
+		data->lods = (MeshLod*)malloc(sizeof(MeshLod) * data->lodCount);
+		memcpy(data->lods, lods.data(), sizeof(MeshLod) * data->lodCount);
+
+		if (data->submeshCount > 0)
+		{
+			free(data->submeshes);
+			data->submeshes = (MeshSubmesh*)malloc(sizeof(MeshSubmesh) * submeshes.size());
+			memcpy(data->submeshes, submeshes.data(), sizeof(MeshSubmesh) * submeshes.size());
+		}
+
+		for (uint32 i = 1; i < data->lodCount; i++)
+		{
+			Message("LOD %u: %u triangles, error %f\n", i, data->lods[i].indexCount / 3, data->lods[i].error);
+		}
+	}
+}
\ No newline at end of file
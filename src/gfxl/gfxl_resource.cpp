@@ -0,0 +1,498 @@
+#include <gfxl_resource.h>
+#include <gfxl_core.h>
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <stdio.h>
+
+namespace gfxl
+{
+	enum class ResourceType : int
+	{
+		Texture2D,
+		Mesh,
+		Shader,
+		Count
+	};
+
+	static const char* const ResourceTypeNames[] = { "Textures", "Meshes", "Shaders" };
+
+	struct ResourceEntry
+	{
+		ResourceType type;
+		void* resource;
+		uint32 refCount;
+
+		// Every path key that leads here, and the hash of the contents, 0 when there is none.
+		std::vector<std::string> keys;
+		ulong64 contentKey;
+
+		// Textures are found by the size and write time of their files, a stamp other files can
+		// share, and the contents confirm the match. They are hashed from filenames when first
+		// needed, contentKey stays 0 until then.
+		ulong64 stampKey;
+		std::vector<std::string> filenames;
+	};
+
+	struct ResourceCache
+	{
+		std::unordered_map<std::string, ResourceEntry*> byKey;
+		std::unordered_map<ulong64, ResourceEntry*> byContent;
+		std::unordered_multimap<ulong64, ResourceEntry*> byStamp;
+		std::unordered_map<const void*, ResourceEntry*> byResource;
+
+		// Loads that found their resource by path and by contents.
+		uint32 pathHits[(int)ResourceType::Count];
+		uint32 contentHits[(int)ResourceType::Count];
+	};
+
+	ResourceCache* CreateResourceCache()
+	{
+		return new ResourceCache();
+	}
+
+	// Hashes the key of the settings and then the size and write time of every file, the stamp
+	// cooked files are checked against. Equal stamps only make candidates, different files can
+	// have them. 0 when a file can't be found, the load reports that.
+	static ulong64 ResourceStampFiles(const std::string& settingsKey, const char* const* filenames, uint32 count)
+	{
+		ulong64 hash = HashData(settingsKey.data(), settingsKey.size());
+
+		for (uint32 i = 0; i < count; i++)
+		{
+			// Which slot a file is in matters as much as what it holds.
+			hash = HashData(&i, sizeof(i), hash);
+
+			if (filenames[i] == nullptr)
+				continue;
+
+			ulong64 size, writeTime;
+			if (!FileGetInfo(filenames[i], &size, &writeTime))
+				return 0;
+
+			hash = HashData(&size, sizeof(size), hash);
+			hash = HashData(&writeTime, sizeof(writeTime), hash);
+		}
+
+		return hash != 0 ? hash : 1;
+	}
+
+	// The same over the contents of every file, so the same bytes under another path hash the
+	// same. 0 when a file can't be read.
+	static ulong64 ResourceHashFiles(const std::string& settingsKey, const char* const* filenames, uint32 count)
+	{
+		ulong64 hash = HashData(settingsKey.data(), settingsKey.size());
+
+		for (uint32 i = 0; i < count; i++)
+		{
+			hash = HashData(&i, sizeof(i), hash);
+
+			if (filenames[i] == nullptr)
+				continue;
+
+			MappedFile file;
+			if (!MappedFileOpen(&file, filenames[i]))
+				return 0;
+
+			hash = HashData(file.data, file.size, hash);
+			MappedFileClose(&file);
+		}
+
+		return hash != 0 ? hash : 1;
+	}
+
+	static ulong64 ResourceEntryHashFiles(ResourceEntry* entry, const std::string& settingsKey)
+	{
+		if (entry->contentKey == 0)
+		{
+			std::vector<const char*> filenames;
+			for (const std::string& filename : entry->filenames)
+				filenames.push_back(filename.empty() ? nullptr : filename.c_str());
+
+			entry->contentKey = ResourceHashFiles(settingsKey, filenames.data(), (uint32)filenames.size());
+		}
+
+		return entry->contentKey;
+	}
+
+	static std::string ResourceMakeKey(const std::string& settingsKey, const char* const* filenames, uint32 count)
+	{
+		std::string key = settingsKey;
+
+		for (uint32 i = 0; i < count; i++)
+		{
+			key += '|';
+			key += filenames[i] != nullptr ? filenames[i] : "";
+		}
+
+		return key;
+	}
+
+	static void* ResourceCacheAcquire(ResourceCache* cache, const std::string& key)
+	{
+		auto found = cache->byKey.find(key);
+		if (found == cache->byKey.end())
+			return nullptr;
+
+		ResourceEntry* entry = found->second;
+		entry->refCount++;
+		cache->pathHits[(int)entry->type]++;
+		return entry->resource;
+	}
+
+	// The entry found becomes reachable through key as well, later loads by it skip the hashing.
+	static void* ResourceCacheAcquireContent(ResourceCache* cache, const std::string& key, ulong64 contentKey)
+	{
+		auto found = contentKey != 0 ? cache->byContent.find(contentKey) : cache->byContent.end();
+		if (found == cache->byContent.end())
+			return nullptr;
+
+		ResourceEntry* entry = found->second;
+		entry->refCount++;
+		entry->keys.push_back(key);
+		cache->byKey[key] = entry;
+		cache->contentHits[(int)entry->type]++;
+		return entry->resource;
+	}
+
+	// Files are only read when another texture has their stamp, which copies and few others do.
+	// The contents of both have to hash the same before the texture is shared.
+	static void* ResourceCacheAcquireStamp(ResourceCache* cache, const std::string& key, const std::string& settingsKey,
+		const char* const* filenames, uint32 count, ulong64 stampKey)
+	{
+		if (stampKey == 0)
+			return nullptr;
+
+		auto range = cache->byStamp.equal_range(stampKey);
+		if (range.first == range.second)
+			return nullptr;
+
+		const ulong64 contentKey = ResourceHashFiles(settingsKey, filenames, count);
+		if (contentKey == 0)
+			return nullptr;
+
+		for (auto found = range.first; found != range.second; ++found)
+		{
+			ResourceEntry* entry = found->second;
+			if (ResourceEntryHashFiles(entry, settingsKey) != contentKey)
+				continue;
+
+			entry->refCount++;
+			entry->keys.push_back(key);
+			cache->byKey[key] = entry;
+			cache->contentHits[(int)entry->type]++;
+			return entry->resource;
+		}
+
+		return nullptr;
+	}
+
+	static void ResourceCacheInsert(ResourceCache* cache, ResourceType type, void* resource,
+		const std::string& key, ulong64 contentKey)
+	{
+		ResourceEntry* entry = new ResourceEntry();
+		entry->type = type;
+		entry->resource = resource;
+		entry->refCount = 1;
+		entry->keys.push_back(key);
+		entry->contentKey = contentKey;
+
+		cache->byKey[key] = entry;
+		cache->byResource[resource] = entry;
+
+		if (contentKey != 0)
+			cache->byContent[contentKey] = entry;
+	}
+
+	static void ResourceCacheInsertTexture(ResourceCache* cache, Texture2D* texture, const std::string& key,
+		const char* const* filenames, uint32 count, ulong64 stampKey)
+	{
+		ResourceCacheInsert(cache, ResourceType::Texture2D, texture, key, 0);
+
+		ResourceEntry* entry = cache->byResource[texture];
+		entry->stampKey = stampKey;
+		for (uint32 i = 0; i < count; i++)
+			entry->filenames.push_back(filenames[i] != nullptr ? filenames[i] : "");
+
+		if (stampKey != 0)
+			cache->byStamp.insert({ stampKey, entry });
+	}
+
+	static void ResourceEntryDispose(ResourceEntry* entry)
+	{
+		switch (entry->type)
+		{
+		case ResourceType::Texture2D:
+			Dispose((Texture2D*)entry->resource);
+			break;
+
+		case ResourceType::Mesh:
+			Dispose((Mesh*)entry->resource);
+			break;
+
+		default:
+			Dispose((Shader*)entry->resource);
+			break;
+		}
+
+		delete entry;
+	}
+
+	// Out of every map before it is disposed, a mesh releases its textures on the way out.
+	static void ResourceCacheRemove(ResourceCache* cache, ResourceEntry* entry)
+	{
+		for (const std::string& key : entry->keys)
+			cache->byKey.erase(key);
+
+		if (entry->stampKey != 0)
+		{
+			auto range = cache->byStamp.equal_range(entry->stampKey);
+			for (auto found = range.first; found != range.second; ++found)
+			{
+				if (found->second == entry)
+				{
+					cache->byStamp.erase(found);
+					break;
+				}
+			}
+		}
+		else if (entry->contentKey != 0)
+		{
+			cache->byContent.erase(entry->contentKey);
+		}
+
+		cache->byResource.erase(entry->resource);
+		ResourceEntryDispose(entry);
+	}
+
+	static void ResourceCacheReleaseResource(ResourceCache* cache, const void* resource)
+	{
+		auto found = cache->byResource.find(resource);
+		if (found == cache->byResource.end())
+		{
+			Message("[ERROR] Released a resource that doesn't come from the cache\n");
+			return;
+		}
+
+		ResourceEntry* entry = found->second;
+		if (--entry->refCount == 0)
+			ResourceCacheRemove(cache, entry);
+	}
+
+	// Only what changes the texture that comes out, the cooked file is the same texture either way.
+	static std::string ResourceTextureSettingsKey(const char* type, const TextureLoadSettings& settings)
+	{
+		char key[64];
+		snprintf(key, sizeof(key), "%s:%d:%d:%d", type, settings.srgb ? 1 : 0, (int)settings.role, (int)settings.compression);
+		return key;
+	}
+
+	Texture2D* ResourceCacheLoadTexture2D(ResourceCache* cache, const char* filename,
+		const TextureLoadSettings& settings, TextureBatch* batch)
+	{
+		const std::string settingsKey = ResourceTextureSettingsKey("Texture2D", settings);
+		const std::string key = ResourceMakeKey(settingsKey, &filename, 1);
+
+		if (void* texture = ResourceCacheAcquire(cache, key))
+			return (Texture2D*)texture;
+
+		const ulong64 stampKey = ResourceStampFiles(settingsKey, &filename, 1);
+		if (void* texture = ResourceCacheAcquireStamp(cache, key, settingsKey, &filename, 1, stampKey))
+			return (Texture2D*)texture;
+
+		Texture2D* texture = CreateTexture2D();
+		if (batch != nullptr)
+			TextureBatchAdd(batch, texture, filename, settings);
+		else
+			Texture2DFromImageFile(texture, filename, settings);
+
+		ResourceCacheInsertTexture(cache, texture, key, &filename, 1, stampKey);
+		return texture;
+	}
+
+	Texture2D* ResourceCacheLoadOrmTexture2D(ResourceCache* cache, const char* occlusion, const char* roughness,
+		const char* metallic, const TextureLoadSettings& settings, TextureBatch* batch)
+	{
+		const char* const filenames[] = { occlusion, roughness, metallic };
+		const std::string settingsKey = ResourceTextureSettingsKey("Orm", settings);
+		const std::string key = ResourceMakeKey(settingsKey, filenames, 3);
+
+		if (void* texture = ResourceCacheAcquire(cache, key))
+			return (Texture2D*)texture;
+
+		const ulong64 stampKey = ResourceStampFiles(settingsKey, filenames, 3);
+		if (void* texture = ResourceCacheAcquireStamp(cache, key, settingsKey, filenames, 3, stampKey))
+			return (Texture2D*)texture;
+
+		Texture2D* texture = CreateTexture2D();
+		if (batch != nullptr)
+			TextureBatchAddOrm(batch, texture, occlusion, roughness, metallic, settings);
+		else
+			Texture2DFromOrmFiles(texture, occlusion, roughness, metallic, settings);
+
+		ResourceCacheInsertTexture(cache, texture, key, filenames, 3, stampKey);
+		return texture;
+	}
+
+	Mesh* ResourceCacheLoadMesh(ResourceCache* cache, const char* filename, const MeshLoadSettings& settings)
+	{
+		MeshLoadSettings meshSettings = settings;
+		if (meshSettings.resourceCache == nullptr)
+			meshSettings.resourceCache = cache;
+
+		// The cache flag only decides where the mesh comes from, not what it is.
+		char settingsKey[160];
+		snprintf(settingsKey, sizeof(settingsKey), "Mesh:%d:%d:%d:%u:%d:%u:%d:%p:%d:%p",
+			meshSettings.optimize ? 1 : 0, (int)meshSettings.vertexFormat, meshSettings.clusters ? 1 : 0,
+			meshSettings.lodCount, meshSettings.stream ? 1 : 0, meshSettings.streamBudget,
+			(int)meshSettings.textureCompression, (void*)meshSettings.textureStreamer,
+			meshSettings.textureArrays ? 1 : 0, (void*)meshSettings.resourceCache);
+
+		const std::string key = ResourceMakeKey(settingsKey, &filename, 1);
+
+		if (void* mesh = ResourceCacheAcquire(cache, key))
+			return (Mesh*)mesh;
+
+		Mesh* mesh = CreateMesh();
+		MeshLoadFromModelFile(mesh, filename, meshSettings);
+
+		ResourceCacheInsert(cache, ResourceType::Mesh, mesh, key, 0);
+		return mesh;
+	}
+
+	Shader* ResourceCacheLoadShader(ResourceCache* cache, const char* vertexFilename, const char* fragmentFilename,
+		const ShaderLoadSettings& settings, ShaderBatch* batch)
+	{
+		const char* const filenames[] = { vertexFilename, fragmentFilename };
+
+		std::string settingsKey = "Shader";
+		for (uint32 i = 0; i < settings.defineCount; i++)
+		{
+			settingsKey += ':';
+			settingsKey += settings.defines[i];
+		}
+
+		const std::string key = ResourceMakeKey(settingsKey, filenames, 2);
+
+		if (void* shader = ResourceCacheAcquire(cache, key))
+			return (Shader*)shader;
+
+		// The files alone don't say what a shader is, includes are relative to them and the
+		// defines change them. Loading only reads and expands the sources, compiling comes after.
+		Shader* shader = CreateShader();
+		ShaderLoadAndCompile(shader, vertexFilename, ShaderType::Vertex, settings);
+		ShaderLoadAndCompile(shader, fragmentFilename, ShaderType::Fragment, settings);
+
+		const ulong64 contentKey = ShaderGetSourceKey(shader);
+		if (void* shared = ResourceCacheAcquireContent(cache, key, contentKey))
+		{
+			Dispose(shader);
+			return (Shader*)shared;
+		}
+
+		if (batch != nullptr)
+			ShaderBatchAdd(batch, shader);
+		else
+			ShaderLink(shader);
+
+		ResourceCacheInsert(cache, ResourceType::Shader, shader, key, contentKey);
+		return shader;
+	}
+
+	ShaderVariants ResourceCacheLoadShaderVariants(ResourceCache* cache, const char* vertexFilename,
+		const char* fragmentFilename, const ShaderLoadSettings& settings, ShaderBatch* batch)
+	{
+		std::vector<const char*> defines(settings.defines, settings.defines + settings.defineCount);
+		defines.resize(settings.defineCount + 2);
+
+		ShaderLoadSettings variantSettings = {};
+		variantSettings.defines = defines.data();
+		variantSettings.defineCount = (uint32)defines.size();
+
+		ShaderVariants variants = {};
+		for (uint32 key = 0; key < MaterialVariantCount; key++)
+		{
+			defines[settings.defineCount] = (key & MaterialVariantNormalMap) != 0 ? "HAS_NORMAL_MAP 1" : "HAS_NORMAL_MAP 0";
+			defines[settings.defineCount + 1] = (key & MaterialVariantOrm) != 0 ? "HAS_ORM 1" : "HAS_ORM 0";
+			variants.shaders[key] = ResourceCacheLoadShader(cache, vertexFilename, fragmentFilename, variantSettings, batch);
+		}
+
+		return variants;
+	}
+
+	void ResourceCacheRelease(ResourceCache* cache, Texture2D* texture)
+	{
+		ResourceCacheReleaseResource(cache, texture);
+	}
+
+	void ResourceCacheRelease(ResourceCache* cache, Mesh* mesh)
+	{
+		ResourceCacheReleaseResource(cache, mesh);
+	}
+
+	void ResourceCacheRelease(ResourceCache* cache, Shader* shader)
+	{
+		ResourceCacheReleaseResource(cache, shader);
+	}
+
+	void ResourceCacheRelease(ResourceCache* cache, const ShaderVariants& variants)
+	{
+		for (Shader* shader : variants.shaders)
+			ResourceCacheReleaseResource(cache, shader);
+	}
+
+	void ResourceCacheReport(const ResourceCache* cache)
+	{
+		uint32 counts[(int)ResourceType::Count] = {};
+		uint32 references[(int)ResourceType::Count] = {};
+		ulong64 sizes[(int)ResourceType::Count] = {};
+
+		for (const auto& pair : cache->byResource)
+		{
+			const ResourceEntry* entry = pair.second;
+			const int type = (int)entry->type;
+
+			counts[type]++;
+			references[type] += entry->refCount;
+
+			if (entry->type == ResourceType::Texture2D)
+				sizes[type] += Texture2DGetMemorySize((const Texture2D*)entry->resource);
+			else if (entry->type == ResourceType::Mesh)
+				sizes[type] += MeshGetMemorySize((const Mesh*)entry->resource);
+		}
+
+		for (int type = 0; type < (int)ResourceType::Count; type++)
+		{
+			if ((ResourceType)type == ResourceType::Shader)
+			{
+				Message("%s: %u, %u references, %u loads shared by path and %u by contents\n",
+					ResourceTypeNames[type], counts[type], references[type], cache->pathHits[type], cache->contentHits[type]);
+				continue;
+			}
+
+			Message("%s: %u, %.2f MB, %u references, %u loads shared by path and %u by contents\n",
+				ResourceTypeNames[type], counts[type], sizes[type] / (1024.0 * 1024.0), references[type],
+				cache->pathHits[type], cache->contentHits[type]);
+		}
+	}
+
+	void Dispose(ResourceCache* cache)
+	{
+		// Meshes first, disposing them releases the textures they took from the cache.
+		std::vector<ResourceEntry*> meshes;
+		for (const auto& pair : cache->byResource)
+		{
+			if (pair.second->type == ResourceType::Mesh)
+				meshes.push_back(pair.second);
+		}
+
+		for (ResourceEntry* entry : meshes)
+			ResourceCacheRemove(cache, entry);
+
+		for (const auto& pair : cache->byResource)
+			ResourceEntryDispose(pair.second);
+
+		delete cache;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,300 @@
+#include <gfxl_texture.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+#include <stb\stb_image.h>
+
+namespace gfxl
+{
+	// Linear values are turned back into 8 bit codes through a table this big, fine enough
+	// that every sRGB code stays reachable even in the dark end of the curve.
+	static const uint32 TextureEncodeTableSize = 16384;
+
+	struct TextureFilterTables
+	{
+		float32 decode[256];
+		unsigned char encode[TextureEncodeTableSize];
+	};
+
+	static TextureFilterTables TextureBuildFilterTables(bool srgb)
+	{
+		TextureFilterTables tables;
+
+		for (uint32 i = 0; i < 256; i++)
+		{
+			float32 value = i / 255.0f;
+			if (srgb)
+				value = value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+
+			tables.decode[i] = value;
+		}
+
+		for (uint32 i = 0; i < TextureEncodeTableSize; i++)
+		{
+			float32 value = (float32)i / (TextureEncodeTableSize - 1);
+			if (srgb)
+				value = value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+
+			tables.encode[i] = (unsigned char)(Clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+		}
+
+		return tables;
+	}
+
+	static const TextureFilterTables& TextureGetFilterTables(bool srgb)
+	{
+		static const TextureFilterTables linearTables = TextureBuildFilterTables(false);
+		static const TextureFilterTables srgbTables = TextureBuildFilterTables(true);
+		return srgb ? srgbTables : linearTables;
+	}
+
+	static inline __m128 TextureLoadTexel(const unsigned char* texel, const float32* decode)
+	{
+		return _mm_setr_ps(decode[texel[0]], decode[texel[1]], decode[texel[2]], (float32)texel[3]);
+	}
+
+	// Halves source into destination, one texel at a time with all four channels in a single
+	// register. Odd edges are dropped like the GL does when it sizes the next level.
+	static void TextureDownsample(unsigned char* destination, const TextureLevel& level,
+		const unsigned char* source, const TextureLevel& sourceLevel, const TextureFilterTables& tables)
+	{
+		// Averages the 4 texels and scales color to an encode table index and alpha to 0-255.
+		const float32 colorScale = 0.25f * (TextureEncodeTableSize - 1);
+		const __m128 scale = _mm_setr_ps(colorScale, colorScale, colorScale, 0.25f);
+
+		const uint32 sourceWidth = sourceLevel.width;
+		const uint32 sourceHeight = sourceLevel.height;
+
+		for (uint32 y = 0; y < level.height; y++)
+		{
+			const unsigned char* row0 = source + (size_t)(y * 2) * sourceWidth * 4;
+			const unsigned char* row1 = source + (size_t)Min(y * 2 + 1, sourceHeight - 1) * sourceWidth * 4;
+			unsigned char* output = destination + (size_t)y * level.width * 4;
+
+			for (uint32 x = 0; x < level.width; x++)
+			{
+				const uint32 x0 = x * 2 * 4;
+				const uint32 x1 = Min(x * 2 + 1, sourceWidth - 1) * 4;
+
+				__m128 sum = _mm_add_ps(
+					_mm_add_ps(TextureLoadTexel(row0 + x0, tables.decode), TextureLoadTexel(row0 + x1, tables.decode)),
+					_mm_add_ps(TextureLoadTexel(row1 + x0, tables.decode), TextureLoadTexel(row1 + x1, tables.decode)));
+
+				alignas(16) int32 index[4];
+				_mm_store_si128((__m128i*)index, _mm_cvtps_epi32(_mm_mul_ps(sum, scale)));
+
+				output[x * 4 + 0] = tables.encode[index[0]];
+				output[x * 4 + 1] = tables.encode[index[1]];
+				output[x * 4 + 2] = tables.encode[index[2]];
+				output[x * 4 + 3] = (unsigned char)index[3];
+			}
+		}
+	}
+
+	uint32 TextureFormatGetLevelSize(TextureFormat format, uint32 width, uint32 height)
+	{
+		const uint32 blocks = ((width + 3) / 4) * ((height + 3) / 4);
+
+		switch (format)
+		{
+		case TextureFormat::R8:
+			return width * height;
+
+		case TextureFormat::BC1:
+		case TextureFormat::BC4:
+			return blocks * 8;
+
+		case TextureFormat::BC3:
+		case TextureFormat::BC5:
+		case TextureFormat::BC7:
+			return blocks * 16;
+
+		default:
+			return width * height * 4;
+		}
+	}
+
+	bool TextureFormatIsCompressed(TextureFormat format)
+	{
+		return format != TextureFormat::RGBA8 && format != TextureFormat::R8;
+	}
+
+	TextureData* CreateTextureData()
+	{
+		TextureData* data = (TextureData*)malloc(sizeof(TextureData));
+		*data = {};
+		return data;
+	}
+
+	void TextureDataAllocate(TextureData* data, TextureFormat format, uint32 width, uint32 height, uint32 levelCount)
+	{
+		free(data->pixels);
+
+		data->format = format;
+		data->width = width;
+		data->height = height;
+		data->levelCount = Clamp(levelCount, 1u, TextureMaxLevels);
+		data->size = 0;
+
+		for (uint32 i = 0; i < data->levelCount; i++)
+		{
+			TextureLevel& level = data->levels[i];
+			level.width = Max(width >> i, 1u);
+			level.height = Max(height >> i, 1u);
+			level.offset = data->size;
+			level.size = TextureFormatGetLevelSize(format, level.width, level.height);
+
+			data->size += level.size;
+		}
+
+		data->pixels = (unsigned char*)malloc((size_t)data->size);
+	}
+
+	bool TextureDataLoadFromImageFile(TextureData* data, const char* filename)
+	{
+		int width, height, channels;
+		unsigned char* pixels = stbi_load(filename, &width, &height, &channels, STBI_rgb_alpha);
+
+		if (pixels == nullptr)
+		{
+			Message("[ERROR] Failed to load image file %s\n", filename);
+			return false;
+		}
+
+		free(data->pixels);
+
+		data->format = TextureFormat::RGBA8;
+		data->width = (uint32)width;
+		data->height = (uint32)height;
+
+		data->levels[0].width = data->width;
+		data->levels[0].height = data->height;
+		data->levels[0].offset = 0;
+		data->levels[0].size = TextureFormatGetLevelSize(data->format, data->width, data->height);
+		data->levelCount = 1;
+
+		// Copied out so the pixels are ours to realloc and free.
+		data->size = data->levels[0].size;
+		data->pixels = (unsigned char*)malloc((size_t)data->size);
+		memcpy(data->pixels, pixels, (size_t)data->size);
+
+		stbi_image_free(pixels);
+		return true;
+	}
+
+	bool TextureDataLoadFromChannelFiles(TextureData* data, const char* const filenames[4], const unsigned char defaults[4])
+	{
+		unsigned char* channels[4] = {};
+		int width = 0, height = 0;
+		bool success = true;
+
+		for (uint32 i = 0; i < 4 && success; i++)
+		{
+			if (filenames[i] == nullptr)
+				continue;
+
+			int channelWidth, channelHeight, channelCount;
+			channels[i] = stbi_load(filenames[i], &channelWidth, &channelHeight, &channelCount, STBI_grey);
+
+			if (channels[i] == nullptr)
+			{
+				Message("[ERROR] Failed to load image file %s\n", filenames[i]);
+				success = false;
+			}
+			else if (width != 0 && (channelWidth != width || channelHeight != height))
+			{
+				Message("[ERROR] Channel image %s is %ix%i, the others are %ix%i\n",
+					filenames[i], channelWidth, channelHeight, width, height);
+				success = false;
+			}
+
+			width = channelWidth;
+			height = channelHeight;
+		}
+
+		success = success && width > 0;
+
+		if (success)
+		{
+			free(data->pixels);
+
+			data->format = TextureFormat::RGBA8;
+			data->width = (uint32)width;
+			data->height = (uint32)height;
+
+			data->levels[0].width = data->width;
+			data->levels[0].height = data->height;
+			data->levels[0].offset = 0;
+			data->levels[0].size = TextureFormatGetLevelSize(data->format, data->width, data->height);
+			data->levelCount = 1;
+
+			data->size = data->levels[0].size;
+			data->pixels = (unsigned char*)malloc((size_t)data->size);
+
+			const size_t texelCount = (size_t)width * height;
+			for (uint32 i = 0; i < 4; i++)
+			{
+				unsigned char* output = data->pixels + i;
+
+				if (channels[i] == nullptr)
+				{
+					for (size_t j = 0; j < texelCount; j++)
+						output[j * 4] = defaults[i];
+				}
+				else
+				{
+					for (size_t j = 0; j < texelCount; j++)
+						output[j * 4] = channels[i][j];
+				}
+			}
+		}
+
+		for (uint32 i = 0; i < 4; i++)
+			stbi_image_free(channels[i]);
+
+		return success;
+	}
+
+	void TextureDataBuildMips(TextureData* data, bool srgb)
+	{
+		if (data->pixels == nullptr)
+			return;
+
+		data->levelCount = 1;
+		data->size = data->levels[0].size;
+
+		while (data->levelCount < TextureMaxLevels)
+		{
+			const TextureLevel& previous = data->levels[data->levelCount - 1];
+			if (previous.width == 1 && previous.height == 1)
+				break;
+
+			TextureLevel& level = data->levels[data->levelCount++];
+			level.width = Max(previous.width / 2, 1u);
+			level.height = Max(previous.height / 2, 1u);
+			level.offset = data->size;
+			level.size = TextureFormatGetLevelSize(data->format, level.width, level.height);
+
+			data->size += level.size;
+		}
+
+		data->pixels = (unsigned char*)realloc(data->pixels, (size_t)data->size);
+
+		const TextureFilterTables& tables = TextureGetFilterTables(srgb);
+		for (uint32 i = 1; i < data->levelCount; i++)
+		{
+			const TextureLevel& source = data->levels[i - 1];
+			const TextureLevel& level = data->levels[i];
+
+			TextureDownsample(data->pixels + level.offset, level, data->pixels + source.offset, source, tables);
+		}
+	}
+
+	void Dispose(TextureData* data)
+	{
+		free(data->pixels);
+		free(data);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,495 @@
+#include <gfxl_texture.h>
+
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+
+namespace gfxl
+{
+	// Power iterations spent looking for the principal axis of a block's colors.
+	static const uint32 CompressAxisIterations = 4;
+
+	// BC7 interpolation weights for 4 bit indices, out of 64.
+	static const uint32 CompressBc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// A 4x4 block of texels as floats in 0-255, texels past the edge of the level repeat the last one.
+	struct CompressBlock
+	{
+		alignas(16) float32 texels[16][4];
+	};
+
+	struct CompressBits
+	{
+		ulong64 words[2];
+		uint32 position;
+	};
+
+	struct CompressJob
+	{
+		const unsigned char* source;
+		unsigned char* destination;
+		TextureLevel level;
+		TextureFormat format;
+		uint32 blocksX;
+		uint32 blockSize;
+	};
+
+	static inline float32 CompressDot(__m128 a, __m128 b)
+	{
+		__m128 product = _mm_mul_ps(a, b);
+		__m128 shuffled = _mm_shuffle_ps(product, product, _MM_SHUFFLE(2, 3, 0, 1));
+		__m128 sums = _mm_add_ps(product, shuffled);
+		shuffled = _mm_movehl_ps(shuffled, sums);
+		return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+	}
+
+	static void CompressLoadBlock(CompressBlock* block, const unsigned char* pixels, const TextureLevel& level,
+		uint32 blockX, uint32 blockY)
+	{
+		for (uint32 y = 0; y < 4; y++)
+		{
+			const uint32 sourceY = Min(blockY * 4 + y, level.height - 1);
+
+			for (uint32 x = 0; x < 4; x++)
+			{
+				const uint32 sourceX = Min(blockX * 4 + x, level.width - 1);
+				const unsigned char* texel = pixels + ((size_t)sourceY * level.width + sourceX) * 4;
+
+				for (uint32 i = 0; i < 4; i++)
+					block->texels[y * 4 + x][i] = texel[i];
+			}
+		}
+	}
+
+	// Endpoints on the principal axis of the texels, found with a few power iterations on
+	// their covariance. The extremes of the texels projected on it become the endpoints.
+	// Channels zeroed in mask are left out of the fit.
+	static void CompressFitEndpoints(const CompressBlock& block, __m128 mask, __m128* endpoint0, __m128* endpoint1)
+	{
+		__m128 texels[16];
+		__m128 mean = _mm_setzero_ps();
+		__m128 minimum = _mm_set1_ps(FLT_MAX);
+		__m128 maximum = _mm_set1_ps(-FLT_MAX);
+
+		for (uint32 i = 0; i < 16; i++)
+		{
+			texels[i] = _mm_mul_ps(_mm_load_ps(block.texels[i]), mask);
+			mean = _mm_add_ps(mean, texels[i]);
+			minimum = _mm_min_ps(minimum, texels[i]);
+			maximum = _mm_max_ps(maximum, texels[i]);
+		}
+
+		mean = _mm_mul_ps(mean, _mm_set1_ps(1.0f / 16.0f));
+
+		__m128 axis = _mm_sub_ps(maximum, minimum);
+		float32 length = sqrtf(CompressDot(axis, axis));
+
+		// A flat block, both endpoints are the same.
+		if (length < 1e-3f)
+		{
+			*endpoint0 = *endpoint1 = mean;
+			return;
+		}
+
+		axis = _mm_mul_ps(axis, _mm_set1_ps(1.0f / length));
+
+		for (uint32 iteration = 0; iteration < CompressAxisIterations; iteration++)
+		{
+			__m128 next = _mm_setzero_ps();
+			for (uint32 i = 0; i < 16; i++)
+			{
+				__m128 offset = _mm_sub_ps(texels[i], mean);
+				next = _mm_add_ps(next, _mm_mul_ps(offset, _mm_set1_ps(CompressDot(offset, axis))));
+			}
+
+			length = sqrtf(CompressDot(next, next));
+			if (length < 1e-3f)
+				break;
+
+			axis = _mm_mul_ps(next, _mm_set1_ps(1.0f / length));
+		}
+
+		float32 low = FLT_MAX;
+		float32 high = -FLT_MAX;
+
+		for (uint32 i = 0; i < 16; i++)
+		{
+			float32 t = CompressDot(_mm_sub_ps(texels[i], mean), axis);
+			low = Min(low, t);
+			high = Max(high, t);
+		}
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(255.0f);
+
+		*endpoint0 = _mm_min_ps(_mm_max_ps(_mm_add_ps(mean, _mm_mul_ps(axis, _mm_set1_ps(low))), zero), one);
+		*endpoint1 = _mm_min_ps(_mm_max_ps(_mm_add_ps(mean, _mm_mul_ps(axis, _mm_set1_ps(high))), zero), one);
+	}
+
+	static inline uint32 CompressNearest(__m128 texel, const __m128* palette, uint32 count)
+	{
+		uint32 best = 0;
+		float32 bestError = FLT_MAX;
+
+		for (uint32 i = 0; i < count; i++)
+		{
+			__m128 difference = _mm_sub_ps(texel, palette[i]);
+			float32 error = CompressDot(difference, difference);
+
+			if (error < bestError)
+			{
+				best = i;
+				bestError = error;
+			}
+		}
+
+		return best;
+	}
+
+	static inline ushort16 CompressTo565(__m128 color)
+	{
+		alignas(16) float32 channels[4];
+		_mm_store_ps(channels, color);
+
+		uint32 r = (uint32)(channels[0] * (31.0f / 255.0f) + 0.5f);
+		uint32 g = (uint32)(channels[1] * (63.0f / 255.0f) + 0.5f);
+		uint32 b = (uint32)(channels[2] * (31.0f / 255.0f) + 0.5f);
+
+		return (ushort16)((r << 11) | (g << 5) | b);
+	}
+
+	static inline __m128 CompressFrom565(ushort16 color)
+	{
+		uint32 r = (color >> 11) & 31;
+		uint32 g = (color >> 5) & 63;
+		uint32 b = color & 31;
+
+		return _mm_setr_ps((float32)((r << 3) | (r >> 2)), (float32)((g << 2) | (g >> 4)), (float32)((b << 3) | (b >> 2)), 0.0f);
+	}
+
+	// Always in the 4 color mode, so the same block works as the color half of BC3.
+	static void CompressBc1(unsigned char* output, const CompressBlock& block)
+	{
+		const __m128 mask = _mm_setr_ps(1.0f, 1.0f, 1.0f, 0.0f);
+
+		__m128 endpoint0, endpoint1;
+		CompressFitEndpoints(block, mask, &endpoint0, &endpoint1);
+
+		ushort16 color0 = CompressTo565(endpoint0);
+		ushort16 color1 = CompressTo565(endpoint1);
+
+		if (color0 < color1)
+		{
+			ushort16 swap = color0;
+			color0 = color1;
+			color1 = swap;
+		}
+
+		uint32 indices = 0;
+
+		// Equal endpoints can't be in the 4 color mode, every texel takes color0.
+		if (color0 != color1)
+		{
+			__m128 palette[4];
+			palette[0] = CompressFrom565(color0);
+			palette[1] = CompressFrom565(color1);
+			palette[2] = _mm_mul_ps(_mm_add_ps(_mm_add_ps(palette[0], palette[0]), palette[1]), _mm_set1_ps(1.0f / 3.0f));
+			palette[3] = _mm_mul_ps(_mm_add_ps(_mm_add_ps(palette[1], palette[1]), palette[0]), _mm_set1_ps(1.0f / 3.0f));
+
+			for (uint32 i = 0; i < 16; i++)
+			{
+				__m128 texel = _mm_mul_ps(_mm_load_ps(block.texels[i]), mask);
+				indices |= CompressNearest(texel, palette, 4) << (i * 2);
+			}
+		}
+
+		memcpy(output + 0, &color0, sizeof(color0));
+		memcpy(output + 2, &color1, sizeof(color1));
+		memcpy(output + 4, &indices, sizeof(indices));
+	}
+
+	// One channel, always in the 8 value mode with the extremes of the block as endpoints.
+	static void CompressBc4(unsigned char* output, const CompressBlock& block, uint32 channel)
+	{
+		float32 low = 255.0f;
+		float32 high = 0.0f;
+
+		for (uint32 i = 0; i < 16; i++)
+		{
+			low = Min(low, block.texels[i][channel]);
+			high = Max(high, block.texels[i][channel]);
+		}
+
+		const uint32 value0 = (uint32)(high + 0.5f);
+		const uint32 value1 = (uint32)(low + 0.5f);
+		ulong64 indices = 0;
+
+		if (value0 != value1)
+		{
+			float32 palette[8];
+			palette[0] = (float32)value0;
+			palette[1] = (float32)value1;
+
+			for (uint32 i = 2; i < 8; i++)
+				palette[i] = (float32)(((8 - i) * value0 + (i - 1) * value1) / 7);
+
+			for (uint32 i = 0; i < 16; i++)
+			{
+				uint32 best = 0;
+				float32 bestError = FLT_MAX;
+
+				for (uint32 j = 0; j < 8; j++)
+				{
+					float32 error = fabsf(block.texels[i][channel] - palette[j]);
+					if (error < bestError)
+					{
+						best = j;
+						bestError = error;
+					}
+				}
+
+				indices |= (ulong64)best << (i * 3);
+			}
+		}
+
+		output[0] = (unsigned char)value0;
+		output[1] = (unsigned char)value1;
+		memcpy(output + 2, &indices, 6);
+	}
+
+	static inline void CompressWriteBits(CompressBits* bits, uint32 value, uint32 count)
+	{
+		for (uint32 i = 0; i < count; i++, bits->position++)
+		{
+			if ((value >> i) & 1)
+				bits->words[bits->position / 64] |= 1ull << (bits->position % 64);
+		}
+	}
+
+	// Both endpoints share the low bit of every channel (the p-bit), the one that lands
+	// closest to the unquantized endpoint is kept.
+	static void CompressQuantizeBc7(__m128 endpoint, uint32 channels[4], uint32* pbit)
+	{
+		alignas(16) float32 values[4];
+		_mm_store_ps(values, endpoint);
+
+		float32 bestError = FLT_MAX;
+
+		for (uint32 p = 0; p < 2; p++)
+		{
+			uint32 candidate[4];
+			float32 error = 0.0f;
+
+			for (uint32 i = 0; i < 4; i++)
+			{
+				candidate[i] = (uint32)Clamp((values[i] - p) * 0.5f + 0.5f, 0.0f, 127.0f);
+
+				float32 difference = (float32)(candidate[i] * 2 + p) - values[i];
+				error += difference * difference;
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				*pbit = p;
+				memcpy(channels, candidate, sizeof(candidate));
+			}
+		}
+	}
+
+	// Mode 6 only, a single subset with RGBA endpoints and 4 bit indices. It carries alpha
+	// in the same fit as color and is the best of the single subset modes for most blocks.
+	static void CompressBc7(unsigned char* output, const CompressBlock& block)
+	{
+		__m128 endpoint0, endpoint1;
+		CompressFitEndpoints(block, _mm_set1_ps(1.0f), &endpoint0, &endpoint1);
+
+		uint32 channels[2][4];
+		uint32 pbits[2];
+		CompressQuantizeBc7(endpoint0, channels[0], &pbits[0]);
+		CompressQuantizeBc7(endpoint1, channels[1], &pbits[1]);
+
+		__m128 palette[16];
+		for (uint32 i = 0; i < 16; i++)
+		{
+			alignas(16) float32 color[4];
+			for (uint32 j = 0; j < 4; j++)
+			{
+				uint32 value0 = channels[0][j] * 2 + pbits[0];
+				uint32 value1 = channels[1][j] * 2 + pbits[1];
+				color[j] = (float32)(((64 - CompressBc7Weights[i]) * value0 + CompressBc7Weights[i] * value1 + 32) >> 6);
+			}
+
+			palette[i] = _mm_load_ps(color);
+		}
+
+		uint32 indices[16];
+		for (uint32 i = 0; i < 16; i++)
+			indices[i] = CompressNearest(_mm_load_ps(block.texels[i]), palette, 16);
+
+		// The first index is stored without its top bit, which has to be 0, swapping the
+		// endpoints flips every index around to make it so.
+		if (indices[0] & 8)
+		{
+			for (uint32 j = 0; j < 4; j++)
+			{
+				uint32 swap = channels[0][j];
+				channels[0][j] = channels[1][j];
+				channels[1][j] = swap;
+			}
+
+			uint32 swap = pbits[0];
+			pbits[0] = pbits[1];
+			pbits[1] = swap;
+
+			for (uint32 i = 0; i < 16; i++)
+				indices[i] = 15 - indices[i];
+		}
+
+		CompressBits bits = {};
+		CompressWriteBits(&bits, 1 << 6, 7);
+
+		for (uint32 j = 0; j < 4; j++)
+		{
+			CompressWriteBits(&bits, channels[0][j], 7);
+			CompressWriteBits(&bits, channels[1][j], 7);
+		}
+
+		CompressWriteBits(&bits, pbits[0], 1);
+		CompressWriteBits(&bits, pbits[1], 1);
+
+		CompressWriteBits(&bits, indices[0], 3);
+		for (uint32 i = 1; i < 16; i++)
+			CompressWriteBits(&bits, indices[i], 4);
+
+		memcpy(output, bits.words, 16);
+	}
+
+	static void CompressRow(uint32 blockY, void* userData)
+	{
+		const CompressJob* job = (const CompressJob*)userData;
+		unsigned char* output = job->destination + (size_t)blockY * job->blocksX * job->blockSize;
+
+		CompressBlock block;
+
+		for (uint32 blockX = 0; blockX < job->blocksX; blockX++, output += job->blockSize)
+		{
+			CompressLoadBlock(&block, job->source, job->level, blockX, blockY);
+
+			switch (job->format)
+			{
+			case TextureFormat::BC1:
+				CompressBc1(output, block);
+				break;
+
+			case TextureFormat::BC3:
+				CompressBc4(output, block, 3);
+				CompressBc1(output + 8, block);
+				break;
+
+			case TextureFormat::BC4:
+				CompressBc4(output, block, 0);
+				break;
+
+			case TextureFormat::BC5:
+				CompressBc4(output, block, 0);
+				CompressBc4(output + 8, block, 1);
+				break;
+
+			case TextureFormat::BC7:
+				CompressBc7(output, block);
+				break;
+
+			default:
+				break;
+			}
+		}
+	}
+
+	TextureFormat TextureChooseFormat(const TextureData* data, const TextureLoadSettings& settings, uint32 supportedFormats)
+	{
+		supportedFormats |= TextureFormatBit(TextureFormat::RGBA8) | TextureFormatBit(TextureFormat::R8);
+
+		const bool compress = settings.compression != TextureCompression::None;
+		TextureFormat format = TextureFormat::RGBA8;
+
+		if (settings.role == TextureRole::Mask)
+		{
+			format = compress ? TextureFormat::BC4 : TextureFormat::R8;
+			return (supportedFormats & TextureFormatBit(format)) ? format : TextureFormat::R8;
+		}
+
+		if (settings.role == TextureRole::Normal)
+		{
+			format = compress ? TextureFormat::BC5 : TextureFormat::RGBA8;
+			return (supportedFormats & TextureFormatBit(format)) ? format : TextureFormat::RGBA8;
+		}
+
+		if (!compress)
+			return TextureFormat::RGBA8;
+
+		if (settings.compression == TextureCompression::High && (supportedFormats & TextureFormatBit(TextureFormat::BC7)))
+			return TextureFormat::BC7;
+
+		bool opaque = true;
+		for (ulong64 i = 3; opaque && data->pixels != nullptr && i < data->levels[0].size; i += 4)
+			opaque = data->pixels[i] == 255;
+
+		format = opaque ? TextureFormat::BC1 : TextureFormat::BC3;
+		return (supportedFormats & TextureFormatBit(format)) ? format : TextureFormat::RGBA8;
+	}
+
+	void TextureDataCompress(TextureData* data, TextureFormat format)
+	{
+		if (data->pixels == nullptr || data->format != TextureFormat::RGBA8 || format == TextureFormat::RGBA8)
+			return;
+
+		TextureLevel levels[TextureMaxLevels];
+		ulong64 size = 0;
+
+		for (uint32 i = 0; i < data->levelCount; i++)
+		{
+			levels[i].width = data->levels[i].width;
+			levels[i].height = data->levels[i].height;
+			levels[i].offset = size;
+			levels[i].size = TextureFormatGetLevelSize(format, levels[i].width, levels[i].height);
+
+			size += levels[i].size;
+		}
+
+		unsigned char* pixels = (unsigned char*)malloc((size_t)size);
+
+		for (uint32 i = 0; i < data->levelCount; i++)
+		{
+			const unsigned char* source = data->pixels + data->levels[i].offset;
+			unsigned char* destination = pixels + levels[i].offset;
+
+			if (format == TextureFormat::R8)
+			{
+				for (ulong64 j = 0; j < levels[i].size; j++)
+					destination[j] = source[j * 4];
+
+				continue;
+			}
+
+			CompressJob job;
+			job.source = source;
+			job.destination = destination;
+			job.level = data->levels[i];
+			job.format = format;
+			job.blocksX = (levels[i].width + 3) / 4;
+			job.blockSize = TextureFormatGetLevelSize(format, 4, 4);
+
+			ParallelFor((levels[i].height + 3) / 4, CompressRow, &job);
+		}
+
+		free(data->pixels);
+
+		data->format = format;
+		data->pixels = pixels;
+		data->size = size;
+		memcpy(data->levels, levels, sizeof(TextureLevel) * data->levelCount);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include <gfxl_texture.h>
+
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+namespace gfxl
+{
+	static const uint32 CookedTextureMagic = 0x54584647; // "GFXT"
+	static const uint32 CookedTextureVersion = 3;
+	static const uint32 CookedTextureAlignment = 16;
+
+	static const uint32 CookedEnvironmentMagic = 0x56454647; // "GFEV"
+	static const uint32 CookedEnvironmentVersion = 1;
+
+	// The level table follows the header, the pixels of every level start at pixelOffset,
+	// largest level first. Level offsets are relative to pixelOffset.
+	struct CookedTextureHeader
+	{
+		uint32 magic;
+		uint32 version;
+
+		ulong64 sourceSize;
+		ulong64 sourceTime;
+		uint32 settingsKey;
+
+		uint32 format;
+		uint32 width;
+		uint32 height;
+		uint32 levelCount;
+
+		ulong64 levelOffset;
+		ulong64 pixelOffset;
+		ulong64 pixelSize;
+	};
+
+	// The pixels of the six specular faces follow the header, then the BRDF table. Their
+	// levels are laid out like TextureDataAllocate does from the sizes.
+	struct CookedEnvironmentHeader
+	{
+		uint32 magic;
+		uint32 version;
+
+		ulong64 sourceSize;
+		ulong64 sourceTime;
+		uint32 settingsKey;
+		uint32 specularSize;
+
+		float32 irradiance[27];
+
+		uint32 faceSize;
+		uint32 faceLevelCount;
+		uint32 brdfSize;
+	};
+
+	// Only settings that change the cooked pixels take part, the cache flag itself doesn't.
+	static uint32 CookedTextureSettingsKey(const TextureLoadSettings& settings)
+	{
+		uint32 key = 0;
+		key |= settings.srgb ? 1 : 0;
+		key |= (uint32)settings.role << 1;
+		key |= (uint32)settings.compression << 3;
+		return key;
+	}
+
+	// Total size and latest write time, a change to any source changes one or the other.
+	static bool CookedTextureGetSourceInfo(const char* const* sourceFilenames, uint32 sourceCount,
+		ulong64* size, ulong64* writeTime)
+	{
+		*size = 0;
+		*writeTime = 0;
+
+		for (uint32 i = 0; i < sourceCount; i++)
+		{
+			ulong64 sourceSize, sourceTime;
+			if (!FileGetInfo(sourceFilenames[i], &sourceSize, &sourceTime))
+				return false;
+
+			*size += sourceSize;
+			*writeTime = Max(*writeTime, sourceTime);
+		}
+
+		return sourceCount > 0;
+	}
+
+	bool TextureDataWriteCooked(const TextureData* data, const char* filename,
+		const char* const* sourceFilenames, uint32 sourceCount, const TextureLoadSettings& settings)
+	{
+		CookedTextureHeader header = {};
+		header.magic = CookedTextureMagic;
+		header.version = CookedTextureVersion;
+
+		if (data->pixels == nullptr ||
+			!CookedTextureGetSourceInfo(sourceFilenames, sourceCount, &header.sourceSize, &header.sourceTime))
+			return false;
+
+		header.settingsKey = CookedTextureSettingsKey(settings);
+		header.format = (uint32)data->format;
+		header.width = data->width;
+		header.height = data->height;
+		header.levelCount = data->levelCount;
+
+		const size_t levelSize = sizeof(TextureLevel) * data->levelCount;
+		header.levelOffset = sizeof(CookedTextureHeader);
+		header.pixelOffset = (header.levelOffset + levelSize + CookedTextureAlignment - 1) & ~(ulong64)(CookedTextureAlignment - 1);
+		header.pixelSize = data->size;
+
+		static const char padding[CookedTextureAlignment] = {};
+		const size_t paddingSize = (size_t)(header.pixelOffset - header.levelOffset - levelSize);
+
+		// Write next to the destination and swap it in at the end, a crash mid write
+		// must never leave a truncated file that looks valid.
+		std::string temporary = std::string(filename) + ".tmp";
+
+		FILE* file = fopen(temporary.c_str(), "wb");
+		if (file == nullptr)
+			return false;
+
+		bool success =
+			fwrite(&header, sizeof(header), 1, file) == 1 &&
+			fwrite(data->levels, levelSize, 1, file) == 1 &&
+			fwrite(padding, 1, paddingSize, file) == paddingSize &&
+			fwrite(data->pixels, 1, (size_t)data->size, file) == data->size;
+
+		success = fclose(file) == 0 && success;
+
+		if (success)
+		{
+			remove(filename);
+			success = rename(temporary.c_str(), filename) == 0;
+		}
+
+		if (!success)
+			remove(temporary.c_str());
+
+		return success;
+	}
+
+	bool CookedTextureOpen(CookedTexture* cooked, const char* filename,
+		const char* const* sourceFilenames, uint32 sourceCount, const TextureLoadSettings& settings)
+	{
+		*cooked = {};
+
+		ulong64 sourceSize, sourceTime;
+		if (!CookedTextureGetSourceInfo(sourceFilenames, sourceCount, &sourceSize, &sourceTime))
+			return false;
+
+		if (!MappedFileOpen(&cooked->file, filename))
+			return false;
+
+		const MappedFile& file = cooked->file;
+		const CookedTextureHeader* header = (const CookedTextureHeader*)file.data;
+
+		bool valid = file.size >= sizeof(CookedTextureHeader) &&
+			header->magic == CookedTextureMagic &&
+			header->version == CookedTextureVersion &&
+			header->sourceSize == sourceSize &&
+			header->sourceTime == sourceTime &&
+			header->settingsKey == CookedTextureSettingsKey(settings) &&
+			header->format <= (uint32)TextureFormat::BC7 &&
+			header->levelCount > 0 && header->levelCount <= TextureMaxLevels &&
+			header->levelOffset + sizeof(TextureLevel) * (ulong64)header->levelCount <= file.size &&
+			header->pixelOffset + header->pixelSize <= file.size;
+
+		const TextureLevel* levels = valid ? (const TextureLevel*)(file.data + header->levelOffset) : nullptr;
+		for (uint32 i = 0; valid && i < header->levelCount; i++)
+		{
+			valid = levels[i].offset + levels[i].size <= header->pixelSize &&
+				levels[i].size == TextureFormatGetLevelSize((TextureFormat)header->format, levels[i].width, levels[i].height);
+		}
+
+		if (!valid)
+		{
+			CookedTextureClose(cooked);
+			return false;
+		}
+
+		cooked->format = (TextureFormat)header->format;
+		cooked->width = header->width;
+		cooked->height = header->height;
+		cooked->levels = levels;
+		cooked->levelCount = header->levelCount;
+		cooked->pixels = (const unsigned char*)file.data + header->pixelOffset;
+
+		return true;
+	}
+
+	void CookedTextureClose(CookedTexture* cooked)
+	{
+		MappedFileClose(&cooked->file);
+		*cooked = {};
+	}
+
+	bool EnvironmentDataWriteCooked(const EnvironmentData* data, const char* filename,
+		const char* const* sourceFilenames, uint32 sourceCount, const TextureLoadSettings& settings, uint32 specularSize)
+	{
+		CookedEnvironmentHeader header = {};
+		header.magic = CookedEnvironmentMagic;
+		header.version = CookedEnvironmentVersion;
+
+		if (data->brdf->pixels == nullptr ||
+			!CookedTextureGetSourceInfo(sourceFilenames, sourceCount, &header.sourceSize, &header.sourceTime))
+			return false;
+
+		header.settingsKey = CookedTextureSettingsKey(settings);
+		header.specularSize = specularSize;
+		memcpy(header.irradiance, data->irradiance, sizeof(header.irradiance));
+
+		header.faceSize = data->specular[0]->width;
+		header.faceLevelCount = data->specular[0]->levelCount;
+		header.brdfSize = data->brdf->width;
+
+		std::string temporary = std::string(filename) + ".tmp";
+
+		FILE* file = fopen(temporary.c_str(), "wb");
+		if (file == nullptr)
+			return false;
+
+		bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+
+		for (uint32 i = 0; i < 6 && success; i++)
+			success = fwrite(data->specular[i]->pixels, 1, (size_t)data->specular[i]->size, file) == data->specular[i]->size;
+
+		success = success && fwrite(data->brdf->pixels, 1, (size_t)data->brdf->size, file) == data->brdf->size;
+		success = fclose(file) == 0 && success;
+
+		if (success)
+		{
+			remove(filename);
+			success = rename(temporary.c_str(), filename) == 0;
+		}
+
+		if (!success)
+			remove(temporary.c_str());
+
+		return success;
+	}
+
+	bool EnvironmentDataReadCooked(EnvironmentData* data, const char* filename,
+		const char* const* sourceFilenames, uint32 sourceCount, const TextureLoadSettings& settings, uint32 specularSize)
+	{
+		ulong64 sourceSize, sourceTime;
+		if (!CookedTextureGetSourceInfo(sourceFilenames, sourceCount, &sourceSize, &sourceTime))
+			return false;
+
+		FILE* file = fopen(filename, "rb");
+		if (file == nullptr)
+			return false;
+
+		CookedEnvironmentHeader header;
+		bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+			header.magic == CookedEnvironmentMagic &&
+			header.version == CookedEnvironmentVersion &&
+			header.sourceSize == sourceSize &&
+			header.sourceTime == sourceTime &&
+			header.settingsKey == CookedTextureSettingsKey(settings) &&
+			header.specularSize == specularSize &&
+			header.faceSize > 0 && header.faceSize <= specularSize &&
+			header.faceLevelCount > 0 && header.faceLevelCount <= TextureMaxLevels &&
+			header.brdfSize > 0 && header.brdfSize <= 4096;
+
+		for (uint32 i = 0; i < 6 && valid; i++)
+		{
+			TextureData* face = data->specular[i];
+			TextureDataAllocate(face, TextureFormat::RGBA8, header.faceSize, header.faceSize, header.faceLevelCount);
+			valid = fread(face->pixels, 1, (size_t)face->size, file) == face->size;
+		}
+
+		if (valid)
+		{
+			TextureDataAllocate(data->brdf, TextureFormat::RGBA8, header.brdfSize, header.brdfSize, 1);
+			valid = fread(data->brdf->pixels, 1, (size_t)data->brdf->size, file) == data->brdf->size;
+		}
+
+		fclose(file);
+
+		if (valid)
+			memcpy(data->irradiance, header.irradiance, sizeof(header.irradiance));
+
+		return valid;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,679 @@
+#include <gfxl_texture.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+#include <emmintrin.h>
+
+namespace gfxl
+{
+	// The faces are box filtered down to at most this size before any convolution, the
+	// specular chain never starts anywhere near it.
+	static const uint32 EnvironmentSourceSize = 512;
+
+	// Irradiance is projected from the first source level at most this big, it only keeps
+	// the lowest frequencies anyway.
+	static const uint32 EnvironmentShSize = 64;
+
+	// Levels of the specular chain, the last one is for roughness 1.
+	static const uint32 EnvironmentSpecularLevels = 6;
+	static const uint32 EnvironmentSpecularSamples = 128;
+
+	static const uint32 EnvironmentBrdfSize = 128;
+	static const uint32 EnvironmentBrdfSamples = 256;
+
+	// The faces as linear RGBA floats, with a box filtered chain the prefilter reads coarser
+	// levels from as its samples spread out. Every level holds the six faces one after the other.
+	struct EnvironmentSource
+	{
+		std::vector<float32> levels[TextureMaxLevels];
+		uint32 sizes[TextureMaxLevels];
+		uint32 levelCount;
+	};
+
+	struct EnvironmentSourceJob
+	{
+		EnvironmentSource* source;
+		const TextureData* const* faces;
+		const float32* decode;
+		uint32 level;
+
+		// Source texels averaged per base level texel, along each axis.
+		uint32 factor;
+	};
+
+	struct EnvironmentShJob
+	{
+		const EnvironmentSource* source;
+		uint32 level;
+
+		// Per face row, 9 coefficients times rgb and then the total weight.
+		float32* rows;
+	};
+
+	struct EnvironmentPrefilterJob
+	{
+		const EnvironmentSource* source;
+		TextureData* const* faces;
+		uint32 level;
+		uint32 size;
+
+		// Sample directions around the normal in tangent space, their weight and the source
+		// level they read, padded to a multiple of 4 with zero weights.
+		std::vector<float32> x, y, z;
+		std::vector<float32> weights;
+		std::vector<float32> sourceLevels;
+		float32 weightSum;
+	};
+
+	struct EnvironmentBrdfJob
+	{
+		unsigned char* pixels;
+
+		// The Hammersley points of every sample, the azimuth as its cosine.
+		alignas(16) float32 cosPhi[EnvironmentBrdfSamples];
+		alignas(16) float32 v[EnvironmentBrdfSamples];
+	};
+
+	static const uint32 EnvironmentShFloats = 9 * 3 + 1;
+
+	static inline float32 EnvironmentSum(__m128 value)
+	{
+		__m128 shuffled = _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 3, 0, 1));
+		__m128 sums = _mm_add_ps(value, shuffled);
+		shuffled = _mm_movehl_ps(shuffled, sums);
+		return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+	}
+
+	static inline __m128 EnvironmentLerp(__m128 a, __m128 b, float32 t)
+	{
+		return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(t)));
+	}
+
+	static inline float32 EnvironmentRadicalInverse(uint32 bits)
+	{
+		bits = (bits << 16) | (bits >> 16);
+		bits = ((bits & 0x55555555) << 1) | ((bits & 0xAAAAAAAA) >> 1);
+		bits = ((bits & 0x33333333) << 2) | ((bits & 0xCCCCCCCC) >> 2);
+		bits = ((bits & 0x0F0F0F0F) << 4) | ((bits & 0xF0F0F0F0) >> 4);
+		bits = ((bits & 0x00FF00FF) << 8) | ((bits & 0xFF00FF00) >> 8);
+		return bits * 2.3283064365386963e-10f;
+	}
+
+	static inline unsigned char EnvironmentEncode(float32 value)
+	{
+		value = Clamp(value, 0.0f, 1.0f);
+		value = value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+		return (unsigned char)(value * 255.0f + 0.5f);
+	}
+
+	// The direction through (s, t) in [-1, 1] of a face, as the GL picks cubemap faces.
+	// Not normalized, the major axis is always 1.
+	static inline Vector3 EnvironmentTexelDirection(uint32 face, float32 s, float32 t)
+	{
+		switch (face)
+		{
+		case 0: return Vector3(1.0f, -t, -s);
+		case 1: return Vector3(-1.0f, -t, s);
+		case 2: return Vector3(s, 1.0f, t);
+		case 3: return Vector3(s, -1.0f, -t);
+		case 4: return Vector3(s, -t, 1.0f);
+		default: return Vector3(-s, -t, -1.0f);
+		}
+	}
+
+	// EnvironmentTexelDirection for four texels of a row at once.
+	static inline void EnvironmentTexelDirection(uint32 face, __m128 s, __m128 t, __m128* x, __m128* y, __m128* z)
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 zero = _mm_setzero_ps();
+
+		switch (face)
+		{
+		case 0: *x = one; *y = _mm_sub_ps(zero, t); *z = _mm_sub_ps(zero, s); break;
+		case 1: *x = _mm_sub_ps(zero, one); *y = _mm_sub_ps(zero, t); *z = s; break;
+		case 2: *x = s; *y = one; *z = t; break;
+		case 3: *x = s; *y = _mm_sub_ps(zero, one); *z = _mm_sub_ps(zero, t); break;
+		case 4: *x = s; *y = _mm_sub_ps(zero, t); *z = one; break;
+		default: *x = _mm_sub_ps(zero, s); *y = _mm_sub_ps(zero, t); *z = _mm_sub_ps(zero, one); break;
+		}
+	}
+
+	static inline uint32 EnvironmentDirectionFace(float32 x, float32 y, float32 z, float32* s, float32* t)
+	{
+		const float32 ax = fabsf(x), ay = fabsf(y), az = fabsf(z);
+		uint32 face;
+		float32 sc, tc, major;
+
+		if (ax >= ay && ax >= az)
+		{
+			face = x > 0.0f ? 0 : 1;
+			sc = x > 0.0f ? -z : z;
+			tc = -y;
+			major = ax;
+		}
+		else if (ay >= az)
+		{
+			face = y > 0.0f ? 2 : 3;
+			sc = x;
+			tc = y > 0.0f ? z : -z;
+			major = ay;
+		}
+		else
+		{
+			face = z > 0.0f ? 4 : 5;
+			sc = z > 0.0f ? x : -x;
+			tc = -y;
+			major = az;
+		}
+
+		*s = sc / major;
+		*t = tc / major;
+		return face;
+	}
+
+	static inline __m128 EnvironmentFetch(const EnvironmentSource& source, uint32 level, uint32 face, float32 s, float32 t)
+	{
+		const uint32 size = source.sizes[level];
+		const float32* texels = source.levels[level].data() + (size_t)face * size * size * 4;
+
+		// Filtering stops at the edge of the face, the seams are a texel wide at most.
+		const float32 x = Clamp((s * 0.5f + 0.5f) * size - 0.5f, 0.0f, (float32)(size - 1));
+		const float32 y = Clamp((t * 0.5f + 0.5f) * size - 0.5f, 0.0f, (float32)(size - 1));
+
+		const uint32 x0 = (uint32)x, y0 = (uint32)y;
+		const uint32 x1 = Min(x0 + 1, size - 1), y1 = Min(y0 + 1, size - 1);
+
+		const float32* row0 = texels + (size_t)y0 * size * 4;
+		const float32* row1 = texels + (size_t)y1 * size * 4;
+
+		const __m128 top = EnvironmentLerp(_mm_loadu_ps(row0 + x0 * 4), _mm_loadu_ps(row0 + x1 * 4), x - x0);
+		const __m128 bottom = EnvironmentLerp(_mm_loadu_ps(row1 + x0 * 4), _mm_loadu_ps(row1 + x1 * 4), x - x0);
+		return EnvironmentLerp(top, bottom, y - y0);
+	}
+
+	// Trilinear, between the two source levels around level.
+	static inline __m128 EnvironmentSample(const EnvironmentSource& source, float32 x, float32 y, float32 z, float32 level)
+	{
+		float32 s, t;
+		const uint32 face = EnvironmentDirectionFace(x, y, z, &s, &t);
+
+		level = Clamp(level, 0.0f, (float32)(source.levelCount - 1));
+		const uint32 level0 = (uint32)level;
+		const uint32 level1 = Min(level0 + 1, source.levelCount - 1);
+
+		const __m128 color = EnvironmentFetch(source, level0, face, s, t);
+		if (level1 == level0 || level == (float32)level0)
+			return color;
+
+		return EnvironmentLerp(color, EnvironmentFetch(source, level1, face, s, t), level - level0);
+	}
+
+	static void EnvironmentSourceRow(uint32 index, void* userData)
+	{
+		const EnvironmentSourceJob* job = (const EnvironmentSourceJob*)userData;
+		EnvironmentSource* source = job->source;
+
+		const uint32 size = source->sizes[job->level];
+		const uint32 face = index / size;
+		const uint32 y = index % size;
+		float32* output = source->levels[job->level].data() + ((size_t)face * size + y) * size * 4;
+
+		if (job->level > 0)
+		{
+			const uint32 sourceSize = source->sizes[job->level - 1];
+			const float32* texels = source->levels[job->level - 1].data() + (size_t)face * sourceSize * sourceSize * 4;
+			const __m128 quarter = _mm_set1_ps(0.25f);
+
+			const float32* row0 = texels + (size_t)(y * 2) * sourceSize * 4;
+			const float32* row1 = texels + (size_t)Min(y * 2 + 1, sourceSize - 1) * sourceSize * 4;
+
+			for (uint32 x = 0; x < size; x++)
+			{
+				const uint32 x0 = x * 2 * 4;
+				const uint32 x1 = Min(x * 2 + 1, sourceSize - 1) * 4;
+				const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+					_mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+
+				_mm_storeu_ps(output + x * 4, _mm_mul_ps(sum, quarter));
+			}
+
+			return;
+		}
+
+		// The base level averages factor x factor texels of the face in linear space.
+		const TextureData* data = job->faces[face];
+		const uint32 factor = job->factor;
+		const __m128 scale = _mm_set1_ps(1.0f / (factor * factor));
+
+		for (uint32 x = 0; x < size; x++)
+		{
+			__m128 sum = _mm_setzero_ps();
+
+			for (uint32 j = 0; j < factor; j++)
+			{
+				const unsigned char* texel = data->pixels + ((size_t)(y * factor + j) * data->width + x * factor) * 4;
+
+				for (uint32 i = 0; i < factor; i++, texel += 4)
+					sum = _mm_add_ps(sum, _mm_setr_ps(job->decode[texel[0]], job->decode[texel[1]], job->decode[texel[2]], 1.0f));
+			}
+
+			_mm_storeu_ps(output + x * 4, _mm_mul_ps(sum, scale));
+		}
+	}
+
+	static void EnvironmentBuildSource(EnvironmentSource* source, const TextureData* const faces[6], bool srgb)
+	{
+		float32 decode[256];
+		for (uint32 i = 0; i < 256; i++)
+		{
+			float32 value = i / 255.0f;
+			decode[i] = srgb ? (value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f)) : value;
+		}
+
+		EnvironmentSourceJob job;
+		job.source = source;
+		job.faces = faces;
+		job.decode = decode;
+		job.factor = 1;
+
+		uint32 size = faces[0]->width;
+		while (size > EnvironmentSourceSize)
+		{
+			size /= 2;
+			job.factor *= 2;
+		}
+
+		source->levelCount = 0;
+
+		while (source->levelCount < TextureMaxLevels)
+		{
+			job.level = source->levelCount++;
+			source->sizes[job.level] = size;
+			source->levels[job.level].resize((size_t)6 * size * size * 4);
+
+			ParallelFor(6 * size, EnvironmentSourceRow, &job);
+
+			if (size == 1)
+				break;
+
+			size = Max(size / 2, 1u);
+		}
+	}
+
+	// Four texels at a time, each in its own lane. The basis constants are applied once to the sums.
+	static void EnvironmentProjectRow(uint32 index, void* userData)
+	{
+		const EnvironmentShJob* job = (const EnvironmentShJob*)userData;
+		const EnvironmentSource& source = *job->source;
+
+		const uint32 size = source.sizes[job->level];
+		const uint32 face = index / size;
+		const uint32 y = index % size;
+		const float32* texels = source.levels[job->level].data() + ((size_t)face * size + y) * size * 4;
+
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 three = _mm_set1_ps(3.0f);
+		const __m128 texelScale = _mm_set1_ps(2.0f / size);
+		const __m128 t = _mm_set1_ps((y + 0.5f) * 2.0f / size - 1.0f);
+		const __m128 t2 = _mm_mul_ps(t, t);
+
+		__m128 sums[9][3];
+		__m128 weightSum = _mm_setzero_ps();
+
+		for (uint32 i = 0; i < 9; i++)
+			sums[i][0] = sums[i][1] = sums[i][2] = _mm_setzero_ps();
+
+		for (uint32 x = 0; x < size; x += 4)
+		{
+			const __m128 lane = _mm_add_ps(_mm_set1_ps((float32)x), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+			const __m128 valid = _mm_cmplt_ps(lane, _mm_set1_ps((float32)size));
+			const __m128 s = _mm_sub_ps(_mm_mul_ps(lane, texelScale), one);
+
+			// 1 / |(s, t, 1)| normalizes the direction, and its cube is the solid angle of the texel.
+			const __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(one, _mm_mul_ps(s, s)), t2)));
+			const __m128 weight = _mm_and_ps(valid, _mm_mul_ps(invLength, _mm_mul_ps(invLength, invLength)));
+
+			__m128 dx, dy, dz;
+			EnvironmentTexelDirection(face, s, t, &dx, &dy, &dz);
+			dx = _mm_mul_ps(dx, invLength);
+			dy = _mm_mul_ps(dy, invLength);
+			dz = _mm_mul_ps(dz, invLength);
+
+			// Lanes past the end of the row read the last texel with a zero weight.
+			__m128 r = _mm_loadu_ps(texels + Min(x + 0, size - 1) * 4);
+			__m128 g = _mm_loadu_ps(texels + Min(x + 1, size - 1) * 4);
+			__m128 b = _mm_loadu_ps(texels + Min(x + 2, size - 1) * 4);
+			__m128 a = _mm_loadu_ps(texels + Min(x + 3, size - 1) * 4);
+			_MM_TRANSPOSE4_PS(r, g, b, a);
+
+			const __m128 basis[9] =
+			{
+				one,
+				dy,
+				dz,
+				dx,
+				_mm_mul_ps(dx, dy),
+				_mm_mul_ps(dy, dz),
+				_mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(dz, dz)), one),
+				_mm_mul_ps(dx, dz),
+				_mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))
+			};
+
+			for (uint32 i = 0; i < 9; i++)
+			{
+				const __m128 weighted = _mm_mul_ps(basis[i], weight);
+				sums[i][0] = _mm_add_ps(sums[i][0], _mm_mul_ps(weighted, r));
+				sums[i][1] = _mm_add_ps(sums[i][1], _mm_mul_ps(weighted, g));
+				sums[i][2] = _mm_add_ps(sums[i][2], _mm_mul_ps(weighted, b));
+			}
+
+			weightSum = _mm_add_ps(weightSum, weight);
+		}
+
+		float32* output = job->rows + (size_t)index * EnvironmentShFloats;
+		for (uint32 i = 0; i < 9; i++)
+		{
+			output[i * 3 + 0] = EnvironmentSum(sums[i][0]);
+			output[i * 3 + 1] = EnvironmentSum(sums[i][1]);
+			output[i * 3 + 2] = EnvironmentSum(sums[i][2]);
+		}
+
+		output[27] = EnvironmentSum(weightSum);
+	}
+
+	static void EnvironmentProjectIrradiance(EnvironmentData* data, const EnvironmentSource& source)
+	{
+		EnvironmentShJob job;
+		job.source = &source;
+		job.level = 0;
+
+		while (source.sizes[job.level] > EnvironmentShSize && job.level + 1 < source.levelCount)
+			job.level++;
+
+		const uint32 rowCount = 6 * source.sizes[job.level];
+		std::vector<float32> rows((size_t)rowCount * EnvironmentShFloats);
+		job.rows = rows.data();
+
+		ParallelFor(rowCount, EnvironmentProjectRow, &job);
+
+		double sums[EnvironmentShFloats] = {};
+		for (uint32 i = 0; i < rowCount; i++)
+		{
+			for (uint32 j = 0; j < EnvironmentShFloats; j++)
+				sums[j] += rows[(size_t)i * EnvironmentShFloats + j];
+		}
+
+		// Each coefficient is scaled by its basis constant twice, once for the projection and
+		// once for the shader, and by the cosine lobe over pi of its band.
+		static const double basis[9] = { 0.282095, 0.488603, 0.488603, 0.488603, 1.092548, 1.092548, 0.315392, 1.092548, 0.546274 };
+		static const double lobe[9] = { 1.0, 2.0 / 3.0, 2.0 / 3.0, 2.0 / 3.0, 0.25, 0.25, 0.25, 0.25, 0.25 };
+
+		// The weights only approximate the solid angles, they are normalized to the whole sphere.
+		const double solidAngle = 4.0 * PI / sums[27];
+
+		for (uint32 i = 0; i < 9; i++)
+		{
+			const double scale = basis[i] * basis[i] * lobe[i] * solidAngle;
+			data->irradiance[i] = Vector3((float32)(sums[i * 3 + 0] * scale), (float32)(sums[i * 3 + 1] * scale),
+				(float32)(sums[i * 3 + 2] * scale));
+		}
+	}
+
+	// GGX importance samples around the normal, with the normal as the view direction. Every
+	// sample reads the source level whose texels cover about the solid angle it stands for,
+	// so few samples come out smooth.
+	static void EnvironmentBuildSamples(EnvironmentPrefilterJob* job, float32 roughness)
+	{
+		const uint32 sourceSize = job->source->sizes[0];
+
+		job->x.clear();
+		job->y.clear();
+		job->z.clear();
+		job->weights.clear();
+		job->sourceLevels.clear();
+		job->weightSum = 0.0f;
+
+		if (roughness == 0.0f)
+		{
+			job->x.push_back(0.0f);
+			job->y.push_back(0.0f);
+			job->z.push_back(1.0f);
+			job->weights.push_back(1.0f);
+			job->sourceLevels.push_back(log2f((float32)sourceSize / job->size));
+			job->weightSum = 1.0f;
+		}
+		else
+		{
+			const float32 alpha2 = roughness * roughness * roughness * roughness;
+			const float32 texelAngle = 4.0f * PI / (6.0f * sourceSize * sourceSize);
+
+			for (uint32 i = 0; i < EnvironmentSpecularSamples; i++)
+			{
+				const float32 phi = 2.0f * PI * i / EnvironmentSpecularSamples;
+				const float32 v = EnvironmentRadicalInverse(i);
+				const float32 cosTheta = sqrtf((1.0f - v) / (1.0f + (alpha2 - 1.0f) * v));
+				const float32 sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+
+				// L is H mirrored around the view, which is the normal here.
+				const float32 nDotL = 2.0f * cosTheta * cosTheta - 1.0f;
+				if (nDotL <= 0.0f)
+					continue;
+
+				const float32 denominator = cosTheta * cosTheta * (alpha2 - 1.0f) + 1.0f;
+				const float32 pdf = alpha2 / (PI * denominator * denominator) * 0.25f;
+				const float32 sampleAngle = 1.0f / (EnvironmentSpecularSamples * pdf);
+
+				job->x.push_back(2.0f * cosTheta * sinTheta * cosf(phi));
+				job->y.push_back(2.0f * cosTheta * sinTheta * sinf(phi));
+				job->z.push_back(nDotL);
+				job->weights.push_back(nDotL);
+				job->sourceLevels.push_back(Max(0.5f * log2f(sampleAngle / texelAngle) + 1.0f, 0.0f));
+				job->weightSum += nDotL;
+			}
+		}
+
+		while (job->weights.size() % 4 != 0)
+		{
+			job->x.push_back(0.0f);
+			job->y.push_back(0.0f);
+			job->z.push_back(1.0f);
+			job->weights.push_back(0.0f);
+			job->sourceLevels.push_back(0.0f);
+		}
+	}
+
+	static void EnvironmentPrefilterRow(uint32 index, void* userData)
+	{
+		const EnvironmentPrefilterJob* job = (const EnvironmentPrefilterJob*)userData;
+
+		const uint32 size = job->size;
+		const uint32 face = index / size;
+		const uint32 y = index % size;
+		const float32 t = (y + 0.5f) * 2.0f / size - 1.0f;
+
+		const TextureData* data = job->faces[face];
+		unsigned char* output = data->pixels + data->levels[job->level].offset + (size_t)y * size * 4;
+
+		const uint32 sampleCount = (uint32)job->weights.size();
+		const __m128 scale = _mm_set1_ps(1.0f / job->weightSum);
+
+		for (uint32 x = 0; x < size; x++, output += 4)
+		{
+			const Vector3 normal = Normalize(EnvironmentTexelDirection(face, (x + 0.5f) * 2.0f / size - 1.0f, t));
+			const Vector3 up = Abs(normal.z) < 0.999f ? Vector3(0.0f, 0.0f, 1.0f) : Vector3(1.0f, 0.0f, 0.0f);
+			const Vector3 tangent = Normalize(Cross(up, normal));
+			const Vector3 bitangent = Cross(normal, tangent);
+
+			__m128 sum = _mm_setzero_ps();
+
+			for (uint32 i = 0; i < sampleCount; i += 4)
+			{
+				// Four samples to world space at once.
+				const __m128 lx = _mm_loadu_ps(&job->x[i]);
+				const __m128 ly = _mm_loadu_ps(&job->y[i]);
+				const __m128 lz = _mm_loadu_ps(&job->z[i]);
+
+				alignas(16) float32 dx[4], dy[4], dz[4];
+				_mm_store_ps(dx, _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tangent.x), lx),
+					_mm_mul_ps(_mm_set1_ps(bitangent.x), ly)), _mm_mul_ps(_mm_set1_ps(normal.x), lz)));
+				_mm_store_ps(dy, _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tangent.y), lx),
+					_mm_mul_ps(_mm_set1_ps(bitangent.y), ly)), _mm_mul_ps(_mm_set1_ps(normal.y), lz)));
+				_mm_store_ps(dz, _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tangent.z), lx),
+					_mm_mul_ps(_mm_set1_ps(bitangent.z), ly)), _mm_mul_ps(_mm_set1_ps(normal.z), lz)));
+
+				for (uint32 j = 0; j < 4; j++)
+				{
+					const float32 weight = job->weights[i + j];
+					if (weight > 0.0f)
+					{
+						const __m128 color = EnvironmentSample(*job->source, dx[j], dy[j], dz[j], job->sourceLevels[i + j]);
+						sum = _mm_add_ps(sum, _mm_mul_ps(color, _mm_set1_ps(weight)));
+					}
+				}
+			}
+
+			alignas(16) float32 color[4];
+			_mm_store_ps(color, _mm_mul_ps(sum, scale));
+
+			output[0] = EnvironmentEncode(color[0]);
+			output[1] = EnvironmentEncode(color[1]);
+			output[2] = EnvironmentEncode(color[2]);
+			output[3] = 255;
+		}
+	}
+
+	// Four samples at a time. The view lies in the xz plane, so only x and z of the half
+	// vector matter.
+	static void EnvironmentBrdfRow(uint32 y, void* userData)
+	{
+		const EnvironmentBrdfJob* job = (const EnvironmentBrdfJob*)userData;
+		unsigned char* output = job->pixels + (size_t)y * EnvironmentBrdfSize * 4;
+
+		const float32 roughness = (y + 0.5f) / EnvironmentBrdfSize;
+		const float32 alpha = roughness * roughness;
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 two = _mm_set1_ps(2.0f);
+		const __m128 alpha2 = _mm_set1_ps(alpha * alpha - 1.0f);
+
+		// Smith with Schlick's k for image based lighting.
+		const __m128 k = _mm_set1_ps(alpha * 0.5f);
+		const __m128 oneMinusK = _mm_sub_ps(one, k);
+
+		for (uint32 x = 0; x < EnvironmentBrdfSize; x++, output += 4)
+		{
+			const float32 nDotV = (x + 0.5f) / EnvironmentBrdfSize;
+			const __m128 viewX = _mm_set1_ps(sqrtf(1.0f - nDotV * nDotV));
+			const __m128 viewZ = _mm_set1_ps(nDotV);
+			const __m128 gView = _mm_div_ps(viewZ, _mm_add_ps(_mm_mul_ps(viewZ, oneMinusK), k));
+
+			__m128 scale = zero;
+			__m128 bias = zero;
+
+			for (uint32 i = 0; i < EnvironmentBrdfSamples; i += 4)
+			{
+				const __m128 v = _mm_load_ps(job->v + i);
+				const __m128 cosTheta = _mm_sqrt_ps(_mm_div_ps(_mm_sub_ps(one, v), _mm_add_ps(one, _mm_mul_ps(alpha2, v))));
+				const __m128 sinTheta = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(cosTheta, cosTheta)), zero));
+				const __m128 halfX = _mm_mul_ps(sinTheta, _mm_load_ps(job->cosPhi + i));
+
+				const __m128 vDotH = _mm_max_ps(_mm_add_ps(_mm_mul_ps(viewX, halfX), _mm_mul_ps(viewZ, cosTheta)), zero);
+				const __m128 nDotL = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(two, vDotH), cosTheta), viewZ);
+				const __m128 mask = _mm_cmpgt_ps(nDotL, zero);
+
+				const __m128 gLight = _mm_div_ps(nDotL, _mm_add_ps(_mm_mul_ps(nDotL, oneMinusK), k));
+				const __m128 visibility = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(gView, gLight), vDotH), _mm_mul_ps(cosTheta, viewZ));
+
+				const __m128 fresnel1 = _mm_sub_ps(one, vDotH);
+				const __m128 fresnel2 = _mm_mul_ps(fresnel1, fresnel1);
+				const __m128 fresnel = _mm_mul_ps(_mm_mul_ps(fresnel2, fresnel2), fresnel1);
+
+				scale = _mm_add_ps(scale, _mm_and_ps(mask, _mm_mul_ps(_mm_sub_ps(one, fresnel), visibility)));
+				bias = _mm_add_ps(bias, _mm_and_ps(mask, _mm_mul_ps(fresnel, visibility)));
+			}
+
+			output[0] = (unsigned char)(Clamp(EnvironmentSum(scale) / EnvironmentBrdfSamples, 0.0f, 1.0f) * 255.0f + 0.5f);
+			output[1] = (unsigned char)(Clamp(EnvironmentSum(bias) / EnvironmentBrdfSamples, 0.0f, 1.0f) * 255.0f + 0.5f);
+			output[2] = 0;
+			output[3] = 255;
+		}
+	}
+
+	EnvironmentData* CreateEnvironmentData()
+	{
+		EnvironmentData* data = (EnvironmentData*)malloc(sizeof(EnvironmentData));
+		*data = {};
+
+		for (uint32 i = 0; i < 6; i++)
+			data->specular[i] = CreateTextureData();
+
+		data->brdf = CreateTextureData();
+		return data;
+	}
+
+	bool EnvironmentDataCompute(EnvironmentData* data, const TextureData* const faces[6], bool srgb, uint32 specularSize)
+	{
+		const uint32 size = faces[0]->width;
+
+		for (uint32 i = 0; i < 6; i++)
+		{
+			if (faces[i]->pixels == nullptr || faces[i]->format != TextureFormat::RGBA8 ||
+				faces[i]->width != size || faces[i]->height != size || size == 0)
+			{
+				Message("[ERROR] Environment faces must be square RGBA8 images of the same size\n");
+				return false;
+			}
+		}
+
+		EnvironmentSource source;
+		EnvironmentBuildSource(&source, faces, srgb);
+		EnvironmentProjectIrradiance(data, source);
+
+		specularSize = Clamp(specularSize, 1u, source.sizes[0]);
+
+		uint32 levelCount = 1;
+		while (levelCount < EnvironmentSpecularLevels && (specularSize >> levelCount) > 0)
+			levelCount++;
+
+		for (uint32 i = 0; i < 6; i++)
+			TextureDataAllocate(data->specular[i], TextureFormat::RGBA8, specularSize, specularSize, levelCount);
+
+		EnvironmentPrefilterJob prefilter;
+		prefilter.source = &source;
+		prefilter.faces = data->specular;
+
+		for (uint32 i = 0; i < levelCount; i++)
+		{
+			prefilter.level = i;
+			prefilter.size = data->specular[0]->levels[i].width;
+			EnvironmentBuildSamples(&prefilter, levelCount > 1 ? (float32)i / (levelCount - 1) : 0.0f);
+
+			ParallelFor(6 * prefilter.size, EnvironmentPrefilterRow, &prefilter);
+		}
+
+		TextureDataAllocate(data->brdf, TextureFormat::RGBA8, EnvironmentBrdfSize, EnvironmentBrdfSize, 1);
+
+		EnvironmentBrdfJob brdf;
+		brdf.pixels = data->brdf->pixels;
+
+		for (uint32 i = 0; i < EnvironmentBrdfSamples; i++)
+		{
+			brdf.cosPhi[i] = cosf(2.0f * PI * i / EnvironmentBrdfSamples);
+			brdf.v[i] = EnvironmentRadicalInverse(i);
+		}
+
+		ParallelFor(EnvironmentBrdfSize, EnvironmentBrdfRow, &brdf);
+		return true;
+	}
+
+	void Dispose(EnvironmentData* data)
+	{
+		for (uint32 i = 0; i < 6; i++)
+			Dispose(data->specular[i]);
+
+		Dispose(data->brdf);
+		free(data);
+	}
+}
\ No newline at end of file
@@ -12,107 +12,288 @@ static Camera* camera;
 
 static Mesh* sphere;
 static Mesh* cube;
+static Mesh* sponza;
+static Mesh* mitsuba;
 
+// The basic shader is owned here rather than by the cache, a reload builds a second one
+// while the first keeps drawing.
 static Shader* basicShader;
+static Shader* reloadShader;
 static Shader* skyboxShader;
+static ShaderVariants litShaders;
+static ShaderVariants arrayShaders;
+static ShaderBatch* shaders;
+static bool shadersSetUp;
+static ParameterBlock* scene;
+static RenderQueue* renderQueue;
+static Pipeline* skyboxPipeline;
+static Pipeline* basicPipeline;
+
+// State changes of the last frame, 's' prints them.
+static StateStats stateStats;
 
 static Cubemap* cubemap;
+static Environment* environment;
 
 static Texture2D* albedo;
-static Texture2D* metallic;
-static Texture2D* roughness;
+static Texture2D* orm;
 static Texture2D* normal;
 
-static inline void ReloadBasicShader()
+static TextureStreamer* textureStreamer;
+static ResourceCache* resources;
+static float viewportHeight = 900.0f;
+
+// One light and plain textures, the sphere isn't normal mapped.
+static const char* const basicShaderDefines[] = { "LIGHT_COUNT 1", "MATERIAL_ARRAYS 0" };
+
+// The queue picks the variant of each Sponza material. The mitsuba model has its material
+// textures packed in arrays.
+static const char* const litShaderDefines[] = { "LIGHT_COUNT 1", "MATERIAL_ARRAYS 0" };
+static const char* const arrayShaderDefines[] = { "LIGHT_COUNT 1", "MATERIAL_ARRAYS 1" };
+
+static inline Shader* LoadBasicShader()
 {
-	basicShader = CreateShader();
-	ShaderLoadAndCompile(basicShader, "assets/glsl/gfxl.vs", ShaderType::Vertex);
-	ShaderLoadAndCompile(basicShader, "assets/glsl/gfxl.fs", ShaderType::Fragment);
-	ShaderLink(basicShader);
-	
-	Bind(basicShader);
+	ShaderLoadSettings settings = {};
+	settings.defines = basicShaderDefines;
+	settings.defineCount = 2;
+
+	Shader* shader = CreateShader();
+	ShaderLoadAndCompile(shader, "assets/glsl/gfxl.vs", ShaderType::Vertex, settings);
+	ShaderLoadAndCompile(shader, "assets/glsl/gfxl.fs", ShaderType::Fragment, settings);
+	ShaderBatchAdd(shaders, shader);
+	return shader;
+}
 
-	ShaderSetVar(basicShader, "LightCount", 1);
+static inline Pipeline* CreateLitPipeline(const Shader* shader)
+{
+	PipelineSettings settings = {};
+	settings.shader = shader;
+	settings.blend = BlendMode::Opaque;
+	settings.cull = CullMode::Back;
+	settings.depthTest = true;
+	settings.depthWrite = true;
+	return CreatePipeline(settings);
+}
 
-	ShaderSetVar(basicShader, "Ambient.color", Vector3(1.0f, 1.0f, 1.0f));
-	ShaderSetVar(basicShader, "Ambient.intensity", 0.35f);
+// Units like RenderSubmeshes binds them, and the scene block in case the shader linked
+// before the block was created.
+static inline void SetUpLitShader(const Shader* shader)
+{
+	Bind(shader);
 
-	ShaderSetVar(basicShader, "Material.albedo", 1);
-	ShaderSetVar(basicShader, "Material.normal", 2);
-	ShaderSetVar(basicShader, "Material.metallic", 3);
-	ShaderSetVar(basicShader, "Material.roughness", 4);
-	ShaderSetVar(basicShader, "Material.emission", 5);
+	ShaderSetVar(shader, "Material.albedo", 1);
+	ShaderSetVar(shader, "Material.normal", 2);
+	ShaderSetVar(shader, "Material.orm", 3);
+	ShaderSetVar(shader, "Material.emission", 4);
 
-	ShaderSetVar(basicShader, "Lights[0].position", Vector3(1, 1, -1.7f));
-	ShaderSetVar(basicShader, "Lights[0].color", Vector3(1, 1, 1));
-	ShaderSetVar(basicShader, "Lights[0].intensity", 10.0f);
+	ShaderSetVar(shader, "MaterialArrays.albedo", 5);
+	ShaderSetVar(shader, "MaterialArrays.normal", 6);
+	ShaderSetVar(shader, "MaterialArrays.orm", 7);
+	ShaderSetVar(shader, "MaterialArrays.emission", 8);
 
-	ShaderSetVar(basicShader, "Lights[1].position", Vector3(0, -1.5f, 0));
-	ShaderSetVar(basicShader, "Lights[1].color", Vector3(0, 0.50f, 0.75f));
-	ShaderSetVar(basicShader, "Lights[1].intensity", 5.0f);
+	ShaderSetEnvironment(shader, environment, 9);
+	ShaderBindParameterBlocks(shader);
+}
+
+static inline void SetUpShaders()
+{
+	if (ShaderIsReady(skyboxShader))
+	{
+		Bind(skyboxShader);
+		ShaderSetVar(skyboxShader, "Skybox", 0);
+	}
+
+	if (!ShaderIsReady(basicShader))
+		return;
+
+	// Reloaded shaders are bound to the scene block as they link.
+	if (scene == nullptr)
+	{
+		scene = CreateParameterBlock(basicShader, "UScene");
 
-	ShaderSetVar(basicShader, "Skybox", 0);
+		ParameterBlockSet(scene, "ambient.color", Vector3(1.0f, 1.0f, 1.0f));
+		ParameterBlockSet(scene, "ambient.intensity", 0.35f);
+		ParameterBlockSet(scene, "lightCount", 1);
+
+		ParameterBlockSet(scene, "lights[0].position", Vector3(1, 1, -1.7f));
+		ParameterBlockSet(scene, "lights[0].color", Vector3(1, 1, 1));
+		ParameterBlockSet(scene, "lights[0].intensity", 10.0f);
+
+		ParameterBlockSet(scene, "lights[1].position", Vector3(0, -1.5f, 0));
+		ParameterBlockSet(scene, "lights[1].color", Vector3(0, 0.50f, 0.75f));
+		ParameterBlockSet(scene, "lights[1].intensity", 5.0f);
+	}
+
+	SetUpLitShader(basicShader);
+
+	for (uint32 key = 0; key < MaterialVariantCount; key++)
+	{
+		if (ShaderIsReady(litShaders.shaders[key]))
+			SetUpLitShader(litShaders.shaders[key]);
+
+		if (ShaderIsReady(arrayShaders.shaders[key]))
+			SetUpLitShader(arrayShaders.shaders[key]);
+	}
+}
+
+// Swaps in the reloaded shader once it is linked, until then the old one draws.
+static inline void UpdateShaders()
+{
+	if (!ShaderBatchUpdate(shaders))
+		return;
+
+	if (reloadShader != nullptr)
+	{
+		if (ShaderIsReady(reloadShader))
+		{
+			Dispose(basicShader);
+			Dispose(basicPipeline);
+			basicShader = reloadShader;
+			basicPipeline = CreateLitPipeline(basicShader);
+			shadersSetUp = false;
+			Message("\tDone!\n");
+		}
+		else
+		{
+			Dispose(reloadShader);
+			Message("\tFailed, the old shaders stay\n");
+		}
+
+		reloadShader = nullptr;
+	}
+
+	if (!shadersSetUp)
+	{
+		SetUpShaders();
+		shadersSetUp = true;
+	}
 }
 
 static void KeyCallback(unsigned char key, bool pressed)
 {
-	if (pressed && key == 'r')
+	if (pressed && key == 'r' && reloadShader == nullptr)
 	{
-		Message("Reloading shaders... %i", 10);
-		Dispose(basicShader);
-		ReloadBasicShader();
-		Message("\tDone!");
+		Message("Reloading shaders...\n");
+		reloadShader = LoadBasicShader();
+	}
+
+	if (pressed && key == 's')
+	{
+		Message("Last frame made %u state changes, %u redundant ones were skipped\n",
+			stateStats.calls, stateStats.redundantCalls);
 	}
 }
 
 static inline bool Init()
 {
-	glEnable(GL_BLEND);
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
-
-	glCullFace(GL_BACK);
+	// Blending, culling and depth are set by the pipelines.
 	glFrontFace(GL_CCW);
 
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
 	SetMessageCallback(vprintf);
 	SetKeyCallback(KeyCallback);
 
-	sphere = CreateMesh();
-	cube = CreateMesh();
 	camera = CreateCamera();
 	cubemap = CreateCubemap();
-	albedo = CreateTexture2D();
-	normal = CreateTexture2D();
-	metallic = CreateTexture2D();
-	roughness = CreateTexture2D();
-
-	Texture2DFromImageFile(albedo, "assets/materials/rusted-iron/albedo.png");
-	Texture2DFromImageFile(metallic, "assets/materials/rusted-iron/metallic.png");
-	Texture2DFromImageFile(roughness, "assets/materials/rusted-iron/roughness.png");
-	Texture2DFromImageFile(normal, "assets/materials/rusted-iron/normal.png");
-
-	skyboxShader = CreateShader();
-	ShaderLoadAndCompile(skyboxShader, "assets/glsl/skybox.vs", ShaderType::Vertex);
-	ShaderLoadAndCompile(skyboxShader, "assets/glsl/skybox.fs", ShaderType::Fragment);
-	ShaderLink(skyboxShader);
-
-	Bind(skyboxShader);
-	ShaderSetVar(skyboxShader, "Skybox", 0);
-
-	ReloadBasicShader();
-
-	MeshLoadFromModelFile(sphere, "assets/sphere.obj");
-	MeshLoadFromModelFile(cube, "assets/cube.obj");
+	environment = CreateEnvironment();
+	resources = CreateResourceCache();
+	shaders = CreateShaderBatch();
+	renderQueue = CreateRenderQueue();
+	textureStreamer = CreateTextureStreamer(256 * 1024 * 1024);
+
+	// Images decode on the worker threads while the shaders and meshes below are loaded.
+	TextureLoadSettings colorSettings = {};
+	colorSettings.cache = true;
+	colorSettings.srgb = true;
+	colorSettings.role = TextureRole::Color;
+	colorSettings.compression = TextureCompression::High;
+
+	TextureLoadSettings normalSettings = {};
+	normalSettings.cache = true;
+	normalSettings.role = TextureRole::Normal;
+	normalSettings.compression = TextureCompression::Default;
+
+	// Three unrelated channels, BC7 keeps them apart far better than BC1.
+	TextureLoadSettings ormSettings = normalSettings;
+	ormSettings.compression = TextureCompression::High;
+
+	TextureLoadSettings skyboxSettings = colorSettings;
+	skyboxSettings.compression = TextureCompression::Default;
+
+	TextureBatch* textures = CreateTextureBatch();
+	albedo = ResourceCacheLoadTexture2D(resources, "assets/materials/rusted-iron/albedo.png", colorSettings, textures);
+	orm = ResourceCacheLoadOrmTexture2D(resources, nullptr,
+		"assets/materials/rusted-iron/roughness.png",
+		"assets/materials/rusted-iron/metallic.png",
+		ormSettings, textures);
+	normal = ResourceCacheLoadTexture2D(resources, "assets/materials/rusted-iron/normal.png", normalSettings, textures);
+	TextureBatchAdd(textures, cubemap,
+		"assets/cubemaps/nissi/front.jpg",
+		"assets/cubemaps/nissi/back.jpg",
+		"assets/cubemaps/nissi/left.jpg",
+		"assets/cubemaps/nissi/right.jpg",
+		"assets/cubemaps/nissi/top.jpg",
+		"assets/cubemaps/nissi/bottom.jpg",
+		skyboxSettings);
 
-	CubemapFromImageFiles(cubemap,
+	// Cooked after the first launch, the convolution only runs when the faces change.
+	EnvironmentFromImageFiles(environment,
 		"assets/cubemaps/nissi/front.jpg",
 		"assets/cubemaps/nissi/back.jpg",
 		"assets/cubemaps/nissi/left.jpg",
 		"assets/cubemaps/nissi/right.jpg",
 		"assets/cubemaps/nissi/top.jpg",
-		"assets/cubemaps/nissi/bottom.jpg");
+		"assets/cubemaps/nissi/bottom.jpg",
+		skyboxSettings);
+
+	// The driver compiles while the meshes load, the first frames draw what's ready.
+	skyboxShader = ResourceCacheLoadShader(resources, "assets/glsl/skybox.vs", "assets/glsl/skybox.fs", {}, shaders);
+	basicShader = LoadBasicShader();
+
+	ShaderLoadSettings litSettings = {};
+	litSettings.defines = litShaderDefines;
+	litSettings.defineCount = 2;
+	litShaders = ResourceCacheLoadShaderVariants(resources, "assets/glsl/gfxl.vs", "assets/glsl/gfxl.fs", litSettings, shaders);
+
+	ShaderLoadSettings arraySettings = {};
+	arraySettings.defines = arrayShaderDefines;
+	arraySettings.defineCount = 2;
+	arrayShaders = ResourceCacheLoadShaderVariants(resources, "assets/glsl/gfxl.vs", "assets/glsl/gfxl.fs", arraySettings, shaders);
+
+	// The skybox is drawn behind everything, from inside the cube.
+	PipelineSettings skyboxPipelineSettings = {};
+	skyboxPipelineSettings.shader = skyboxShader;
+	skyboxPipelineSettings.blend = BlendMode::Opaque;
+	skyboxPipelineSettings.cull = CullMode::None;
+	skyboxPipelineSettings.depthTest = true;
+	skyboxPipelineSettings.depthWrite = false;
+
+	skyboxPipeline = CreatePipeline(skyboxPipelineSettings);
+	basicPipeline = CreateLitPipeline(basicShader);
+
+	MeshLoadSettings meshSettings = {};
+	meshSettings.cache = true;
+	meshSettings.optimize = true;
+	meshSettings.vertexFormat = VertexFormat::PackedOctahedral;
+	meshSettings.clusters = true;
+	meshSettings.lodCount = 4;
+	meshSettings.textureCompression = TextureCompression::Default;
+
+	sphere = ResourceCacheLoadMesh(resources, "assets/sphere.obj", meshSettings);
+	cube = ResourceCacheLoadMesh(resources, "assets/cube.obj", meshSettings);
+
+	// Drawn by bind group, a handful of calls whatever its material count.
+	meshSettings.textureArrays = true;
+	mitsuba = ResourceCacheLoadMesh(resources, "assets/mitsuba/mitsuba.obj", meshSettings);
+	meshSettings.textureArrays = false;
+
+	// Sponza has more texture data than the rest, only what the view needs stays resident.
+	meshSettings.textureStreamer = textureStreamer;
+	sponza = ResourceCacheLoadMesh(resources, "assets/sponza/sponza.obj", meshSettings);
+
+	TextureBatchFinish(textures);
+	Dispose(textures);
+
+	ResourceCacheReport(resources);
 
 	camera->position = Vector3(0, 0, -5);
 	CameraSetToPerspective(camera, 45.0f, 1600.0f / 900.0f, 0.1f, 1000.0f);
@@ -122,42 +303,85 @@ static inline bool Init()
 
 static inline void Render()
 {
+	stateStats = GetStateStats();
+
+	UpdateShaders();
 	Clear(0.35f, 0.1f, 0.27f);
 
 	Bind(cubemap, 0);
 	Bind(albedo, 1);
 	Bind(normal, 2);
-	Bind(metallic, 3);
-	Bind(roughness, 4);
-
-	glDisable(GL_CULL_FACE);
-	glDepthMask(GL_FALSE);
-	Bind(skyboxShader);
-	Render(cube);
-	glDepthMask(GL_TRUE);
-	glEnable(GL_CULL_FACE);
-
-	Bind(basicShader);
-	Render(sphere);
+	Bind(orm, 3);
+	Bind(environment, 9);
+
+	if (ShaderIsReady(skyboxShader))
+	{
+		Bind(skyboxPipeline);
+		Render(cube);
+	}
+
+	// Sponza is modelled in centimeters, and binds its own textures per material.
+	Matrix4 sponzaModel(0.01f);
+	sponzaModel[3][3] = 1.0f;
+
+	if (ShaderIsReady(basicShader) && shadersSetUp)
+	{
+		ParameterBlockFlush(scene);
+
+		// The queue leaves the Model of its last draw behind. The variants it binds draw
+		// with the state of the pipeline.
+		static constexpr uint32 model = HashString("Model");
+		Bind(basicPipeline);
+		ShaderSetVar(basicShader, model, Matrix4(1.0f));
+		RenderClusters(sphere, camera);
+
+		Matrix4 mitsubaModel(1.0f);
+		mitsubaModel[3] = Vector4(2.5f, -1.0f, 0.0f, 1.0f);
+
+		// Sorted so draws sharing a variant, then textures, go together.
+		RenderQueueAddSubmeshes(renderQueue, arrayShaders, mitsuba, mitsubaModel);
+		RenderQueueAddSubmeshes(renderQueue, litShaders, sponza, sponzaModel);
+		RenderQueueSubmit(renderQueue, camera);
+	}
+
+	TextureStreamerRequest(textureStreamer, sponza, camera, sponzaModel, viewportHeight);
+	TextureStreamerUpdate(textureStreamer, 8 * 1024 * 1024);
 }
 
 static inline void Dispose()
 {
-	Dispose(sphere);
-	Dispose(cube);
+	ResourceCacheRelease(resources, sphere);
+	ResourceCacheRelease(resources, cube);
+	ResourceCacheRelease(resources, sponza);
+	ResourceCacheRelease(resources, mitsuba);
+	ResourceCacheRelease(resources, skyboxShader);
+	ResourceCacheRelease(resources, litShaders);
+	ResourceCacheRelease(resources, arrayShaders);
+	ResourceCacheRelease(resources, albedo);
+	ResourceCacheRelease(resources, orm);
+	ResourceCacheRelease(resources, normal);
+	Dispose(resources);
+
+	Dispose(shaders);
+	Dispose(renderQueue);
+	Dispose(skyboxPipeline);
+	Dispose(basicPipeline);
+	if (scene != nullptr)
+		Dispose(scene);
 	Dispose(basicShader);
-	Dispose(skyboxShader);
+	if (reloadShader != nullptr)
+		Dispose(reloadShader);
+
 	Dispose(camera);
 	Dispose(cubemap);
-	Dispose(albedo);
-	Dispose(metallic);
-	Dispose(roughness);
-	Dispose(normal);
+	Dispose(environment);
+	Dispose(textureStreamer);
 }
 
 static inline void Resize(int width, int height, float aspectRatio)
 {
 	glViewport(0, 0, width, height);
+	viewportHeight = (float)height;
 }
 
 int main(void)